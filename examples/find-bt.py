@@ -19,7 +19,9 @@ class BluezPlugin(Ldm.Plugin):
     __gtype_name__ = "BluezPlugin"
 
     def __init__(self):
-        Ldm.Plugin.__init__(self)
+        # Only looks at the device it is given, so the manager may call it
+        # from worker threads when asked to resolve providers in parallel
+        Ldm.Plugin.__init__(self, thread_safe=True)
 
     def do_get_provider(self, device):
         if not device.has_type(Ldm.DeviceType.BLUETOOTH):
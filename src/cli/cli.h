@@ -18,6 +18,7 @@ typedef int (*ldm_cli_command)(int argc, char **argv);
 
 int ldm_cli_configure(int argc, char **argv);
 int ldm_cli_status(int argc, char **argv);
+int ldm_cli_update_cache(int argc, char **argv);
 int ldm_cli_version(int argc, char **argv);
 
 /*
@@ -33,7 +33,7 @@ static GOptionEntry cli_entries[] = {
 
 static void print_usage(const char *progname)
 {
-        fprintf(stderr, "%s usage: [status]\n", progname);
+        fprintf(stderr, "%s usage: [status|update-cache]\n", progname);
         fprintf(stderr, "Run '%s --help' for further information\n", progname);
 }
 
@@ -52,9 +52,10 @@ int main(int argc, char **argv)
         g_option_context_set_description(opt_context,
                                          "This tool accepts a number of subcommands:\n\
 \n\
-        configure   - Attempt configuration of a subsystem\n\
-        status      - Emit the status for known, detected devices\n\
-        version     - Print the version and quit\n\
+        configure     - Attempt configuration of a subsystem\n\
+        status        - Emit the status for known, detected devices\n\
+        update-cache  - Refresh the modalias cache after package changes\n\
+        version       - Print the version and quit\n\
 ");
 
         if (!g_option_context_parse(opt_context, &argc, &argv, &error)) {
@@ -80,6 +81,8 @@ int main(int argc, char **argv)
                 command = &ldm_cli_status;
         } else if (g_str_equal(opt_strings[0], "configure")) {
                 command = &ldm_cli_configure;
+        } else if (g_str_equal(opt_strings[0], "update-cache")) {
+                command = &ldm_cli_update_cache;
         } else if (g_str_equal(opt_strings[0], "version")) {
                 command = &ldm_cli_version;
         } else {
@@ -17,13 +17,13 @@
 #include <stdio.h>
 #include <stdlib.h>
 
-static void print_drivers(LdmManager *manager, LdmDevice *device)
+static void print_drivers(GHashTable *providers_map, LdmDevice *device)
 {
-        g_autoptr(GPtrArray) providers = NULL;
+        GPtrArray *providers = NULL;
 
         /* Look for provider options */
-        providers = ldm_manager_get_providers(manager, device);
-        if (providers->len < 1) {
+        providers = g_hash_table_lookup(providers_map, device);
+        if (!providers || providers->len < 1) {
                 return;
         }
 
@@ -83,7 +83,7 @@ static void print_device(LdmDevice *device)
 /**
  * Handle pretty printing of the GPU configuration to the display
  */
-static void print_gpu_config(LdmManager *manager, LdmGPUConfig *config)
+static void print_gpu_config(GHashTable *providers_map, LdmGPUConfig *config)
 {
         LdmDevice *primary = NULL, *secondary = NULL;
 
@@ -125,7 +125,7 @@ static void print_gpu_config(LdmManager *manager, LdmGPUConfig *config)
 emit_gpu_drivers:
 
         /* Only emit the drivers for the primary detection device */
-        print_drivers(manager, ldm_gpu_config_get_detection_device(config));
+        print_drivers(providers_map, ldm_gpu_config_get_detection_device(config));
 }
 
 /**
@@ -142,10 +142,10 @@ static void print_platform_device(LdmDevice *device)
 /**
  * Handle pretty printing of the remaining devices.
  */
-static void print_non_gpu(LdmManager *manager, LdmDevice *device)
+static void print_non_gpu(GHashTable *providers_map, LdmDevice *device)
 {
         const gchar *device_title = NULL;
-        g_autoptr(GPtrArray) providers = NULL;
+        GPtrArray *providers = NULL;
 
         /* We've already handled GPU devices in a special fashion */
         if (ldm_device_has_type(device, LDM_DEVICE_TYPE_GPU)) {
@@ -158,8 +158,8 @@ static void print_non_gpu(LdmManager *manager, LdmDevice *device)
         }
 
         /* Only emit actionable items here */
-        providers = ldm_manager_get_providers(manager, device);
-        if (providers->len < 1) {
+        providers = g_hash_table_lookup(providers_map, device);
+        if (!providers || providers->len < 1) {
                 return;
         }
 
@@ -205,9 +205,11 @@ int ldm_cli_status(__ldm_unused__ int argc, __ldm_unused__ char **argv)
         g_autoptr(LdmManager) manager = NULL;
         g_autoptr(LdmGPUConfig) gpu_config = NULL;
         g_autoptr(GPtrArray) devices = NULL;
+        g_autoptr(GHashTable) providers_map = NULL;
+        LdmDevice *detection_device = NULL;
 
-        /* No need for hot plug events */
-        manager = ldm_manager_new(LDM_MANAGER_FLAGS_NO_MONITOR);
+        /* No need for hot plug events, or modaliases for hardware we lack */
+        manager = ldm_manager_new(LDM_MANAGER_FLAGS_NO_MONITOR | LDM_MANAGER_FLAGS_LAZY_PLUGINS);
         if (!manager) {
                 fprintf(stderr, "Failed to initialiase LdmManager\n");
                 return EXIT_FAILURE;
@@ -224,14 +226,24 @@ int ldm_cli_status(__ldm_unused__ int argc, __ldm_unused__ char **argv)
                 return EXIT_FAILURE;
         }
 
-        /* Emit non GPU items here, platform first */
+        /* Resolve providers for everything we'll display in one go */
         devices = ldm_manager_get_devices(manager, LDM_DEVICE_TYPE_ANY);
+        detection_device = ldm_gpu_config_get_detection_device(gpu_config);
+        if (detection_device) {
+                g_ptr_array_add(devices, g_object_ref(detection_device));
+        }
+        providers_map = ldm_manager_get_providers_for_devices(manager, devices);
+        if (detection_device) {
+                g_ptr_array_remove_index(devices, devices->len - 1);
+        }
+
+        /* Emit non GPU items here, platform first */
         for (guint i = 0; i < devices->len; i++) {
-                print_non_gpu(manager, devices->pdata[i]);
+                print_non_gpu(providers_map, devices->pdata[i]);
         }
 
         /* Emit GPU config last for consistency */
-        print_gpu_config(manager, gpu_config);
+        print_gpu_config(providers_map, gpu_config);
 
         return EXIT_SUCCESS;
 }
@@ -0,0 +1,67 @@
+/*
+ * This file is part of linux-driver-management.
+ *
+ * Copyright © 2016-2018 Ikey Doherty
+ *
+ * linux-driver-management is free software; you can redistribute it and/or
+ * modify it under the terms of the GNU Lesser General Public License as
+ * published by the Free Software Foundation; either version 2.1
+ * of the License, or (at your option) any later version.
+ */
+
+#include "cli.h"
+#include "config.h"
+#include "ldm.h"
+
+#include <glib.h>
+#include <stdio.h>
+#include <stdlib.h>
+
+static inline void print_usage(void)
+{
+        fputs("update-cache takes at most one argument: [directory]\n", stderr);
+}
+
+/**
+ * Refresh the modalias cache so that later runs of the library can skip
+ * parsing the text files. Intended to be run from package manager triggers
+ * whenever a package installs or removes a .modaliases file.
+ */
+int ldm_cli_update_cache(int argc, char **argv)
+{
+        const gchar *directory = MODALIAS_DIR;
+
+        if (argc > 2) {
+                print_usage();
+                return EXIT_FAILURE;
+        }
+
+        if (argc == 2) {
+                directory = argv[1];
+        }
+
+        if (!g_file_test(directory, G_FILE_TEST_IS_DIR)) {
+                fprintf(stderr, "Not a directory: %s\n", directory);
+                return EXIT_FAILURE;
+        }
+
+        if (!ldm_manager_update_modalias_cache(directory)) {
+                fprintf(stderr, "Failed to update the modalias cache in %s\n", directory);
+                return EXIT_FAILURE;
+        }
+
+        return EXIT_SUCCESS;
+}
+
+/*
+ * Editor modelines  -  https://www.wireshark.org/tools/modelines.html
+ *
+ * Local variables:
+ * c-basic-offset: 8
+ * tab-width: 8
+ * indent-tabs-mode: nil
+ * End:
+ *
+ * vi: set shiftwidth=8 tabstop=8 expandtab:
+ * :indentSize=8:tabSize=8:noTabs=true:
+ */
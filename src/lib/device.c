@@ -11,6 +11,8 @@
 
 #define _GNU_SOURCE
 
+#include <string.h>
+
 #include "device.h"
 #include "ldm-enums.h"
 #include "ldm-private.h"
@@ -24,6 +26,9 @@
 #include "usb-device.h"
 #include "wifi-device.h"
 
+/* Children a device holds before it indexes them by sysfs path */
+#define LDM_DEVICE_KID_INDEX_MIN 8
+
 static void ldm_device_set_property(GObject *object, guint id, const GValue *value,
                                     GParamSpec *spec);
 static void ldm_device_get_property(GObject *object, guint id, GValue *value, GParamSpec *spec);
@@ -78,7 +83,9 @@ static void ldm_device_dispose(GObject *obj)
 {
         LdmDevice *self = LDM_DEVICE(obj);
 
-        g_clear_pointer(&self->tree.kids, g_hash_table_unref);
+        g_clear_pointer(&self->tree.kid_index, g_hash_table_unref);
+        g_clear_pointer(&self->tree.kids, g_ptr_array_unref);
+        g_clear_pointer(&self->tree.modaliases, g_ptr_array_unref);
         g_clear_pointer(&self->os.hwdb_info, g_hash_table_unref);
         g_clear_pointer(&self->os.sysfs_path, g_free);
         g_clear_pointer(&self->os.modalias, g_free);
@@ -275,8 +282,58 @@ static void ldm_device_init(LdmDevice *self)
         /* Just set up the table for our properties */
         self->os.hwdb_info = g_hash_table_new_full(g_str_hash, g_str_equal, g_free, g_free);
 
-        /* We have sysfs ID to child mapping and own the child */
-        self->tree.kids = g_hash_table_new_full(g_str_hash, g_str_equal, g_free, g_object_unref);
+        /* Flattened view of the modaliases beneath us, for matching */
+        self->tree.modaliases = g_ptr_array_new();
+}
+
+/**
+ * ldm_device_n_kids:
+ *
+ * Returns: Number of immediate children, most devices having none
+ */
+static guint ldm_device_n_kids(LdmDevice *self)
+{
+        return self->tree.kids ? self->tree.kids->len : 0;
+}
+
+/**
+ * ldm_device_find_child:
+ * @path: Sysfs path of the child
+ * @out_index: (out) (optional): Position of the child within tree.kids
+ *
+ * Few devices have more than a handful of children, so they're compared
+ * in turn until there are enough to warrant tree.kid_index.
+ *
+ * Returns: (transfer none) (nullable): The child with this path
+ */
+static LdmDevice *ldm_device_find_child(LdmDevice *self, const gchar *path, guint *out_index)
+{
+        LdmDevice *child = NULL;
+        guint position = 0;
+
+        if (self->tree.kid_index) {
+                position = GPOINTER_TO_UINT(g_hash_table_lookup(self->tree.kid_index, path));
+                if (position == 0) {
+                        return NULL;
+                }
+                if (out_index) {
+                        *out_index = position - 1;
+                }
+                return self->tree.kids->pdata[position - 1];
+        }
+
+        for (guint i = 0; i < ldm_device_n_kids(self); i++) {
+                child = self->tree.kids->pdata[i];
+                if (!g_str_equal(child->os.sysfs_path, path)) {
+                        continue;
+                }
+                if (out_index) {
+                        *out_index = i;
+                }
+                return child;
+        }
+
+        return NULL;
 }
 
 /**
@@ -297,6 +354,24 @@ const gchar *ldm_device_get_modalias(LdmDevice *self)
         return (const gchar *)self->os.modalias;
 }
 
+/**
+ * ldm_device_get_modalias_fields:
+ *
+ * Private accessor for the decoded form of the modalias, which is normally
+ * filled in at construction. Devices built by hand are decoded on first use,
+ * which may happen on a plugin worker thread, so the decode is guarded.
+ *
+ * Returns: (transfer none): The decoded modalias fields
+ */
+const LdmModaliasFields *ldm_device_get_modalias_fields(LdmDevice *self)
+{
+        if (g_once_init_enter(&self->os.modalias_decoded)) {
+                ldm_modalias_fields_decode(self->os.modalias, &self->os.modalias_fields);
+                g_once_init_leave(&self->os.modalias_decoded, 1);
+        }
+        return &self->os.modalias_fields;
+}
+
 /**
  * ldm_device_get_name:
  *
@@ -420,6 +495,7 @@ LdmDevice *ldm_device_new_from_udev(LdmDevice *parent, udev_device *device, udev
         if (sysattr) {
                 self->os.modalias = g_strdup(sysattr);
         }
+        ldm_device_get_modalias_fields(self);
 
         /* Shouldn't happen, but is definitely possible.. */
         if (!properties) {
@@ -506,10 +582,6 @@ LdmDeviceType ldm_device_get_device_type(LdmDevice *self)
  */
 gboolean ldm_device_has_type(LdmDevice *self, LdmDeviceType mask)
 {
-        GHashTableIter iter = { 0 };
-        __ldm_unused__ void *key = NULL;
-        LdmDevice *value = NULL;
-
         g_return_val_if_fail(self != NULL, FALSE);
 
         /* Do we match? */
@@ -517,10 +589,19 @@ gboolean ldm_device_has_type(LdmDevice *self, LdmDeviceType mask)
                 return TRUE;
         }
 
-        /* Walk children */
-        g_hash_table_iter_init(&iter, self->tree.kids);
-        while (g_hash_table_iter_next(&iter, (void **)&key, (void **)&value)) {
-                if (ldm_device_has_type(value, mask)) {
+        /* Nothing beneath us has every type */
+        if ((self->tree.kid_types & mask) != mask) {
+                return FALSE;
+        }
+
+        /* A single type is then known to be on some descendant */
+        if ((mask & (mask - 1)) == 0) {
+                return TRUE;
+        }
+
+        /* Several types must all be found on the same descendant */
+        for (guint i = 0; i < ldm_device_n_kids(self); i++) {
+                if (ldm_device_has_type(self->tree.kids->pdata[i], mask)) {
                         return TRUE;
                 }
         }
@@ -557,10 +638,6 @@ LdmDeviceAttribute ldm_device_get_attributes(LdmDevice *self)
  */
 gboolean ldm_device_has_attribute(LdmDevice *self, LdmDeviceAttribute mask)
 {
-        GHashTableIter iter = { 0 };
-        __ldm_unused__ void *key = NULL;
-        LdmDevice *value = NULL;
-
         g_return_val_if_fail(self != NULL, FALSE);
 
         /* Do we match? */
@@ -568,10 +645,19 @@ gboolean ldm_device_has_attribute(LdmDevice *self, LdmDeviceAttribute mask)
                 return TRUE;
         }
 
-        /* Walk children */
-        g_hash_table_iter_init(&iter, self->tree.kids);
-        while (g_hash_table_iter_next(&iter, (void **)&key, (void **)&value)) {
-                if (ldm_device_has_type(value, mask)) {
+        /* Nothing beneath us has every attribute */
+        if ((self->tree.kid_attributes & mask) != mask) {
+                return FALSE;
+        }
+
+        /* A single attribute is then known to be on some descendant */
+        if ((mask & (mask - 1)) == 0) {
+                return TRUE;
+        }
+
+        /* Several attributes must all be found on the same descendant */
+        for (guint i = 0; i < ldm_device_n_kids(self); i++) {
+                if (ldm_device_has_attribute(self->tree.kids->pdata[i], mask)) {
                         return TRUE;
                 }
         }
@@ -603,9 +689,216 @@ LdmDevice *ldm_device_get_parent(LdmDevice *self)
  */
 GList *ldm_device_get_children(LdmDevice *self)
 {
+        GList *ret = NULL;
+
         g_return_val_if_fail(self != NULL, NULL);
 
-        return g_hash_table_get_values(self->tree.kids);
+        for (guint i = ldm_device_n_kids(self); i > 0; i--) {
+                ret = g_list_prepend(ret, self->tree.kids->pdata[i - 1]);
+        }
+
+        return ret;
+}
+
+/**
+ * ldm_device_foreach_child:
+ * @func: (scope call): Function to call with each child
+ * @user_data: User data to pass to @func
+ *
+ * Call @func with each immediate child of this device, in the order they
+ * were added. Unlike #ldm_device_get_children this doesn't allocate. @func
+ * must not add or remove children of this device.
+ */
+void ldm_device_foreach_child(LdmDevice *self, LdmDeviceFunc func, gpointer user_data)
+{
+        LdmDeviceIter iter = { 0 };
+        LdmDevice *child = NULL;
+
+        g_return_if_fail(self != NULL);
+        g_return_if_fail(func != NULL);
+
+        ldm_device_iter_init(&iter, self);
+        while (ldm_device_iter_next(&iter, &child)) {
+                func(child, user_data);
+        }
+}
+
+/**
+ * ldm_device_iter_init: (skip)
+ * @iter: Uninitialised iterator, usually on the stack
+ *
+ * Prepare @iter to walk the immediate children of this device, in the order
+ * they were added.
+ *
+ * C example:
+ *
+ * |[<!-- language="C" -->
+ *      LdmDeviceIter iter;
+ *      LdmDevice *child;
+ *
+ *      ldm_device_iter_init(&iter, device);
+ *      while (ldm_device_iter_next(&iter, &child)) {
+ *              g_message("Child: %s", ldm_device_get_path(child));
+ *      }
+ * ]|
+ */
+void ldm_device_iter_init(LdmDeviceIter *iter, LdmDevice *self)
+{
+        LdmRealDeviceIter *real = (LdmRealDeviceIter *)iter;
+
+        g_return_if_fail(iter != NULL);
+        g_return_if_fail(self != NULL);
+
+        memset(real, 0, sizeof(*real));
+        real->owner = self;
+        real->kind = LDM_DEVICE_ITER_CHILDREN;
+}
+
+/**
+ * ldm_device_iter_next: (skip)
+ * @iter: Iterator set up by #ldm_device_iter_init or #ldm_manager_iter_init
+ * @device: (out) (transfer none): Location to store the next device
+ *
+ * Advance @iter. The device is borrowed from its owner, so take a reference
+ * to keep it beyond the iteration.
+ *
+ * Returns: FALSE once every device has been visited
+ */
+gboolean ldm_device_iter_next(LdmDeviceIter *iter, LdmDevice **device)
+{
+        LdmRealDeviceIter *real = (LdmRealDeviceIter *)iter;
+
+        g_return_val_if_fail(iter != NULL, FALSE);
+        g_return_val_if_fail(device != NULL, FALSE);
+
+        if (real->kind == LDM_DEVICE_ITER_MANAGER) {
+                return ldm_manager_iter_next(real, device);
+        }
+        if (real->position >= ldm_device_n_kids(real->owner)) {
+                return FALSE;
+        }
+        *device = ((LdmDevice *)real->owner)->tree.kids->pdata[real->position++];
+        return TRUE;
+}
+
+/**
+ * ldm_device_get_linked_parent:
+ *
+ * Returns: The parent of the device, only if the parent already owns it
+ */
+static LdmDevice *ldm_device_get_linked_parent(LdmDevice *self)
+{
+        LdmDevice *parent = self->tree.parent;
+
+        if (!parent || !self->os.sysfs_path) {
+                return NULL;
+        }
+        if (ldm_device_find_child(parent, self->os.sysfs_path, NULL) != self) {
+                return NULL;
+        }
+        return parent;
+}
+
+/**
+ * ldm_device_link_modaliases:
+ * @child: Newly added child
+ *
+ * Add the child's modalias and those of its descendants to the flattened
+ * modaliases of this device and every ancestor already owning it.
+ */
+static void ldm_device_link_modaliases(LdmDevice *self, LdmDevice *child)
+{
+        for (LdmDevice *node = self; node; node = ldm_device_get_linked_parent(node)) {
+                if (child->os.modalias) {
+                        g_ptr_array_add(node->tree.modaliases, child);
+                }
+                for (guint i = 0; i < child->tree.modaliases->len; i++) {
+                        g_ptr_array_add(node->tree.modaliases, child->tree.modaliases->pdata[i]);
+                }
+        }
+}
+
+/**
+ * ldm_device_unlink_modaliases:
+ * @child: Child about to be removed
+ *
+ * Inverse of #ldm_device_link_modaliases
+ */
+static void ldm_device_unlink_modaliases(LdmDevice *self, LdmDevice *child)
+{
+        for (LdmDevice *node = self; node; node = ldm_device_get_linked_parent(node)) {
+                if (child->os.modalias) {
+                        g_ptr_array_remove_fast(node->tree.modaliases, child);
+                }
+                for (guint i = 0; i < child->tree.modaliases->len; i++) {
+                        g_ptr_array_remove_fast(node->tree.modaliases,
+                                                child->tree.modaliases->pdata[i]);
+                }
+        }
+}
+
+/**
+ * ldm_device_get_subtree_modaliases:
+ *
+ * Every descendant of this device having a modalias, in no particular order.
+ * This does not include the device itself.
+ *
+ * Returns: (transfer none) (element-type Ldm.Device): Flattened descendants
+ */
+GPtrArray *ldm_device_get_subtree_modaliases(LdmDevice *self)
+{
+        return self->tree.modaliases;
+}
+
+/**
+ * ldm_device_get_subtree_types:
+ *
+ * Returns: Every #LdmDeviceType bit of this device or any of its descendants
+ */
+guint ldm_device_get_subtree_types(LdmDevice *self)
+{
+        return self->os.devtype | self->tree.kid_types;
+}
+
+/**
+ * ldm_device_link_masks:
+ * @child: Newly added child
+ *
+ * OR the types and attributes of the child's subtree into this device and
+ * every ancestor already owning it.
+ */
+static void ldm_device_link_masks(LdmDevice *self, LdmDevice *child)
+{
+        guint types = child->os.devtype | child->tree.kid_types;
+        guint attributes = child->os.attributes | child->tree.kid_attributes;
+
+        for (LdmDevice *node = self; node; node = ldm_device_get_linked_parent(node)) {
+                node->tree.kid_types |= types;
+                node->tree.kid_attributes |= attributes;
+        }
+}
+
+/**
+ * ldm_device_refresh_masks:
+ *
+ * A bit can't be cleared without knowing whether another child still has
+ * it, so after a removal rebuild the masks of this device and each ancestor
+ * from their direct children.
+ */
+static void ldm_device_refresh_masks(LdmDevice *self)
+{
+        for (LdmDevice *node = self; node; node = ldm_device_get_linked_parent(node)) {
+                node->tree.kid_types = 0;
+                node->tree.kid_attributes = 0;
+
+                for (guint i = 0; i < ldm_device_n_kids(node); i++) {
+                        LdmDevice *value = node->tree.kids->pdata[i];
+
+                        node->tree.kid_types |= value->os.devtype | value->tree.kid_types;
+                        node->tree.kid_attributes |=
+                            value->os.attributes | value->tree.kid_attributes;
+                }
+        }
 }
 
 /**
@@ -620,11 +913,49 @@ GList *ldm_device_get_children(LdmDevice *self)
 void ldm_device_add_child(LdmDevice *self, LdmDevice *child)
 {
         const gchar *id = NULL;
+        LdmDevice *existing = NULL;
+        guint index = 0;
         g_return_if_fail(self != NULL);
 
         id = ldm_device_get_path(child);
-        if (!g_hash_table_replace(self->tree.kids, g_strdup(id), g_object_ref_sink(child))) {
-                return;
+        g_object_ref_sink(child);
+
+        if (!self->tree.kids) {
+                self->tree.kids = g_ptr_array_new_full(1, g_object_unref);
+        }
+
+        /* Replacing a child drops its subtree */
+        existing = ldm_device_find_child(self, id, &index);
+        if (existing) {
+                ldm_device_unlink_modaliases(self, existing);
+                self->tree.kids->pdata[index] = child;
+        } else {
+                g_ptr_array_add(self->tree.kids, child);
+        }
+
+        /* Index keys are borrowed from the children, so a replacement swaps the key too */
+        if (self->tree.kid_index) {
+                g_hash_table_replace(self->tree.kid_index,
+                                     child->os.sysfs_path,
+                                     GUINT_TO_POINTER(existing ? index + 1 : self->tree.kids->len));
+        } else if (self->tree.kids->len > LDM_DEVICE_KID_INDEX_MIN) {
+                self->tree.kid_index = g_hash_table_new(g_str_hash, g_str_equal);
+                for (guint i = 0; i < self->tree.kids->len; i++) {
+                        LdmDevice *kid = self->tree.kids->pdata[i];
+
+                        g_hash_table_insert(self->tree.kid_index,
+                                            kid->os.sysfs_path,
+                                            GUINT_TO_POINTER(i + 1));
+                }
+        }
+
+        ldm_device_link_modaliases(self, child);
+
+        if (existing) {
+                g_object_unref(existing);
+                ldm_device_refresh_masks(self);
+        } else {
+                ldm_device_link_masks(self, child);
         }
 }
 
@@ -652,11 +983,34 @@ void ldm_device_remove_child(LdmDevice *self, LdmDevice *child)
  */
 void ldm_device_remove_child_by_path(LdmDevice *self, const gchar *path)
 {
+        LdmDevice *child = NULL;
+        guint index = 0;
+
         g_return_if_fail(self != NULL);
 
-        if (!g_hash_table_remove(self->tree.kids, path)) {
+        child = ldm_device_find_child(self, path, &index);
+        if (!child) {
                 return;
         }
+
+        ldm_device_unlink_modaliases(self, child);
+        if (self->tree.kid_index) {
+                g_hash_table_remove(self->tree.kid_index, child->os.sysfs_path);
+        }
+
+        /* Keep the remaining children in the order they were added */
+        g_ptr_array_remove_index(self->tree.kids, index);
+
+        /* Those after it moved down a place, which the shift already cost */
+        for (guint i = index; self->tree.kid_index && i < self->tree.kids->len; i++) {
+                LdmDevice *kid = self->tree.kids->pdata[i];
+
+                g_hash_table_insert(self->tree.kid_index,
+                                    kid->os.sysfs_path,
+                                    GUINT_TO_POINTER(i + 1));
+        }
+
+        ldm_device_refresh_masks(self);
 }
 
 /**
@@ -669,7 +1023,7 @@ LdmDevice *ldm_device_get_child_by_path(LdmDevice *self, const gchar *path)
 {
         g_return_val_if_fail(self != NULL, NULL);
 
-        return g_hash_table_lookup(self->tree.kids, path);
+        return ldm_device_find_child(self, path, NULL);
 }
 
 /*
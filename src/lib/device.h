@@ -101,6 +101,31 @@ typedef enum {
 
 GType ldm_device_get_type(void);
 
+/**
+ * LdmDeviceIter:
+ *
+ * Stack allocated iterator over devices, see #ldm_device_iter_init and
+ * #ldm_manager_iter_init. Neither allocates nor takes references, so the
+ * devices and their owner must not change while iterating.
+ */
+typedef struct _LdmDeviceIter {
+        /*< private >*/
+        gpointer dummy1;
+        guint64 dummy2;
+        guint dummy3;
+        guint dummy4;
+        guint dummy5;
+} LdmDeviceIter;
+
+/**
+ * LdmDeviceFunc:
+ * @device: (transfer none): Device being visited
+ * @user_data: User data passed to the foreach function
+ *
+ * Callback for #ldm_device_foreach_child and #ldm_manager_foreach_device
+ */
+typedef void (*LdmDeviceFunc)(LdmDevice *device, gpointer user_data);
+
 /* API */
 const gchar *ldm_device_get_modalias(LdmDevice *device);
 const gchar *ldm_device_get_name(LdmDevice *device);
@@ -116,6 +141,11 @@ gboolean ldm_device_has_attribute(LdmDevice *device, LdmDeviceAttribute mask);
 
 LdmDevice *ldm_device_get_parent(LdmDevice *device);
 GList *ldm_device_get_children(LdmDevice *device);
+void ldm_device_foreach_child(LdmDevice *device, LdmDeviceFunc func, gpointer user_data);
+
+/* Iteration API */
+void ldm_device_iter_init(LdmDeviceIter *iter, LdmDevice *device);
+gboolean ldm_device_iter_next(LdmDeviceIter *iter, LdmDevice **device);
 
 G_DEFINE_AUTOPTR_CLEANUP_FUNC(LdmDevice, g_object_unref)
 
@@ -15,6 +15,7 @@
 #include <libudev.h>
 
 #include "device.h"
+#include "modalias-fields.h"
 #include "util.h"
 
 /*
@@ -42,13 +43,19 @@ struct _LdmDevice {
 
         struct {
                 LdmDevice *parent;
-                GHashTable *kids;
+                GPtrArray *kids;       /* Owned children, NULL until the first is added */
+                GHashTable *kid_index; /* Child sysfs path to 1 + its position in kids, once many */
+                GPtrArray *modaliases; /* Descendants with a modalias, unowned */
+                guint kid_types;       /* os.devtype of every descendant OR'd together */
+                guint kid_attributes;  /* os.attributes of every descendant OR'd together */
         } tree;
 
         /* OS Data */
         struct {
                 gchar *sysfs_path;
                 gchar *modalias;
+                LdmModaliasFields modalias_fields; /* modalias decoded once */
+                gsize modalias_decoded;            /* g_once guard for modalias_fields */
                 GHashTable *hwdb_info;
                 guint devtype;
                 guint attributes;
@@ -83,6 +90,33 @@ void ldm_device_add_child(LdmDevice *device, LdmDevice *child);
 void ldm_device_remove_child(LdmDevice *device, LdmDevice *child);
 void ldm_device_remove_child_by_path(LdmDevice *device, const gchar *path);
 LdmDevice *ldm_device_get_child_by_path(LdmDevice *device, const gchar *path);
+GPtrArray *ldm_device_get_subtree_modaliases(LdmDevice *device);
+guint ldm_device_get_subtree_types(LdmDevice *device);
+
+/* Kinds of LdmDeviceIter */
+typedef enum {
+        LDM_DEVICE_ITER_CHILDREN = 0,
+        LDM_DEVICE_ITER_MANAGER,
+} LdmDeviceIterKind;
+
+/*
+ * Private layout of the public LdmDeviceIter
+ */
+typedef struct LdmRealDeviceIter {
+        gpointer owner;      /* LdmDevice or LdmManager being iterated */
+        guint64 candidates;  /* Slots of the current bitmap word left to visit */
+        guint position;      /* Next slot, or next bitmap word */
+        guint mask;          /* LdmDeviceType filter */
+        guint kind;          /* LdmDeviceIterKind */
+} LdmRealDeviceIter;
+
+G_STATIC_ASSERT(sizeof(LdmRealDeviceIter) == sizeof(LdmDeviceIter));
+
+/* private manager iteration, see ldm_manager_iter_init */
+gboolean ldm_manager_iter_next(LdmRealDeviceIter *iter, LdmDevice **device);
+
+/* private modalias APIs */
+const LdmModaliasFields *ldm_device_get_modalias_fields(LdmDevice *device);
 
 /*
  * Editor modelines  -  https://www.wireshark.org/tools/modelines.html
@@ -11,12 +11,18 @@
 
 #define _GNU_SOURCE
 
-#include <glob.h>
+#include <errno.h>
+#include <string.h>
+#include <sys/inotify.h>
+#include <unistd.h>
 
 #include "config.h"
 #include "manager-private.h"
 #include "plugin.h"
 
+#include "modalias-db.h"
+#include "modalias-file.h"
+#include "plugins/modalias-plugin-private.h"
 #include "plugins/modalias-plugin.h"
 
 /**
@@ -49,6 +55,47 @@ void ldm_manager_add_plugin(LdmManager *self, LdmPlugin *plugin)
 
         /* Handle pythonic apis with non floating references */
         g_hash_table_replace(self->plugins, g_strdup(plugin_id), g_object_ref_sink(plugin));
+
+        /* Plugin set changed, the unified index and cache must be rebuilt */
+        ++self->match.generation;
+}
+
+/**
+ * ldm_manager_add_modalias_plugin:
+ * @plugin: (transfer full) (nullable): Newly constructed modalias plugin
+ *
+ * Add the plugin with the next modalias priority.
+ *
+ * Returns: TRUE if the plugin was added
+ */
+static gboolean ldm_manager_add_modalias_plugin(LdmManager *self, LdmPlugin *plugin)
+{
+        if (!plugin) {
+                return FALSE;
+        }
+
+        /* Enforce priority based on insert order */
+        ldm_plugin_set_priority(plugin, self->modalias_plugin_priority);
+        ++self->modalias_plugin_priority;
+
+        ldm_manager_add_plugin(self, plugin);
+
+        return TRUE;
+}
+
+/**
+ * ldm_manager_new_modalias_plugin:
+ * @path: The fully qualified ".modaliases" file path
+ *
+ * Returns: (transfer full) (nullable): A plugin for the file, loaded lazily
+ * if the manager was constructed with %LDM_MANAGER_FLAGS_LAZY_PLUGINS
+ */
+static LdmPlugin *ldm_manager_new_modalias_plugin(LdmManager *self, const gchar *path)
+{
+        if ((self->flags & LDM_MANAGER_FLAGS_LAZY_PLUGINS) == LDM_MANAGER_FLAGS_LAZY_PLUGINS) {
+                return ldm_modalias_plugin_new_lazy(path);
+        }
+        return ldm_modalias_plugin_new_from_filename(path);
 }
 
 /**
@@ -58,6 +105,10 @@ void ldm_manager_add_plugin(LdmManager *self, LdmPlugin *plugin)
  * Add a new #LdmModaliasPlugin to the manager for the given path. This is a convenience
  * wrapper around #ldm_modalias_plugin_new_from_filename and #ldm_manager_add_plugin.
  *
+ * If the manager was constructed with %LDM_MANAGER_FLAGS_LAZY_PLUGINS, the file
+ * is only parsed once a provider lookup needs it, and not at all if its summary
+ * line shows it can't match any device we look up.
+ *
  * Note that newer modalias plugins have a higher priority than older plugins,
  * so you should add newest drivers last if you have multiple driver versions.
  * This is already taken care of by using the glob-based function
@@ -69,23 +120,327 @@ void ldm_manager_add_plugin(LdmManager *self, LdmPlugin *plugin)
  */
 gboolean ldm_manager_add_modalias_plugin_for_path(LdmManager *self, const gchar *path)
 {
+        if (!g_file_test(path, G_FILE_TEST_EXISTS)) {
+                return FALSE;
+        }
+
+        return ldm_manager_add_modalias_plugin(self, ldm_manager_new_modalias_plugin(self, path));
+}
+
+/*
+ * One `.modaliases` file to be parsed on a worker thread
+ */
+typedef struct LdmManagerLoadJob {
+        const gchar *path;
+        LdmPlugin *plugin;
+        gboolean pending; /* Still needs parsing from text */
+} LdmManagerLoadJob;
+
+static void ldm_manager_run_load_job(gpointer data, __ldm_unused__ gpointer user_data)
+{
+        LdmManagerLoadJob *job = data;
+
+        job->plugin = ldm_modalias_plugin_new_from_filename(job->path);
+}
+
+/**
+ * ldm_manager_run_load_jobs:
+ * @n_pending: Number of jobs that still need parsing
+ *
+ * Parse every pending job, concurrently if there's more than one.
+ */
+static void ldm_manager_run_load_jobs(LdmManagerLoadJob *jobs, guint n_jobs, guint n_pending)
+{
+        g_autoptr(GError) error = NULL;
+        GThreadPool *pool = NULL;
+        guint n_threads = MIN(g_get_num_processors(), n_pending);
+
+        if (n_threads >= 2) {
+                pool = g_thread_pool_new(ldm_manager_run_load_job,
+                                         NULL,
+                                         (gint)n_threads,
+                                         TRUE,
+                                         &error);
+                if (!pool) {
+                        g_warning("failed to create modalias loader pool: %s", error->message);
+                }
+        }
+
+        for (guint i = 0; i < n_jobs; i++) {
+                if (!jobs[i].pending) {
+                        continue;
+                }
+                if (!pool || !g_thread_pool_push(pool, &jobs[i], NULL)) {
+                        ldm_manager_run_load_job(&jobs[i], NULL);
+                }
+        }
+
+        /* Wait for every file to be parsed */
+        if (pool) {
+                g_thread_pool_free(pool, FALSE, TRUE);
+        }
+}
+
+/**
+ * ldm_manager_add_modalias_plugins_for_paths:
+ * @paths: `.modaliases` files in priority order, lowest first
+ * @db: (nullable): Modalias database alongside the files
+ *
+ * Files the database still describes accurately are backed by it, and the
+ * rest are parsed concurrently. The plugins are then added in the order given
+ * so the priorities are exactly those of adding each path in turn. Lazy
+ * plugins don't parse anything up front, so they're simply created in order.
+ *
+ * Returns: TRUE if a new plugin was added
+ */
+static gboolean ldm_manager_add_modalias_plugins_for_paths(LdmManager *self, gchar **paths,
+                                                           guint n_paths, LdmModaliasDb *db)
+{
+        g_autofree LdmManagerLoadJob *jobs = NULL;
+        gboolean lazy = FALSE;
+        guint n_pending = 0;
+        gboolean ret = FALSE;
+
+        lazy = (self->flags & LDM_MANAGER_FLAGS_LAZY_PLUGINS) == LDM_MANAGER_FLAGS_LAZY_PLUGINS;
+
+        jobs = g_new0(LdmManagerLoadJob, n_paths);
+        for (guint i = 0; i < n_paths; i++) {
+                gint source = db ? ldm_modalias_db_lookup_source(db, paths[i]) : -1;
+
+                jobs[i].path = paths[i];
+                if (source >= 0) {
+                        jobs[i].plugin = ldm_modalias_plugin_new_from_db(db, (guint)source);
+                        continue;
+                }
+                if (db) {
+                        g_debug("modalias database is stale for %s", paths[i]);
+                }
+                if (lazy) {
+                        jobs[i].plugin = ldm_modalias_plugin_new_lazy(paths[i]);
+                        continue;
+                }
+                jobs[i].pending = TRUE;
+                ++n_pending;
+        }
+
+        ldm_manager_run_load_jobs(jobs, n_paths, n_pending);
+
+        for (guint i = 0; i < n_paths; i++) {
+                if (ldm_manager_add_modalias_plugin(self, jobs[i].plugin)) {
+                        ret = TRUE;
+                }
+        }
+
+        return ret;
+}
+
+/**
+ * ldm_manager_plugin_provides:
+ *
+ * Modalias plugins still waiting to parse their file answer from their
+ * summary instead, so reacting to a file change doesn't undo
+ * %LDM_MANAGER_FLAGS_LAZY_PLUGINS. That may report a device the rules
+ * wouldn't match, but never misses one.
+ *
+ * Returns: TRUE if @plugin may provide for @device
+ */
+static gboolean ldm_manager_plugin_provides(LdmPlugin *plugin, LdmDevice *device)
+{
+        g_autoptr(LdmProvider) provider = NULL;
+
+        if (LDM_IS_MODALIAS_PLUGIN(plugin) &&
+            !ldm_modalias_plugin_is_loaded(LDM_MODALIAS_PLUGIN(plugin))) {
+                return ldm_modalias_plugin_may_match(LDM_MODALIAS_PLUGIN(plugin), device);
+        }
+
+        provider = ldm_plugin_get_provider(plugin, device);
+        if (!provider) {
+                return FALSE;
+        }
+        g_object_ref_sink(provider);
+
+        return TRUE;
+}
+
+/**
+ * ldm_manager_get_affected_devices:
+ * @old_plugin: (nullable): Plugin that was replaced or removed
+ * @new_plugin: (nullable): Plugin that was added in its place
+ *
+ * Returns: (transfer full): Devices either plugin may provide for
+ */
+static GPtrArray *ldm_manager_get_affected_devices(LdmManager *self, LdmPlugin *old_plugin,
+                                                   LdmPlugin *new_plugin)
+{
+        LdmPlugin *plugins[] = { old_plugin, new_plugin };
+        GPtrArray *ret = NULL;
+
+        ret = g_ptr_array_new_with_free_func(g_object_unref);
+
+        for (guint i = 0; i < self->devices->len; i++) {
+                LdmDevice *device = self->devices->pdata[i];
+
+                if (!device) {
+                        continue;
+                }
+                for (guint j = 0; j < G_N_ELEMENTS(plugins); j++) {
+                        if (plugins[j] && ldm_manager_plugin_provides(plugins[j], device)) {
+                                g_ptr_array_add(ret, g_object_ref(device));
+                                break;
+                        }
+                }
+        }
+
+        return ret;
+}
+
+/**
+ * ldm_manager_reload_modalias_file:
+ * @path: `.modaliases` file that was written, replaced or removed
+ *
+ * Swap in the plugin for a single changed file, keeping the priority of the
+ * plugin it replaces, so nothing else is parsed again. New files take the
+ * next priority, as if they had been added last. The plugin is always loaded
+ * from the form of the file a directory scan would pick, so removing one of
+ * several forms falls back to another rather than dropping the plugin.
+ */
+static void ldm_manager_reload_modalias_file(LdmManager *self, const gchar *path)
+{
+        g_autofree gchar *name = NULL;
+        g_autofree gchar *directory = NULL;
+        g_autofree gchar *source = NULL;
+        g_autoptr(LdmPlugin) old_plugin = NULL;
+        g_autoptr(GPtrArray) devices = NULL;
+        LdmPlugin *existing = NULL;
         LdmPlugin *plugin = NULL;
 
-        if (!g_file_test(path, G_FILE_TEST_EXISTS)) {
+        name = ldm_modalias_file_get_name(path);
+
+        existing = g_hash_table_lookup(self->plugins, name);
+        if (existing && !LDM_IS_MODALIAS_PLUGIN(existing)) {
+                g_debug("not replacing plugin '%s' for %s", name, path);
+                return;
+        }
+        if (existing) {
+                old_plugin = g_object_ref(existing);
+        }
+
+        directory = g_path_get_dirname(path);
+        source = ldm_modalias_file_find(directory, name);
+        if (source) {
+                plugin = ldm_manager_new_modalias_plugin(self, source);
+        }
+
+        if (plugin && old_plugin) {
+                ldm_plugin_set_priority(plugin, ldm_plugin_get_priority(old_plugin));
+                ldm_manager_add_plugin(self, plugin);
+        } else if (plugin) {
+                ldm_manager_add_modalias_plugin(self, plugin);
+        } else if (old_plugin) {
+                g_debug("removing plugin '%s'", name);
+                g_hash_table_remove(self->plugins, name);
+                ++self->match.generation;
+        } else {
+                return;
+        }
+
+        devices = ldm_manager_get_affected_devices(self, old_plugin, plugin);
+        g_signal_emit_by_name(self, "plugins-changed", devices);
+}
+
+/**
+ * ldm_manager_watch_ready:
+ *
+ * We have I/O on the inotify channel, reload every `.modaliases` file
+ * it tells us about.
+ */
+static gboolean ldm_manager_watch_ready(__ldm_unused__ GIOChannel *source, GIOCondition condition,
+                                        gpointer v)
+{
+        LdmManager *self = v;
+        gchar buffer[4096] __attribute__((aligned(__alignof__(struct inotify_event))));
+        const struct inotify_event *event = NULL;
+        ssize_t len = 0;
+
+        /* Only want G_IO_IN here. */
+        if ((condition & G_IO_IN) != G_IO_IN) {
+                return TRUE;
+        }
+
+        len = read(self->watch.fd, buffer, sizeof(buffer));
+        if (len < 0) {
+                if (errno == EAGAIN || errno == EINTR) {
+                        return TRUE;
+                }
+                /* Remove polling now, something is badly wrong. */
+                g_warning("Failed to read modalias directory events: %s", strerror(errno));
+                self->watch.source = 0;
                 return FALSE;
         }
 
-        plugin = ldm_modalias_plugin_new_from_filename(path);
+        for (gchar *p = buffer; p < buffer + len; p += sizeof(*event) + event->len) {
+                g_autofree gchar *path = NULL;
+                const gchar *directory = NULL;
 
-        /* Enforce priority based on insert order */
-        ldm_plugin_set_priority(plugin, self->modalias_plugin_priority);
-        ++self->modalias_plugin_priority;
+                event = (const struct inotify_event *)p;
+                directory = g_hash_table_lookup(self->watch.dirs, GINT_TO_POINTER(event->wd));
+                if (!directory || event->len == 0) {
+                        continue;
+                }
+                if (!ldm_modalias_file_is_supported(event->name)) {
+                        continue;
+                }
 
-        ldm_manager_add_plugin(self, plugin);
+                path = g_build_filename(directory, event->name, NULL);
+                ldm_manager_reload_modalias_file(self, path);
+        }
 
+        /* Keep the source around */
         return TRUE;
 }
 
+/**
+ * ldm_manager_watch_directory:
+ * @directory: Path containing `*.modaliases` files
+ *
+ * Reload the plugin for any `.modaliases` file written, moved into place or
+ * removed from the directory, if the manager was constructed with
+ * %LDM_MANAGER_FLAGS_WATCH_PLUGINS.
+ */
+static void ldm_manager_watch_directory(LdmManager *self, const gchar *directory)
+{
+        gint wd = -1;
+
+        if ((self->flags & LDM_MANAGER_FLAGS_WATCH_PLUGINS) != LDM_MANAGER_FLAGS_WATCH_PLUGINS) {
+                return;
+        }
+
+        if (self->watch.fd < 0) {
+                self->watch.fd = inotify_init1(IN_NONBLOCK | IN_CLOEXEC);
+                if (self->watch.fd < 0) {
+                        g_warning("modalias directory watching is unavailable: %s",
+                                  strerror(errno));
+                        return;
+                }
+
+                self->watch.channel = g_io_channel_unix_new(self->watch.fd);
+                g_io_channel_set_encoding(self->watch.channel, NULL, NULL);
+                self->watch.source =
+                    g_io_add_watch(self->watch.channel, G_IO_IN, ldm_manager_watch_ready, self);
+        }
+
+        /* Package managers usually move files into place, or write them directly */
+        wd = inotify_add_watch(self->watch.fd,
+                               directory,
+                               IN_CLOSE_WRITE | IN_MOVED_TO | IN_MOVED_FROM | IN_DELETE);
+        if (wd < 0) {
+                g_warning("Failed to watch %s: %s", directory, strerror(errno));
+                return;
+        }
+
+        g_hash_table_replace(self->watch.dirs, GINT_TO_POINTER(wd), g_strdup(directory));
+}
+
 /**
  * ldm_manager_add_modalias_plugins_for_directory:
  * @directory: Path containing `*.modaliases` files
@@ -96,32 +451,79 @@ gboolean ldm_manager_add_modalias_plugin_for_path(LdmManager *self, const gchar
  * This function is used to add well known modalias paths to the plugin and
  * construct plugins used for hardware detection.
  *
+ * Files compressed as `.modaliases.gz` or `.modaliases.zst` are picked up
+ * too when support for them was built in, sorting by their base name.
+ *
+ * If the directory contains a `modaliases.db`, as generated by
+ * #ldm_manager_update_modalias_cache or `mkmodaliases --database`, every file
+ * it is still up to date for is backed by a memory mapping of it instead of
+ * being parsed. Any other file is parsed, concurrently with the rest, and the
+ * plugins are added in glob order either way.
+ *
+ * With %LDM_MANAGER_FLAGS_WATCH_PLUGINS the directory is then watched, and
+ * the plugin for any single file added, replaced or removed is swapped in
+ * place, emitting #LdmManager::plugins-changed.
+ *
  * Returns: TRUE if a new plugin was added
  */
 gboolean ldm_manager_add_modalias_plugins_for_directory(LdmManager *self, const gchar *directory)
 {
-        g_autofree gchar *glob_path = NULL;
-        glob_t glo = { 0 };
-        gboolean ret = FALSE;
+        g_autoptr(GPtrArray) paths = NULL;
+        g_autofree gchar *db_path = NULL;
+        autofree(LdmModaliasDb) *db = NULL;
 
-        glob_path = g_strdup_printf("%s%s*.modaliases", directory, G_DIR_SEPARATOR_S);
+        /* Watch before globbing so we can't miss a file added in between */
+        ldm_manager_watch_directory(self, directory);
 
-        if (glob(glob_path, 0, NULL, &glo) != 0) {
-                goto cleanup;
+        paths = ldm_modalias_file_glob(directory);
+        if (paths->len < 1) {
+                return FALSE;
         }
 
-        if (glo.gl_pathc < 1) {
-                goto cleanup;
+        db_path = g_build_filename(directory, LDM_MODALIAS_DB_NAME, NULL);
+        db = ldm_modalias_db_open(db_path);
+
+        return ldm_manager_add_modalias_plugins_for_paths(self,
+                                                          (gchar **)paths->pdata,
+                                                          paths->len,
+                                                          db);
+}
+
+/**
+ * ldm_manager_add_modalias_plugins_for_table:
+ * @table: (array length=size) (element-type guint8): Rule table generated by
+ * `mkmodaliases --emit-c`, which must outlive the manager
+ * @size: Size of @table in bytes
+ *
+ * Add an #LdmModaliasPlugin for every `.modaliases` file compiled into the
+ * table, in the order they were given to mkmodaliases. The rules and their
+ * index are used in place, so nothing is parsed and no memory is allocated
+ * per rule, which suits installers and embedded images without modalias
+ * files. The plugins match exactly as they would if loaded from the files.
+ *
+ * Returns: TRUE if a new plugin was added, FALSE if the table wasn't generated
+ * for this version of the library
+ */
+gboolean ldm_manager_add_modalias_plugins_for_table(LdmManager *self, gconstpointer table,
+                                                    gsize size)
+{
+        autofree(LdmModaliasDb) *db = NULL;
+        gboolean ret = FALSE;
+
+        g_return_val_if_fail(self != NULL, FALSE);
+        g_return_val_if_fail(table != NULL, FALSE);
+
+        db = ldm_modalias_db_new_static(table, size);
+        if (!db) {
+                return FALSE;
         }
 
-        for (size_t i = 0; i < glo.gl_pathc; i++) {
-                if (ldm_manager_add_modalias_plugin_for_path(self, glo.gl_pathv[i])) {
+        for (guint i = 0; i < ldm_modalias_db_get_n_sources(db); i++) {
+                if (ldm_manager_add_modalias_plugin(self, ldm_modalias_plugin_new_from_db(db, i))) {
                         ret = TRUE;
                 }
         }
 
-cleanup:
-        globfree(&glo);
         return ret;
 }
 
@@ -140,6 +542,48 @@ gboolean ldm_manager_add_system_modalias_plugins(LdmManager *self)
         return ldm_manager_add_modalias_plugins_for_directory(self, MODALIAS_DIR);
 }
 
+/**
+ * ldm_manager_update_modalias_cache:
+ * @directory: Path containing `*.modaliases` files
+ *
+ * Merge every `.modaliases` file in the directory into its `modaliases.db`
+ * cache, which #ldm_manager_add_modalias_plugins_for_directory then uses in
+ * place of parsing the files. Only files added or changed since the cache was
+ * last written are parsed, and those since removed are dropped, so this is
+ * cheap enough to run whenever a package installs or removes its file.
+ *
+ * Returns: TRUE if the cache was written
+ */
+gboolean ldm_manager_update_modalias_cache(const gchar *directory)
+{
+        g_autofree gchar *db_path = NULL;
+        guint n_reused = 0;
+        guint n_parsed = 0;
+
+        g_return_val_if_fail(directory != NULL, FALSE);
+
+        db_path = g_build_filename(directory, LDM_MODALIAS_DB_NAME, NULL);
+        if (!ldm_modalias_db_update(directory, db_path, &n_reused, &n_parsed)) {
+                return FALSE;
+        }
+
+        g_debug("updated %s: %u files reused, %u parsed", db_path, n_reused, n_parsed);
+        return TRUE;
+}
+
+/**
+ * ldm_manager_update_system_modalias_cache:
+ *
+ * Update the cache for the modalias directory set when the library was
+ * compiled. This is a convenience wrapper around #ldm_manager_update_modalias_cache.
+ *
+ * Returns: TRUE if the cache was written
+ */
+gboolean ldm_manager_update_system_modalias_cache(void)
+{
+        return ldm_manager_update_modalias_cache(MODALIAS_DIR);
+}
+
 static gint ldm_manager_sort_by_priority(gconstpointer a, gconstpointer b)
 {
         gint prioA = ldm_plugin_get_priority(ldm_provider_get_plugin(*(LdmProvider **)a));
@@ -149,47 +593,710 @@ static gint ldm_manager_sort_by_priority(gconstpointer a, gconstpointer b)
 }
 
 /**
- * ldm_manager_get_providers:
+ * ldm_manager_is_indexed_plugin:
  *
- * Walk the plugins and find all known providers for the given device,
- * if they can support it. The returned #GPtrArray will free all elements
- * when it itself is freed.
+ * Only plain #LdmModaliasPlugin instances are handled by the unified index,
+ * subclasses may have overridden get_provider.
+ */
+static inline gboolean ldm_manager_is_indexed_plugin(LdmPlugin *plugin)
+{
+        return G_OBJECT_TYPE(plugin) == LDM_TYPE_MODALIAS_PLUGIN;
+}
+
+static gint ldm_manager_sort_sources(gconstpointer a, gconstpointer b)
+{
+        const LdmManagerMatchSource *sourceA = a;
+        const LdmManagerMatchSource *sourceB = b;
+
+        return sourceB->priority - sourceA->priority;
+}
+
+/**
+ * ldm_manager_index_rule:
+ * @entry: Position of the owning entry in match.entries
  *
- * Returns: (element-type Ldm.Provider) (transfer container): a list of all possible providers
+ * Patterns are interned across every plugin, so each distinct pattern is
+ * added to the index and evaluated once however many plugins share it, and
+ * its index rule ID leads to the chain of entries owning it.
  */
-GPtrArray *ldm_manager_get_providers(LdmManager *self, LdmDevice *device)
+static void ldm_manager_index_rule(LdmManager *self, const gchar *pattern, guint entry)
+{
+        LdmManagerMatchEntry *match = &g_array_index(self->match.entries,
+                                                     LdmManagerMatchEntry,
+                                                     entry);
+        gpointer k = NULL;
+        gpointer v = NULL;
+        guint id = 0;
+
+        if (g_hash_table_lookup_extended(self->match.patterns, pattern, &k, &v)) {
+                guint *head = &g_array_index(self->match.heads, guint, GPOINTER_TO_UINT(v));
+
+                match->next = *head;
+                *head = entry;
+                return;
+        }
+
+        id = self->match.heads->len;
+        match->next = G_MAXUINT;
+        g_array_append_val(self->match.heads, entry);
+        g_hash_table_insert(self->match.patterns, (gpointer)pattern, GUINT_TO_POINTER(id));
+        ldm_modalias_index_add(self->match.index, pattern, id);
+}
+
+/**
+ * ldm_manager_index_source:
+ * @source: Position of the plugin in match.sources
+ *
+ * Add any rules the plugin gained since we last saw it to the unified index.
+ *
+ * Returns: TRUE if any rule was added
+ */
+static gboolean ldm_manager_index_source(LdmManager *self, guint source)
+{
+        LdmManagerMatchSource *entry = &g_array_index(self->match.sources,
+                                                      LdmManagerMatchSource,
+                                                      source);
+        guint n_rules = ldm_modalias_plugin_get_n_rules(entry->plugin);
+        gboolean ret = n_rules != entry->n_rules;
+
+        for (guint i = entry->n_rules; i < n_rules; i++) {
+                LdmManagerMatchEntry match = {
+                        .source = source,
+                        .rule = i,
+                };
+                g_array_append_val(self->match.entries, match);
+                ldm_manager_index_rule(self,
+                                       ldm_modalias_plugin_get_rule_match(entry->plugin, i),
+                                       self->match.entries->len - 1);
+        }
+
+        entry->n_rules = n_rules;
+
+        return ret;
+}
+
+/**
+ * ldm_manager_sync_index:
+ *
+ * Ensure the unified index reflects the current modalias plugins. Any change
+ * to the plugin set or their priorities requires a rebuild, whereas rules
+ * added to an existing plugin are simply appended. The probe cache is
+ * dropped whenever the index changes.
+ */
+static void ldm_manager_sync_index(LdmManager *self)
 {
-        GPtrArray *ret = NULL;
         __ldm_unused__ gpointer k = NULL;
         LdmPlugin *plugin = NULL;
         GHashTableIter iter = { 0 };
+        gboolean rebuild = self->match.index_generation != self->match.generation;
+        gboolean changed = FALSE;
 
-        g_return_val_if_fail(self != NULL, NULL);
+        for (guint i = 0; i < self->match.sources->len && !rebuild; i++) {
+                LdmManagerMatchSource *source = &g_array_index(self->match.sources,
+                                                               LdmManagerMatchSource,
+                                                               i);
 
-        ret = g_ptr_array_new_with_free_func(g_object_unref);
+                if (ldm_plugin_get_priority(LDM_PLUGIN(source->plugin)) != source->priority) {
+                        rebuild = TRUE;
+                }
+        }
 
+        if (!rebuild) {
+                for (guint i = 0; i < self->match.sources->len; i++) {
+                        if (ldm_manager_index_source(self, i)) {
+                                changed = TRUE;
+                        }
+                }
+                if (changed) {
+                        g_hash_table_remove_all(self->match.cache);
+                }
+                return;
+        }
+
+        g_hash_table_remove_all(self->match.cache);
+        g_clear_pointer(&self->match.index, ldm_modalias_index_free);
+        self->match.index = ldm_modalias_index_new();
+        g_array_set_size(self->match.sources, 0);
+        g_array_set_size(self->match.entries, 0);
+        g_hash_table_remove_all(self->match.patterns);
+        g_array_set_size(self->match.heads, 0);
+
+        g_hash_table_iter_init(&iter, self->plugins);
+        while (g_hash_table_iter_next(&iter, &k, (void **)&plugin)) {
+                LdmManagerMatchSource source = { 0 };
+
+                if (!ldm_manager_is_indexed_plugin(plugin)) {
+                        continue;
+                }
+
+                source.plugin = LDM_MODALIAS_PLUGIN(plugin);
+                source.priority = ldm_plugin_get_priority(plugin);
+                source.db = ldm_modalias_plugin_get_db(source.plugin, &source.db_source);
+                g_array_append_val(self->match.sources, source);
+        }
+
+        g_array_sort(self->match.sources, ldm_manager_sort_sources);
+
+        for (guint i = 0; i < self->match.sources->len; i++) {
+                ldm_manager_index_source(self, i);
+        }
+
+        self->match.index_generation = self->match.generation;
+}
+
+/*
+ * A rule matched while probing a single modalias
+ */
+typedef struct LdmManagerMatchHit {
+        guint source; /* Position in match.sources */
+        guint rule;   /* Plugin or database rule ID */
+        gboolean db;  /* Whether @rule refers to the database */
+} LdmManagerMatchHit;
+
+/*
+ * Scratch state shared by every device resolved in one call
+ */
+typedef struct LdmManagerBatch {
+        GArray *ids;        /* Matching unified index IDs */
+        GPtrArray *plugins; /* Plugins not covered by the unified index */
+        guint *best;        /* Best plugin rule per source */
+        guint *db_best;     /* Best database rule per source */
+} LdmManagerBatch;
+
+/**
+ * ldm_manager_batch_init:
+ *
+ * Prepare to resolve providers for one or more devices.
+ */
+static void ldm_manager_batch_init(LdmManager *self, LdmManagerBatch *batch)
+{
+        __ldm_unused__ gpointer k = NULL;
+        LdmPlugin *plugin = NULL;
+        GHashTableIter iter = { 0 };
+        guint n_sources = 0;
+
+        ldm_manager_sync_index(self);
+        n_sources = self->match.sources->len;
+
+        batch->ids = g_array_new(FALSE, FALSE, sizeof(guint));
+        batch->best = g_new(guint, n_sources);
+        batch->db_best = g_new(guint, n_sources);
+
+        batch->plugins = g_ptr_array_new();
         g_hash_table_iter_init(&iter, self->plugins);
         while (g_hash_table_iter_next(&iter, &k, (void **)&plugin)) {
-                LdmProvider *provider = NULL;
+                if (!ldm_manager_is_indexed_plugin(plugin)) {
+                        g_ptr_array_add(batch->plugins, plugin);
+                }
+        }
+}
+
+static void ldm_manager_batch_clear(LdmManagerBatch *batch)
+{
+        g_clear_pointer(&batch->ids, g_array_unref);
+        g_clear_pointer(&batch->plugins, g_ptr_array_unref);
+        g_clear_pointer(&batch->best, g_free);
+        g_clear_pointer(&batch->db_best, g_free);
+}
+
+/**
+ * ldm_manager_probe_modalias:
+ * @hits: Storage for the matching rules
+ *
+ * Run a single modalias through the unified index and any database backed
+ * plugins.
+ */
+static void ldm_manager_probe_modalias(LdmManager *self, LdmManagerBatch *batch,
+                                       LdmDevice *device, GArray *hits)
+{
+        const LdmModaliasFields *fields = ldm_device_get_modalias_fields(device);
+
+        g_array_set_size(batch->ids, 0);
+        ldm_modalias_index_match_fields(self->match.index,
+                                        device->os.modalias,
+                                        fields,
+                                        batch->ids);
+
+        for (guint i = 0; i < batch->ids->len; i++) {
+                guint id = g_array_index(batch->ids, guint, i);
+                guint next = g_array_index(self->match.heads, guint, id);
+
+                /* Every owner of the pattern matched along with it */
+                while (next != G_MAXUINT) {
+                        LdmManagerMatchEntry *entry = &g_array_index(self->match.entries,
+                                                                     LdmManagerMatchEntry,
+                                                                     next);
+                        LdmManagerMatchHit hit = {
+                                .source = entry->source,
+                                .rule = entry->rule,
+                                .db = FALSE,
+                        };
+
+                        g_array_append_val(hits, hit);
+                        next = entry->next;
+                }
+        }
+
+        for (guint i = 0; i < self->match.sources->len; i++) {
+                LdmManagerMatchSource *source = &g_array_index(self->match.sources,
+                                                               LdmManagerMatchSource,
+                                                               i);
+                LdmManagerMatchHit hit = {
+                        .source = i,
+                        .rule = G_MAXUINT,
+                        .db = TRUE,
+                };
+
+                if (!source->db) {
+                        continue;
+                }
+                if (ldm_modalias_db_match(source->db,
+                                          source->db_source,
+                                          device->os.modalias,
+                                          fields,
+                                          &hit.rule)) {
+                        g_array_append_val(hits, hit);
+                }
+        }
+}
+
+/**
+ * ldm_manager_match_modalias:
+ *
+ * Run a single device modalias through the unified index and any database
+ * backed plugins, tracking the best rule for each source. Probes are memoised
+ * per modalias until the index next changes.
+ */
+static void ldm_manager_match_modalias(LdmManager *self, LdmManagerBatch *batch,
+                                       LdmDevice *device)
+{
+        GArray *hits = NULL;
+
+        /* Identical modaliases share the probe, including misses */
+        hits = g_hash_table_lookup(self->match.cache, device->os.modalias);
+        if (hits) {
+                ++self->match.cache_hits;
+        } else {
+                ++self->match.cache_misses;
+                hits = g_array_new(FALSE, FALSE, sizeof(LdmManagerMatchHit));
+                ldm_manager_probe_modalias(self, batch, device, hits);
+                g_hash_table_insert(self->match.cache, g_strdup(device->os.modalias), hits);
+        }
+
+        for (guint i = 0; i < hits->len; i++) {
+                LdmManagerMatchHit *hit = &g_array_index(hits, LdmManagerMatchHit, i);
+                guint *best = hit->db ? batch->db_best : batch->best;
+
+                best[hit->source] = MIN(best[hit->source], hit->rule);
+        }
+}
+
+/**
+ * ldm_manager_match_device:
+ *
+ * Match the device modalias, and those of all of its descendants
+ * (interfaces), in one pass.
+ */
+static void ldm_manager_match_device(LdmManager *self, LdmManagerBatch *batch, LdmDevice *device)
+{
+        GPtrArray *descendants = ldm_device_get_subtree_modaliases(device);
+
+        if (device->os.modalias) {
+                ldm_manager_match_modalias(self, batch, device);
+        }
+
+        for (guint i = 0; i < descendants->len; i++) {
+                ldm_manager_match_modalias(self, batch, descendants->pdata[i]);
+        }
+}
+
+/**
+ * ldm_manager_load_sources:
+ *
+ * Load any lazy plugin that may match the device and add its rules to the
+ * unified index before we probe it. Cached probes predate those rules and
+ * are dropped.
+ */
+static void ldm_manager_load_sources(LdmManager *self, LdmDevice *device)
+{
+        gboolean changed = FALSE;
+
+        for (guint i = 0; i < self->match.sources->len; i++) {
+                LdmManagerMatchSource *source = &g_array_index(self->match.sources,
+                                                               LdmManagerMatchSource,
+                                                               i);
+
+                if (ldm_modalias_plugin_is_loaded(source->plugin) ||
+                    !ldm_modalias_plugin_may_match(source->plugin, device)) {
+                        continue;
+                }
+
+                ldm_modalias_plugin_load(source->plugin);
+                if (ldm_manager_index_source(self, i)) {
+                        changed = TRUE;
+                }
+        }
+
+        if (changed) {
+                g_hash_table_remove_all(self->match.cache);
+        }
+}
+
+/**
+ * ldm_manager_batch_match:
+ *
+ * Find the modalias providers for a single device. Each modalias plugin
+ * reports its earliest matching rule, with database rules preceding those
+ * added at runtime, exactly as #ldm_plugin_get_provider would. The sources
+ * are kept in priority order, so the result is already sorted.
+ *
+ * Returns: (transfer full): The modalias providers for @device
+ */
+static GPtrArray *ldm_manager_batch_match(LdmManager *self, LdmManagerBatch *batch,
+                                          LdmDevice *device)
+{
+        GPtrArray *ret = NULL;
+        guint n_sources = self->match.sources->len;
+
+        ret = g_ptr_array_new_with_free_func(g_object_unref);
+
+        for (guint i = 0; i < n_sources; i++) {
+                batch->best[i] = G_MAXUINT;
+                batch->db_best[i] = G_MAXUINT;
+        }
+
+        if (n_sources > 0) {
+                ldm_manager_load_sources(self, device);
+                ldm_manager_match_device(self, batch, device);
+        }
+
+        for (guint i = 0; i < n_sources; i++) {
+                LdmManagerMatchSource *source = &g_array_index(self->match.sources,
+                                                               LdmManagerMatchSource,
+                                                               i);
+                const gchar *package = NULL;
+
+                if (batch->db_best[i] != G_MAXUINT) {
+                        package = ldm_modalias_db_get_package(source->db,
+                                                              source->db_source,
+                                                              batch->db_best[i]);
+                } else if (batch->best[i] != G_MAXUINT) {
+                        package = ldm_modalias_plugin_get_rule_package(source->plugin,
+                                                                       batch->best[i]);
+                } else {
+                        continue;
+                }
+
+                g_ptr_array_add(ret,
+                                g_object_ref_sink(
+                                    ldm_provider_new(LDM_PLUGIN(source->plugin), device, package)));
+        }
+
+        return ret;
+}
+
+/*
+ * One plugin to be run against one device on a worker thread
+ */
+typedef struct LdmManagerJob {
+        LdmPlugin *plugin;
+        LdmDevice *device;
+        LdmProvider **slot; /* Where to store the result */
+} LdmManagerJob;
+
+/**
+ * ldm_manager_run_job:
+ *
+ * Worker thread entry, storing the provider in the job slot.
+ */
+static void ldm_manager_run_job(gpointer data, gpointer user_data)
+{
+        LdmManagerJob *job = data;
+        LdmManager *self = user_data;
+
+        *job->slot = ldm_plugin_get_provider(job->plugin, job->device);
+        g_free(job);
+
+        g_mutex_lock(&self->parallel.lock);
+        if (--self->parallel.pending == 0) {
+                g_cond_broadcast(&self->parallel.cond);
+        }
+        g_mutex_unlock(&self->parallel.lock);
+}
+
+/**
+ * ldm_manager_push_job:
+ *
+ * Queue the plugin to be run against the device on the worker pool.
+ *
+ * Returns: FALSE if the job couldn't be queued and must be run directly
+ */
+static gboolean ldm_manager_push_job(LdmManager *self, LdmPlugin *plugin, LdmDevice *device,
+                                     LdmProvider **slot)
+{
+        g_autoptr(GError) error = NULL;
+        LdmManagerJob *job = NULL;
+
+        if (!self->parallel.pool) {
+                self->parallel.pool = g_thread_pool_new(ldm_manager_run_job,
+                                                        self,
+                                                        (gint)g_get_num_processors(),
+                                                        FALSE,
+                                                        &error);
+                if (!self->parallel.pool) {
+                        g_warning("failed to create plugin thread pool: %s", error->message);
+                        return FALSE;
+                }
+        }
+
+        job = g_new0(LdmManagerJob, 1);
+        job->plugin = plugin;
+        job->device = device;
+        job->slot = slot;
+
+        g_mutex_lock(&self->parallel.lock);
+        ++self->parallel.pending;
+        g_mutex_unlock(&self->parallel.lock);
+
+        if (!g_thread_pool_push(self->parallel.pool, job, &error)) {
+                g_warning("failed to queue plugin job: %s", error->message);
+                g_free(job);
+                g_mutex_lock(&self->parallel.lock);
+                --self->parallel.pending;
+                g_mutex_unlock(&self->parallel.lock);
+                return FALSE;
+        }
+
+        return TRUE;
+}
+
+/**
+ * ldm_manager_batch_dispatch:
+ * @slots: Storage for the provider of each plugin in batch->plugins
+ *
+ * Run the plugins not covered by the unified index against the device. When
+ * the manager was constructed with %LDM_MANAGER_FLAGS_PARALLEL_PLUGINS, those
+ * declaring themselves thread-safe are queued on the worker pool, and the
+ * rest run on the calling thread in the meantime. The slots must not be
+ * read before #ldm_manager_batch_wait returns.
+ */
+static void ldm_manager_batch_dispatch(LdmManager *self, LdmManagerBatch *batch,
+                                       LdmDevice *device, LdmProvider **slots)
+{
+        gboolean parallel = (self->flags & LDM_MANAGER_FLAGS_PARALLEL_PLUGINS) ==
+                            LDM_MANAGER_FLAGS_PARALLEL_PLUGINS;
+
+        for (guint i = 0; i < batch->plugins->len; i++) {
+                LdmPlugin *plugin = batch->plugins->pdata[i];
+
+                if (parallel && ldm_plugin_get_thread_safe(plugin) &&
+                    ldm_manager_push_job(self, plugin, device, &slots[i])) {
+                        continue;
+                }
+
+                slots[i] = ldm_plugin_get_provider(plugin, device);
+        }
+}
+
+/**
+ * ldm_manager_batch_wait:
+ *
+ * Block until every queued plugin job has completed.
+ */
+static void ldm_manager_batch_wait(LdmManager *self)
+{
+        g_mutex_lock(&self->parallel.lock);
+        while (self->parallel.pending > 0) {
+                g_cond_wait(&self->parallel.cond, &self->parallel.lock);
+        }
+        g_mutex_unlock(&self->parallel.lock);
+}
+
+/**
+ * ldm_manager_batch_merge:
+ * @providers: The modalias providers for the device
+ * @slots: The providers found by #ldm_manager_batch_dispatch
+ *
+ * Append the plugin providers in plugin order, regardless of the order the
+ * workers completed in, so the result is identical to a serial run. Sorting
+ * is only needed when such plugins provide for the device.
+ */
+static void ldm_manager_batch_merge(LdmManagerBatch *batch, GPtrArray *providers,
+                                    LdmProvider **slots)
+{
+        gboolean sort = FALSE;
+
+        for (guint i = 0; i < batch->plugins->len; i++) {
+                LdmProvider *provider = slots[i];
 
                 /* See if this plugin supports the device */
-                provider = ldm_plugin_get_provider(plugin, device);
                 if (!provider) {
                         continue;
                 }
 
                 if (g_object_is_floating(provider)) {
-                        g_ptr_array_add(ret, g_object_ref_sink(provider));
+                        g_ptr_array_add(providers, g_object_ref_sink(provider));
                 } else {
-                        g_ptr_array_add(ret, provider);
+                        g_ptr_array_add(providers, provider);
+                }
+                sort = TRUE;
+        }
+
+        if (sort) {
+                g_ptr_array_sort(providers, ldm_manager_sort_by_priority);
+        }
+}
+
+/**
+ * ldm_manager_get_providers:
+ *
+ * Walk the plugins and find all known providers for the given device,
+ * if they can support it. The returned #GPtrArray will free all elements
+ * when it itself is freed.
+ *
+ * Returns: (element-type Ldm.Provider) (transfer container): a list of all possible providers
+ */
+GPtrArray *ldm_manager_get_providers(LdmManager *self, LdmDevice *device)
+{
+        LdmManagerBatch batch = { 0 };
+        g_autofree LdmProvider **slots = NULL;
+        GPtrArray *ret = NULL;
+
+        g_return_val_if_fail(self != NULL, NULL);
+
+        ldm_manager_batch_init(self, &batch);
+        slots = g_new0(LdmProvider *, batch.plugins->len);
+
+        ldm_manager_batch_dispatch(self, &batch, device, slots);
+        ret = ldm_manager_batch_match(self, &batch, device);
+        ldm_manager_batch_wait(self);
+        ldm_manager_batch_merge(&batch, ret, slots);
+
+        ldm_manager_batch_clear(&batch);
+
+        return ret;
+}
+
+/**
+ * ldm_manager_get_providers_for_devices:
+ * @devices: (element-type Ldm.Device): The devices to find providers for
+ *
+ * Find all known providers for every device in the set in a single pass.
+ * This is equivalent to calling #ldm_manager_get_providers for each device,
+ * but the plugin set is only walked once and the scratch state is shared
+ * across all devices, making it the preferred way to examine a whole system.
+ * With %LDM_MANAGER_FLAGS_PARALLEL_PLUGINS, thread-safe plugins are run for
+ * every device at once.
+ *
+ * Every device of the set is present in the returned table, mapped to a
+ * (possibly empty) #GPtrArray of providers in priority order.
+ *
+ * Returns: (element-type Ldm.Device GLib.PtrArray) (transfer full): a mapping of
+ * each device to its providers
+ */
+GHashTable *ldm_manager_get_providers_for_devices(LdmManager *self, GPtrArray *devices)
+{
+        LdmManagerBatch batch = { 0 };
+        g_autoptr(GHashTable) seen = NULL;
+        g_autoptr(GPtrArray) unique = NULL;
+        g_autofree LdmProvider **slots = NULL;
+        GHashTable *ret = NULL;
+        guint n_plugins = 0;
+
+        g_return_val_if_fail(self != NULL, NULL);
+        g_return_val_if_fail(devices != NULL, NULL);
+
+        ret = g_hash_table_new_full(g_direct_hash,
+                                    g_direct_equal,
+                                    g_object_unref,
+                                    (GDestroyNotify)g_ptr_array_unref);
+
+        seen = g_hash_table_new(g_direct_hash, g_direct_equal);
+        unique = g_ptr_array_sized_new(devices->len);
+        for (guint i = 0; i < devices->len; i++) {
+                if (g_hash_table_add(seen, devices->pdata[i])) {
+                        g_ptr_array_add(unique, devices->pdata[i]);
                 }
         }
 
-        g_ptr_array_sort(ret, ldm_manager_sort_by_priority);
+        ldm_manager_batch_init(self, &batch);
+        n_plugins = batch.plugins->len;
+        slots = g_new0(LdmProvider *, MAX(n_plugins * unique->len, 1));
+
+        /* Get the workers going before matching modaliases on this thread */
+        for (guint i = 0; i < unique->len; i++) {
+                ldm_manager_batch_dispatch(self, &batch, unique->pdata[i], slots + i * n_plugins);
+        }
+
+        for (guint i = 0; i < unique->len; i++) {
+                LdmDevice *device = unique->pdata[i];
+
+                g_hash_table_insert(ret,
+                                    g_object_ref(device),
+                                    ldm_manager_batch_match(self, &batch, device));
+        }
+
+        ldm_manager_batch_wait(self);
+
+        for (guint i = 0; i < unique->len; i++) {
+                ldm_manager_batch_merge(&batch,
+                                        g_hash_table_lookup(ret, unique->pdata[i]),
+                                        slots + i * n_plugins);
+        }
+
+        ldm_manager_batch_clear(&batch);
 
         return ret;
 }
 
+/**
+ * ldm_manager_get_cache_stats:
+ * @hits: (out) (optional): Number of modalias probes answered from the cache
+ * @misses: (out) (optional): Number of modalias probes that had to be run
+ *
+ * Provider resolution memoises the plugin matches for each distinct modalias
+ * it sees, including those matching nothing, until the plugin set changes.
+ * This reports the effectiveness of that cache over the manager's lifetime.
+ */
+void ldm_manager_get_cache_stats(LdmManager *self, guint64 *hits, guint64 *misses)
+{
+        g_return_if_fail(self != NULL);
+
+        if (hits) {
+                *hits = self->match.cache_hits;
+        }
+        if (misses) {
+                *misses = self->match.cache_misses;
+        }
+}
+
+/**
+ * ldm_manager_get_pattern_stats:
+ * @n_rules: (out) (optional): Number of modalias rules across all plugins
+ * @n_patterns: (out) (optional): Number of distinct patterns among them
+ *
+ * Identical match patterns from different modalias plugins, such as the
+ * device IDs shared by several generations of a driver, are only indexed
+ * and evaluated once by the manager. This reports how many rules the loaded
+ * plugins hold against how many patterns were actually indexed for them.
+ *
+ * Plugins backed by a `modaliases.db` are matched against the database, and
+ * lazy plugins are only counted once loaded.
+ */
+void ldm_manager_get_pattern_stats(LdmManager *self, guint *n_rules, guint *n_patterns)
+{
+        g_return_if_fail(self != NULL);
+
+        ldm_manager_sync_index(self);
+
+        if (n_rules) {
+                *n_rules = self->match.entries->len;
+        }
+        if (n_patterns) {
+                *n_patterns = self->match.heads->len;
+        }
+}
+
 /*
  * Editor modelines  -  https://www.wireshark.org/tools/modelines.html
  *
@@ -16,6 +16,9 @@
 #include "device.h"
 #include "ldm-private.h"
 #include "manager.h"
+#include "modalias-db.h"
+#include "modalias-index.h"
+#include "plugins/modalias-plugin.h"
 
 struct _LdmManagerClass {
         GObjectClass parent_class;
@@ -23,15 +26,76 @@ struct _LdmManagerClass {
         /* Signals */
         void (*device_added)(LdmManager *self, LdmDevice *device);
         void (*device_removed)(LdmManager *self, LdmDevice *device);
+        void (*plugins_changed)(LdmManager *self, GPtrArray *devices);
 };
 
+/*
+ * A modalias plugin contributing rules to the manager's unified index
+ */
+typedef struct LdmManagerMatchSource {
+        LdmModaliasPlugin *plugin;
+        gint priority;
+        guint n_rules;     /* Plugin rules added to the index so far */
+        LdmModaliasDb *db; /* Database backing the plugin, if any */
+        guint db_source;
+} LdmManagerMatchSource;
+
+/*
+ * Owner of a rule within the unified index. Rules sharing a pattern are
+ * chained together from the head for that pattern.
+ */
+typedef struct LdmManagerMatchEntry {
+        guint source; /* Position in match.sources */
+        guint rule;   /* Rule ID within the owning plugin */
+        guint next;   /* Next entry with the same pattern, or G_MAXUINT */
+} LdmManagerMatchEntry;
+
+/* Bits of LdmDeviceType, see LdmManager.types */
+#define LDM_MANAGER_TYPE_BITS 12
+
 struct _LdmManager {
         GObject parent;
-        GPtrArray *devices;
+        GPtrArray *devices; /* Top level devices in udev order, NULL where one was removed */
         GHashTable *plugins;
 
+        /* Lookup of self->devices by sysfs path */
+        struct {
+                GHashTable *positions; /* Sysfs path, owned by the device, to position */
+                guint n_holes;         /* NULL slots in self->devices awaiting compaction */
+        } device_index;
+
+        /* Struct-of-arrays view of self->devices for ldm_manager_get_devices */
+        struct {
+                GArray *masks; /* LdmDeviceType of each slot's subtree, 0 for holes */
+                GArray *slots[LDM_MANAGER_TYPE_BITS]; /* guint64 bitmap of slots with the bit */
+        } types;
+
         gint modalias_plugin_priority;
 
+        /* Unified index over the rules of every LdmModaliasPlugin */
+        struct {
+                LdmModaliasIndex *index;
+                GArray *sources;  /* LdmManagerMatchSource, highest priority first */
+                GArray *entries;  /* LdmManagerMatchEntry */
+                GHashTable *patterns;   /* Pattern, owned by a plugin, to index rule ID */
+                GArray *heads;          /* First entry for each index rule ID */
+                guint generation;       /* Bumped when the plugin set changes */
+                guint index_generation; /* Generation the index was built for */
+
+                /* Modalias to GArray of matches, valid for the current index */
+                GHashTable *cache;
+                guint64 cache_hits;
+                guint64 cache_misses;
+        } match;
+
+        /* Workers for thread-safe plugins, see LDM_MANAGER_FLAGS_PARALLEL_PLUGINS */
+        struct {
+                GThreadPool *pool;
+                GMutex lock;
+                GCond cond;
+                guint pending; /* Jobs pushed but not yet completed */
+        } parallel;
+
         /* Udev */
         udev_connection *udev;
 
@@ -42,6 +106,14 @@ struct _LdmManager {
                 GIOChannel *channel; /* Main channel for poll main loop */
                 guint source;        /* GIO source */
         } monitor;
+
+        /* Modalias directories, see LDM_MANAGER_FLAGS_WATCH_PLUGINS */
+        struct {
+                gint fd;             /* inotify instance, -1 until first needed */
+                GIOChannel *channel; /* Channel for the inotify instance */
+                guint source;        /* GIO source */
+                GHashTable *dirs;    /* Watch descriptor to directory */
+        } watch;
 };
 
 /*
@@ -12,6 +12,8 @@
 #define _GNU_SOURCE
 
 #include <libudev.h>
+#include <string.h>
+#include <unistd.h>
 
 #include "device.h"
 #include "ldm-enums.h"
@@ -24,6 +26,7 @@ static void ldm_manager_set_property(GObject *object, guint id, const GValue *va
                                      GParamSpec *spec);
 static void ldm_manager_get_property(GObject *object, guint id, GValue *value, GParamSpec *spec);
 static void ldm_manager_constructed(GObject *obj);
+static void ldm_manager_finalize(GObject *obj);
 
 static void ldm_manager_init_udev_monitor(LdmManager *self);
 static void ldm_manager_init_udev_static(LdmManager *self);
@@ -43,7 +46,7 @@ static GParamSpec *obj_properties[N_PROPS] = {
 };
 
 /* Signal IDs */
-enum { SIGNAL_DEVICE_ADDED = 0, SIGNAL_DEVICE_REMOVED, N_SIGNALS };
+enum { SIGNAL_DEVICE_ADDED = 0, SIGNAL_DEVICE_REMOVED, SIGNAL_PLUGINS_CHANGED, N_SIGNALS };
 
 static guint obj_signals[N_SIGNALS] = { 0 };
 
@@ -81,6 +84,18 @@ static guint obj_signals[N_SIGNALS] = { 0 };
 
 G_DEFINE_TYPE(LdmManager, ldm_manager, G_TYPE_OBJECT)
 
+/**
+ * ldm_manager_device_free:
+ *
+ * Element free function for self->devices, which may hold removal holes
+ */
+static void ldm_manager_device_free(gpointer v)
+{
+        if (v) {
+                g_object_unref(v);
+        }
+}
+
 /**
  * ldm_manager_dispose:
  *
@@ -103,16 +118,60 @@ static void ldm_manager_dispose(GObject *obj)
                 g_clear_pointer(&self->monitor.udev, udev_monitor_unref);
         }
 
+        /* Stop watching modalias directories */
+        if (self->watch.source > 0) {
+                g_source_remove(self->watch.source);
+                self->watch.source = 0;
+        }
+        g_clear_pointer(&self->watch.channel, g_io_channel_unref);
+        if (self->watch.fd >= 0) {
+                close(self->watch.fd);
+                self->watch.fd = -1;
+        }
+        g_clear_pointer(&self->watch.dirs, g_hash_table_unref);
+
         g_clear_pointer(&self->udev, udev_unref);
 
-        /* clean ourselves up */
+        /* clean ourselves up, the index borrows its keys from the devices */
+        g_clear_pointer(&self->device_index.positions, g_hash_table_unref);
         g_clear_pointer(&self->devices, g_ptr_array_unref);
+        g_clear_pointer(&self->types.masks, g_array_unref);
+        for (guint i = 0; i < LDM_MANAGER_TYPE_BITS; i++) {
+                g_clear_pointer(&self->types.slots[i], g_array_unref);
+        }
 
         g_clear_pointer(&self->plugins, g_hash_table_unref);
+        g_clear_pointer(&self->match.index, ldm_modalias_index_free);
+        g_clear_pointer(&self->match.sources, g_array_unref);
+        g_clear_pointer(&self->match.entries, g_array_unref);
+        g_clear_pointer(&self->match.patterns, g_hash_table_unref);
+        g_clear_pointer(&self->match.heads, g_array_unref);
+        g_clear_pointer(&self->match.cache, g_hash_table_unref);
+
+        /* Let any outstanding plugin jobs complete */
+        if (self->parallel.pool) {
+                g_thread_pool_free(self->parallel.pool, FALSE, TRUE);
+                self->parallel.pool = NULL;
+        }
 
         G_OBJECT_CLASS(ldm_manager_parent_class)->dispose(obj);
 }
 
+/**
+ * ldm_manager_finalize:
+ *
+ * Release the worker synchronisation primitives
+ */
+static void ldm_manager_finalize(GObject *obj)
+{
+        LdmManager *self = LDM_MANAGER(obj);
+
+        g_mutex_clear(&self->parallel.lock);
+        g_cond_clear(&self->parallel.cond);
+
+        G_OBJECT_CLASS(ldm_manager_parent_class)->finalize(obj);
+}
+
 /**
  * ldm_manager_class_init:
  *
@@ -125,6 +184,7 @@ static void ldm_manager_class_init(LdmManagerClass *klazz)
         /* gobject vtable hookup */
         obj_class->constructed = ldm_manager_constructed;
         obj_class->dispose = ldm_manager_dispose;
+        obj_class->finalize = ldm_manager_finalize;
         obj_class->get_property = ldm_manager_get_property;
         obj_class->set_property = ldm_manager_set_property;
 
@@ -170,6 +230,30 @@ static void ldm_manager_class_init(LdmManagerClass *klazz)
                          1,
                          LDM_TYPE_DEVICE);
 
+        /**
+         * LdmManager::plugins-changed:
+         * @manager: The manager owning the plugins
+         * @devices: (element-type Ldm.Device): Devices whose providers may have changed
+         *
+         * Connect to this signal to be notified when a `.modaliases` file in a
+         * watched directory was added, replaced or removed, and the manager
+         * has swapped in the new plugin. Only the devices passed, which the
+         * previous or the new plugin provides for, need to be queried again.
+         *
+         * Directories are only watched with %LDM_MANAGER_FLAGS_WATCH_PLUGINS.
+         */
+        obj_signals[SIGNAL_PLUGINS_CHANGED] =
+            g_signal_new("plugins-changed",
+                         LDM_TYPE_MANAGER,
+                         G_SIGNAL_RUN_FIRST | G_SIGNAL_ACTION,
+                         G_STRUCT_OFFSET(LdmManagerClass, plugins_changed),
+                         NULL,
+                         NULL,
+                         NULL,
+                         G_TYPE_NONE,
+                         1,
+                         G_TYPE_PTR_ARRAY);
+
         /**
          * LdmManager:flags
          *
@@ -249,10 +333,34 @@ static_init:
 static void ldm_manager_init(LdmManager *self)
 {
         /* Devices is an array of devices in the order that we encounter them */
-        self->devices = g_ptr_array_new_full(30, g_object_unref);
+        self->devices = g_ptr_array_new_full(30, ldm_manager_device_free);
+        self->device_index.positions = g_hash_table_new(g_str_hash, g_str_equal);
+
+        /* Type table mirrors the devices for filtering without walking them */
+        self->types.masks = g_array_sized_new(FALSE, TRUE, sizeof(guint), 30);
+        for (guint i = 0; i < LDM_MANAGER_TYPE_BITS; i++) {
+                self->types.slots[i] = g_array_new(FALSE, TRUE, sizeof(guint64));
+        }
 
         /* Plugin table is a mapping from plugin name to plugin */
         self->plugins = g_hash_table_new_full(g_str_hash, g_str_equal, g_free, g_object_unref);
+
+        /* Unified modalias index is built on first use */
+        self->match.sources = g_array_new(FALSE, FALSE, sizeof(LdmManagerMatchSource));
+        self->match.entries = g_array_new(FALSE, FALSE, sizeof(LdmManagerMatchEntry));
+        self->match.patterns = g_hash_table_new(g_str_hash, g_str_equal);
+        self->match.heads = g_array_new(FALSE, FALSE, sizeof(guint));
+        self->match.cache =
+            g_hash_table_new_full(g_str_hash, g_str_equal, g_free, (GDestroyNotify)g_array_unref);
+        self->match.generation = 1;
+
+        /* Worker pool is only spawned when a thread-safe plugin needs it */
+        g_mutex_init(&self->parallel.lock);
+        g_cond_init(&self->parallel.cond);
+
+        /* inotify is only set up once a directory needs watching */
+        self->watch.fd = -1;
+        self->watch.dirs = g_hash_table_new_full(g_direct_hash, g_direct_equal, NULL, g_free);
 }
 
 /**
@@ -400,15 +508,19 @@ static gboolean ldm_manager_io_ready(__ldm_unused__ GIOChannel *source, GIOCondi
 }
 
 /*
- * Walk devices and find the matching device.
- * We originally used a hashtable internally but that has the undesirable
+ * Find the matching device.
+ * We originally stored the devices in a hashtable but that has the undesirable
  * effect that we lose our original sorting as it came from udev, and not
  * only did it make test suites unreliable, it also meant we could encounter
- * PCI devices in the wrong order too.
+ * PCI devices in the wrong order too. The array remains the storage, and the
+ * index only records where in it each sysfs path lives.
  */
 static gboolean ldm_manager_device_by_sysfs_path(LdmManager *self, const char *sysfs_path,
                                                  LdmDevice **out_device, guint *out_index)
 {
+        gpointer position = NULL;
+        guint index = 0;
+
         if (out_device) {
                 *out_device = NULL;
         }
@@ -416,25 +528,143 @@ static gboolean ldm_manager_device_by_sysfs_path(LdmManager *self, const char *s
                 *out_index = 0;
         }
 
-        /* Find the device */
-        for (guint i = 0; i < self->devices->len; i++) {
-                LdmDevice *node = NULL;
+        if (!g_hash_table_lookup_extended(self->device_index.positions,
+                                          sysfs_path,
+                                          NULL,
+                                          &position)) {
+                return FALSE;
+        }
 
-                node = self->devices->pdata[i];
-                if (!g_str_equal(node->os.sysfs_path, sysfs_path)) {
-                        continue;
+        index = GPOINTER_TO_UINT(position);
+        if (out_device) {
+                *out_device = self->devices->pdata[index];
+        }
+        if (out_index) {
+                *out_index = index;
+        }
+        return TRUE;
+}
+
+/**
+ * ldm_manager_set_slot_types:
+ * @index: Position within self->devices
+ * @mask: New LdmDeviceType of the subtree at @index
+ *
+ * Update the type table for a slot, flipping only the bitmap bits that changed.
+ */
+static void ldm_manager_set_slot_types(LdmManager *self, guint index, guint mask)
+{
+        guint *masks = &g_array_index(self->types.masks, guint, 0);
+        guint changed = masks[index] ^ mask;
+        guint64 bit = G_GUINT64_CONSTANT(1) << (index % 64);
+
+        for (guint i = 0; i < LDM_MANAGER_TYPE_BITS; i++) {
+                if ((changed & (1u << i)) != 0) {
+                        g_array_index(self->types.slots[i], guint64, index / 64) ^= bit;
                 }
+        }
+        masks[index] = mask;
+}
 
-                if (out_device) {
-                        *out_device = node;
+/**
+ * ldm_manager_resize_types:
+ * @n_slots: New length of self->devices
+ *
+ * Grow or shrink the type table, new slots having no types.
+ */
+static void ldm_manager_resize_types(LdmManager *self, guint n_slots)
+{
+        g_array_set_size(self->types.masks, n_slots);
+        for (guint i = 0; i < LDM_MANAGER_TYPE_BITS; i++) {
+                g_array_set_size(self->types.slots[i], (n_slots + 63) / 64);
+        }
+}
+
+/**
+ * ldm_manager_refresh_types:
+ * @device: Device whose children just changed
+ *
+ * Recompute the types of the top level device owning @device.
+ */
+static void ldm_manager_refresh_types(LdmManager *self, LdmDevice *device)
+{
+        LdmDevice *root = device;
+        guint index = 0;
+
+        while (root->tree.parent) {
+                root = root->tree.parent;
+        }
+        if (!ldm_manager_device_by_sysfs_path(self, root->os.sysfs_path, NULL, &index) ||
+            self->devices->pdata[index] != root) {
+                return;
+        }
+        ldm_manager_set_slot_types(self, index, ldm_device_get_subtree_types(root));
+}
+
+/**
+ * ldm_manager_append_device:
+ * @device: (transfer full): New top level device
+ *
+ * Store @device after every known device and index it by sysfs path.
+ */
+static void ldm_manager_append_device(LdmManager *self, LdmDevice *device)
+{
+        guint index = self->devices->len;
+
+        g_hash_table_insert(self->device_index.positions,
+                            device->os.sysfs_path,
+                            GUINT_TO_POINTER(index));
+        g_ptr_array_add(self->devices, device);
+
+        ldm_manager_resize_types(self, index + 1);
+        ldm_manager_set_slot_types(self, index, ldm_device_get_subtree_types(device));
+}
+
+/**
+ * ldm_manager_compact_devices:
+ *
+ * Close up the holes left by removals, keeping the udev order and updating
+ * the index for every device that moved.
+ */
+static void ldm_manager_compact_devices(LdmManager *self)
+{
+        guint *masks = &g_array_index(self->types.masks, guint, 0);
+        guint n_devices = 0;
+
+        for (guint i = 0; i < self->devices->len; i++) {
+                LdmDevice *node = self->devices->pdata[i];
+
+                if (!node) {
+                        continue;
                 }
-                if (out_index) {
-                        *out_index = i;
+                if (n_devices != i) {
+                        self->devices->pdata[n_devices] = node;
+                        self->devices->pdata[i] = NULL;
+                        masks[n_devices] = masks[i];
+                        g_hash_table_insert(self->device_index.positions,
+                                            node->os.sysfs_path,
+                                            GUINT_TO_POINTER(n_devices));
                 }
-                return TRUE;
+                ++n_devices;
+        }
+
+        g_ptr_array_set_size(self->devices, (gint)n_devices);
+        self->device_index.n_holes = 0;
+
+        /* Redraw the bitmaps from the moved masks */
+        ldm_manager_resize_types(self, n_devices);
+        masks = &g_array_index(self->types.masks, guint, 0);
+        for (guint i = 0; i < LDM_MANAGER_TYPE_BITS; i++) {
+                GArray *slots = self->types.slots[i];
+
+                memset(slots->data, 0, slots->len * sizeof(guint64));
         }
+        for (guint i = 0; i < n_devices; i++) {
+                guint mask = masks[i];
 
-        return FALSE;
+                masks[i] = 0;
+                ldm_manager_set_slot_types(self, i, mask);
+        }
 }
 
 /**
@@ -457,6 +687,7 @@ static void ldm_manager_remove_device(LdmManager *self, udev_device *device)
         parent = ldm_manager_get_device_parent(self, subsystem, device);
         if (parent) {
                 ldm_device_remove_child_by_path(parent, sysfs_path);
+                ldm_manager_refresh_types(self, parent);
                 return;
         }
 
@@ -467,8 +698,16 @@ static void ldm_manager_remove_device(LdmManager *self, udev_device *device)
         /*  Emit signal for the device removal */
         g_signal_emit(self, obj_signals[SIGNAL_DEVICE_REMOVED], 0, node);
 
-        /* Remove from our known devices */
-        g_ptr_array_remove_index(self->devices, index);
+        /* Remove from our known devices, leaving a hole rather than shifting the rest down */
+        g_hash_table_remove(self->device_index.positions, node->os.sysfs_path);
+        ldm_manager_set_slot_types(self, index, 0);
+        self->devices->pdata[index] = NULL;
+        g_object_unref(node);
+
+        /* Compacting once half the slots are holes keeps removal amortised O(1) */
+        if (++self->device_index.n_holes > self->devices->len / 2) {
+                ldm_manager_compact_devices(self);
+        }
 }
 
 /**
@@ -651,7 +890,7 @@ static void ldm_manager_push_device(LdmManager *self, udev_device *device, gbool
         parent = ldm_manager_get_device_parent(self, subsystem, device);
 
         /* Don't push the child interface again to the parent, i.e. monitor vs enumerate */
-        if (parent && g_hash_table_contains(parent->tree.kids, sysfs_path)) {
+        if (parent && ldm_device_get_child_by_path(parent, sysfs_path)) {
                 return;
         }
 
@@ -660,10 +899,11 @@ static void ldm_manager_push_device(LdmManager *self, udev_device *device, gbool
 
         if (parent) {
                 ldm_device_add_child(parent, ldm_device);
+                ldm_manager_refresh_types(self, parent);
                 return;
         }
 
-        g_ptr_array_add(self->devices, g_object_ref_sink(ldm_device));
+        ldm_manager_append_device(self, g_object_ref_sink(ldm_device));
 
         /*  Emit signal for the new device. */
         if (!emit_signal) {
@@ -710,22 +950,150 @@ LdmManager *ldm_manager_new(LdmManagerFlags flags)
 GPtrArray *ldm_manager_get_devices(LdmManager *self, LdmDeviceType class_mask)
 {
         GPtrArray *ret = NULL;
+        LdmDeviceIter iter = { 0 };
+        LdmDevice *node = NULL;
 
         g_return_val_if_fail(self != NULL, NULL);
 
-        ret = g_ptr_array_new_with_free_func(g_object_unref);
+        /* Every device matches the empty mask */
+        if (class_mask == LDM_DEVICE_TYPE_ANY) {
+                ret = g_ptr_array_new_full(self->devices->len - self->device_index.n_holes,
+                                           g_object_unref);
+        } else {
+                ret = g_ptr_array_new_with_free_func(g_object_unref);
+        }
 
-        for (guint i = 0; i < self->devices->len; i++) {
+        ldm_manager_iter_init(&iter, self, class_mask);
+        while (ldm_device_iter_next(&iter, &node)) {
+                g_ptr_array_add(ret, g_object_ref(node));
+        }
+
+        return ret;
+}
+
+/**
+ * ldm_manager_iter_init: (skip)
+ * @iter: Uninitialised iterator, usually on the stack
+ * @class_mask: Bitwise mask of LdmDeviceType
+ *
+ * Prepare @iter to walk the devices #ldm_manager_get_devices would return,
+ * in the same order, advancing it with #ldm_device_iter_next. This neither
+ * allocates nor takes references, so it suits callers that query often,
+ * such as hotplug handlers. The devices must not change while iterating,
+ * so don't hold the iterator across a return to the main loop.
+ *
+ * C example:
+ *
+ * |[<!-- language="C" -->
+ *      LdmDeviceIter iter;
+ *      LdmDevice *device;
+ *
+ *      ldm_manager_iter_init(&iter, manager, LDM_DEVICE_TYPE_GPU);
+ *      while (ldm_device_iter_next(&iter, &device)) {
+ *              g_message("GPU: %s", ldm_device_get_name(device));
+ *      }
+ * ]|
+ */
+void ldm_manager_iter_init(LdmDeviceIter *iter, LdmManager *self, LdmDeviceType class_mask)
+{
+        LdmRealDeviceIter *real = (LdmRealDeviceIter *)iter;
+
+        g_return_if_fail(iter != NULL);
+        g_return_if_fail(self != NULL);
+
+        memset(real, 0, sizeof(*real));
+        real->owner = self;
+        real->mask = class_mask;
+        real->kind = LDM_DEVICE_ITER_MANAGER;
+}
+
+/**
+ * ldm_manager_iter_next:
+ *
+ * Private half of #ldm_device_iter_next for an iterator over the manager.
+ * A typed mask visits only the slots set in every bitmap of its bits.
+ */
+gboolean ldm_manager_iter_next(LdmRealDeviceIter *iter, LdmDevice **device)
+{
+        LdmManager *self = iter->owner;
+        guint n_words = self->types.slots[0]->len;
+        gboolean several = (iter->mask & (iter->mask - 1)) != 0;
+
+        /* Every device matches the empty mask */
+        if (iter->mask == LDM_DEVICE_TYPE_ANY) {
+                while (iter->position < self->devices->len) {
+                        LdmDevice *node = self->devices->pdata[iter->position++];
+
+                        if (node) {
+                                *device = node;
+                                return TRUE;
+                        }
+                }
+                return FALSE;
+        }
+
+        /* No device can have a type we don't know */
+        if ((iter->mask >> LDM_MANAGER_TYPE_BITS) != 0) {
+                return FALSE;
+        }
+
+        for (;;) {
                 LdmDevice *node = NULL;
+                guint index = 0;
 
-                node = self->devices->pdata[i];
-                if (!ldm_device_has_type(node, class_mask)) {
+                /* Intersect the bitmaps of the next word with any candidates */
+                while (iter->candidates == 0) {
+                        if (iter->position >= n_words) {
+                                return FALSE;
+                        }
+                        iter->candidates = G_MAXUINT64;
+                        for (guint i = 0; i < LDM_MANAGER_TYPE_BITS; i++) {
+                                if ((iter->mask & (1u << i)) != 0) {
+                                        iter->candidates &= g_array_index(self->types.slots[i],
+                                                                          guint64,
+                                                                          iter->position);
+                                }
+                        }
+                        ++iter->position;
+                }
+
+                index = (iter->position - 1) * 64 + (guint)__builtin_ctzll(iter->candidates);
+                iter->candidates &= iter->candidates - 1;
+                node = self->devices->pdata[index];
+
+                /* With several bits, a single node of the subtree must have them all */
+                if (several && !ldm_device_has_type(node, iter->mask)) {
                         continue;
                 }
-                g_ptr_array_add(ret, g_object_ref(node));
+
+                *device = node;
+                return TRUE;
         }
+}
 
-        return ret;
+/**
+ * ldm_manager_foreach_device:
+ * @class_mask: Bitwise mask of LdmDeviceType
+ * @func: (scope call): Function to call with each device
+ * @user_data: User data to pass to @func
+ *
+ * Call @func with each device #ldm_manager_get_devices would return, in the
+ * same order, without building an array. @func must not cause devices to be
+ * added or removed.
+ */
+void ldm_manager_foreach_device(LdmManager *self, LdmDeviceType class_mask, LdmDeviceFunc func,
+                                gpointer user_data)
+{
+        LdmDeviceIter iter = { 0 };
+        LdmDevice *node = NULL;
+
+        g_return_if_fail(self != NULL);
+        g_return_if_fail(func != NULL);
+
+        ldm_manager_iter_init(&iter, self, class_mask);
+        while (ldm_device_iter_next(&iter, &node)) {
+                func(node, user_data);
+        }
 }
 
 /*
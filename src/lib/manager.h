@@ -26,6 +26,9 @@ typedef struct _LdmManagerClass LdmManagerClass;
  * @LDM_MANAGER_FLAGS_NONE: No special behaviour required
  * @LDM_MANAGER_FLAGS_NO_MONITOR: Disable hotplug events
  * @LDM_MANAGER_FLAGS_GPU_QUICK: Only allow GPU devices for fast initialisation
+ * @LDM_MANAGER_FLAGS_LAZY_PLUGINS: Only parse `.modaliases` files when a device needs them
+ * @LDM_MANAGER_FLAGS_PARALLEL_PLUGINS: Run thread-safe plugins on a worker pool
+ * @LDM_MANAGER_FLAGS_WATCH_PLUGINS: Reload modalias plugins as their directory changes
  *
  * Override the behaviour of the new LdmManager to allow disabling
  * of hotplug events, etc.
@@ -34,6 +37,9 @@ typedef enum {
         LDM_MANAGER_FLAGS_NONE = 0,
         LDM_MANAGER_FLAGS_NO_MONITOR = 1 << 0,
         LDM_MANAGER_FLAGS_GPU_QUICK = 1 << 1,
+        LDM_MANAGER_FLAGS_LAZY_PLUGINS = 1 << 2,
+        LDM_MANAGER_FLAGS_PARALLEL_PLUGINS = 1 << 3,
+        LDM_MANAGER_FLAGS_WATCH_PLUGINS = 1 << 4,
 } LdmManagerFlags;
 
 #define LDM_TYPE_MANAGER ldm_manager_get_type()
@@ -48,13 +54,23 @@ GType ldm_manager_get_type(void);
 /* Main API */
 LdmManager *ldm_manager_new(LdmManagerFlags flags);
 GPtrArray *ldm_manager_get_devices(LdmManager *manager, LdmDeviceType class_mask);
+void ldm_manager_iter_init(LdmDeviceIter *iter, LdmManager *manager, LdmDeviceType class_mask);
+void ldm_manager_foreach_device(LdmManager *manager, LdmDeviceType class_mask, LdmDeviceFunc func,
+                                gpointer user_data);
 GPtrArray *ldm_manager_get_providers(LdmManager *manager, LdmDevice *device);
+GHashTable *ldm_manager_get_providers_for_devices(LdmManager *manager, GPtrArray *devices);
+void ldm_manager_get_cache_stats(LdmManager *manager, guint64 *hits, guint64 *misses);
+void ldm_manager_get_pattern_stats(LdmManager *manager, guint *n_rules, guint *n_patterns);
 
 /* Plugin API */
 gboolean ldm_manager_add_modalias_plugin_for_path(LdmManager *manager, const gchar *path);
 gboolean ldm_manager_add_modalias_plugins_for_directory(LdmManager *manager,
                                                         const gchar *directory);
+gboolean ldm_manager_add_modalias_plugins_for_table(LdmManager *manager, gconstpointer table,
+                                                    gsize size);
 gboolean ldm_manager_add_system_modalias_plugins(LdmManager *manager);
+gboolean ldm_manager_update_modalias_cache(const gchar *directory);
+gboolean ldm_manager_update_system_modalias_cache(void);
 void ldm_manager_add_plugin(LdmManager *manager, LdmPlugin *plugin);
 
 G_DEFINE_AUTOPTR_CLEANUP_FUNC(LdmManager, g_object_unref)
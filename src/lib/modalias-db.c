@@ -0,0 +1,926 @@
+/*
+ * This file is part of linux-driver-management.
+ *
+ * Copyright © 2016-2018 Ikey Doherty
+ *
+ * linux-driver-management is free software; you can redistribute it and/or
+ * modify it under the terms of the GNU Lesser General Public License as
+ * published by the Free Software Foundation; either version 2.1
+ * of the License, or (at your option) any later version.
+ */
+
+#define _GNU_SOURCE
+
+#include <errno.h>
+#include <fnmatch.h>
+#include <stdio.h>
+#include <stdlib.h>
+#include <string.h>
+#include <sys/stat.h>
+
+#include "modalias-db.h"
+#include "modalias-file.h"
+
+struct _LdmModaliasDb {
+        gint ref_count;
+        GMappedFile *file; /* NULL for a table compiled into the program */
+
+        const LdmModaliasDbHeader *header;
+        const LdmModaliasDbSource *sources;
+        const LdmModaliasDbRule *rules;
+        const LdmModaliasDbKey *typed;
+        const guint32 *irregular;
+        const gchar *strings;
+
+        GHashTable *names; /* Source name to index, keys owned by the mapping, NULL if static */
+};
+
+/*
+ * Writer state while assembling a database
+ */
+typedef struct LdmModaliasDbWriter {
+        GByteArray *strings;
+        GHashTable *interned; /* String to offset in strings */
+        GArray *sources;      /* LdmModaliasDbSource */
+        GArray *rules;        /* LdmModaliasDbRule */
+        GArray *typed;        /* LdmModaliasDbKey */
+        GArray *irregular;    /* guint32 */
+} LdmModaliasDbWriter;
+
+static guint32 ldm_modalias_db_writer_intern(LdmModaliasDbWriter *writer, const gchar *str)
+{
+        gpointer v = NULL;
+        guint32 offset = 0;
+
+        if (g_hash_table_lookup_extended(writer->interned, str, NULL, &v)) {
+                return GPOINTER_TO_UINT(v);
+        }
+
+        offset = writer->strings->len;
+        g_byte_array_append(writer->strings, (const guint8 *)str, (guint)strlen(str) + 1);
+        g_hash_table_insert(writer->interned, g_strdup(str), GUINT_TO_POINTER(offset));
+
+        return offset;
+}
+
+static gint ldm_modalias_db_key_compare(gconstpointer a, gconstpointer b)
+{
+        const LdmModaliasDbKey *ka = a;
+        const LdmModaliasDbKey *kb = b;
+
+        if (ka->key != kb->key) {
+                return ka->key < kb->key ? -1 : 1;
+        }
+        return (gint)ka->rule - (gint)kb->rule;
+}
+
+typedef struct LdmModaliasDbFileState {
+        LdmModaliasDbWriter *writer;
+        LdmModaliasDbSource *source;
+        GHashTable *seen;
+        GString *buffer; /* Reused for the columns of each rule */
+} LdmModaliasDbFileState;
+
+/**
+ * ldm_modalias_db_compile:
+ * @rules: Storage for at least LDM_MODALIAS_EXPAND_MAX rules
+ *
+ * Compile the pattern into one or more rules. A pattern merging runs of IDs
+ * into bracket expressions becomes one rule for each alternative, so they
+ * can all use the typed table. Anything else is a single, possibly
+ * irregular, rule.
+ *
+ * Returns: The number of rules stored
+ */
+static guint ldm_modalias_db_compile(const gchar *pattern, LdmModaliasRule *rules)
+{
+        g_autoptr(GPtrArray) expanded = NULL;
+
+        expanded = ldm_modalias_pattern_expand(pattern);
+        if (expanded) {
+                guint i = 0;
+
+                for (i = 0; i < expanded->len; i++) {
+                        if (!ldm_modalias_rule_compile(expanded->pdata[i], &rules[i])) {
+                                break;
+                        }
+                }
+                if (i == expanded->len) {
+                        return expanded->len;
+                }
+        }
+
+        ldm_modalias_rule_compile(pattern, &rules[0]);
+        return 1;
+}
+
+static gboolean ldm_modalias_db_writer_add_line(const gchar *line, gsize len, gpointer v)
+{
+        LdmModaliasDbFileState *state = v;
+        LdmModaliasDbWriter *writer = state->writer;
+        LdmModaliasSpan columns[4] = { 0 };
+        const gchar *splits[4] = { 0 };
+        LdmModaliasRule compiled[LDM_MODALIAS_EXPAND_MAX];
+        LdmModaliasDbRule rule = { 0 };
+        gpointer index = NULL;
+        gboolean replace = FALSE;
+        guint n_compiled = 0;
+
+        if (!ldm_modalias_file_split_line(line, len, columns)) {
+                return TRUE;
+        }
+        if (!ldm_modalias_span_equal(&columns[0], "alias")) {
+                g_warning("unknown directive '%.*s'", (int)columns[0].len, columns[0].str);
+                return TRUE;
+        }
+        ldm_modalias_span_copy(columns, G_N_ELEMENTS(columns), state->buffer, splits);
+
+        rule.match = ldm_modalias_db_writer_intern(writer, splits[1]);
+        rule.driver = ldm_modalias_db_writer_intern(writer, splits[2]);
+        rule.package = ldm_modalias_db_writer_intern(writer, splits[3]);
+        n_compiled = ldm_modalias_db_compile(splits[1], compiled);
+
+        /* Replacement keeps the original position, and expands identically */
+        replace = g_hash_table_lookup_extended(state->seen, splits[1], NULL, &index);
+        if (!replace) {
+                index = GUINT_TO_POINTER(state->source->n_rules);
+                g_hash_table_insert(state->seen, g_strdup(splits[1]), index);
+                g_array_set_size(writer->rules, writer->rules->len + n_compiled);
+                state->source->n_rules += n_compiled;
+        }
+
+        for (guint i = 0; i < n_compiled; i++) {
+                rule.bus = compiled[i].bus;
+                rule.mask = compiled[i].mask;
+                memcpy(rule.values, compiled[i].values, sizeof(rule.values));
+                g_array_index(writer->rules,
+                              LdmModaliasDbRule,
+                              state->source->rules_begin + GPOINTER_TO_UINT(index) + i) = rule;
+        }
+
+        return TRUE;
+}
+
+/**
+ * ldm_modalias_db_writer_add_file:
+ *
+ * Parse a single `.modaliases` file, which may be compressed, with the same
+ * semantics as #ldm_modalias_plugin_new_from_filename: a repeated match keeps
+ * its original position, but takes the driver and package of the later line.
+ */
+static gboolean ldm_modalias_db_writer_add_file(LdmModaliasDbWriter *writer, const gchar *path)
+{
+        g_autofree gchar *name = NULL;
+        g_autoptr(GHashTable) seen = NULL;
+        g_autoptr(GString) buffer = NULL;
+        g_autoptr(GArray) keys = NULL;
+        LdmModaliasDbSource source = { 0 };
+        LdmModaliasDbFileState state = { 0 };
+        struct stat st = { 0 };
+
+        if (stat(path, &st) != 0) {
+                fprintf(stderr, "Failed to read %s: %s\n", path, strerror(errno));
+                return FALSE;
+        }
+
+        name = g_path_get_basename(path);
+        source.name = ldm_modalias_db_writer_intern(writer, name);
+        source.rules_begin = writer->rules->len;
+        source.typed_begin = writer->typed->len;
+        source.irregular_begin = writer->irregular->len;
+        source.size = (guint64)st.st_size;
+        source.mtime = (gint64)st.st_mtim.tv_sec;
+        source.mtime_nsec = (guint32)st.st_mtim.tv_nsec;
+        source.inode = (guint64)st.st_ino;
+
+        seen = g_hash_table_new_full(g_str_hash, g_str_equal, g_free, NULL);
+        buffer = g_string_sized_new(128);
+        state.writer = writer;
+        state.source = &source;
+        state.seen = seen;
+        state.buffer = buffer;
+
+        if (!ldm_modalias_file_foreach_line(path, ldm_modalias_db_writer_add_line, &state)) {
+                return FALSE;
+        }
+
+        /* Prebuild the index for this source */
+        keys = g_array_new(FALSE, FALSE, sizeof(LdmModaliasDbKey));
+        for (guint32 i = 0; i < source.n_rules; i++) {
+                LdmModaliasDbRule *rule =
+                    &g_array_index(writer->rules, LdmModaliasDbRule, source.rules_begin + i);
+                LdmModaliasRule compiled = { .bus = (LdmModaliasBus)rule->bus, .mask = rule->mask };
+                LdmModaliasDbKey key = { .rule = i };
+
+                if (rule->bus == LDM_MODALIAS_BUS_NONE) {
+                        g_array_append_val(writer->irregular, i);
+                        continue;
+                }
+
+                memcpy(compiled.values, rule->values, sizeof(compiled.values));
+                key.key = ldm_modalias_key(compiled.bus,
+                                           compiled.values,
+                                           ldm_modalias_rule_key_level(&compiled));
+                g_array_append_val(keys, key);
+        }
+        g_array_sort(keys, ldm_modalias_db_key_compare);
+        g_array_append_vals(writer->typed, keys->data, keys->len);
+
+        source.n_typed = writer->typed->len - source.typed_begin;
+        source.n_irregular = writer->irregular->len - source.irregular_begin;
+        g_array_append_val(writer->sources, source);
+
+        return TRUE;
+}
+
+static guint64 ldm_modalias_db_append_section(GByteArray *out, const void *data, gsize len)
+{
+        static const guint8 zeroes[8] = { 0 };
+        guint64 offset = 0;
+
+        /* Keep every table 8-byte aligned for direct access from the mapping */
+        if (out->len % 8 != 0) {
+                g_byte_array_append(out, zeroes, 8 - (out->len % 8));
+        }
+        offset = out->len;
+        if (len > 0) {
+                g_byte_array_append(out, data, (guint)len);
+        }
+
+        return offset;
+}
+
+/**
+ * ldm_modalias_db_writer_add_cached:
+ * @db: Previous database
+ * @index: Index of a still current source within @db
+ *
+ * Carry a source over from the previous database without reading its text
+ * file. Only the string offsets change; the typed and irregular tables are
+ * relative to the source's rules, so they're copied as they are.
+ */
+static void ldm_modalias_db_writer_add_cached(LdmModaliasDbWriter *writer, LdmModaliasDb *db,
+                                              guint index)
+{
+        const LdmModaliasDbSource *cached = &db->sources[index];
+        LdmModaliasDbSource source = *cached;
+
+        source.name = ldm_modalias_db_writer_intern(writer, db->strings + cached->name);
+        source.rules_begin = writer->rules->len;
+        source.typed_begin = writer->typed->len;
+        source.irregular_begin = writer->irregular->len;
+
+        for (guint32 i = 0; i < cached->n_rules; i++) {
+                LdmModaliasDbRule rule = db->rules[cached->rules_begin + i];
+
+                rule.match = ldm_modalias_db_writer_intern(writer, db->strings + rule.match);
+                rule.driver = ldm_modalias_db_writer_intern(writer, db->strings + rule.driver);
+                rule.package =
+                    ldm_modalias_db_writer_intern(writer, db->strings + rule.package);
+                g_array_append_val(writer->rules, rule);
+        }
+
+        g_array_append_vals(writer->typed, &db->typed[cached->typed_begin], cached->n_typed);
+        g_array_append_vals(writer->irregular,
+                            &db->irregular[cached->irregular_begin],
+                            cached->n_irregular);
+        g_array_append_val(writer->sources, source);
+}
+
+static void ldm_modalias_db_writer_init(LdmModaliasDbWriter *writer)
+{
+        writer->strings = g_byte_array_new();
+        writer->interned = g_hash_table_new_full(g_str_hash, g_str_equal, g_free, NULL);
+        writer->sources = g_array_new(FALSE, FALSE, sizeof(LdmModaliasDbSource));
+        writer->rules = g_array_new(FALSE, FALSE, sizeof(LdmModaliasDbRule));
+        writer->typed = g_array_new(FALSE, FALSE, sizeof(LdmModaliasDbKey));
+        writer->irregular = g_array_new(FALSE, FALSE, sizeof(guint32));
+
+        /* Offset 0 is always the empty string */
+        ldm_modalias_db_writer_intern(writer, "");
+}
+
+static void ldm_modalias_db_writer_clear(LdmModaliasDbWriter *writer)
+{
+        g_byte_array_unref(writer->strings);
+        g_hash_table_unref(writer->interned);
+        g_array_unref(writer->sources);
+        g_array_unref(writer->rules);
+        g_array_unref(writer->typed);
+        g_array_unref(writer->irregular);
+}
+
+/**
+ * ldm_modalias_db_writer_serialize:
+ *
+ * Returns: (transfer full): The database image
+ */
+static GByteArray *ldm_modalias_db_writer_serialize(LdmModaliasDbWriter *writer)
+{
+        LdmModaliasDbHeader header = { 0 };
+        GByteArray *out = NULL;
+
+        memcpy(header.magic, LDM_MODALIAS_DB_MAGIC, sizeof(header.magic));
+        header.version = LDM_MODALIAS_DB_VERSION;
+        header.n_sources = writer->sources->len;
+        header.n_rules = writer->rules->len;
+        header.n_typed = writer->typed->len;
+        header.n_irregular = writer->irregular->len;
+        header.strings_size = writer->strings->len;
+
+        out = g_byte_array_new();
+        g_byte_array_append(out, (const guint8 *)&header, sizeof(header));
+        header.sources_offset =
+            ldm_modalias_db_append_section(out,
+                                           writer->sources->data,
+                                           writer->sources->len * sizeof(LdmModaliasDbSource));
+        header.rules_offset =
+            ldm_modalias_db_append_section(out,
+                                           writer->rules->data,
+                                           writer->rules->len * sizeof(LdmModaliasDbRule));
+        header.typed_offset =
+            ldm_modalias_db_append_section(out,
+                                           writer->typed->data,
+                                           writer->typed->len * sizeof(LdmModaliasDbKey));
+        header.irregular_offset =
+            ldm_modalias_db_append_section(out,
+                                           writer->irregular->data,
+                                           writer->irregular->len * sizeof(guint32));
+        header.strings_offset =
+            ldm_modalias_db_append_section(out, writer->strings->data, writer->strings->len);
+
+        /* Now the offsets are known */
+        memcpy(out->data, &header, sizeof(header));
+
+        return out;
+}
+
+/**
+ * ldm_modalias_db_build:
+ * @directory: Directory containing `*.modaliases` files
+ * @output: Path for the new database
+ * @previous: (nullable): Database whose current sources may be reused
+ * @n_reused: (out) (optional): Number of sources taken from @previous
+ * @n_parsed: (out) (optional): Number of sources parsed from text
+ *
+ * Compile the directory into @output, taking every source that @previous
+ * still describes accurately from it instead of parsing the file again.
+ */
+static gboolean ldm_modalias_db_build(const gchar *directory, const gchar *output,
+                                      LdmModaliasDb *previous, guint *n_reused, guint *n_parsed)
+{
+        g_autoptr(GPtrArray) paths = NULL;
+        g_autoptr(GByteArray) out = NULL;
+        g_autoptr(GError) error = NULL;
+        LdmModaliasDbWriter writer = { 0 };
+        guint reused = 0;
+        guint parsed = 0;
+        gboolean ret = FALSE;
+
+        ldm_modalias_db_writer_init(&writer);
+
+        paths = ldm_modalias_file_glob(directory);
+        for (guint i = 0; i < paths->len; i++) {
+                const gchar *path = paths->pdata[i];
+                gint index = -1;
+
+                if (previous) {
+                        index = ldm_modalias_db_lookup_source(previous, path);
+                }
+                if (index >= 0) {
+                        ldm_modalias_db_writer_add_cached(&writer, previous, (guint)index);
+                        ++reused;
+                        continue;
+                }
+
+                if (!ldm_modalias_db_writer_add_file(&writer, path)) {
+                        goto cleanup;
+                }
+                ++parsed;
+        }
+
+        out = ldm_modalias_db_writer_serialize(&writer);
+
+        /* Readers holding the previous mapping keep using it until they reopen */
+        if (!g_file_set_contents(output, (const gchar *)out->data, out->len, &error)) {
+                fprintf(stderr, "Failed to write %s: %s\n", output, error->message);
+                goto cleanup;
+        }
+
+        if (n_reused) {
+                *n_reused = reused;
+        }
+        if (n_parsed) {
+                *n_parsed = parsed;
+        }
+        ret = TRUE;
+
+cleanup:
+        ldm_modalias_db_writer_clear(&writer);
+
+        return ret;
+}
+
+/**
+ * ldm_modalias_db_update:
+ * @directory: Directory containing `*.modaliases` files
+ * @output: Path of the database, which need not exist yet
+ * @n_reused: (out) (optional): Number of files taken from the existing database
+ * @n_parsed: (out) (optional): Number of files parsed from text
+ *
+ * Compile every `.modaliases` file in the directory, in the same order as
+ * #ldm_manager_add_modalias_plugins_for_directory, into a single database.
+ * If @output already holds a database, only files that were added or changed
+ * since it was written are parsed, the others are copied from it, and removed
+ * files are dropped. The output is replaced atomically.
+ *
+ * Returns: TRUE if the database was written
+ */
+gboolean ldm_modalias_db_update(const gchar *directory, const gchar *output, guint *n_reused,
+                                guint *n_parsed)
+{
+        autofree(LdmModaliasDb) *previous = NULL;
+
+        g_return_val_if_fail(directory != NULL, FALSE);
+        g_return_val_if_fail(output != NULL, FALSE);
+
+        /* Missing or from an older version means starting from scratch */
+        previous = ldm_modalias_db_open(output);
+
+        return ldm_modalias_db_build(directory, output, previous, n_reused, n_parsed);
+}
+
+/**
+ * ldm_modalias_db_compile_files:
+ * @paths: `.modaliases` files, which may be compressed, in priority order
+ *
+ * Compile the files into a database image to be embedded in a program and
+ * opened with #ldm_modalias_db_new_static, as `mkmodaliases --emit-c` does.
+ * The size, mtime and inode of the files are recorded, but never checked for
+ * a static database.
+ *
+ * Returns: (transfer full) (nullable): The database image, or NULL if a file
+ * couldn't be read
+ */
+GByteArray *ldm_modalias_db_compile_files(gchar **paths, guint n_paths)
+{
+        LdmModaliasDbWriter writer = { 0 };
+        GByteArray *ret = NULL;
+
+        g_return_val_if_fail(paths != NULL || n_paths == 0, NULL);
+
+        ldm_modalias_db_writer_init(&writer);
+
+        for (guint i = 0; i < n_paths; i++) {
+                if (!ldm_modalias_db_writer_add_file(&writer, paths[i])) {
+                        goto cleanup;
+                }
+        }
+
+        ret = ldm_modalias_db_writer_serialize(&writer);
+
+cleanup:
+        ldm_modalias_db_writer_clear(&writer);
+
+        return ret;
+}
+
+/**
+ * ldm_modalias_db_section_valid:
+ *
+ * Ensure the table lies entirely within the mapping.
+ */
+static gboolean ldm_modalias_db_section_valid(gsize len, guint64 offset, guint64 count,
+                                              gsize size)
+{
+        if (offset % 8 != 0 || offset > len) {
+                return FALSE;
+        }
+        return count <= (len - offset) / size;
+}
+
+static gboolean ldm_modalias_db_validate(LdmModaliasDb *self, gsize len)
+{
+        const LdmModaliasDbHeader *header = self->header;
+
+        if (!ldm_modalias_db_section_valid(len,
+                                           header->sources_offset,
+                                           header->n_sources,
+                                           sizeof(LdmModaliasDbSource)) ||
+            !ldm_modalias_db_section_valid(len,
+                                           header->rules_offset,
+                                           header->n_rules,
+                                           sizeof(LdmModaliasDbRule)) ||
+            !ldm_modalias_db_section_valid(len,
+                                           header->typed_offset,
+                                           header->n_typed,
+                                           sizeof(LdmModaliasDbKey)) ||
+            !ldm_modalias_db_section_valid(len,
+                                           header->irregular_offset,
+                                           header->n_irregular,
+                                           sizeof(guint32)) ||
+            !ldm_modalias_db_section_valid(len, header->strings_offset, header->strings_size, 1)) {
+                return FALSE;
+        }
+
+        if (header->strings_size < 1 || self->strings[header->strings_size - 1] != '\0') {
+                return FALSE;
+        }
+
+        /* Every range and reference has to be sane, so lookups can trust them */
+        for (guint32 i = 0; i < header->n_sources; i++) {
+                const LdmModaliasDbSource *source = &self->sources[i];
+
+                if (source->name >= header->strings_size ||
+                    source->rules_begin > header->n_rules ||
+                    source->n_rules > header->n_rules - source->rules_begin ||
+                    source->typed_begin > header->n_typed ||
+                    source->n_typed > header->n_typed - source->typed_begin ||
+                    source->irregular_begin > header->n_irregular ||
+                    source->n_irregular > header->n_irregular - source->irregular_begin) {
+                        return FALSE;
+                }
+                for (guint32 j = 0; j < source->n_typed; j++) {
+                        if (self->typed[source->typed_begin + j].rule >= source->n_rules) {
+                                return FALSE;
+                        }
+                }
+                for (guint32 j = 0; j < source->n_irregular; j++) {
+                        if (self->irregular[source->irregular_begin + j] >= source->n_rules) {
+                                return FALSE;
+                        }
+                }
+        }
+
+        for (guint32 i = 0; i < header->n_rules; i++) {
+                const LdmModaliasDbRule *rule = &self->rules[i];
+
+                if (rule->match >= header->strings_size || rule->driver >= header->strings_size ||
+                    rule->package >= header->strings_size) {
+                        return FALSE;
+                }
+                if (rule->bus != LDM_MODALIAS_BUS_NONE && rule->bus != LDM_MODALIAS_BUS_PCI &&
+                    rule->bus != LDM_MODALIAS_BUS_USB && rule->bus != LDM_MODALIAS_BUS_HID) {
+                        return FALSE;
+                }
+        }
+
+        return TRUE;
+}
+
+/**
+ * ldm_modalias_db_new_for_data:
+ * @data: Database image, 8-byte aligned
+ * @file: (transfer full) (nullable): Mapping holding @data
+ * @what: Description of the database for messages
+ *
+ * Returns: (transfer full) (nullable): The database, or NULL if it is invalid
+ */
+static LdmModaliasDb *ldm_modalias_db_new_for_data(const gchar *data, gsize len,
+                                                   GMappedFile *file, const gchar *what)
+{
+        LdmModaliasDb *self = NULL;
+
+        if (len < sizeof(LdmModaliasDbHeader) ||
+            memcmp(data, LDM_MODALIAS_DB_MAGIC, sizeof(((LdmModaliasDbHeader *)0)->magic)) != 0) {
+                g_warning("Not a modalias database: %s", what);
+                if (file) {
+                        g_mapped_file_unref(file);
+                }
+                return NULL;
+        }
+
+        self = g_new0(LdmModaliasDb, 1);
+        self->ref_count = 1;
+        self->file = file;
+        self->header = (const LdmModaliasDbHeader *)data;
+
+        if (self->header->version != LDM_MODALIAS_DB_VERSION) {
+                g_debug("Ignoring modalias database with version %u: %s",
+                        self->header->version,
+                        what);
+                ldm_modalias_db_unref(self);
+                return NULL;
+        }
+
+        self->sources = (const LdmModaliasDbSource *)(data + self->header->sources_offset);
+        self->rules = (const LdmModaliasDbRule *)(data + self->header->rules_offset);
+        self->typed = (const LdmModaliasDbKey *)(data + self->header->typed_offset);
+        self->irregular = (const guint32 *)(data + self->header->irregular_offset);
+        self->strings = data + self->header->strings_offset;
+
+        if (!ldm_modalias_db_validate(self, len)) {
+                g_warning("Corrupt modalias database: %s", what);
+                ldm_modalias_db_unref(self);
+                return NULL;
+        }
+
+        return self;
+}
+
+/**
+ * ldm_modalias_db_open:
+ * @path: Path to a database written by #ldm_modalias_db_update
+ *
+ * Map the database into memory. Nothing is parsed or copied, the tables are
+ * used directly from the mapping.
+ *
+ * Returns: (transfer full) (nullable): The database, or NULL if it is missing or invalid
+ */
+LdmModaliasDb *ldm_modalias_db_open(const gchar *path)
+{
+        g_autoptr(GError) error = NULL;
+        LdmModaliasDb *self = NULL;
+        GMappedFile *file = NULL;
+
+        g_return_val_if_fail(path != NULL, NULL);
+
+        file = g_mapped_file_new(path, FALSE, &error);
+        if (!file) {
+                return NULL;
+        }
+
+        self = ldm_modalias_db_new_for_data(g_mapped_file_get_contents(file),
+                                            g_mapped_file_get_length(file),
+                                            file,
+                                            path);
+        if (!self) {
+                return NULL;
+        }
+
+        self->names = g_hash_table_new(g_str_hash, g_str_equal);
+        for (guint32 i = 0; i < self->header->n_sources; i++) {
+                g_hash_table_insert(self->names,
+                                    (gpointer)(self->strings + self->sources[i].name),
+                                    GUINT_TO_POINTER(i));
+        }
+
+        return self;
+}
+
+/**
+ * ldm_modalias_db_new_static:
+ * @data: Database image from #ldm_modalias_db_compile_files, 8-byte aligned
+ * @len: Size of @data in bytes
+ *
+ * Use a database compiled into the program, which must outlive it. Like a
+ * mapped database, the tables are used in place. There are no files to
+ * compare against, so no source is ever found stale.
+ *
+ * Returns: (transfer full) (nullable): The database, or NULL if @data isn't a
+ * valid database for this version of the library
+ */
+LdmModaliasDb *ldm_modalias_db_new_static(gconstpointer data, gsize len)
+{
+        g_return_val_if_fail(data != NULL, NULL);
+        g_return_val_if_fail(((guintptr)data % 8) == 0, NULL);
+
+        return ldm_modalias_db_new_for_data(data, len, NULL, "compiled-in table");
+}
+
+/**
+ * ldm_modalias_db_ref:
+ *
+ * Returns: (transfer full): A new reference to the database
+ */
+LdmModaliasDb *ldm_modalias_db_ref(LdmModaliasDb *self)
+{
+        g_return_val_if_fail(self != NULL, NULL);
+        g_atomic_int_inc(&self->ref_count);
+        return self;
+}
+
+/**
+ * ldm_modalias_db_unref:
+ *
+ * Drop a reference to the database, unmapping it when the last one is gone.
+ */
+void ldm_modalias_db_unref(LdmModaliasDb *self)
+{
+        if (!self) {
+                return;
+        }
+        if (!g_atomic_int_dec_and_test(&self->ref_count)) {
+                return;
+        }
+        g_clear_pointer(&self->names, g_hash_table_unref);
+        g_clear_pointer(&self->file, g_mapped_file_unref);
+        g_free(self);
+}
+
+/**
+ * ldm_modalias_db_lookup_source:
+ * @path: Path of a `.modaliases` file alongside the database
+ *
+ * Find the source recorded for the file, provided the file still has the
+ * size, mtime and inode it had when the database was written. Files whose
+ * record is missing or stale must be parsed from text instead.
+ *
+ * Returns: Index of the source, or -1 if the database can't be used for @path
+ */
+gint ldm_modalias_db_lookup_source(LdmModaliasDb *self, const gchar *path)
+{
+        g_autofree gchar *name = NULL;
+        const LdmModaliasDbSource *source = NULL;
+        struct stat st = { 0 };
+        gpointer v = NULL;
+
+        g_return_val_if_fail(self != NULL, -1);
+        g_return_val_if_fail(path != NULL, -1);
+
+        /* Compiled-in tables have no files behind them */
+        if (!self->names) {
+                return -1;
+        }
+
+        name = g_path_get_basename(path);
+        if (!g_hash_table_lookup_extended(self->names, name, NULL, &v)) {
+                return -1;
+        }
+        if (stat(path, &st) != 0) {
+                return -1;
+        }
+
+        source = &self->sources[GPOINTER_TO_UINT(v)];
+        if ((guint64)st.st_size != source->size || (gint64)st.st_mtim.tv_sec != source->mtime ||
+            (guint32)st.st_mtim.tv_nsec != source->mtime_nsec ||
+            (guint64)st.st_ino != source->inode) {
+                return -1;
+        }
+
+        return (gint)GPOINTER_TO_UINT(v);
+}
+
+/**
+ * ldm_modalias_db_get_n_sources:
+ *
+ * Returns: The number of `.modaliases` files in the database
+ */
+guint ldm_modalias_db_get_n_sources(LdmModaliasDb *self)
+{
+        g_return_val_if_fail(self != NULL, 0);
+        return self->header->n_sources;
+}
+
+/**
+ * ldm_modalias_db_get_source_name:
+ * @source: Index of the source file
+ *
+ * Returns: (transfer none): The basename of the source file
+ */
+const gchar *ldm_modalias_db_get_source_name(LdmModaliasDb *self, guint source)
+{
+        g_return_val_if_fail(self != NULL, NULL);
+        g_return_val_if_fail(source < self->header->n_sources, NULL);
+        return self->strings + self->sources[source].name;
+}
+
+/**
+ * ldm_modalias_db_get_n_rules:
+ * @source: Index of the source file
+ *
+ * Returns: The number of rules for the source file
+ */
+guint ldm_modalias_db_get_n_rules(LdmModaliasDb *self, guint source)
+{
+        g_return_val_if_fail(self != NULL, 0);
+        g_return_val_if_fail(source < self->header->n_sources, 0);
+        return self->sources[source].n_rules;
+}
+
+/**
+ * ldm_modalias_db_get_package:
+ * @source: Index of the source file
+ * @rule: Index of the rule within the source, as returned by #ldm_modalias_db_match
+ *
+ * Returns: (transfer none): The package providing the driver for the rule
+ */
+const gchar *ldm_modalias_db_get_package(LdmModaliasDb *self, guint source, guint rule)
+{
+        const LdmModaliasDbSource *src = NULL;
+
+        g_return_val_if_fail(self != NULL, NULL);
+        g_return_val_if_fail(source < self->header->n_sources, NULL);
+
+        src = &self->sources[source];
+        g_return_val_if_fail(rule < src->n_rules, NULL);
+
+        return self->strings + self->rules[src->rules_begin + rule].package;
+}
+
+static inline gboolean ldm_modalias_db_rule_matches(const LdmModaliasDbRule *rule,
+                                                    const LdmModaliasFields *fields)
+{
+        if (rule->bus != (guint32)fields->bus) {
+                return FALSE;
+        }
+        for (guint i = 0; i < LDM_MODALIAS_MAX_IDS; i++) {
+                if ((rule->mask & (1U << i)) && rule->values[i] != fields->ids[i]) {
+                        return FALSE;
+                }
+        }
+        return TRUE;
+}
+
+/**
+ * ldm_modalias_db_match:
+ * @source: Index of the source file
+ * @subject: Device modalias
+ * @fields: @subject decoded by #ldm_modalias_fields_decode
+ * @best: (inout): Lowest matching rule index so far, G_MAXUINT if none
+ *
+ * Find the first rule of the source that matches the subject. Only rules
+ * before @best are considered, allowing the caller to accumulate the best
+ * match over several modaliases (i.e. those of a device's interfaces).
+ *
+ * Returns: TRUE if @best was updated
+ */
+gboolean ldm_modalias_db_match(LdmModaliasDb *self, guint source, const gchar *subject,
+                               const LdmModaliasFields *fields, guint *best)
+{
+        const LdmModaliasDbSource *src = NULL;
+        const LdmModaliasDbRule *rules = NULL;
+        gboolean ret = FALSE;
+
+        g_return_val_if_fail(self != NULL, FALSE);
+        g_return_val_if_fail(source < self->header->n_sources, FALSE);
+        g_return_val_if_fail(subject != NULL, FALSE);
+
+        src = &self->sources[source];
+        rules = &self->rules[src->rules_begin];
+
+        if (ldm_modalias_fields_has_ids(fields)) {
+                const LdmModaliasDbKey *keys = &self->typed[src->typed_begin];
+
+                for (guint level = 0; level < LDM_MODALIAS_KEY_LEVELS; level++) {
+                        guint64 key = ldm_modalias_key(fields->bus, fields->ids, level);
+                        guint lo = 0;
+                        guint hi = src->n_typed;
+
+                        /* Lower bound of the key within our sorted range */
+                        while (lo < hi) {
+                                guint mid = lo + (hi - lo) / 2;
+                                if (keys[mid].key < key) {
+                                        lo = mid + 1;
+                                } else {
+                                        hi = mid;
+                                }
+                        }
+
+                        /* Equal keys are sorted by rule, so the first hit is the best */
+                        for (guint i = lo; i < src->n_typed && keys[i].key == key; i++) {
+                                guint rule = keys[i].rule;
+
+                                if (rule >= *best) {
+                                        break;
+                                }
+                                if (ldm_modalias_db_rule_matches(&rules[rule], fields)) {
+                                        *best = rule;
+                                        ret = TRUE;
+                                        break;
+                                }
+                        }
+                }
+        } else if (ldm_modalias_bus_for_prefix(subject) != LDM_MODALIAS_BUS_NONE) {
+                /* Known bus, but we couldn't decode it, so fnmatch the lot */
+                for (guint rule = 0; rule < src->n_rules && rule < *best; rule++) {
+                        if (rules[rule].bus == LDM_MODALIAS_BUS_NONE) {
+                                continue;
+                        }
+                        if (fnmatch(self->strings + rules[rule].match, subject, 0) == 0) {
+                                *best = rule;
+                                ret = TRUE;
+                                break;
+                        }
+                }
+        }
+
+        /* Irregular patterns are stored in rule order as well */
+        for (guint i = 0; i < src->n_irregular; i++) {
+                guint rule = self->irregular[src->irregular_begin + i];
+
+                if (rule >= *best) {
+                        break;
+                }
+                if (fnmatch(self->strings + rules[rule].match, subject, 0) == 0) {
+                        *best = rule;
+                        ret = TRUE;
+                        break;
+                }
+        }
+
+        return ret;
+}
+
+/*
+ * Editor modelines  -  https://www.wireshark.org/tools/modelines.html
+ *
+ * Local variables:
+ * c-basic-offset: 8
+ * tab-width: 8
+ * indent-tabs-mode: nil
+ * End:
+ *
+ * vi: set shiftwidth=8 tabstop=8 expandtab:
+ * :indentSize=8:tabSize=8:noTabs=true:
+ */
@@ -0,0 +1,125 @@
+/*
+ * This file is part of linux-driver-management.
+ *
+ * Copyright © 2016-2018 Ikey Doherty
+ *
+ * linux-driver-management is free software; you can redistribute it and/or
+ * modify it under the terms of the GNU Lesser General Public License as
+ * published by the Free Software Foundation; either version 2.1
+ * of the License, or (at your option) any later version.
+ */
+
+#pragma once
+
+#include <glib.h>
+
+#include "modalias-fields.h"
+#include "util.h"
+
+/*
+ * LdmModaliasDb
+ *
+ * Precompiled, memory mappable form of a directory of `.modaliases` files, as
+ * emitted by `mkmodaliases --database` or `linux-driver-management update-cache`.
+ * The text files remain the source of truth: the database records the name,
+ * size, mtime and inode of every file it was built from, and each file whose
+ * record no longer agrees is parsed from text instead. Recording the inode
+ * catches a package upgrade that replaces a file keeping its size and mtime.
+ *
+ * The on-disk layout is a fixed header followed by 8-byte aligned tables:
+ *
+ *      sources:   One LdmModaliasDbSource per file, in glob (priority) order
+ *      rules:     LdmModaliasDbRule, grouped by source, in match order
+ *      typed:     LdmModaliasDbKey for compiled rules, per source sorted by key
+ *      irregular: Rule indices for patterns needing fnmatch, per source
+ *      strings:   Interned NUL terminated strings
+ *
+ * All integers are in host byte order, as the database is built and used on
+ * the same machine. Images compiled into a program by `mkmodaliases --emit-c`
+ * must likewise be generated on a host of the same byte order as the target.
+ */
+
+#define LDM_MODALIAS_DB_NAME "modaliases.db"
+#define LDM_MODALIAS_DB_MAGIC "LDMALIAS"
+#define LDM_MODALIAS_DB_VERSION 2
+
+typedef struct LdmModaliasDbHeader {
+        gchar magic[8];
+        guint32 version;
+        guint32 n_sources;
+        guint32 n_rules;
+        guint32 n_typed;
+        guint32 n_irregular;
+        guint32 strings_size;
+        guint64 sources_offset;
+        guint64 rules_offset;
+        guint64 typed_offset;
+        guint64 irregular_offset;
+        guint64 strings_offset;
+} LdmModaliasDbHeader;
+
+typedef struct LdmModaliasDbSource {
+        guint32 name; /* Basename of the source file, relative to the database */
+        guint32 rules_begin;
+        guint32 n_rules;
+        guint32 typed_begin;
+        guint32 n_typed;
+        guint32 irregular_begin;
+        guint32 n_irregular;
+        guint32 mtime_nsec;
+        guint64 size;
+        gint64 mtime;
+        guint64 inode;
+} LdmModaliasDbSource;
+
+typedef struct LdmModaliasDbRule {
+        guint32 match;
+        guint32 driver;
+        guint32 package;
+        guint32 bus; /* LdmModaliasBus, NONE if not compiled */
+        guint32 mask;
+        guint32 values[LDM_MODALIAS_MAX_IDS];
+} LdmModaliasDbRule;
+
+typedef struct LdmModaliasDbKey {
+        guint64 key;
+        guint32 rule; /* Index relative to the source rules */
+        guint32 padding;
+} LdmModaliasDbKey;
+
+typedef struct _LdmModaliasDb LdmModaliasDb;
+
+gboolean ldm_modalias_db_update(const gchar *directory, const gchar *output, guint *n_reused,
+                                guint *n_parsed);
+
+GByteArray *ldm_modalias_db_compile_files(gchar **paths, guint n_paths);
+
+LdmModaliasDb *ldm_modalias_db_open(const gchar *path);
+LdmModaliasDb *ldm_modalias_db_new_static(gconstpointer data, gsize len);
+LdmModaliasDb *ldm_modalias_db_ref(LdmModaliasDb *db);
+void ldm_modalias_db_unref(LdmModaliasDb *db);
+
+gint ldm_modalias_db_lookup_source(LdmModaliasDb *db, const gchar *path);
+
+guint ldm_modalias_db_get_n_sources(LdmModaliasDb *db);
+const gchar *ldm_modalias_db_get_source_name(LdmModaliasDb *db, guint source);
+guint ldm_modalias_db_get_n_rules(LdmModaliasDb *db, guint source);
+const gchar *ldm_modalias_db_get_package(LdmModaliasDb *db, guint source, guint rule);
+
+gboolean ldm_modalias_db_match(LdmModaliasDb *db, guint source, const gchar *subject,
+                               const LdmModaliasFields *fields, guint *best);
+
+DEF_AUTOFREE(LdmModaliasDb, ldm_modalias_db_unref)
+
+/*
+ * Editor modelines  -  https://www.wireshark.org/tools/modelines.html
+ *
+ * Local variables:
+ * c-basic-offset: 8
+ * tab-width: 8
+ * indent-tabs-mode: nil
+ * End:
+ *
+ * vi: set shiftwidth=8 tabstop=8 expandtab:
+ * :indentSize=8:tabSize=8:noTabs=true:
+ */
@@ -0,0 +1,506 @@
+/*
+ * This file is part of linux-driver-management.
+ *
+ * Copyright © 2016-2018 Ikey Doherty
+ *
+ * linux-driver-management is free software; you can redistribute it and/or
+ * modify it under the terms of the GNU Lesser General Public License as
+ * published by the Free Software Foundation; either version 2.1
+ * of the License, or (at your option) any later version.
+ */
+
+#define _GNU_SOURCE
+
+#include <string.h>
+
+#include "modalias-fields.h"
+
+/*
+ * A single tagged hex field, i.e. `sv` followed by 8 hex digits.
+ */
+typedef struct LdmModaliasField {
+        const gchar *tag;
+        guint width;
+} LdmModaliasField;
+
+/*
+ * Fixed layout of a structured modalias, as printed by the kernel.
+ */
+typedef struct LdmModaliasLayout {
+        LdmModaliasBus bus;
+        const gchar *prefix;
+        guint n_fields;
+        guint vendor; /* Field index used for the vendor key */
+        guint device; /* Field index used for the device key */
+        LdmModaliasField fields[LDM_MODALIAS_MAX_IDS];
+} LdmModaliasLayout;
+
+static const LdmModaliasLayout ldm_modalias_layouts[] = {
+        {
+            .bus = LDM_MODALIAS_BUS_PCI,
+            .prefix = "pci:",
+            .n_fields = 7,
+            .vendor = LDM_MODALIAS_PCI_VENDOR,
+            .device = LDM_MODALIAS_PCI_DEVICE,
+            .fields = {
+                { "v", 8 },
+                { "d", 8 },
+                { "sv", 8 },
+                { "sd", 8 },
+                { "bc", 2 },
+                { "sc", 2 },
+                { "i", 2 },
+            },
+        },
+        {
+            .bus = LDM_MODALIAS_BUS_USB,
+            .prefix = "usb:",
+            .n_fields = 10,
+            .vendor = LDM_MODALIAS_USB_VENDOR,
+            .device = LDM_MODALIAS_USB_PRODUCT,
+            .fields = {
+                { "v", 4 },
+                { "p", 4 },
+                { "d", 4 },
+                { "dc", 2 },
+                { "dsc", 2 },
+                { "dp", 2 },
+                { "ic", 2 },
+                { "isc", 2 },
+                { "ip", 2 },
+                { "in", 2 },
+            },
+        },
+        {
+            .bus = LDM_MODALIAS_BUS_HID,
+            .prefix = "hid:",
+            .n_fields = 4,
+            .vendor = LDM_MODALIAS_HID_VENDOR,
+            .device = LDM_MODALIAS_HID_PRODUCT,
+            .fields = {
+                { "b", 4 },
+                { "g", 4 },
+                { "v", 8 },
+                { "p", 8 },
+            },
+        },
+};
+
+static const LdmModaliasLayout *ldm_modalias_layout_for(const gchar *s)
+{
+        for (guint i = 0; i < G_N_ELEMENTS(ldm_modalias_layouts); i++) {
+                const LdmModaliasLayout *layout = &ldm_modalias_layouts[i];
+
+                if (strncmp(s, layout->prefix, strlen(layout->prefix)) == 0) {
+                        return layout;
+                }
+        }
+        return NULL;
+}
+
+static const LdmModaliasLayout *ldm_modalias_layout_for_bus(LdmModaliasBus bus)
+{
+        for (guint i = 0; i < G_N_ELEMENTS(ldm_modalias_layouts); i++) {
+                if (ldm_modalias_layouts[i].bus == bus) {
+                        return &ldm_modalias_layouts[i];
+                }
+        }
+        return NULL;
+}
+
+/**
+ * ldm_modalias_parse_hex:
+ *
+ * Parse exactly @width uppercase hex digits, as the kernel prints them.
+ * Lowercase digits are rejected as fnmatch would treat them as distinct.
+ */
+static gboolean ldm_modalias_parse_hex(const gchar *s, guint width, guint32 *value)
+{
+        guint32 ret = 0;
+
+        for (guint i = 0; i < width; i++) {
+                gchar c = s[i];
+
+                if (c >= '0' && c <= '9') {
+                        ret = (ret << 4) | (guint32)(c - '0');
+                } else if (c >= 'A' && c <= 'F') {
+                        ret = (ret << 4) | (guint32)(c - 'A' + 10);
+                } else {
+                        return FALSE;
+                }
+        }
+
+        *value = ret;
+        return TRUE;
+}
+
+/**
+ * ldm_modalias_fields_decode:
+ * @modalias: (nullable): Device modalias
+ * @fields: Storage for the decoded fields
+ *
+ * Decode the modalias into typed fields. A modalias that doesn't exactly
+ * follow the known layout is marked as LDM_MODALIAS_BUS_NONE, and will only
+ * be matched as a string.
+ */
+void ldm_modalias_fields_decode(const gchar *modalias, LdmModaliasFields *fields)
+{
+        const LdmModaliasLayout *layout = NULL;
+        const gchar *c = NULL;
+
+        memset(fields, 0, sizeof(*fields));
+        fields->bus = LDM_MODALIAS_BUS_NONE;
+
+        if (!modalias) {
+                return;
+        }
+
+        layout = ldm_modalias_layout_for(modalias);
+        if (!layout) {
+                return;
+        }
+
+        c = modalias + strlen(layout->prefix);
+        for (guint i = 0; i < layout->n_fields; i++) {
+                const LdmModaliasField *field = &layout->fields[i];
+                gsize tag_len = strlen(field->tag);
+
+                if (strncmp(c, field->tag, tag_len) != 0) {
+                        return;
+                }
+                c += tag_len;
+
+                if (!ldm_modalias_parse_hex(c, field->width, &fields->ids[i])) {
+                        return;
+                }
+                c += field->width;
+        }
+
+        /* Trailing junk means this isn't what we think it is */
+        if (*c != '\0') {
+                return;
+        }
+
+        fields->bus = layout->bus;
+}
+
+/**
+ * ldm_modalias_bus_for_prefix:
+ * @s: Modalias or pattern
+ *
+ * Returns: The fixed layout bus that @s starts with, or LDM_MODALIAS_BUS_NONE
+ */
+LdmModaliasBus ldm_modalias_bus_for_prefix(const gchar *s)
+{
+        const LdmModaliasLayout *layout = ldm_modalias_layout_for(s);
+
+        return layout ? layout->bus : LDM_MODALIAS_BUS_NONE;
+}
+
+/**
+ * ldm_modalias_bus_get_prefix:
+ *
+ * Returns: The modalias prefix for a fixed layout bus, i.e. `pci:`, or NULL
+ */
+const gchar *ldm_modalias_bus_get_prefix(LdmModaliasBus bus)
+{
+        const LdmModaliasLayout *layout = ldm_modalias_layout_for_bus(bus);
+
+        return layout ? layout->prefix : NULL;
+}
+
+/**
+ * ldm_modalias_vendor:
+ * @bus: Fixed layout bus the IDs belong to
+ * @ids: Decoded fields, or compiled rule values, for @bus
+ *
+ * Returns: The vendor ID field for the bus layout
+ */
+guint32 ldm_modalias_vendor(LdmModaliasBus bus, const guint32 *ids)
+{
+        const LdmModaliasLayout *layout = ldm_modalias_layout_for_bus(bus);
+
+        g_assert(layout != NULL);
+
+        return ids[layout->vendor];
+}
+
+/**
+ * ldm_modalias_rule_compile:
+ * @pattern: fnmatch style pattern
+ * @rule: Storage for the compiled rule
+ *
+ * Attempt to compile the pattern into an integer rule. This only succeeds if
+ * the pattern follows a known layout with every field either being an exact
+ * width uppercase literal or a lone `*`. A trailing `*` in place of a field
+ * wildcards every field after it.
+ *
+ * As field tags are lowercase and values are uppercase hex, a `*` can never
+ * span a tag in a well formed modalias, so the compiled rule matches exactly
+ * the same decoded modaliases that fnmatch would.
+ *
+ * Returns: TRUE if the pattern was compiled
+ */
+gboolean ldm_modalias_rule_compile(const gchar *pattern, LdmModaliasRule *rule)
+{
+        const LdmModaliasLayout *layout = NULL;
+        const gchar *c = NULL;
+
+        memset(rule, 0, sizeof(*rule));
+        rule->bus = LDM_MODALIAS_BUS_NONE;
+
+        layout = ldm_modalias_layout_for(pattern);
+        if (!layout) {
+                return FALSE;
+        }
+
+        c = pattern + strlen(layout->prefix);
+        for (guint i = 0; i < layout->n_fields; i++) {
+                const LdmModaliasField *field = &layout->fields[i];
+                gsize tag_len = strlen(field->tag);
+
+                if (strncmp(c, field->tag, tag_len) != 0) {
+                        return FALSE;
+                }
+                c += tag_len;
+
+                if (*c == '*') {
+                        ++c;
+                        /* Everything from here on is a wildcard */
+                        if (*c == '\0') {
+                                goto compiled;
+                        }
+                        continue;
+                }
+
+                if (!ldm_modalias_parse_hex(c, field->width, &rule->values[i])) {
+                        return FALSE;
+                }
+                rule->mask |= 1U << i;
+                c += field->width;
+        }
+
+        /* Permit a trailing `*` as it can only match the empty string */
+        if (*c == '*') {
+                ++c;
+        }
+        if (*c != '\0') {
+                return FALSE;
+        }
+
+compiled:
+        rule->bus = layout->bus;
+        return TRUE;
+}
+
+/**
+ * ldm_modalias_pattern_parse_set:
+ * @pattern: (inout): Position of the opening `[`, advanced past the `]`
+ *
+ * Returns: (transfer full) (nullable): `[` followed by the members of the set
+ * in ascending order, or NULL if it isn't a plain set of characters and ranges
+ */
+static gchar *ldm_modalias_pattern_parse_set(const gchar **pattern)
+{
+        gboolean members[256] = { FALSE };
+        const gchar *c = *pattern + 1;
+        GString *ret = NULL;
+
+        /* Negation, a leading `]` and anything else fancy isn't worth it */
+        if (*c == '!' || *c == '^' || *c == ']') {
+                return NULL;
+        }
+
+        while (*c != '\0' && *c != ']') {
+                guchar first = (guchar)*c;
+                guchar last = first;
+
+                if (c[1] == '-' && c[2] != '\0' && c[2] != ']') {
+                        last = (guchar)c[2];
+                        c += 3;
+                } else {
+                        ++c;
+                }
+
+                if (last < first) {
+                        return NULL;
+                }
+                for (guint i = first; i <= last; i++) {
+                        members[i] = TRUE;
+                }
+        }
+
+        /* fnmatch treats an unterminated `[` literally */
+        if (*c != ']') {
+                return NULL;
+        }
+
+        /* Members must stay literal once they're out of the brackets */
+        if (members['*'] || members['?'] || members['['] || members['\\']) {
+                return NULL;
+        }
+        *pattern = c + 1;
+
+        ret = g_string_new("[");
+        for (guint i = 1; i < G_N_ELEMENTS(members); i++) {
+                if (members[i]) {
+                        g_string_append_c(ret, (gchar)i);
+                }
+        }
+
+        return g_string_free(ret, FALSE);
+}
+
+/**
+ * ldm_modalias_pattern_expand:
+ * @pattern: fnmatch style pattern
+ *
+ * Expand the bracket expressions in the pattern into the patterns they stand
+ * for, i.e. `d000011E[0-2]` into `d000011E0`, `d000011E1` and `d000011E2`.
+ * This lets rules merged by `mkmodaliases --optimize` still be compiled.
+ *
+ * Returns: (transfer full) (nullable): The expanded patterns in ascending
+ * order, or NULL if there's nothing to expand, the pattern uses anything but
+ * plain sets and ranges, or it would expand to more than
+ * LDM_MODALIAS_EXPAND_MAX patterns
+ */
+GPtrArray *ldm_modalias_pattern_expand(const gchar *pattern)
+{
+        g_autoptr(GPtrArray) segments = NULL;
+        g_autofree guint *choices = NULL;
+        GPtrArray *ret = NULL;
+        const gchar *c = pattern;
+        guint n_expanded = 1;
+
+        g_return_val_if_fail(pattern != NULL, NULL);
+
+        if (!strchr(pattern, '[')) {
+                return NULL;
+        }
+
+        /* Literal runs, and sets marked with their leading `[` */
+        segments = g_ptr_array_new_with_free_func(g_free);
+        while (*c != '\0') {
+                gsize literal_len = strcspn(c, "[\\");
+                gchar *set = NULL;
+
+                if (literal_len > 0) {
+                        g_ptr_array_add(segments, g_strndup(c, literal_len));
+                        c += literal_len;
+                        continue;
+                }
+                if (*c == '\\') {
+                        return NULL;
+                }
+
+                set = ldm_modalias_pattern_parse_set(&c);
+                if (!set) {
+                        return NULL;
+                }
+                g_ptr_array_add(segments, set);
+
+                n_expanded *= (guint)strlen(set) - 1;
+                if (n_expanded > LDM_MODALIAS_EXPAND_MAX) {
+                        return NULL;
+                }
+        }
+
+        ret = g_ptr_array_new_full(n_expanded, g_free);
+        choices = g_new0(guint, segments->len);
+
+        for (guint n = 0; n < n_expanded; n++) {
+                GString *expanded = g_string_new(NULL);
+                guint remainder = n;
+
+                /* The last set varies fastest, keeping the output sorted */
+                for (guint i = segments->len; i > 0; i--) {
+                        const gchar *segment = segments->pdata[i - 1];
+                        guint n_members = (guint)strlen(segment) - 1;
+
+                        if (*segment != '[') {
+                                continue;
+                        }
+                        choices[i - 1] = remainder % n_members;
+                        remainder /= n_members;
+                }
+
+                for (guint i = 0; i < segments->len; i++) {
+                        const gchar *segment = segments->pdata[i];
+
+                        if (*segment == '[') {
+                                g_string_append_c(expanded, segment[1 + choices[i]]);
+                        } else {
+                                g_string_append(expanded, segment);
+                        }
+                }
+
+                g_ptr_array_add(ret, g_string_free(expanded, FALSE));
+        }
+
+        return ret;
+}
+
+/**
+ * ldm_modalias_rule_key_level:
+ *
+ * Determine the most specific bucket level for the compiled rule, i.e. 2 if
+ * both the vendor and device are literal, 1 for just the vendor, and 0 if only
+ * the bus is known.
+ */
+guint ldm_modalias_rule_key_level(const LdmModaliasRule *rule)
+{
+        const LdmModaliasLayout *layout = ldm_modalias_layout_for_bus(rule->bus);
+
+        g_assert(layout != NULL);
+
+        if (!(rule->mask & (1U << layout->vendor))) {
+                return 0;
+        }
+        if (!(rule->mask & (1U << layout->device))) {
+                return 1;
+        }
+        return 2;
+}
+
+/**
+ * ldm_modalias_key:
+ * @bus: Bus the IDs belong to
+ * @ids: Decoded fields for @bus
+ * @level: Bucket level, see #ldm_modalias_rule_key_level
+ *
+ * Compute the bucket key for the given level. Keys are only used to narrow
+ * down the candidate rules, each of which is still tested in full, so a rare
+ * collision costs a compare and never a wrong match.
+ *
+ * Returns: A key suitable for a 64-bit hash table
+ */
+guint64 ldm_modalias_key(LdmModaliasBus bus, const guint32 *ids, guint level)
+{
+        const LdmModaliasLayout *layout = ldm_modalias_layout_for_bus(bus);
+        guint64 key = 0;
+
+        g_assert(layout != NULL);
+
+        key = ((guint64)bus << 58) | ((guint64)level << 56);
+        if (level >= 1) {
+                key ^= (guint64)ids[layout->vendor] << 24;
+        }
+        if (level >= 2) {
+                key ^= (guint64)ids[layout->device];
+        }
+
+        return key;
+}
+
+/*
+ * Editor modelines  -  https://www.wireshark.org/tools/modelines.html
+ *
+ * Local variables:
+ * c-basic-offset: 8
+ * tab-width: 8
+ * indent-tabs-mode: nil
+ * End:
+ *
+ * vi: set shiftwidth=8 tabstop=8 expandtab:
+ * :indentSize=8:tabSize=8:noTabs=true:
+ */
@@ -0,0 +1,147 @@
+/*
+ * This file is part of linux-driver-management.
+ *
+ * Copyright © 2016-2018 Ikey Doherty
+ *
+ * linux-driver-management is free software; you can redistribute it and/or
+ * modify it under the terms of the GNU Lesser General Public License as
+ * published by the Free Software Foundation; either version 2.1
+ * of the License, or (at your option) any later version.
+ */
+
+#pragma once
+
+#include <glib.h>
+
+/*
+ * Structured modalias support.
+ *
+ * Kernel modaliases for the common buses have a fixed layout of tagged hex
+ * fields, i.e. `pci:v%08Xd%08Xsv%08Xsd%08Xbc%02Xsc%02Xi%02X`. We decode
+ * these once into integers, and compile rules of the same shape (each field
+ * either literal or `*`) into a mask/value pair, turning a glob match into a
+ * handful of integer compares. Anything irregular is left to fnmatch.
+ */
+
+typedef enum {
+        LDM_MODALIAS_BUS_UNKNOWN = 0, /* Not yet decoded */
+        LDM_MODALIAS_BUS_NONE,        /* Decoded, but not a structured modalias */
+        LDM_MODALIAS_BUS_PCI,
+        LDM_MODALIAS_BUS_USB,
+        LDM_MODALIAS_BUS_HID,
+        LDM_MODALIAS_BUS_MAX,
+} LdmModaliasBus;
+
+/* pci:vXXXXXXXXdXXXXXXXXsvXXXXXXXXsdXXXXXXXXbcXXscXXiXX */
+enum {
+        LDM_MODALIAS_PCI_VENDOR = 0,
+        LDM_MODALIAS_PCI_DEVICE,
+        LDM_MODALIAS_PCI_SUBVENDOR,
+        LDM_MODALIAS_PCI_SUBDEVICE,
+        LDM_MODALIAS_PCI_CLASS,
+        LDM_MODALIAS_PCI_SUBCLASS,
+        LDM_MODALIAS_PCI_PROGIF,
+};
+
+/* usb:vXXXXpXXXXdXXXXdcXXdscXXdpXXicXXiscXXipXXinXX */
+enum {
+        LDM_MODALIAS_USB_VENDOR = 0,
+        LDM_MODALIAS_USB_PRODUCT,
+        LDM_MODALIAS_USB_BCD_DEVICE,
+        LDM_MODALIAS_USB_DEVICE_CLASS,
+        LDM_MODALIAS_USB_DEVICE_SUBCLASS,
+        LDM_MODALIAS_USB_DEVICE_PROTOCOL,
+        LDM_MODALIAS_USB_INTERFACE_CLASS,
+        LDM_MODALIAS_USB_INTERFACE_SUBCLASS,
+        LDM_MODALIAS_USB_INTERFACE_PROTOCOL,
+        LDM_MODALIAS_USB_INTERFACE_NUMBER,
+};
+
+/* hid:bXXXXgXXXXvXXXXXXXXpXXXXXXXX */
+enum {
+        LDM_MODALIAS_HID_BUS = 0,
+        LDM_MODALIAS_HID_GROUP,
+        LDM_MODALIAS_HID_VENDOR,
+        LDM_MODALIAS_HID_PRODUCT,
+};
+
+/* Most numeric fields in any layout (USB) */
+#define LDM_MODALIAS_MAX_IDS 10
+
+/* Bucket levels for rule lookup: bus, bus + vendor, bus + vendor + device */
+#define LDM_MODALIAS_KEY_LEVELS 3
+
+/* Most literal patterns a single bracketed pattern may be expanded into */
+#define LDM_MODALIAS_EXPAND_MAX 256
+
+/*
+ * A decoded device modalias.
+ */
+typedef struct LdmModaliasFields {
+        LdmModaliasBus bus;
+        guint32 ids[LDM_MODALIAS_MAX_IDS];
+} LdmModaliasFields;
+
+/*
+ * A rule compiled from a regular pattern. Field i must equal values[i] when
+ * bit i of the mask is set, and is a wildcard otherwise.
+ */
+typedef struct LdmModaliasRule {
+        LdmModaliasBus bus; /* LDM_MODALIAS_BUS_NONE if the pattern didn't compile */
+        guint32 mask;
+        guint32 values[LDM_MODALIAS_MAX_IDS];
+} LdmModaliasRule;
+
+void ldm_modalias_fields_decode(const gchar *modalias, LdmModaliasFields *fields);
+LdmModaliasBus ldm_modalias_bus_for_prefix(const gchar *s);
+const gchar *ldm_modalias_bus_get_prefix(LdmModaliasBus bus);
+guint32 ldm_modalias_vendor(LdmModaliasBus bus, const guint32 *ids);
+
+gboolean ldm_modalias_rule_compile(const gchar *pattern, LdmModaliasRule *rule);
+GPtrArray *ldm_modalias_pattern_expand(const gchar *pattern);
+
+guint ldm_modalias_rule_key_level(const LdmModaliasRule *rule);
+guint64 ldm_modalias_key(LdmModaliasBus bus, const guint32 *ids, guint level);
+
+/**
+ * ldm_modalias_fields_has_ids:
+ *
+ * Returns: TRUE if the fields were decoded from a fixed layout modalias
+ */
+static inline gboolean ldm_modalias_fields_has_ids(const LdmModaliasFields *fields)
+{
+        return fields->bus == LDM_MODALIAS_BUS_PCI || fields->bus == LDM_MODALIAS_BUS_USB ||
+               fields->bus == LDM_MODALIAS_BUS_HID;
+}
+
+/**
+ * ldm_modalias_rule_matches:
+ *
+ * Test the decoded modalias against the compiled rule.
+ */
+static inline gboolean ldm_modalias_rule_matches(const LdmModaliasRule *rule,
+                                                 const LdmModaliasFields *fields)
+{
+        if (rule->bus != fields->bus) {
+                return FALSE;
+        }
+        for (guint i = 0; i < LDM_MODALIAS_MAX_IDS; i++) {
+                if ((rule->mask & (1U << i)) && rule->values[i] != fields->ids[i]) {
+                        return FALSE;
+                }
+        }
+        return TRUE;
+}
+
+/*
+ * Editor modelines  -  https://www.wireshark.org/tools/modelines.html
+ *
+ * Local variables:
+ * c-basic-offset: 8
+ * tab-width: 8
+ * indent-tabs-mode: nil
+ * End:
+ *
+ * vi: set shiftwidth=8 tabstop=8 expandtab:
+ * :indentSize=8:tabSize=8:noTabs=true:
+ */
@@ -0,0 +1,538 @@
+/*
+ * This file is part of linux-driver-management.
+ *
+ * Copyright © 2016-2018 Ikey Doherty
+ *
+ * linux-driver-management is free software; you can redistribute it and/or
+ * modify it under the terms of the GNU Lesser General Public License as
+ * published by the Free Software Foundation; either version 2.1
+ * of the License, or (at your option) any later version.
+ */
+
+#define _GNU_SOURCE
+
+#include <errno.h>
+#include <glob.h>
+#include <stdio.h>
+#include <string.h>
+
+#include "config.h"
+#include "modalias-file.h"
+
+#ifdef HAVE_ZLIB
+#include <zlib.h>
+#endif
+
+#ifdef HAVE_ZSTD
+#include <zstd.h>
+#endif
+
+/* Size of the compressed and decompressed buffers */
+#define LDM_MODALIAS_FILE_CHUNK (64 * 1024)
+
+/* Compressed forms, in the order tried */
+static const gchar *ldm_modalias_file_suffixes[] = {
+        LDM_MODALIAS_FILE_SUFFIX,
+#ifdef HAVE_ZLIB
+        LDM_MODALIAS_FILE_SUFFIX ".gz",
+#endif
+#ifdef HAVE_ZSTD
+        LDM_MODALIAS_FILE_SUFFIX ".zst",
+#endif
+};
+
+/*
+ * Splits decoded data into lines for the caller
+ */
+typedef struct LdmModaliasLines {
+        LdmModaliasLineFunc func;
+        gpointer user_data;
+        GString *pending; /* Partial line carried over from the last chunk */
+        gboolean stopped;
+} LdmModaliasLines;
+
+/**
+ * ldm_modalias_file_is_supported:
+ * @path: Name or path of a file
+ *
+ * Returns: TRUE if @path is a `.modaliases` file we're able to read
+ */
+gboolean ldm_modalias_file_is_supported(const gchar *path)
+{
+        g_return_val_if_fail(path != NULL, FALSE);
+
+        for (guint i = 0; i < G_N_ELEMENTS(ldm_modalias_file_suffixes); i++) {
+                if (g_str_has_suffix(path, ldm_modalias_file_suffixes[i])) {
+                        return TRUE;
+                }
+        }
+
+        return FALSE;
+}
+
+/**
+ * ldm_modalias_file_get_name:
+ * @path: Path of a `.modaliases` file
+ *
+ * Compressed and plain forms of the same file share the name.
+ *
+ * Returns: (transfer full): The basename of @path without any suffix
+ */
+gchar *ldm_modalias_file_get_name(const gchar *path)
+{
+        gchar *ret = NULL;
+
+        g_return_val_if_fail(path != NULL, NULL);
+
+        ret = g_path_get_basename(path);
+        for (guint i = 0; i < G_N_ELEMENTS(ldm_modalias_file_suffixes); i++) {
+                if (g_str_has_suffix(ret, ldm_modalias_file_suffixes[i])) {
+                        ret[strlen(ret) - strlen(ldm_modalias_file_suffixes[i])] = '\0';
+                        break;
+                }
+        }
+
+        return ret;
+}
+
+/**
+ * ldm_modalias_file_find:
+ * @directory: Directory containing `.modaliases` files
+ * @name: Name shared by every form of the file
+ *
+ * Returns: (transfer full) (nullable): Path of the form of @name that
+ * #ldm_modalias_file_glob would pick, or NULL if there are none left
+ */
+gchar *ldm_modalias_file_find(const gchar *directory, const gchar *name)
+{
+        g_return_val_if_fail(directory != NULL, NULL);
+        g_return_val_if_fail(name != NULL, NULL);
+
+        for (guint i = 0; i < G_N_ELEMENTS(ldm_modalias_file_suffixes); i++) {
+                g_autofree gchar *file = g_strconcat(name, ldm_modalias_file_suffixes[i], NULL);
+                gchar *path = g_build_filename(directory, file, NULL);
+
+                if (g_file_test(path, G_FILE_TEST_EXISTS)) {
+                        return path;
+                }
+                g_free(path);
+        }
+
+        return NULL;
+}
+
+/**
+ * ldm_modalias_file_glob:
+ * @directory: Directory containing `.modaliases` files
+ *
+ * Plain and compressed forms of one file would give plugins of the same
+ * name, so only the first in sorted order is kept. As the suffixes sort in
+ * the order they're tried, that's the plain file, then gzip, then zstd.
+ *
+ * Returns: (transfer full) (element-type filename): Every supported file in
+ * the directory, sorted by path
+ */
+GPtrArray *ldm_modalias_file_glob(const gchar *directory)
+{
+        g_autofree gchar *glob_path = NULL;
+        g_autoptr(GHashTable) names = NULL;
+        GPtrArray *ret = NULL;
+        glob_t glo = { 0 };
+
+        g_return_val_if_fail(directory != NULL, NULL);
+
+        ret = g_ptr_array_new_with_free_func(g_free);
+        names = g_hash_table_new_full(g_str_hash, g_str_equal, g_free, NULL);
+
+        /* One pattern keeps every form in a single sorted list */
+        glob_path = g_strdup_printf("%s%s*" LDM_MODALIAS_FILE_SUFFIX "*",
+                                    directory,
+                                    G_DIR_SEPARATOR_S);
+        if (glob(glob_path, 0, NULL, &glo) == 0) {
+                for (size_t i = 0; i < glo.gl_pathc; i++) {
+                        gchar *name = NULL;
+
+                        if (!ldm_modalias_file_is_supported(glo.gl_pathv[i])) {
+                                continue;
+                        }
+
+                        name = ldm_modalias_file_get_name(glo.gl_pathv[i]);
+                        if (!g_hash_table_add(names, name)) {
+                                g_warning("Ignoring %s, another form of '%s' is already loaded",
+                                          glo.gl_pathv[i],
+                                          name);
+                                continue;
+                        }
+                        g_ptr_array_add(ret, g_strdup(glo.gl_pathv[i]));
+                }
+        }
+        globfree(&glo);
+
+        return ret;
+}
+
+/**
+ * ldm_modalias_lines_feed:
+ *
+ * Hand every complete line in @data to the caller, keeping the remainder
+ * until the next chunk arrives.
+ */
+static void ldm_modalias_lines_feed(LdmModaliasLines *lines, const gchar *data, gsize len)
+{
+        const gchar *end = data + len;
+
+        while (data < end && !lines->stopped) {
+                const gchar *eol = memchr(data, '\n', (gsize)(end - data));
+
+                if (!eol) {
+                        g_string_append_len(lines->pending, data, end - data);
+                        return;
+                }
+
+                if (lines->pending->len > 0) {
+                        g_string_append_len(lines->pending, data, eol - data);
+                        lines->stopped = !lines->func(lines->pending->str,
+                                                      lines->pending->len,
+                                                      lines->user_data);
+                        g_string_truncate(lines->pending, 0);
+                } else {
+                        lines->stopped =
+                            !lines->func(data, (gsize)(eol - data), lines->user_data);
+                }
+
+                data = eol + 1;
+        }
+}
+
+static void ldm_modalias_lines_finish(LdmModaliasLines *lines)
+{
+        if (lines->pending->len > 0 && !lines->stopped) {
+                lines->func(lines->pending->str, lines->pending->len, lines->user_data);
+        }
+}
+
+/**
+ * ldm_modalias_file_read_plain:
+ *
+ * Plain files are mapped read-only, so lines come straight from the page
+ * cache and the file only has to be readable.
+ */
+static gboolean ldm_modalias_file_read_plain(const gchar *path, LdmModaliasLines *lines)
+{
+        g_autoptr(GError) error = NULL;
+        g_autoptr(GMappedFile) file = NULL;
+
+        file = g_mapped_file_new(path, FALSE, &error);
+        if (!file) {
+                fprintf(stderr, "Failed to open %s: %s\n", path, error->message);
+                return FALSE;
+        }
+
+        ldm_modalias_lines_feed(lines,
+                                g_mapped_file_get_contents(file),
+                                g_mapped_file_get_length(file));
+
+        return TRUE;
+}
+
+#ifdef HAVE_ZLIB
+/**
+ * ldm_modalias_file_read_gzip:
+ *
+ * Inflate the file a chunk at a time, including any concatenated members.
+ */
+static gboolean ldm_modalias_file_read_gzip(const gchar *path, FILE *fp, LdmModaliasLines *lines)
+{
+        g_autofree guint8 *in = g_malloc(LDM_MODALIAS_FILE_CHUNK);
+        g_autofree gchar *out = g_malloc(LDM_MODALIAS_FILE_CHUNK);
+        z_stream stream = { 0 };
+        gboolean flushed = TRUE;
+        gboolean ret = FALSE;
+        int rc = Z_OK;
+
+        /* Accept gzip headers only */
+        if (inflateInit2(&stream, 16 + MAX_WBITS) != Z_OK) {
+                fprintf(stderr, "Failed to initialise zlib for %s\n", path);
+                return FALSE;
+        }
+
+        while (!lines->stopped) {
+                /* Only read more once the last output has been drained */
+                if (stream.avail_in == 0 && flushed) {
+                        size_t n = fread(in, 1, LDM_MODALIAS_FILE_CHUNK, fp);
+
+                        if (n == 0) {
+                                ret = !ferror(fp) && rc == Z_STREAM_END;
+                                if (!ret) {
+                                        fprintf(stderr, "Truncated gzip file %s\n", path);
+                                }
+                                break;
+                        }
+                        stream.next_in = in;
+                        stream.avail_in = (uInt)n;
+                }
+
+                /* Next member of a concatenated file */
+                if (rc == Z_STREAM_END) {
+                        inflateReset(&stream);
+                }
+
+                stream.next_out = (Bytef *)out;
+                stream.avail_out = LDM_MODALIAS_FILE_CHUNK;
+                rc = inflate(&stream, Z_NO_FLUSH);
+                if (rc != Z_OK && rc != Z_STREAM_END && rc != Z_BUF_ERROR) {
+                        fprintf(stderr,
+                                "Failed to decompress %s: %s\n",
+                                path,
+                                stream.msg ? stream.msg : "invalid data");
+                        break;
+                }
+
+                /* The end of a member, or no progress, means nothing is held back */
+                flushed = stream.avail_out > 0 || rc != Z_OK;
+                ldm_modalias_lines_feed(lines, out, LDM_MODALIAS_FILE_CHUNK - stream.avail_out);
+        }
+
+        if (lines->stopped) {
+                ret = TRUE;
+        }
+
+        inflateEnd(&stream);
+        return ret;
+}
+#endif
+
+#ifdef HAVE_ZSTD
+/**
+ * ldm_modalias_file_read_zstd:
+ *
+ * Decompress the file a chunk at a time, including any concatenated frames.
+ */
+static gboolean ldm_modalias_file_read_zstd(const gchar *path, FILE *fp, LdmModaliasLines *lines)
+{
+        g_autofree guint8 *in = g_malloc(LDM_MODALIAS_FILE_CHUNK);
+        g_autofree gchar *out = g_malloc(LDM_MODALIAS_FILE_CHUNK);
+        ZSTD_DStream *stream = NULL;
+        ZSTD_inBuffer input = { in, 0, 0 };
+        gboolean flushed = TRUE;
+        gboolean ret = FALSE;
+        size_t hint = 0;
+
+        stream = ZSTD_createDStream();
+        if (!stream) {
+                fprintf(stderr, "Failed to initialise zstd for %s\n", path);
+                return FALSE;
+        }
+        ZSTD_initDStream(stream);
+
+        while (!lines->stopped) {
+                ZSTD_outBuffer output = { out, LDM_MODALIAS_FILE_CHUNK, 0 };
+
+                /* Only read more once the last output has been drained */
+                if (input.pos == input.size && flushed) {
+                        size_t n = fread(in, 1, LDM_MODALIAS_FILE_CHUNK, fp);
+
+                        if (n == 0) {
+                                /* Zero means the last frame was complete */
+                                ret = !ferror(fp) && hint == 0;
+                                if (!ret) {
+                                        fprintf(stderr, "Truncated zstd file %s\n", path);
+                                }
+                                break;
+                        }
+                        input.size = n;
+                        input.pos = 0;
+                }
+
+                hint = ZSTD_decompressStream(stream, &output, &input);
+                if (ZSTD_isError(hint)) {
+                        fprintf(stderr,
+                                "Failed to decompress %s: %s\n",
+                                path,
+                                ZSTD_getErrorName(hint));
+                        break;
+                }
+
+                flushed = output.pos < output.size;
+                ldm_modalias_lines_feed(lines, out, output.pos);
+        }
+
+        if (lines->stopped) {
+                ret = TRUE;
+        }
+
+        ZSTD_freeDStream(stream);
+        return ret;
+}
+#endif
+
+/**
+ * ldm_modalias_file_read_compressed:
+ *
+ * Open the file for the decoder matching its suffix.
+ */
+static gboolean ldm_modalias_file_read_compressed(const gchar *path, LdmModaliasLines *lines)
+{
+        FILE *fp = NULL;
+        gboolean ret = FALSE;
+
+        fp = fopen(path, "re");
+        if (!fp) {
+                fprintf(stderr, "Failed to open %s: %s\n", path, strerror(errno));
+                return FALSE;
+        }
+
+#ifdef HAVE_ZLIB
+        if (g_str_has_suffix(path, ".gz")) {
+                ret = ldm_modalias_file_read_gzip(path, fp, lines);
+        }
+#endif
+#ifdef HAVE_ZSTD
+        if (g_str_has_suffix(path, ".zst")) {
+                ret = ldm_modalias_file_read_zstd(path, fp, lines);
+        }
+#endif
+
+        fclose(fp);
+        return ret;
+}
+
+/**
+ * ldm_modalias_file_foreach_line:
+ * @path: Path of a supported `.modaliases` file
+ * @func: Called for each line in turn
+ *
+ * Read the file line by line, decompressing it as it goes. Lines are only
+ * valid for the duration of the call to @func.
+ *
+ * Returns: TRUE if the file was read to the end, or @func stopped it
+ */
+gboolean ldm_modalias_file_foreach_line(const gchar *path, LdmModaliasLineFunc func,
+                                        gpointer user_data)
+{
+        LdmModaliasLines lines = {
+                .func = func,
+                .user_data = user_data,
+        };
+        gboolean ret = FALSE;
+
+        g_return_val_if_fail(path != NULL, FALSE);
+        g_return_val_if_fail(func != NULL, FALSE);
+
+        if (!ldm_modalias_file_is_supported(path)) {
+                fprintf(stderr, "Unsupported modaliases file: %s\n", path);
+                return FALSE;
+        }
+
+        lines.pending = g_string_sized_new(128);
+
+        if (g_str_has_suffix(path, LDM_MODALIAS_FILE_SUFFIX)) {
+                ret = ldm_modalias_file_read_plain(path, &lines);
+        } else {
+                ret = ldm_modalias_file_read_compressed(path, &lines);
+        }
+
+        /* A final line without a newline is only complete if the file was */
+        if (ret) {
+                ldm_modalias_lines_finish(&lines);
+        }
+        g_string_free(lines.pending, TRUE);
+
+        return ret;
+}
+
+/**
+ * ldm_modalias_file_split_line:
+ * @line: Line as given to a #LdmModaliasLineFunc
+ * @len: Length of the line
+ * @columns: (out caller-allocates): Storage for the 4 columns
+ *
+ * Split a line into its 4 space separated columns, the last of which takes
+ * the remainder of the line. Surrounding whitespace is dropped, as with
+ * g_strstrip. The line is left untouched, the columns only point into it.
+ *
+ * Returns: FALSE for blank lines, comments and lines with too few columns
+ */
+gboolean ldm_modalias_file_split_line(const gchar *line, gsize len, LdmModaliasSpan *columns)
+{
+        const gchar *end = line + len;
+
+        while (line < end && g_ascii_isspace(*line)) {
+                ++line;
+        }
+        while (end > line && g_ascii_isspace(end[-1])) {
+                --end;
+        }
+
+        /* Empty lines and comments are uninteresting. */
+        if (line == end || *line == '#') {
+                return FALSE;
+        }
+
+        for (guint i = 0; i < 3; i++) {
+                const gchar *space = memchr(line, ' ', (gsize)(end - line));
+
+                if (!space) {
+                        return FALSE;
+                }
+                columns[i] = (LdmModaliasSpan){ line, (gsize)(space - line) };
+                line = space + 1;
+        }
+        columns[3] = (LdmModaliasSpan){ line, (gsize)(end - line) };
+
+        return TRUE;
+}
+
+/**
+ * ldm_modalias_span_equal:
+ *
+ * Returns: TRUE if @span holds exactly @str
+ */
+gboolean ldm_modalias_span_equal(const LdmModaliasSpan *span, const gchar *str)
+{
+        return strlen(str) == span->len && memcmp(span->str, str, span->len) == 0;
+}
+
+/**
+ * ldm_modalias_span_copy:
+ * @spans: Columns to copy
+ * @n_spans: Number of columns
+ * @buffer: Buffer reused from line to line
+ * @strings: (out caller-allocates): NUL terminated copies, valid until
+ *           @buffer is next used
+ *
+ * Copy the columns into @buffer for APIs needing NUL terminated strings. Once
+ * @buffer has grown to the longest line this allocates nothing.
+ */
+void ldm_modalias_span_copy(const LdmModaliasSpan *spans, guint n_spans, GString *buffer,
+                            const gchar **strings)
+{
+        gsize offsets[4] = { 0 };
+
+        g_assert(n_spans <= G_N_ELEMENTS(offsets));
+
+        g_string_truncate(buffer, 0);
+        for (guint i = 0; i < n_spans; i++) {
+                offsets[i] = buffer->len;
+                g_string_append_len(buffer, spans[i].str, (gssize)spans[i].len);
+                g_string_append_c(buffer, '\0');
+        }
+
+        /* Only now is the buffer done moving */
+        for (guint i = 0; i < n_spans; i++) {
+                strings[i] = buffer->str + offsets[i];
+        }
+}
+
+/*
+ * Editor modelines  -  https://www.wireshark.org/tools/modelines.html
+ *
+ * Local variables:
+ * c-basic-offset: 8
+ * tab-width: 8
+ * indent-tabs-mode: nil
+ * End:
+ *
+ * vi: set shiftwidth=8 tabstop=8 expandtab:
+ * :indentSize=8:tabSize=8:noTabs=true:
+ */
@@ -0,0 +1,69 @@
+/*
+ * This file is part of linux-driver-management.
+ *
+ * Copyright © 2016-2018 Ikey Doherty
+ *
+ * linux-driver-management is free software; you can redistribute it and/or
+ * modify it under the terms of the GNU Lesser General Public License as
+ * published by the Free Software Foundation; either version 2.1
+ * of the License, or (at your option) any later version.
+ */
+
+#pragma once
+
+#include <glib.h>
+
+/*
+ * `.modaliases` files on disk
+ *
+ * Besides plain text, files may be compressed as `.modaliases.gz` or
+ * `.modaliases.zst` when the library was built with zlib or libzstd
+ * respectively. Compressed files are decoded in fixed size chunks, so only
+ * the current chunk and any line straddling it are ever held in memory.
+ */
+
+#define LDM_MODALIAS_FILE_SUFFIX ".modaliases"
+
+/**
+ * LdmModaliasLineFunc:
+ * @line: Start of the line, not NUL terminated
+ * @len: Length of the line, excluding the newline
+ *
+ * Returns: FALSE to stop reading
+ */
+typedef gboolean (*LdmModaliasLineFunc)(const gchar *line, gsize len, gpointer user_data);
+
+/**
+ * LdmModaliasSpan:
+ * @str: Start of the column within the line, not NUL terminated
+ * @len: Length of the column
+ */
+typedef struct LdmModaliasSpan {
+        const gchar *str;
+        gsize len;
+} LdmModaliasSpan;
+
+gboolean ldm_modalias_file_is_supported(const gchar *path);
+gchar *ldm_modalias_file_get_name(const gchar *path);
+GPtrArray *ldm_modalias_file_glob(const gchar *directory);
+gchar *ldm_modalias_file_find(const gchar *directory, const gchar *name);
+
+gboolean ldm_modalias_file_foreach_line(const gchar *path, LdmModaliasLineFunc func,
+                                        gpointer user_data);
+gboolean ldm_modalias_file_split_line(const gchar *line, gsize len, LdmModaliasSpan *columns);
+gboolean ldm_modalias_span_equal(const LdmModaliasSpan *span, const gchar *str);
+void ldm_modalias_span_copy(const LdmModaliasSpan *spans, guint n_spans, GString *buffer,
+                            const gchar **strings);
+
+/*
+ * Editor modelines  -  https://www.wireshark.org/tools/modelines.html
+ *
+ * Local variables:
+ * c-basic-offset: 8
+ * tab-width: 8
+ * indent-tabs-mode: nil
+ * End:
+ *
+ * vi: set shiftwidth=8 tabstop=8 expandtab:
+ * :indentSize=8:tabSize=8:noTabs=true:
+ */
@@ -0,0 +1,427 @@
+/*
+ * This file is part of linux-driver-management.
+ *
+ * Copyright © 2016-2018 Ikey Doherty
+ *
+ * linux-driver-management is free software; you can redistribute it and/or
+ * modify it under the terms of the GNU Lesser General Public License as
+ * published by the Free Software Foundation; either version 2.1
+ * of the License, or (at your option) any later version.
+ */
+
+#define _GNU_SOURCE
+
+#include <fnmatch.h>
+#include <string.h>
+
+#include "modalias-index.h"
+#include "modalias-matcher.h"
+
+/* Longest bus prefix we'll index, i.e. `platform:` */
+#define LDM_INDEX_BUS_MAX 24
+
+/* Bus prefix plus the fixed width ID fields we may append to it */
+#define LDM_INDEX_LEVELS 3
+
+/*
+ * Fixed layout buses where the vendor and device IDs have a known width,
+ * allowing us to key on them as well as the bus.
+ */
+typedef struct LdmIndexBus {
+        const gchar *bus;
+        gsize levels[LDM_INDEX_LEVELS - 1];
+} LdmIndexBus;
+
+static const LdmIndexBus ldm_index_buses[] = {
+        /* pci:vXXXXXXXXdXXXXXXXX */
+        { "pci:", { 13, 22 } },
+        /* usb:vXXXXpXXXX */
+        { "usb:", { 9, 14 } },
+};
+
+/*
+ * Rule compiled into integer compares, see modalias-fields.h
+ */
+typedef struct LdmIndexRule {
+        LdmModaliasRule rule;
+        guint id;
+        const gchar *pattern; /* Only used for modaliases we couldn't decode */
+} LdmIndexRule;
+
+struct _LdmModaliasIndex {
+        GHashTable *buckets;          /* Literal prefix to LdmModaliasMatcher */
+        LdmModaliasMatcher *fallback; /* Rules starting with a wildcard */
+
+        /* Compiled rules */
+        GArray *rules;                               /* LdmIndexRule */
+        GHashTable *typed;                           /* Integer key to GArray of rule indices */
+        GArray *typed_by_bus[LDM_MODALIAS_BUS_MAX]; /* Rule indices for each bus */
+
+        /* Alternatives of expanded patterns, the only ones the index owns */
+        GStringChunk *expanded;
+};
+
+/**
+ * ldm_modalias_index_new:
+ *
+ * Construct a new, empty index.
+ *
+ * Returns: (transfer full): A newly allocated LdmModaliasIndex
+ */
+LdmModaliasIndex *ldm_modalias_index_new(void)
+{
+        LdmModaliasIndex *self = NULL;
+
+        self = g_new0(LdmModaliasIndex, 1);
+        self->buckets = g_hash_table_new_full(g_str_hash,
+                                              g_str_equal,
+                                              g_free,
+                                              (GDestroyNotify)ldm_modalias_matcher_free);
+        self->fallback = ldm_modalias_matcher_new();
+
+        self->rules = g_array_new(FALSE, FALSE, sizeof(LdmIndexRule));
+        self->typed =
+            g_hash_table_new_full(g_int64_hash, g_int64_equal, g_free, (GDestroyNotify)g_array_unref);
+        for (guint i = 0; i < LDM_MODALIAS_BUS_MAX; i++) {
+                self->typed_by_bus[i] = g_array_new(FALSE, FALSE, sizeof(guint));
+        }
+
+        return self;
+}
+
+/**
+ * ldm_modalias_index_free:
+ *
+ * Free a previously allocated index.
+ */
+void ldm_modalias_index_free(LdmModaliasIndex *self)
+{
+        if (!self) {
+                return;
+        }
+        g_hash_table_unref(self->buckets);
+        ldm_modalias_matcher_free(self->fallback);
+        g_array_unref(self->rules);
+        g_hash_table_unref(self->typed);
+        for (guint i = 0; i < LDM_MODALIAS_BUS_MAX; i++) {
+                g_array_unref(self->typed_by_bus[i]);
+        }
+        if (self->expanded) {
+                g_string_chunk_free(self->expanded);
+        }
+        g_free(self);
+}
+
+/**
+ * ldm_modalias_index_levels:
+ * @s: Pattern or subject string
+ * @len: Length of @s that may be used for keys
+ * @levels: Storage for the key lengths
+ *
+ * Compute the possible key lengths for the given string, shortest first. This
+ * is always the bus prefix (including the colon) followed by any fixed width
+ * ID fields the bus is known to have.
+ *
+ * Returns: The number of key lengths stored in @levels
+ */
+static guint ldm_modalias_index_levels(const gchar *s, gsize len, gsize *levels)
+{
+        const gchar *colon = NULL;
+        gsize bus_len = 0;
+        guint n_levels = 0;
+
+        colon = memchr(s, ':', MIN(len, LDM_INDEX_BUS_MAX));
+        if (!colon) {
+                return 0;
+        }
+        bus_len = (gsize)(colon - s) + 1;
+        levels[n_levels++] = bus_len;
+
+        for (guint i = 0; i < G_N_ELEMENTS(ldm_index_buses); i++) {
+                const LdmIndexBus *bus = &ldm_index_buses[i];
+
+                if (strlen(bus->bus) != bus_len || strncmp(s, bus->bus, bus_len) != 0) {
+                        continue;
+                }
+                for (guint j = 0; j < G_N_ELEMENTS(bus->levels); j++) {
+                        if (bus->levels[j] > len) {
+                                break;
+                        }
+                        levels[n_levels++] = bus->levels[j];
+                }
+                break;
+        }
+
+        return n_levels;
+}
+
+/**
+ * ldm_modalias_index_add_typed:
+ * @pattern: Pattern the rule was compiled from, which must outlive the index
+ *
+ * Store a compiled rule in the integer bucket for its most specific key.
+ */
+static void ldm_modalias_index_add_typed(LdmModaliasIndex *self, const gchar *pattern,
+                                         LdmModaliasRule *rule, guint id)
+{
+        LdmIndexRule entry = {
+                .rule = *rule,
+                .id = id,
+                .pattern = pattern,
+        };
+        guint index = self->rules->len;
+        guint64 key = 0;
+        GArray *bucket = NULL;
+
+        g_array_append_val(self->rules, entry);
+        g_array_append_val(self->typed_by_bus[rule->bus], index);
+
+        key = ldm_modalias_key(rule->bus, rule->values, ldm_modalias_rule_key_level(rule));
+        bucket = g_hash_table_lookup(self->typed, &key);
+        if (!bucket) {
+                guint64 *bucket_key = g_new(guint64, 1);
+
+                *bucket_key = key;
+                bucket = g_array_new(FALSE, FALSE, sizeof(guint));
+                g_hash_table_insert(self->typed, bucket_key, bucket);
+        }
+        g_array_append_val(bucket, index);
+}
+
+/**
+ * ldm_modalias_index_add_expanded:
+ *
+ * Bracket expressions, as written by `mkmodaliases --optimize` for runs of
+ * IDs, are expanded so each alternative still gets an integer rule. Only one
+ * of them can match any given subject.
+ *
+ * Returns: TRUE if every alternative compiled and was added
+ */
+static gboolean ldm_modalias_index_add_expanded(LdmModaliasIndex *self, const gchar *pattern,
+                                                guint id)
+{
+        g_autoptr(GPtrArray) expanded = NULL;
+        g_autofree LdmModaliasRule *rules = NULL;
+
+        expanded = ldm_modalias_pattern_expand(pattern);
+        if (!expanded) {
+                return FALSE;
+        }
+
+        rules = g_new0(LdmModaliasRule, expanded->len);
+        for (guint i = 0; i < expanded->len; i++) {
+                if (!ldm_modalias_rule_compile(expanded->pdata[i], &rules[i])) {
+                        return FALSE;
+                }
+        }
+
+        if (!self->expanded) {
+                self->expanded = g_string_chunk_new(1024);
+        }
+        for (guint i = 0; i < expanded->len; i++) {
+                ldm_modalias_index_add_typed(self,
+                                             g_string_chunk_insert(self->expanded,
+                                                                   expanded->pdata[i]),
+                                             &rules[i],
+                                             id);
+        }
+
+        return TRUE;
+}
+
+/**
+ * ldm_modalias_index_add:
+ * @pattern: fnmatch style pattern, which must outlive the index
+ * @id: Caller defined ID reported when @pattern matches
+ *
+ * The index points at @pattern rather than copying it, as callers already
+ * keep their patterns in an arena or database for as long as the index.
+ *
+ * Regular patterns are compiled into integer rules and bucketed by their bus,
+ * vendor and device IDs, as are those whose bracket expressions expand into
+ * regular patterns. Everything else is placed in the string bucket for
+ * its longest literal key, or in the fallback bucket if it doesn't even have
+ * a literal bus. The key is stripped from the pattern before compiling it
+ * into the bucket matcher.
+ */
+void ldm_modalias_index_add(LdmModaliasIndex *self, const gchar *pattern, guint id)
+{
+        gsize levels[LDM_INDEX_LEVELS] = { 0 };
+        gsize literal_len = 0;
+        gsize key_len = 0;
+        guint n_levels = 0;
+        g_autofree gchar *key = NULL;
+        LdmModaliasMatcher *matcher = NULL;
+        LdmModaliasRule rule = { 0 };
+
+        g_return_if_fail(self != NULL);
+        g_return_if_fail(pattern != NULL);
+
+        if (ldm_modalias_rule_compile(pattern, &rule)) {
+                ldm_modalias_index_add_typed(self, pattern, &rule, id);
+                return;
+        }
+        if (ldm_modalias_index_add_expanded(self, pattern, id)) {
+                return;
+        }
+
+        literal_len = strcspn(pattern, "*?[\\");
+        n_levels = ldm_modalias_index_levels(pattern, literal_len, levels);
+        if (n_levels == 0) {
+                ldm_modalias_matcher_add(self->fallback, pattern, id);
+                return;
+        }
+        key_len = levels[n_levels - 1];
+
+        key = g_strndup(pattern, key_len);
+        matcher = g_hash_table_lookup(self->buckets, key);
+        if (!matcher) {
+                matcher = ldm_modalias_matcher_new();
+                g_hash_table_insert(self->buckets, g_steal_pointer(&key), matcher);
+        }
+
+        ldm_modalias_matcher_add(matcher, pattern + key_len, id);
+}
+
+/**
+ * ldm_modalias_index_match_typed:
+ *
+ * Test the compiled rules against the modalias. Decoded modaliases only need
+ * to visit the buckets for their own keys, whereas anything on a known bus
+ * that we failed to decode has to go through fnmatch to remain correct.
+ */
+static gboolean ldm_modalias_index_match_typed(LdmModaliasIndex *self, const gchar *subject,
+                                               const LdmModaliasFields *fields, GArray *ids)
+{
+        LdmModaliasBus bus = LDM_MODALIAS_BUS_NONE;
+        GArray *candidates = NULL;
+        gboolean ret = FALSE;
+
+        if (!ldm_modalias_fields_has_ids(fields)) {
+                bus = ldm_modalias_bus_for_prefix(subject);
+                candidates = self->typed_by_bus[bus];
+
+                for (guint i = 0; i < candidates->len; i++) {
+                        LdmIndexRule *rule = &g_array_index(self->rules,
+                                                            LdmIndexRule,
+                                                            g_array_index(candidates, guint, i));
+
+                        if (fnmatch(rule->pattern, subject, 0) != 0) {
+                                continue;
+                        }
+                        ret = TRUE;
+                        if (ids) {
+                                g_array_append_val(ids, rule->id);
+                        }
+                }
+
+                return ret;
+        }
+
+        for (guint level = 0; level < LDM_MODALIAS_KEY_LEVELS; level++) {
+                guint64 key = ldm_modalias_key(fields->bus, fields->ids, level);
+
+                candidates = g_hash_table_lookup(self->typed, &key);
+                if (!candidates) {
+                        continue;
+                }
+
+                for (guint i = 0; i < candidates->len; i++) {
+                        LdmIndexRule *rule = &g_array_index(self->rules,
+                                                            LdmIndexRule,
+                                                            g_array_index(candidates, guint, i));
+
+                        if (!ldm_modalias_rule_matches(&rule->rule, fields)) {
+                                continue;
+                        }
+                        ret = TRUE;
+                        if (ids) {
+                                g_array_append_val(ids, rule->id);
+                        }
+                }
+        }
+
+        return ret;
+}
+
+/**
+ * ldm_modalias_index_match_fields:
+ * @subject: The string to test, i.e. a device modalias
+ * @fields: @subject decoded by #ldm_modalias_fields_decode
+ * @ids: (element-type guint) (nullable): Storage for the matching IDs
+ *
+ * Probe the buckets for each key of the subject, along with the fallback
+ * bucket. Rules for other vendors or devices are never evaluated.
+ *
+ * Returns: TRUE if any pattern matched the subject
+ */
+gboolean ldm_modalias_index_match_fields(LdmModaliasIndex *self, const gchar *subject,
+                                         const LdmModaliasFields *fields, GArray *ids)
+{
+        gsize levels[LDM_INDEX_LEVELS] = { 0 };
+        gchar key[LDM_INDEX_BUS_MAX + 32];
+        guint n_levels = 0;
+        gboolean ret = FALSE;
+
+        g_return_val_if_fail(self != NULL, FALSE);
+        g_return_val_if_fail(subject != NULL, FALSE);
+        g_return_val_if_fail(fields != NULL, FALSE);
+
+        if (self->rules->len > 0 && ldm_modalias_index_match_typed(self, subject, fields, ids)) {
+                ret = TRUE;
+        }
+
+        n_levels = ldm_modalias_index_levels(subject, strlen(subject), levels);
+
+        for (guint i = 0; i < n_levels; i++) {
+                LdmModaliasMatcher *matcher = NULL;
+
+                g_assert(levels[i] < sizeof(key));
+                memcpy(key, subject, levels[i]);
+                key[levels[i]] = '\0';
+
+                matcher = g_hash_table_lookup(self->buckets, key);
+                if (matcher && ldm_modalias_matcher_match(matcher, subject + levels[i], ids)) {
+                        ret = TRUE;
+                }
+        }
+
+        if (ldm_modalias_matcher_match(self->fallback, subject, ids)) {
+                ret = TRUE;
+        }
+
+        return ret;
+}
+
+/**
+ * ldm_modalias_index_match:
+ * @subject: The string to test, i.e. a device modalias
+ * @ids: (element-type guint) (nullable): Storage for the matching IDs
+ *
+ * Convenience wrapper around #ldm_modalias_index_match_fields for when the
+ * subject hasn't already been decoded.
+ *
+ * Returns: TRUE if any pattern matched the subject
+ */
+gboolean ldm_modalias_index_match(LdmModaliasIndex *self, const gchar *subject, GArray *ids)
+{
+        LdmModaliasFields fields = { 0 };
+
+        g_return_val_if_fail(subject != NULL, FALSE);
+
+        ldm_modalias_fields_decode(subject, &fields);
+        return ldm_modalias_index_match_fields(self, subject, &fields, ids);
+}
+
+/*
+ * Editor modelines  -  https://www.wireshark.org/tools/modelines.html
+ *
+ * Local variables:
+ * c-basic-offset: 8
+ * tab-width: 8
+ * indent-tabs-mode: nil
+ * End:
+ *
+ * vi: set shiftwidth=8 tabstop=8 expandtab:
+ * :indentSize=8:tabSize=8:noTabs=true:
+ */
@@ -0,0 +1,52 @@
+/*
+ * This file is part of linux-driver-management.
+ *
+ * Copyright © 2016-2018 Ikey Doherty
+ *
+ * linux-driver-management is free software; you can redistribute it and/or
+ * modify it under the terms of the GNU Lesser General Public License as
+ * published by the Free Software Foundation; either version 2.1
+ * of the License, or (at your option) any later version.
+ */
+
+#pragma once
+
+#include <glib.h>
+
+#include "modalias-fields.h"
+#include "util.h"
+
+/*
+ * LdmModaliasIndex
+ *
+ * Private rule index used by the modalias plugins. Patterns are bucketed by
+ * their literal prefix (bus, then vendor, then device ID when these are not
+ * wildcarded) so that a subject is only tested against the rules that could
+ * possibly match it. Regular patterns are compiled into integer rules keyed
+ * on the decoded IDs, and each string bucket owns a compiled matcher for the
+ * remainder of its patterns.
+ */
+typedef struct _LdmModaliasIndex LdmModaliasIndex;
+
+LdmModaliasIndex *ldm_modalias_index_new(void);
+void ldm_modalias_index_free(LdmModaliasIndex *index);
+
+void ldm_modalias_index_add(LdmModaliasIndex *index, const gchar *pattern, guint id);
+gboolean ldm_modalias_index_match(LdmModaliasIndex *index, const gchar *subject, GArray *ids);
+gboolean ldm_modalias_index_match_fields(LdmModaliasIndex *index, const gchar *subject,
+                                         const LdmModaliasFields *fields, GArray *ids);
+
+DEF_AUTOFREE(LdmModaliasIndex, ldm_modalias_index_free)
+
+/*
+ * Editor modelines  -  https://www.wireshark.org/tools/modelines.html
+ *
+ * Local variables:
+ * c-basic-offset: 8
+ * tab-width: 8
+ * indent-tabs-mode: nil
+ * End:
+ *
+ * vi: set shiftwidth=8 tabstop=8 expandtab:
+ * :indentSize=8:tabSize=8:noTabs=true:
+ */
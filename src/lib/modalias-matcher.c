@@ -0,0 +1,372 @@
+/*
+ * This file is part of linux-driver-management.
+ *
+ * Copyright © 2016-2018 Ikey Doherty
+ *
+ * linux-driver-management is free software; you can redistribute it and/or
+ * modify it under the terms of the GNU Lesser General Public License as
+ * published by the Free Software Foundation; either version 2.1
+ * of the License, or (at your option) any later version.
+ */
+
+#define _GNU_SOURCE
+
+#include <fnmatch.h>
+#include <string.h>
+
+#include "modalias-matcher.h"
+
+/* Edge labels beyond the byte range */
+#define LDM_MATCHER_LABEL_ANY 256  /* `?` */
+#define LDM_MATCHER_LABEL_STAR 257 /* `*` */
+
+#define LDM_MATCHER_NONE G_MAXUINT32
+
+/* How many states we track before spilling the state set to the heap */
+#define LDM_MATCHER_STACK_STATES 64
+
+/*
+ * A single trie node. Children are kept as a singly linked sibling list as
+ * most nodes only have a single child, with real fan-out only happening on
+ * the hex digits of the vendor and device IDs.
+ */
+typedef struct LdmMatcherNode {
+        guint32 label;    /* Byte, or one of the LDM_MATCHER_LABEL_* values */
+        guint32 child;    /* First child */
+        guint32 sibling;  /* Next sibling */
+        guint32 terminal; /* Head of our terminal list if a pattern ends here */
+} LdmMatcherNode;
+
+/*
+ * Chain of pattern IDs ending at a given node.
+ */
+typedef struct LdmMatcherTerminal {
+        guint32 id;
+        guint32 next;
+} LdmMatcherTerminal;
+
+/*
+ * Patterns using bracket expressions or escapes are left to fnmatch.
+ */
+typedef struct LdmMatcherFallback {
+        gchar *pattern;
+        guint id;
+} LdmMatcherFallback;
+
+/*
+ * Set of active trie states while walking the subject string.
+ */
+typedef struct LdmMatcherSet {
+        guint32 *states;
+        guint len;
+        guint alloc;
+        guint32 stack[LDM_MATCHER_STACK_STATES];
+} LdmMatcherSet;
+
+/*
+ * The trie is stored as flat arrays of indices rather than pointers, keeping
+ * the nodes contiguous in memory.
+ */
+struct _LdmModaliasMatcher {
+        GArray *nodes;     /* LdmMatcherNode, root is always 0 */
+        GArray *terminals; /* LdmMatcherTerminal */
+        GArray *fallback;  /* LdmMatcherFallback */
+};
+
+static inline LdmMatcherNode *ldm_matcher_node(LdmModaliasMatcher *self, guint32 index)
+{
+        return &g_array_index(self->nodes, LdmMatcherNode, index);
+}
+
+static guint32 ldm_matcher_node_new(LdmModaliasMatcher *self, guint32 label)
+{
+        LdmMatcherNode node = {
+                .label = label,
+                .child = LDM_MATCHER_NONE,
+                .sibling = LDM_MATCHER_NONE,
+                .terminal = LDM_MATCHER_NONE,
+        };
+
+        g_array_append_val(self->nodes, node);
+        return self->nodes->len - 1;
+}
+
+static void ldm_matcher_fallback_clear(gpointer v)
+{
+        LdmMatcherFallback *fallback = v;
+        g_free(fallback->pattern);
+}
+
+/**
+ * ldm_modalias_matcher_new:
+ *
+ * Construct a new, empty matcher.
+ *
+ * Returns: (transfer full): A newly allocated LdmModaliasMatcher
+ */
+LdmModaliasMatcher *ldm_modalias_matcher_new(void)
+{
+        LdmModaliasMatcher *self = NULL;
+
+        self = g_new0(LdmModaliasMatcher, 1);
+        self->nodes = g_array_new(FALSE, FALSE, sizeof(LdmMatcherNode));
+        self->terminals = g_array_new(FALSE, FALSE, sizeof(LdmMatcherTerminal));
+        self->fallback = g_array_new(FALSE, FALSE, sizeof(LdmMatcherFallback));
+        g_array_set_clear_func(self->fallback, ldm_matcher_fallback_clear);
+
+        /* Root node */
+        ldm_matcher_node_new(self, 0);
+
+        return self;
+}
+
+/**
+ * ldm_modalias_matcher_free:
+ *
+ * Free a previously allocated matcher.
+ */
+void ldm_modalias_matcher_free(LdmModaliasMatcher *self)
+{
+        if (!self) {
+                return;
+        }
+        g_array_unref(self->nodes);
+        g_array_unref(self->terminals);
+        g_array_unref(self->fallback);
+        g_free(self);
+}
+
+/**
+ * ldm_matcher_get_child:
+ *
+ * Find the child of @parent with the given label, creating it if needed.
+ */
+static guint32 ldm_matcher_get_child(LdmModaliasMatcher *self, guint32 parent, guint32 label)
+{
+        guint32 child = 0;
+        guint32 new_child = 0;
+
+        for (child = ldm_matcher_node(self, parent)->child; child != LDM_MATCHER_NONE;
+             child = ldm_matcher_node(self, child)->sibling) {
+                if (ldm_matcher_node(self, child)->label == label) {
+                        return child;
+                }
+        }
+
+        /* Appending may reallocate the node array, so only grab pointers after */
+        new_child = ldm_matcher_node_new(self, label);
+        ldm_matcher_node(self, new_child)->sibling = ldm_matcher_node(self, parent)->child;
+        ldm_matcher_node(self, parent)->child = new_child;
+
+        return new_child;
+}
+
+/**
+ * ldm_modalias_matcher_add:
+ * @pattern: fnmatch style pattern
+ * @id: Caller defined ID reported when @pattern matches
+ *
+ * Compile the pattern into the matcher. Simple globs (`*` and `?`) are merged
+ * into the trie, whereas anything needing bracket expressions or escapes is
+ * kept aside and tested with fnmatch.
+ */
+void ldm_modalias_matcher_add(LdmModaliasMatcher *self, const gchar *pattern, guint id)
+{
+        LdmMatcherTerminal terminal = { 0 };
+        guint32 node = 0;
+
+        g_return_if_fail(self != NULL);
+        g_return_if_fail(pattern != NULL);
+
+        if (strpbrk(pattern, "[\\") != NULL) {
+                LdmMatcherFallback fallback = {
+                        .pattern = g_strdup(pattern),
+                        .id = id,
+                };
+                g_array_append_val(self->fallback, fallback);
+                return;
+        }
+
+        for (const gchar *c = pattern; *c; c++) {
+                guint32 label = 0;
+
+                switch (*c) {
+                case '*':
+                        /* Consecutive stars are equivalent to a single one */
+                        if (ldm_matcher_node(self, node)->label == LDM_MATCHER_LABEL_STAR) {
+                                continue;
+                        }
+                        label = LDM_MATCHER_LABEL_STAR;
+                        break;
+                case '?':
+                        label = LDM_MATCHER_LABEL_ANY;
+                        break;
+                default:
+                        label = (guchar)*c;
+                        break;
+                }
+
+                node = ldm_matcher_get_child(self, node, label);
+        }
+
+        terminal.id = id;
+        terminal.next = ldm_matcher_node(self, node)->terminal;
+        g_array_append_val(self->terminals, terminal);
+        ldm_matcher_node(self, node)->terminal = self->terminals->len - 1;
+}
+
+static void ldm_matcher_set_init(LdmMatcherSet *set)
+{
+        set->states = set->stack;
+        set->len = 0;
+        set->alloc = LDM_MATCHER_STACK_STATES;
+}
+
+static void ldm_matcher_set_clear(LdmMatcherSet *set)
+{
+        if (set->states != set->stack) {
+                g_free(set->states);
+        }
+        ldm_matcher_set_init(set);
+}
+
+/**
+ * ldm_matcher_set_add:
+ *
+ * Add a state to the set, along with any star states reachable from it
+ * without consuming input (a star may match the empty string).
+ *
+ * State sets stay tiny in practice as only the patterns sharing the subject's
+ * literal prefix survive, so a linear membership test beats hashing here.
+ */
+static void ldm_matcher_set_add(LdmModaliasMatcher *self, LdmMatcherSet *set, guint32 state)
+{
+        for (guint i = 0; i < set->len; i++) {
+                if (set->states[i] == state) {
+                        return;
+                }
+        }
+
+        if (set->len == set->alloc) {
+                set->alloc *= 2;
+                if (set->states == set->stack) {
+                        set->states = g_new(guint32, set->alloc);
+                        memcpy(set->states, set->stack, sizeof(set->stack));
+                } else {
+                        set->states = g_renew(guint32, set->states, set->alloc);
+                }
+        }
+        set->states[set->len++] = state;
+
+        for (guint32 child = ldm_matcher_node(self, state)->child; child != LDM_MATCHER_NONE;
+             child = ldm_matcher_node(self, child)->sibling) {
+                if (ldm_matcher_node(self, child)->label == LDM_MATCHER_LABEL_STAR) {
+                        ldm_matcher_set_add(self, set, child);
+                }
+        }
+}
+
+/**
+ * ldm_modalias_matcher_match:
+ * @subject: The string to test, i.e. a device modalias
+ * @ids: (element-type guint) (nullable): Storage for the matching IDs
+ *
+ * Walk the subject string exactly once, advancing every live trie state in
+ * lockstep. Any pattern whose final state is live at the end of the string
+ * is a match, and its ID is appended to @ids.
+ *
+ * Returns: TRUE if any pattern matched the subject
+ */
+gboolean ldm_modalias_matcher_match(LdmModaliasMatcher *self, const gchar *subject, GArray *ids)
+{
+        LdmMatcherSet sets[2];
+        LdmMatcherSet *current = &sets[0];
+        LdmMatcherSet *next = &sets[1];
+        gboolean ret = FALSE;
+
+        g_return_val_if_fail(self != NULL, FALSE);
+        g_return_val_if_fail(subject != NULL, FALSE);
+
+        ldm_matcher_set_init(current);
+        ldm_matcher_set_init(next);
+
+        ldm_matcher_set_add(self, current, 0);
+
+        for (const gchar *c = subject; *c && current->len > 0; c++) {
+                guint32 label = (guchar)*c;
+                LdmMatcherSet *swap = NULL;
+
+                next->len = 0;
+
+                for (guint i = 0; i < current->len; i++) {
+                        guint32 state = current->states[i];
+
+                        /* Stars consume anything and stay put */
+                        if (ldm_matcher_node(self, state)->label == LDM_MATCHER_LABEL_STAR) {
+                                ldm_matcher_set_add(self, next, state);
+                        }
+
+                        for (guint32 child = ldm_matcher_node(self, state)->child;
+                             child != LDM_MATCHER_NONE;
+                             child = ldm_matcher_node(self, child)->sibling) {
+                                guint32 child_label = ldm_matcher_node(self, child)->label;
+
+                                if (child_label == label || child_label == LDM_MATCHER_LABEL_ANY) {
+                                        ldm_matcher_set_add(self, next, child);
+                                }
+                        }
+                }
+
+                swap = current;
+                current = next;
+                next = swap;
+        }
+
+        /* Collect the patterns that ended on a live state */
+        for (guint i = 0; i < current->len; i++) {
+                guint32 index = ldm_matcher_node(self, current->states[i])->terminal;
+
+                while (index != LDM_MATCHER_NONE) {
+                        LdmMatcherTerminal *terminal =
+                            &g_array_index(self->terminals, LdmMatcherTerminal, index);
+                        guint id = terminal->id;
+
+                        ret = TRUE;
+                        if (ids) {
+                                g_array_append_val(ids, id);
+                        }
+                        index = terminal->next;
+                }
+        }
+
+        ldm_matcher_set_clear(current);
+        ldm_matcher_set_clear(next);
+
+        /* Leftovers that the trie cannot express */
+        for (guint i = 0; i < self->fallback->len; i++) {
+                LdmMatcherFallback *fallback = &g_array_index(self->fallback, LdmMatcherFallback, i);
+
+                if (fnmatch(fallback->pattern, subject, 0) != 0) {
+                        continue;
+                }
+                ret = TRUE;
+                if (ids) {
+                        g_array_append_val(ids, fallback->id);
+                }
+        }
+
+        return ret;
+}
+
+/*
+ * Editor modelines  -  https://www.wireshark.org/tools/modelines.html
+ *
+ * Local variables:
+ * c-basic-offset: 8
+ * tab-width: 8
+ * indent-tabs-mode: nil
+ * End:
+ *
+ * vi: set shiftwidth=8 tabstop=8 expandtab:
+ * :indentSize=8:tabSize=8:noTabs=true:
+ */
@@ -0,0 +1,47 @@
+/*
+ * This file is part of linux-driver-management.
+ *
+ * Copyright © 2016-2018 Ikey Doherty
+ *
+ * linux-driver-management is free software; you can redistribute it and/or
+ * modify it under the terms of the GNU Lesser General Public License as
+ * published by the Free Software Foundation; either version 2.1
+ * of the License, or (at your option) any later version.
+ */
+
+#pragma once
+
+#include <glib.h>
+
+#include "util.h"
+
+/*
+ * LdmModaliasMatcher
+ *
+ * Private multi-pattern matcher used by the modalias plugins. Every pattern
+ * is compiled into a shared trie, with `*` and `?` encoded as special edges,
+ * so a subject string is tested against all patterns in a single pass.
+ */
+typedef struct _LdmModaliasMatcher LdmModaliasMatcher;
+
+LdmModaliasMatcher *ldm_modalias_matcher_new(void);
+void ldm_modalias_matcher_free(LdmModaliasMatcher *matcher);
+
+void ldm_modalias_matcher_add(LdmModaliasMatcher *matcher, const gchar *pattern, guint id);
+gboolean ldm_modalias_matcher_match(LdmModaliasMatcher *matcher, const gchar *subject,
+                                    GArray *ids);
+
+DEF_AUTOFREE(LdmModaliasMatcher, ldm_modalias_matcher_free)
+
+/*
+ * Editor modelines  -  https://www.wireshark.org/tools/modelines.html
+ *
+ * Local variables:
+ * c-basic-offset: 8
+ * tab-width: 8
+ * indent-tabs-mode: nil
+ * End:
+ *
+ * vi: set shiftwidth=8 tabstop=8 expandtab:
+ * :indentSize=8:tabSize=8:noTabs=true:
+ */
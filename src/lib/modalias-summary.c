@@ -0,0 +1,307 @@
+/*
+ * This file is part of linux-driver-management.
+ *
+ * Copyright © 2016-2018 Ikey Doherty
+ *
+ * linux-driver-management is free software; you can redistribute it and/or
+ * modify it under the terms of the GNU Lesser General Public License as
+ * published by the Free Software Foundation; either version 2.1
+ * of the License, or (at your option) any later version.
+ */
+
+#define _GNU_SOURCE
+
+#include <stdlib.h>
+#include <string.h>
+
+#include "modalias-summary.h"
+
+/* Longest bus name we'll record, i.e. `platform` */
+#define LDM_SUMMARY_BUS_MAX 24
+
+struct _LdmModaliasSummary {
+        gboolean any;             /* Rules without a literal bus */
+        GHashTable *buses;        /* Bus names with rules not keyed on the vendor */
+        GHashTable *vendor_buses; /* Bus names with rules keyed on the vendor */
+        GHashTable *vendors;      /* Bus and vendor packed as a guint64 */
+};
+
+static guint64 ldm_modalias_summary_vendor_key(LdmModaliasBus bus, guint32 vendor)
+{
+        return ((guint64)bus << 32) | vendor;
+}
+
+/**
+ * ldm_modalias_summary_bus_name:
+ * @s: Pattern or subject string
+ *
+ * Returns: (transfer full) (nullable): The literal bus name of @s, without
+ * the colon
+ */
+static gchar *ldm_modalias_summary_bus_name(const gchar *s)
+{
+        gsize literal_len = strcspn(s, "*?[\\");
+        const gchar *colon = memchr(s, ':', MIN(literal_len, LDM_SUMMARY_BUS_MAX));
+
+        if (!colon || colon == s) {
+                return NULL;
+        }
+        return g_strndup(s, (gsize)(colon - s));
+}
+
+/**
+ * ldm_modalias_summary_new:
+ *
+ * Construct a new summary admitting nothing.
+ *
+ * Returns: (transfer full): A newly allocated LdmModaliasSummary
+ */
+LdmModaliasSummary *ldm_modalias_summary_new(void)
+{
+        LdmModaliasSummary *self = NULL;
+
+        self = g_new0(LdmModaliasSummary, 1);
+        self->buses = g_hash_table_new_full(g_str_hash, g_str_equal, g_free, NULL);
+        self->vendor_buses = g_hash_table_new_full(g_str_hash, g_str_equal, g_free, NULL);
+        self->vendors = g_hash_table_new_full(g_int64_hash, g_int64_equal, g_free, NULL);
+
+        return self;
+}
+
+/**
+ * ldm_modalias_summary_free:
+ *
+ * Free a previously allocated summary.
+ */
+void ldm_modalias_summary_free(LdmModaliasSummary *self)
+{
+        if (!self) {
+                return;
+        }
+        g_hash_table_unref(self->buses);
+        g_hash_table_unref(self->vendor_buses);
+        g_hash_table_unref(self->vendors);
+        g_free(self);
+}
+
+static void ldm_modalias_summary_add_vendor(LdmModaliasSummary *self, LdmModaliasBus bus,
+                                            guint32 vendor)
+{
+        guint64 *key = g_new(guint64, 1);
+        const gchar *prefix = ldm_modalias_bus_get_prefix(bus);
+
+        *key = ldm_modalias_summary_vendor_key(bus, vendor);
+        g_hash_table_add(self->vendors, key);
+        g_hash_table_add(self->vendor_buses, g_strndup(prefix, strlen(prefix) - 1));
+}
+
+/**
+ * ldm_modalias_summary_add:
+ * @pattern: fnmatch style pattern
+ *
+ * Widen the summary so that it admits every modalias @pattern could match.
+ */
+void ldm_modalias_summary_add(LdmModaliasSummary *self, const gchar *pattern)
+{
+        g_autoptr(GPtrArray) expanded = NULL;
+        LdmModaliasRule rule = { 0 };
+        gchar *bus = NULL;
+
+        g_return_if_fail(self != NULL);
+        g_return_if_fail(pattern != NULL);
+
+        /* Summarise runs merged into bracket expressions by what they stand for */
+        expanded = ldm_modalias_pattern_expand(pattern);
+        if (expanded) {
+                for (guint i = 0; i < expanded->len; i++) {
+                        ldm_modalias_summary_add(self, expanded->pdata[i]);
+                }
+                return;
+        }
+
+        if (ldm_modalias_rule_compile(pattern, &rule) && ldm_modalias_rule_key_level(&rule) > 0) {
+                ldm_modalias_summary_add_vendor(self,
+                                                rule.bus,
+                                                ldm_modalias_vendor(rule.bus, rule.values));
+                return;
+        }
+
+        bus = ldm_modalias_summary_bus_name(pattern);
+        if (!bus) {
+                self->any = TRUE;
+                return;
+        }
+        g_hash_table_add(self->buses, bus);
+}
+
+static gint ldm_modalias_summary_sort_tokens(gconstpointer a, gconstpointer b)
+{
+        return strcmp(*(const gchar **)a, *(const gchar **)b);
+}
+
+/**
+ * ldm_modalias_summary_to_string:
+ *
+ * Serialise the summary into the header line for a `.modaliases` file, with
+ * tokens sorted so the output is stable.
+ *
+ * Returns: (transfer full): The summary line, without a trailing newline
+ */
+gchar *ldm_modalias_summary_to_string(LdmModaliasSummary *self)
+{
+        g_autoptr(GPtrArray) tokens = NULL;
+        GString *ret = NULL;
+        GHashTableIter iter = { 0 };
+        gpointer key = NULL;
+
+        g_return_val_if_fail(self != NULL, NULL);
+
+        tokens = g_ptr_array_new_with_free_func(g_free);
+
+        g_hash_table_iter_init(&iter, self->vendors);
+        while (g_hash_table_iter_next(&iter, &key, NULL)) {
+                guint64 vendor_key = *(guint64 *)key;
+                LdmModaliasBus bus = (LdmModaliasBus)(vendor_key >> 32);
+                guint32 vendor = (guint32)(vendor_key & G_MAXUINT32);
+
+                g_ptr_array_add(tokens,
+                                g_strdup_printf("%s%X", ldm_modalias_bus_get_prefix(bus), vendor));
+        }
+
+        g_hash_table_iter_init(&iter, self->buses);
+        while (g_hash_table_iter_next(&iter, &key, NULL)) {
+                g_ptr_array_add(tokens, g_strdup_printf("%s:*", (const gchar *)key));
+        }
+
+        if (self->any) {
+                g_ptr_array_add(tokens, g_strdup("*"));
+        }
+
+        g_ptr_array_sort(tokens, ldm_modalias_summary_sort_tokens);
+
+        ret = g_string_new(LDM_MODALIAS_SUMMARY_PREFIX);
+        for (guint i = 0; i < tokens->len; i++) {
+                g_string_append_c(ret, ' ');
+                g_string_append(ret, tokens->pdata[i]);
+        }
+
+        return g_string_free(ret, FALSE);
+}
+
+/**
+ * ldm_modalias_summary_parse_token:
+ *
+ * Anything we don't understand admits everything, so a newer or damaged
+ * summary can never hide a match.
+ */
+static void ldm_modalias_summary_parse_token(LdmModaliasSummary *self, const gchar *token)
+{
+        LdmModaliasBus bus = ldm_modalias_bus_for_prefix(token);
+        const gchar *colon = strchr(token, ':');
+        gchar *end = NULL;
+        guint64 vendor = 0;
+
+        if (!colon || colon == token || g_str_equal(token, "*")) {
+                self->any = TRUE;
+                return;
+        }
+
+        if (g_str_equal(colon + 1, "*")) {
+                g_hash_table_add(self->buses, g_strndup(token, (gsize)(colon - token)));
+                return;
+        }
+
+        if (bus == LDM_MODALIAS_BUS_NONE || !g_ascii_isxdigit(colon[1])) {
+                self->any = TRUE;
+                return;
+        }
+
+        vendor = g_ascii_strtoull(colon + 1, &end, 16);
+        if (*end != '\0' || vendor > G_MAXUINT32) {
+                self->any = TRUE;
+                return;
+        }
+
+        ldm_modalias_summary_add_vendor(self, bus, (guint32)vendor);
+}
+
+/**
+ * ldm_modalias_summary_parse:
+ * @line: First line of a `.modaliases` file
+ *
+ * Returns: (transfer full) (nullable): The summary, or NULL if @line isn't one
+ */
+LdmModaliasSummary *ldm_modalias_summary_parse(const gchar *line)
+{
+        LdmModaliasSummary *self = NULL;
+        g_auto(GStrv) tokens = NULL;
+
+        g_return_val_if_fail(line != NULL, NULL);
+
+        if (!g_str_has_prefix(line, LDM_MODALIAS_SUMMARY_PREFIX)) {
+                return NULL;
+        }
+
+        self = ldm_modalias_summary_new();
+        tokens = g_strsplit(line + strlen(LDM_MODALIAS_SUMMARY_PREFIX), " ", -1);
+        for (guint i = 0; tokens[i]; i++) {
+                g_strstrip(tokens[i]);
+                if (*tokens[i] == '\0') {
+                        continue;
+                }
+                ldm_modalias_summary_parse_token(self, tokens[i]);
+        }
+
+        return self;
+}
+
+/**
+ * ldm_modalias_summary_admits:
+ * @subject: The device modalias
+ * @fields: @subject decoded by #ldm_modalias_fields_decode
+ *
+ * Returns: FALSE if no rule of the summarised file can match @subject
+ */
+gboolean ldm_modalias_summary_admits(LdmModaliasSummary *self, const gchar *subject,
+                                     const LdmModaliasFields *fields)
+{
+        g_autofree gchar *bus = NULL;
+
+        g_return_val_if_fail(self != NULL, TRUE);
+        g_return_val_if_fail(subject != NULL, TRUE);
+
+        if (self->any) {
+                return TRUE;
+        }
+
+        bus = ldm_modalias_summary_bus_name(subject);
+        if (!bus) {
+                return FALSE;
+        }
+        if (g_hash_table_contains(self->buses, bus)) {
+                return TRUE;
+        }
+
+        if (ldm_modalias_fields_has_ids(fields)) {
+                guint64 key = ldm_modalias_summary_vendor_key(fields->bus,
+                                                              ldm_modalias_vendor(fields->bus,
+                                                                                  fields->ids));
+                return g_hash_table_contains(self->vendors, &key);
+        }
+
+        /* Compiled rules still apply to a malformed subject via fnmatch */
+        return g_hash_table_contains(self->vendor_buses, bus);
+}
+
+/*
+ * Editor modelines  -  https://www.wireshark.org/tools/modelines.html
+ *
+ * Local variables:
+ * c-basic-offset: 8
+ * tab-width: 8
+ * indent-tabs-mode: nil
+ * End:
+ *
+ * vi: set shiftwidth=8 tabstop=8 expandtab:
+ * :indentSize=8:tabSize=8:noTabs=true:
+ */
@@ -0,0 +1,60 @@
+/*
+ * This file is part of linux-driver-management.
+ *
+ * Copyright © 2016-2018 Ikey Doherty
+ *
+ * linux-driver-management is free software; you can redistribute it and/or
+ * modify it under the terms of the GNU Lesser General Public License as
+ * published by the Free Software Foundation; either version 2.1
+ * of the License, or (at your option) any later version.
+ */
+
+#pragma once
+
+#include <glib.h>
+
+#include "modalias-fields.h"
+#include "util.h"
+
+/*
+ * LdmModaliasSummary
+ *
+ * Conservative description of the modaliases a `.modaliases` file may match,
+ * stored as a comment on its first line so it can be read without parsing
+ * the rest of the file:
+ *
+ *      `# ldm-summary: pci:10DE usb:* dmi:* *`
+ *
+ * `bus:VENDOR` covers rules with a literal vendor on a fixed layout bus,
+ * `bus:*` any rule on that bus, and a lone `*` rules without a literal bus.
+ * A file can only match a device if the summary admits one of its modaliases.
+ */
+
+#define LDM_MODALIAS_SUMMARY_PREFIX "# ldm-summary:"
+
+typedef struct _LdmModaliasSummary LdmModaliasSummary;
+
+LdmModaliasSummary *ldm_modalias_summary_new(void);
+void ldm_modalias_summary_free(LdmModaliasSummary *summary);
+
+void ldm_modalias_summary_add(LdmModaliasSummary *summary, const gchar *pattern);
+gchar *ldm_modalias_summary_to_string(LdmModaliasSummary *summary);
+LdmModaliasSummary *ldm_modalias_summary_parse(const gchar *line);
+
+gboolean ldm_modalias_summary_admits(LdmModaliasSummary *summary, const gchar *subject,
+                                     const LdmModaliasFields *fields);
+
+DEF_AUTOFREE(LdmModaliasSummary, ldm_modalias_summary_free)
+
+/*
+ * Editor modelines  -  https://www.wireshark.org/tools/modelines.html
+ *
+ * Local variables:
+ * c-basic-offset: 8
+ * tab-width: 8
+ * indent-tabs-mode: nil
+ * End:
+ *
+ * vi: set shiftwidth=8 tabstop=8 expandtab:
+ * :indentSize=8:tabSize=8:noTabs=true:
+ */
@@ -12,7 +12,10 @@
 #define _GNU_SOURCE
 
 #include <fnmatch.h>
+#include <string.h>
 
+#include "ldm-private.h"
+#include "modalias-fields.h"
 #include "modalias.h"
 #include "util.h"
 
@@ -63,6 +66,9 @@ struct _LdmModalias {
         /* What do we match? */
         gchar *match;
 
+        /* Integer form of match, if it follows a known modalias layout */
+        LdmModaliasRule rule;
+
         /* What kernel driver enables this? */
         gchar *driver;
 
@@ -160,6 +166,13 @@ static void ldm_modalias_set_property(GObject *object, guint id, const GValue *v
         case PROP_MATCH:
                 g_clear_pointer(&self->match, g_free);
                 self->match = g_value_dup_string(value);
+                /* Never leave the rule compiled from a previous match behind */
+                if (self->match) {
+                        ldm_modalias_rule_compile(self->match, &self->rule);
+                } else {
+                        memset(&self->rule, 0, sizeof(self->rule));
+                        self->rule.bus = LDM_MODALIAS_BUS_NONE;
+                }
                 break;
         case PROP_DRIVER:
                 g_clear_pointer(&self->driver, g_free);
@@ -200,8 +213,9 @@ static void ldm_modalias_get_property(GObject *object, guint id, GValue *value,
  *
  * Handle construction of the LdmModalias
  */
-static void ldm_modalias_init(__ldm_unused__ LdmModalias *self)
+static void ldm_modalias_init(LdmModalias *self)
 {
+        self->rule.bus = LDM_MODALIAS_BUS_NONE;
 }
 
 /**
@@ -284,40 +298,59 @@ gboolean ldm_modalias_matches(LdmModalias *self, const gchar *match_string)
         return fnmatch(self->match, match_string, 0) == 0 ? TRUE : FALSE;
 }
 
+/**
+ * ldm_modalias_matches_fields:
+ *
+ * Test a device modalias, using the decoded fields when both the modalias and
+ * our match follow a known layout, and fnmatch otherwise.
+ */
+static gboolean ldm_modalias_matches_fields(LdmModalias *self, const gchar *id,
+                                            const LdmModaliasFields *fields)
+{
+        /* Without a match there's nothing to compare against */
+        if (!self->match) {
+                return FALSE;
+        }
+        if (self->rule.bus != LDM_MODALIAS_BUS_NONE && ldm_modalias_fields_has_ids(fields)) {
+                return ldm_modalias_rule_matches(&self->rule, fields);
+        }
+        return ldm_modalias_matches(self, id);
+}
+
 /**
  * ldm_modalias_matches_device:
  * @match_device: An LdmDevice to test against
  *
  * This is a simple wrapper around #ldm_modalias_matches, and will simply pass
- * the device's #LdmDevice:modalias for testing.
+ * the device's #LdmDevice:modalias for testing. Common PCI, USB and HID
+ * matches are tested against the pre-decoded modalias as integers.
+ *
+ * The modaliases of all descendants (interfaces) are tested too, using the
+ * device's flattened view of its subtree.
  *
  * Returns: True if the match_device is indeed a match
  */
 gboolean ldm_modalias_matches_device(LdmModalias *self, LdmDevice *match_device)
 {
         g_return_val_if_fail(match_device != NULL, FALSE);
-        g_autoptr(GList) kids = NULL;
-        GList *elem = NULL;
+        GPtrArray *descendants = NULL;
         const gchar *id = NULL;
 
         /* Root match? */
         id = ldm_device_get_modalias(match_device);
-        if (id && ldm_modalias_matches(self, id)) {
+        if (id &&
+            ldm_modalias_matches_fields(self, id, ldm_device_get_modalias_fields(match_device))) {
                 return TRUE;
         }
 
-        /* Any kids? */
-        kids = ldm_device_get_children(match_device);
-        if (!kids) {
-                return FALSE;
-        }
-
         /* Try matching child devices (interfaces) */
-        for (elem = kids; elem; elem = elem->next) {
-                LdmDevice *child_device = NULL;
+        descendants = ldm_device_get_subtree_modaliases(match_device);
+        for (guint i = 0; i < descendants->len; i++) {
+                LdmDevice *child_device = descendants->pdata[i];
 
-                child_device = LDM_DEVICE(elem->data);
-                if (ldm_modalias_matches_device(self, child_device)) {
+                if (ldm_modalias_matches_fields(self,
+                                                child_device->os.modalias,
+                                                ldm_device_get_modalias_fields(child_device))) {
                         return TRUE;
                 }
         }
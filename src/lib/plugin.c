@@ -29,11 +29,12 @@
 struct _LdmPluginPrivate {
         gchar *name;
         gint priority;
+        gboolean thread_safe;
 };
 
 G_DEFINE_TYPE_WITH_PRIVATE(LdmPlugin, ldm_plugin, G_TYPE_INITIALLY_UNOWNED)
 
-enum { PROP_NAME = 1, PROP_PRIORITY, N_PROPS };
+enum { PROP_NAME = 1, PROP_PRIORITY, PROP_THREAD_SAFE, N_PROPS };
 
 static GParamSpec *obj_properties[N_PROPS] = {
         NULL,
@@ -98,6 +99,21 @@ static void ldm_plugin_class_init(LdmPluginClass *klazz)
                              0,
                              G_PARAM_READWRITE);
 
+        /**
+         * LdmPlugin:thread-safe
+         *
+         * Whether this plugin's get_provider may be called concurrently for
+         * different devices. This is the same promise as
+         * #LdmPluginClass.thread_safe, for plugins implemented through bindings
+         * that have no access to the class structure.
+         */
+        obj_properties[PROP_THREAD_SAFE] =
+            g_param_spec_boolean("thread-safe",
+                                 "Thread safe",
+                                 "Whether providers may be found on worker threads",
+                                 FALSE,
+                                 G_PARAM_READWRITE | G_PARAM_CONSTRUCT_ONLY);
+
         g_object_class_install_properties(obj_class, N_PROPS, obj_properties);
 }
 
@@ -114,6 +130,9 @@ static void ldm_plugin_set_property(GObject *object, guint id, const GValue *val
         case PROP_PRIORITY:
                 self->priv->priority = g_value_get_int(value);
                 break;
+        case PROP_THREAD_SAFE:
+                self->priv->thread_safe = g_value_get_boolean(value);
+                break;
         default:
                 G_OBJECT_WARN_INVALID_PROPERTY_ID(object, id, spec);
                 break;
@@ -131,6 +150,9 @@ static void ldm_plugin_get_property(GObject *object, guint id, GValue *value, GP
         case PROP_PRIORITY:
                 g_value_set_int(value, self->priv->priority);
                 break;
+        case PROP_THREAD_SAFE:
+                g_value_set_boolean(value, ldm_plugin_get_thread_safe(self));
+                break;
         default:
                 G_OBJECT_WARN_INVALID_PROPERTY_ID(object, id, spec);
                 break;
@@ -198,6 +220,21 @@ void ldm_plugin_set_priority(LdmPlugin *self, gint priority)
         g_object_set(self, "priority", priority, NULL);
 }
 
+/**
+ * ldm_plugin_get_thread_safe:
+ *
+ * Determine whether the #LdmManager may call this plugin from worker
+ * threads, either because its class says so or because it was constructed
+ * with #LdmPlugin:thread-safe set.
+ *
+ * Returns: TRUE if get_provider may be called concurrently
+ */
+gboolean ldm_plugin_get_thread_safe(LdmPlugin *self)
+{
+        g_return_val_if_fail(self != NULL, FALSE);
+        return LDM_PLUGIN_GET_CLASS(self)->thread_safe || self->priv->thread_safe;
+}
+
 /**
  * ldm_plugin_get_provider:
  *
@@ -28,14 +28,19 @@ typedef struct _LdmPluginClass LdmPluginClass;
  * LdmPluginClass:
  * @parent_class: The parent class
  * @get_provider: Virtual get_provider function
+ * @thread_safe: Set in class_init if get_provider may be called concurrently
+ * for different devices, allowing the #LdmManager to run it on worker threads.
+ * Plugins written through bindings set #LdmPlugin:thread-safe instead.
  */
 struct _LdmPluginClass {
         GInitiallyUnownedClass parent_class;
 
         LdmProvider *(*get_provider)(LdmPlugin *plugin, LdmDevice *device);
 
+        gboolean thread_safe;
+
         /*< private >*/
-        gpointer padding[12];
+        gpointer padding[11];
 };
 
 struct _LdmPlugin {
@@ -57,6 +62,7 @@ const gchar *ldm_plugin_get_name(LdmPlugin *plugin);
 void ldm_plugin_set_name(LdmPlugin *plugin, const gchar *name);
 gint ldm_plugin_get_priority(LdmPlugin *plugin);
 void ldm_plugin_set_priority(LdmPlugin *plugin, gint priority);
+gboolean ldm_plugin_get_thread_safe(LdmPlugin *plugin);
 
 LdmProvider *ldm_plugin_get_provider(LdmPlugin *self, LdmDevice *device);
 
@@ -0,0 +1,41 @@
+/*
+ * This file is part of linux-driver-management.
+ *
+ * Copyright © 2016-2018 Ikey Doherty
+ *
+ * linux-driver-management is free software; you can redistribute it and/or
+ * modify it under the terms of the GNU Lesser General Public License as
+ * published by the Free Software Foundation; either version 2.1
+ * of the License, or (at your option) any later version.
+ */
+
+#pragma once
+
+#include "modalias-db.h"
+#include "modalias-plugin.h"
+
+/* Private modalias plugin API */
+LdmPlugin *ldm_modalias_plugin_new_from_db(LdmModaliasDb *db, guint source);
+guint ldm_modalias_plugin_get_n_rules(LdmModaliasPlugin *self);
+const gchar *ldm_modalias_plugin_get_rule_match(LdmModaliasPlugin *self, guint rule);
+const gchar *ldm_modalias_plugin_get_rule_package(LdmModaliasPlugin *self, guint rule);
+LdmModaliasDb *ldm_modalias_plugin_get_db(LdmModaliasPlugin *self, guint *source);
+
+/* Lazily loaded plugins */
+LdmPlugin *ldm_modalias_plugin_new_lazy(const gchar *filename);
+gboolean ldm_modalias_plugin_is_loaded(LdmModaliasPlugin *self);
+void ldm_modalias_plugin_load(LdmModaliasPlugin *self);
+gboolean ldm_modalias_plugin_may_match(LdmModaliasPlugin *self, LdmDevice *device);
+
+/*
+ * Editor modelines  -  https://www.wireshark.org/tools/modelines.html
+ *
+ * Local variables:
+ * c-basic-offset: 8
+ * tab-width: 8
+ * indent-tabs-mode: nil
+ * End:
+ *
+ * vi: set shiftwidth=8 tabstop=8 expandtab:
+ * :indentSize=8:tabSize=8:noTabs=true:
+ */
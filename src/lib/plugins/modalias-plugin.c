@@ -16,8 +16,15 @@
 #include <stdio.h>
 #include <stdlib.h>
 #include <string.h>
+#include <sys/stat.h>
 #include <unistd.h>
 
+#include "ldm-private.h"
+#include "modalias-db.h"
+#include "modalias-file.h"
+#include "modalias-index.h"
+#include "modalias-summary.h"
+#include "modalias-plugin-private.h"
 #include "modalias-plugin.h"
 #include "util.h"
 
@@ -26,6 +33,9 @@ struct _LdmModaliasPluginClass {
 };
 
 static LdmProvider *ldm_modalias_plugin_get_provider(LdmPlugin *plugin, LdmDevice *device);
+static void ldm_modalias_plugin_add_rule(LdmModaliasPlugin *self, const gchar *match,
+                                         const gchar *driver, const gchar *package,
+                                         LdmModalias *modalias);
 
 /**
  * SECTION:modalias-plugin
@@ -60,11 +70,45 @@ static LdmProvider *ldm_modalias_plugin_get_provider(LdmPlugin *plugin, LdmDevic
  * it requires `wl.ko` to operate correctly (or to enhance it). The user can find
  * `wl.ko` in the `broadcom-sta` package.
  */
+/*
+ * Compact form of a rule, with all strings owned by the plugin arena
+ */
+typedef struct LdmModaliasRecord {
+        const gchar *match;
+        const gchar *driver;  /* Interned */
+        const gchar *package; /* Interned */
+} LdmModaliasRecord;
+
 struct _LdmModaliasPlugin {
         LdmPlugin parent;
 
-        /* Our known modalias implementations */
+        /* Storage for every rule string. Driver and package names are
+         * interned, as a file rarely has more than a handful of each. */
+        GStringChunk *strings;
+
+        /* Map match string (owned by the arena) to rule ID */
         GHashTable *modaliases;
+
+        /* Our known modalias rules, indexed by rule ID */
+        GArray *rules;
+
+        /* LdmModalias objects by rule ID, only created when one was added
+         * or has been requested through the API */
+        GHashTable *objects;
+
+        /* Rule patterns bucketed by bus, vendor and device. This is only
+         * built when the plugin is queried directly, as the LdmManager keeps
+         * its own index spanning all modalias plugins. */
+        LdmModaliasIndex *index;
+
+        /* Precompiled rules, which always precede the ones above */
+        LdmModaliasDb *db;
+        guint db_source;
+
+        /* Lazily loaded plugins keep the path until first needed, along
+         * with the summary of what the file may match, if it has one. */
+        gchar *filename;
+        LdmModaliasSummary *summary;
 };
 
 G_DEFINE_TYPE(LdmModaliasPlugin, ldm_modalias_plugin, LDM_TYPE_PLUGIN)
@@ -79,6 +123,13 @@ static void ldm_modalias_plugin_dispose(GObject *obj)
         LdmModaliasPlugin *self = LDM_MODALIAS_PLUGIN(obj);
 
         g_clear_pointer(&self->modaliases, g_hash_table_unref);
+        g_clear_pointer(&self->rules, g_array_unref);
+        g_clear_pointer(&self->objects, g_hash_table_unref);
+        g_clear_pointer(&self->strings, g_string_chunk_free);
+        g_clear_pointer(&self->index, ldm_modalias_index_free);
+        g_clear_pointer(&self->db, ldm_modalias_db_unref);
+        g_clear_pointer(&self->filename, g_free);
+        g_clear_pointer(&self->summary, ldm_modalias_summary_free);
 
         G_OBJECT_CLASS(ldm_modalias_plugin_parent_class)->dispose(obj);
 }
@@ -107,8 +158,10 @@ static void ldm_modalias_plugin_class_init(LdmModaliasPluginClass *klazz)
  */
 static void ldm_modalias_plugin_init(LdmModaliasPlugin *self)
 {
-        /* Map name to modalias */
-        self->modaliases = g_hash_table_new_full(g_str_hash, g_str_equal, g_free, g_object_unref);
+        /* Map name to rule ID */
+        self->strings = g_string_chunk_new(4096);
+        self->modaliases = g_hash_table_new(g_str_hash, g_str_equal);
+        self->rules = g_array_new(FALSE, FALSE, sizeof(LdmModaliasRecord));
 }
 
 /**
@@ -124,6 +177,92 @@ LdmPlugin *ldm_modalias_plugin_new(const gchar *name)
         return g_object_new(LDM_TYPE_MODALIAS_PLUGIN, "name", name, "priority", 0, NULL);
 }
 
+/**
+ * ldm_modalias_plugin_new_from_db:
+ * @db: Precompiled modalias database
+ * @source: Index of the `.modaliases` file within @db
+ *
+ * Create a new LdmPlugin backed by one source file of a modalias database.
+ * The rules are used directly from the database without being parsed, and
+ * any modalias added later is only consulted after them.
+ *
+ * Returns: (transfer full): A newly initialised LdmModaliasPlugin
+ */
+LdmPlugin *ldm_modalias_plugin_new_from_db(LdmModaliasDb *db, guint source)
+{
+        LdmModaliasPlugin *ret = NULL;
+        g_autofree gchar *name = NULL;
+
+        g_return_val_if_fail(db != NULL, NULL);
+        g_return_val_if_fail(source < ldm_modalias_db_get_n_sources(db), NULL);
+
+        name = ldm_modalias_file_get_name(ldm_modalias_db_get_source_name(db, source));
+
+        ret = LDM_MODALIAS_PLUGIN(ldm_modalias_plugin_new(name));
+        ret->db = ldm_modalias_db_ref(db);
+        ret->db_source = source;
+
+        return LDM_PLUGIN(ret);
+}
+
+/*
+ * State for parsing one file line by line
+ */
+typedef struct LdmModaliasPluginLoad {
+        LdmModaliasPlugin *plugin;
+        GString *buffer; /* Reused for the columns of each rule */
+} LdmModaliasPluginLoad;
+
+/**
+ * ldm_modalias_plugin_load_line:
+ * @line: Start of the line within the file
+ * @len: Length of the line, excluding the newline
+ *
+ * Tokenize one line where it lies and add the rule.
+ */
+static gboolean ldm_modalias_plugin_load_line(const gchar *line, gsize len, gpointer v)
+{
+        LdmModaliasPluginLoad *load = v;
+        LdmModaliasSpan columns[4] = { 0 };
+        const gchar *rule[3] = { 0 };
+
+        if (!ldm_modalias_file_split_line(line, len, columns)) {
+                return TRUE;
+        }
+
+        if (!ldm_modalias_span_equal(&columns[0], "alias")) {
+                g_warning("unknown directive '%.*s'", (int)columns[0].len, columns[0].str);
+                return TRUE;
+        }
+
+        ldm_modalias_span_copy(&columns[1], G_N_ELEMENTS(rule), load->buffer, rule);
+        ldm_modalias_plugin_add_rule(load->plugin, rule[0], rule[1], rule[2], NULL);
+        return TRUE;
+}
+
+/**
+ * ldm_modalias_plugin_load_file:
+ * @filename: Path to a modaliases file
+ *
+ * Add each of the file's modaliases to the plugin. Plain files are mapped,
+ * compressed ones decoded a chunk at a time, and lines are tokenized where
+ * they lie. Only the rule columns pass through a single reused buffer, so
+ * the only allocations that last are the rule strings in the plugin arena,
+ * which the rule records and index point into.
+ *
+ * Returns: TRUE if the file could be read
+ */
+static gboolean ldm_modalias_plugin_load_file(LdmModaliasPlugin *self, const gchar *filename)
+{
+        g_autoptr(GString) buffer = g_string_sized_new(128);
+        LdmModaliasPluginLoad load = {
+                .plugin = self,
+                .buffer = buffer,
+        };
+
+        return ldm_modalias_file_foreach_line(filename, ldm_modalias_plugin_load_line, &load);
+}
+
 /**
  * ldm_modalias_plugin_new_from_filename:
  * @filename: Path to a modaliases file
@@ -131,14 +270,14 @@ LdmPlugin *ldm_modalias_plugin_new(const gchar *name)
  * Create a new LdmPlugin for modalias detection. The named file will be
  * opened and the resulting plugin will be seeded from that file.
  *
+ * The file may also be compressed as `.modaliases.gz` or `.modaliases.zst`,
+ * if the library was built with support for it, and is then decompressed
+ * as it is parsed rather than up front.
+ *
  * Returns: (transfer full): A newly initialised LdmModaliasPlugin
  */
 LdmPlugin *ldm_modalias_plugin_new_from_filename(const gchar *filename)
 {
-        FILE *fp = NULL;
-        char *bfr = NULL;
-        size_t n = 0;
-        ssize_t read = 0;
         LdmPlugin *ret = NULL;
         g_autofree gchar *path = NULL;
 
@@ -147,78 +286,209 @@ LdmPlugin *ldm_modalias_plugin_new_from_filename(const gchar *filename)
                 return NULL;
         }
 
-        fp = fopen(filename, "r");
-        if (!fp) {
-                fprintf(stderr, "Failed to open %s: %s\n", filename, strerror(errno));
+        path = ldm_modalias_file_get_name(filename);
+        ret = ldm_modalias_plugin_new(path);
+
+        if (!ldm_modalias_plugin_load_file(LDM_MODALIAS_PLUGIN(ret), filename)) {
+                g_object_unref(g_object_ref_sink(ret));
                 return NULL;
         }
 
-        /* Strip suffix if set */
-        path = g_path_get_basename(filename);
-        if (g_str_has_suffix(path, ".modaliases")) {
-                path[strlen(path) - strlen(".modaliases")] = '\0';
+        return ret;
+}
+
+static gboolean ldm_modalias_plugin_read_first_line(const gchar *line, gsize len, gpointer v)
+{
+        g_autofree gchar *first = g_strndup(line, len);
+
+        *(LdmModaliasSummary **)v = ldm_modalias_summary_parse(g_strstrip(first));
+        return FALSE;
+}
+
+/**
+ * ldm_modalias_plugin_read_summary:
+ *
+ * Only the first line is read, or decompressed, from the file.
+ *
+ * Returns: (transfer full) (nullable): The summary heading the file, if any
+ */
+static LdmModaliasSummary *ldm_modalias_plugin_read_summary(const gchar *filename)
+{
+        LdmModaliasSummary *ret = NULL;
+
+        ldm_modalias_file_foreach_line(filename, ldm_modalias_plugin_read_first_line, &ret);
+
+        return ret;
+}
+
+/**
+ * ldm_modalias_plugin_new_lazy:
+ * @filename: Path to a modaliases file
+ *
+ * Create a new LdmPlugin for the named file without parsing it. Only the
+ * summary line written by `mkmodaliases` is read up front, the rules are
+ * loaded the first time a device the summary admits is tested, or when a
+ * modalias is added to the plugin.
+ *
+ * Returns: (transfer full) (nullable): A newly initialised LdmModaliasPlugin
+ */
+LdmPlugin *ldm_modalias_plugin_new_lazy(const gchar *filename)
+{
+        LdmModaliasPlugin *ret = NULL;
+        g_autofree gchar *path = NULL;
+        struct stat st = { 0 };
+
+        g_return_val_if_fail(filename != NULL, NULL);
+        if (stat(filename, &st) != 0) {
+                return NULL;
         }
 
-        ret = ldm_modalias_plugin_new(path);
+        path = ldm_modalias_file_get_name(filename);
+        ret = LDM_MODALIAS_PLUGIN(ldm_modalias_plugin_new(path));
+
+        /* Nothing to load from an empty file */
+        if (st.st_size == 0) {
+                return LDM_PLUGIN(ret);
+        }
 
-        /* Walk the line. */
-        while ((read = getline(&bfr, &n, fp)) > 0) {
-                gchar *work = NULL;
-                gchar **splits = NULL;
-                LdmModalias *alias = NULL;
+        ret->filename = g_strdup(filename);
+        ret->summary = ldm_modalias_plugin_read_summary(filename);
 
-                /* Strip the newline from it */
-                if (bfr[read - 1] == '\n') {
-                        bfr[read - 1] = '\0';
-                        --read;
-                }
+        return LDM_PLUGIN(ret);
+}
 
-                /* Empty lines are uninteresting. */
-                if (read < 1) {
-                        continue;
-                }
+/**
+ * ldm_modalias_plugin_is_loaded:
+ *
+ * Returns: FALSE if the plugin still has to parse its file
+ */
+gboolean ldm_modalias_plugin_is_loaded(LdmModaliasPlugin *self)
+{
+        g_return_val_if_fail(self != NULL, TRUE);
+        return self->filename == NULL;
+}
 
-                work = g_strstrip(bfr);
+/**
+ * ldm_modalias_plugin_load:
+ *
+ * Parse the file of a lazily constructed plugin, if not already done.
+ */
+void ldm_modalias_plugin_load(LdmModaliasPlugin *self)
+{
+        g_autofree gchar *filename = NULL;
 
-                /* Comment? */
-                if (g_str_has_prefix(work, "#")) {
-                        goto next_line;
-                }
+        g_return_if_fail(self != NULL);
 
-                splits = g_strsplit(work, " ", 4);
-                if (!splits || g_strv_length(splits) != 4) {
-                        goto next_line;
-                }
+        if (!self->filename) {
+                return;
+        }
 
-                if (!g_str_equal(splits[0], "alias")) {
-                        g_warning("unknown directive '%s'", splits[0]);
-                        goto next_line;
-                }
+        /* Detach first, as loading adds modaliases through the public API */
+        filename = g_steal_pointer(&self->filename);
+        g_clear_pointer(&self->summary, ldm_modalias_summary_free);
 
-                alias = ldm_modalias_new(splits[1], splits[2], splits[3]);
-                if (!alias) {
-                        g_warning("invalid alias '%s'", work);
-                        goto next_line;
-                }
+        g_debug("loading modalias plugin %s", filename);
+        ldm_modalias_plugin_load_file(self, filename);
+}
+
+/**
+ * ldm_modalias_plugin_may_match:
+ * @device: Device to be tested
+ *
+ * Consult the summary of a plugin that hasn't been loaded yet to see if any
+ * of its rules could match the device, or one of its descendants.
+ *
+ * Returns: FALSE if the plugin can't possibly provide for the device
+ */
+gboolean ldm_modalias_plugin_may_match(LdmModaliasPlugin *self, LdmDevice *device)
+{
+        GPtrArray *descendants = NULL;
+
+        g_return_val_if_fail(self != NULL, FALSE);
+        g_return_val_if_fail(device != NULL, FALSE);
 
-                /* Add modalias. */
-                ldm_modalias_plugin_add_modalias(LDM_MODALIAS_PLUGIN(ret), alias);
+        if (!self->summary) {
+                return TRUE;
+        }
 
-        next_line:
-                if (splits) {
-                        g_strfreev(splits);
+        if (device->os.modalias &&
+            ldm_modalias_summary_admits(self->summary,
+                                        device->os.modalias,
+                                        ldm_device_get_modalias_fields(device))) {
+                return TRUE;
+        }
+
+        descendants = ldm_device_get_subtree_modaliases(device);
+        for (guint i = 0; i < descendants->len; i++) {
+                LdmDevice *descendant = descendants->pdata[i];
+
+                if (ldm_modalias_summary_admits(self->summary,
+                                                descendant->os.modalias,
+                                                ldm_device_get_modalias_fields(descendant))) {
+                        return TRUE;
                 }
-                free(bfr);
-                bfr = NULL;
         }
 
-        if (bfr) {
-                free(bfr);
+        return FALSE;
+}
+
+/**
+ * ldm_modalias_plugin_set_object:
+ * @modalias: (transfer full): Object representing the rule
+ */
+static void ldm_modalias_plugin_set_object(LdmModaliasPlugin *self, guint id,
+                                           LdmModalias *modalias)
+{
+        if (!self->objects) {
+                self->objects =
+                    g_hash_table_new_full(g_direct_hash, g_direct_equal, NULL, g_object_unref);
         }
+        g_hash_table_replace(self->objects, GUINT_TO_POINTER(id), modalias);
+}
 
-        fclose(fp);
+/**
+ * ldm_modalias_plugin_add_rule:
+ * @modalias: (transfer full) (nullable): Object for the rule, if we have one
+ *
+ * Store the rule in the arena, replacing any existing rule with the same
+ * match string while keeping its ID.
+ */
+static void ldm_modalias_plugin_add_rule(LdmModaliasPlugin *self, const gchar *match,
+                                         const gchar *driver, const gchar *package,
+                                         LdmModalias *modalias)
+{
+        LdmModaliasRecord record = {
+                .driver = driver ? g_string_chunk_insert_const(self->strings, driver) : NULL,
+                .package = package ? g_string_chunk_insert_const(self->strings, package) : NULL,
+        };
+        gpointer v = NULL;
+        guint id = 0;
+
+        /* Replacement keeps the already compiled pattern and its ID */
+        if (g_hash_table_lookup_extended(self->modaliases, match, NULL, &v)) {
+                id = GPOINTER_TO_UINT(v);
+                record.match = g_array_index(self->rules, LdmModaliasRecord, id).match;
+                g_array_index(self->rules, LdmModaliasRecord, id) = record;
+
+                /* Any object for the old rule no longer represents it */
+                if (modalias) {
+                        ldm_modalias_plugin_set_object(self, id, modalias);
+                } else if (self->objects) {
+                        g_hash_table_remove(self->objects, GUINT_TO_POINTER(id));
+                }
+                return;
+        }
 
-        return ret;
+        id = self->rules->len;
+        record.match = g_string_chunk_insert(self->strings, match);
+        g_array_append_val(self->rules, record);
+        g_hash_table_insert(self->modaliases, (gpointer)record.match, GUINT_TO_POINTER(id));
+        if (modalias) {
+                ldm_modalias_plugin_set_object(self, id, modalias);
+        }
+        if (self->index) {
+                ldm_modalias_index_add(self->index, record.match, id);
+        }
 }
 
 /**
@@ -227,49 +497,244 @@ LdmPlugin *ldm_modalias_plugin_new_from_filename(const gchar *filename)
  *
  * Add a new modalias object to the plugin table. This method will take a new
  * reference to the modalias.
+ *
+ * Adding a modalias with the same match string as an existing one will replace
+ * the existing modalias.
  */
 void ldm_modalias_plugin_add_modalias(LdmModaliasPlugin *self, LdmModalias *modalias)
 {
-        const gchar *id = NULL;
+        const gchar *match = NULL;
 
         g_return_if_fail(self != NULL);
         g_return_if_fail(modalias != NULL);
 
-        id = ldm_modalias_get_match(modalias);
-        g_assert(id != NULL);
+        match = ldm_modalias_get_match(modalias);
+        g_assert(match != NULL);
+
+        /* Keep the file's rules ahead of any added at runtime */
+        ldm_modalias_plugin_load(self);
 
-        g_hash_table_replace(self->modaliases, g_strdup(id), g_object_ref_sink(modalias));
+        g_object_ref_sink(modalias);
+        ldm_modalias_plugin_add_rule(self,
+                                     match,
+                                     ldm_modalias_get_driver(modalias),
+                                     ldm_modalias_get_package(modalias),
+                                     modalias);
+}
+
+/**
+ * ldm_modalias_plugin_get_modalias:
+ * @match: The match string of the rule
+ *
+ * Look up the modalias rule with the given match string. Rules loaded from a
+ * file are stored in a compact form, and the #LdmModalias is only constructed
+ * the first time it is requested.
+ *
+ * Returns: (transfer none) (nullable): The modalias, or NULL if not found
+ */
+LdmModalias *ldm_modalias_plugin_get_modalias(LdmModaliasPlugin *self, const gchar *match)
+{
+        LdmModaliasRecord *record = NULL;
+        LdmModalias *ret = NULL;
+        gpointer v = NULL;
+        guint id = 0;
+
+        g_return_val_if_fail(self != NULL, NULL);
+        g_return_val_if_fail(match != NULL, NULL);
+
+        ldm_modalias_plugin_load(self);
+
+        if (!g_hash_table_lookup_extended(self->modaliases, match, NULL, &v)) {
+                return NULL;
+        }
+        id = GPOINTER_TO_UINT(v);
+
+        if (self->objects) {
+                ret = g_hash_table_lookup(self->objects, GUINT_TO_POINTER(id));
+                if (ret) {
+                        return ret;
+                }
+        }
+
+        record = &g_array_index(self->rules, LdmModaliasRecord, id);
+        ret = g_object_ref_sink(ldm_modalias_new(record->match, record->driver, record->package));
+        ldm_modalias_plugin_set_object(self, id, ret);
+
+        return ret;
+}
+
+/**
+ * ldm_modalias_plugin_get_n_rules:
+ *
+ * Returns: The number of modaliases added to the plugin, excluding those of
+ * its database. Rule IDs are allocated sequentially from zero.
+ */
+guint ldm_modalias_plugin_get_n_rules(LdmModaliasPlugin *self)
+{
+        g_return_val_if_fail(self != NULL, 0);
+        return self->rules->len;
+}
+
+/**
+ * ldm_modalias_plugin_get_rule_match:
+ * @rule: Rule ID, less than #ldm_modalias_plugin_get_n_rules
+ *
+ * Returns: (transfer none): The match string stored for the rule ID
+ */
+const gchar *ldm_modalias_plugin_get_rule_match(LdmModaliasPlugin *self, guint rule)
+{
+        g_return_val_if_fail(self != NULL, NULL);
+        g_return_val_if_fail(rule < self->rules->len, NULL);
+        return g_array_index(self->rules, LdmModaliasRecord, rule).match;
+}
+
+/**
+ * ldm_modalias_plugin_get_rule_package:
+ * @rule: Rule ID, less than #ldm_modalias_plugin_get_n_rules
+ *
+ * Returns: (transfer none): The package stored for the rule ID
+ */
+const gchar *ldm_modalias_plugin_get_rule_package(LdmModaliasPlugin *self, guint rule)
+{
+        g_return_val_if_fail(self != NULL, NULL);
+        g_return_val_if_fail(rule < self->rules->len, NULL);
+        return g_array_index(self->rules, LdmModaliasRecord, rule).package;
+}
+
+/**
+ * ldm_modalias_plugin_get_db:
+ * @source: (out): Index of our source file within the database
+ *
+ * Returns: (transfer none) (nullable): The database backing this plugin, if any
+ */
+LdmModaliasDb *ldm_modalias_plugin_get_db(LdmModaliasPlugin *self, guint *source)
+{
+        g_return_val_if_fail(self != NULL, NULL);
+        if (source) {
+                *source = self->db_source;
+        }
+        return self->db;
+}
+
+/**
+ * ldm_modalias_plugin_get_index:
+ *
+ * Build the rule index on first use.
+ */
+static LdmModaliasIndex *ldm_modalias_plugin_get_index(LdmModaliasPlugin *self)
+{
+        if (self->index) {
+                return self->index;
+        }
+
+        self->index = ldm_modalias_index_new();
+        for (guint i = 0; i < self->rules->len; i++) {
+                ldm_modalias_index_add(self->index,
+                                       g_array_index(self->rules, LdmModaliasRecord, i).match,
+                                       i);
+        }
+
+        return self->index;
+}
+
+/**
+ * ldm_modalias_plugin_match_modalias:
+ * @ids: Storage for the matching rule IDs
+ * @db_best: (inout): Best matching database rule so far
+ *
+ * Run a single device modalias through the database and the rule index.
+ */
+static void ldm_modalias_plugin_match_modalias(LdmModaliasPlugin *self, LdmModaliasIndex *index,
+                                               LdmDevice *device, GArray *ids, guint *db_best)
+{
+        const LdmModaliasFields *fields = ldm_device_get_modalias_fields(device);
+
+        if (self->db) {
+                ldm_modalias_db_match(self->db,
+                                      self->db_source,
+                                      device->os.modalias,
+                                      fields,
+                                      db_best);
+        }
+        ldm_modalias_index_match_fields(index, device->os.modalias, fields, ids);
+}
+
+/**
+ * ldm_modalias_plugin_match_device:
+ * @ids: Storage for the matching rule IDs
+ * @db_best: (inout): Best matching database rule so far
+ *
+ * Run the device modalias, and those of all of its descendants (interfaces),
+ * through the database and the rule index.
+ */
+static void ldm_modalias_plugin_match_device(LdmModaliasPlugin *self, LdmModaliasIndex *index,
+                                             LdmDevice *device, GArray *ids, guint *db_best)
+{
+        GPtrArray *descendants = ldm_device_get_subtree_modaliases(device);
+
+        if (device->os.modalias) {
+                ldm_modalias_plugin_match_modalias(self, index, device, ids, db_best);
+        }
+
+        for (guint i = 0; i < descendants->len; i++) {
+                ldm_modalias_plugin_match_modalias(self,
+                                                   index,
+                                                   descendants->pdata[i],
+                                                   ids,
+                                                   db_best);
+        }
 }
 
 /**
  * ldm_modalias_plugin_get_provider:
  * @device: Test input device
  *
- * Walk our modaliases and attempt to find a match from one of those lines. If
- * we match the device off against our table, return a new #LdmProvider to help
- * configure that device.
+ * Test the device against our indexed modalias table. Only rules sharing the
+ * device's bus, vendor or device prefix (and those starting with a wildcard)
+ * are evaluated. If we match the device, return a new #LdmProvider to help
+ * configure that device. When multiple rules match, the earliest added rule
+ * wins.
  *
  * Returns: (transfer full) (nullable): A new #LdmProvider for the device
  */
 static LdmProvider *ldm_modalias_plugin_get_provider(LdmPlugin *plugin, LdmDevice *device)
 {
         LdmModaliasPlugin *self = LDM_MODALIAS_PLUGIN(plugin);
-        LdmProvider *ret = NULL;
-        GHashTableIter iter = { 0 };
-        __ldm_unused__ gpointer key = NULL;
-        LdmModalias *modalias = NULL;
-
-        g_hash_table_iter_init(&iter, self->modaliases);
-        while (g_hash_table_iter_next(&iter, &key, (void **)&modalias)) {
-                if (!ldm_modalias_matches_device(modalias, device)) {
-                        continue;
-                }
+        g_autoptr(GArray) ids = NULL;
+        guint db_best = G_MAXUINT;
+        guint best = G_MAXUINT;
+
+        if (!ldm_modalias_plugin_may_match(self, device)) {
+                return NULL;
+        }
+        ldm_modalias_plugin_load(self);
+
+        ids = g_array_new(FALSE, FALSE, sizeof(guint));
+        ldm_modalias_plugin_match_device(self,
+                                         ldm_modalias_plugin_get_index(self),
+                                         device,
+                                         ids,
+                                         &db_best);
+
+        if (db_best != G_MAXUINT) {
+                return ldm_provider_new(plugin,
+                                        device,
+                                        ldm_modalias_db_get_package(self->db,
+                                                                    self->db_source,
+                                                                    db_best));
+        }
 
-                ret = ldm_provider_new(plugin, device, ldm_modalias_get_package(modalias));
-                return ret;
+        for (guint i = 0; i < ids->len; i++) {
+                best = MIN(best, g_array_index(ids, guint, i));
+        }
+
+        if (best == G_MAXUINT) {
+                return NULL;
         }
 
-        return NULL;
+        return ldm_provider_new(plugin,
+                                device,
+                                g_array_index(self->rules, LdmModaliasRecord, best).package);
 }
 
 /*
@@ -39,6 +39,7 @@ LdmPlugin *ldm_modalias_plugin_new(const gchar *name);
 LdmPlugin *ldm_modalias_plugin_new_from_filename(const gchar *filename);
 
 void ldm_modalias_plugin_add_modalias(LdmModaliasPlugin *driver, LdmModalias *modalias);
+LdmModalias *ldm_modalias_plugin_get_modalias(LdmModaliasPlugin *driver, const gchar *match);
 
 G_END_DECLS
 
@@ -0,0 +1,348 @@
+/*
+ * This file is part of linux-driver-management.
+ *
+ * Copyright © 2016-2018 Ikey Doherty
+ *
+ * linux-driver-management is free software; you can redistribute it and/or
+ * modify it under the terms of the GNU Lesser General Public License as
+ * published by the Free Software Foundation; either version 2.1
+ * of the License, or (at your option) any later version.
+ */
+
+#define _GNU_SOURCE
+
+#include <errno.h>
+#include <stdio.h>
+#include <stdlib.h>
+#include <string.h>
+#include <sys/stat.h>
+#include <unistd.h>
+
+#include "manifest.h"
+#include "optimize.h"
+
+#define MK_MANIFEST_GROUP "Manifest"
+#define MK_MANIFEST_VERSION 1
+
+struct MkManifest {
+        gchar *filename;
+        GKeyFile *keyfile; /* A group per module, named for its canonical path */
+        GMutex lock;       /* Guards everything below */
+        guint n_reused;
+        guint n_probed;
+        gboolean dirty;
+};
+
+/*
+ * What we know about a module on disk
+ */
+typedef struct MkManifestFile {
+        gchar *path; /* Canonical */
+        guint64 size;
+        gint64 mtime; /* Nanoseconds */
+} MkManifestFile;
+
+static void mk_manifest_file_clear(MkManifestFile *file)
+{
+        free(file->path);
+        file->path = NULL;
+}
+
+/**
+ * mk_manifest_file_init:
+ *
+ * Returns: TRUE if the module exists and its path can name a group
+ */
+static gboolean mk_manifest_file_init(MkManifestFile *file, const gchar *path)
+{
+        struct stat st = { 0 };
+
+        file->path = realpath(path, NULL);
+        if (!file->path || stat(file->path, &st) != 0) {
+                mk_manifest_file_clear(file);
+                return FALSE;
+        }
+        if (strpbrk(file->path, "[]\n")) {
+                mk_manifest_file_clear(file);
+                return FALSE;
+        }
+
+        file->size = (guint64)st.st_size;
+        file->mtime = (gint64)st.st_mtim.tv_sec * G_GINT64_CONSTANT(1000000000) +
+                      st.st_mtim.tv_nsec;
+        return TRUE;
+}
+
+/**
+ * mk_manifest_file_checksum:
+ *
+ * Returns: (transfer full) (nullable): SHA-256 of the module contents
+ */
+static gchar *mk_manifest_file_checksum(MkManifestFile *file)
+{
+        g_autoptr(GMappedFile) mapped = NULL;
+
+        mapped = g_mapped_file_new(file->path, FALSE, NULL);
+        if (!mapped) {
+                return NULL;
+        }
+
+        return g_compute_checksum_for_data(G_CHECKSUM_SHA256,
+                                           (const guchar *)g_mapped_file_get_contents(mapped),
+                                           g_mapped_file_get_length(mapped));
+}
+
+/**
+ * mk_manifest_load:
+ * @filename: Path of the manifest, which needn't exist yet
+ *
+ * Load the manifest, starting afresh if it's missing, unreadable or of
+ * another version. Probing everything again is always safe.
+ *
+ * Returns: (transfer full): A newly allocated MkManifest
+ */
+MkManifest *mk_manifest_load(const gchar *filename)
+{
+        g_autoptr(GError) error = NULL;
+        MkManifest *self = NULL;
+
+        self = g_new0(MkManifest, 1);
+        self->filename = g_strdup(filename);
+        self->keyfile = g_key_file_new();
+        g_mutex_init(&self->lock);
+
+        if (!g_key_file_load_from_file(self->keyfile, filename, G_KEY_FILE_NONE, &error)) {
+                if (!g_error_matches(error, G_FILE_ERROR, G_FILE_ERROR_NOENT)) {
+                        fprintf(stderr, "Ignoring manifest %s: %s\n", filename, error->message);
+                }
+        } else if (g_key_file_get_integer(self->keyfile, MK_MANIFEST_GROUP, "Version", NULL) !=
+                   MK_MANIFEST_VERSION) {
+                fprintf(stderr, "Ignoring manifest %s: unsupported version\n", filename);
+        } else {
+                return self;
+        }
+
+        g_key_file_unref(self->keyfile);
+        self->keyfile = g_key_file_new();
+        self->dirty = TRUE;
+
+        return self;
+}
+
+/**
+ * mk_manifest_free:
+ *
+ * Free the manifest without saving it.
+ */
+void mk_manifest_free(MkManifest *self)
+{
+        if (!self) {
+                return;
+        }
+        g_key_file_unref(self->keyfile);
+        g_mutex_clear(&self->lock);
+        g_free(self->filename);
+        g_free(self);
+}
+
+/**
+ * mk_manifest_lookup:
+ * @path: Kernel module about to be probed
+ * @aliases: (element-type MkAlias): Array to append the recorded aliases to
+ *
+ * A module whose size and mtime are as recorded is trusted outright. One
+ * whose mtime changed, as it does on every rebuild, is still reused if its
+ * contents hash the same.
+ *
+ * Returns: TRUE if the recorded aliases were appended, FALSE if the module
+ * must be probed
+ */
+gboolean mk_manifest_lookup(MkManifest *self, const gchar *path, const gchar *package_name,
+                            GPtrArray *aliases)
+{
+        MkManifestFile file = { 0 };
+        g_autofree gchar *recorded = NULL;
+        g_autofree gchar *checksum = NULL;
+        g_autofree gchar *name = NULL;
+        g_auto(GStrv) matches = NULL;
+        gboolean current = FALSE;
+
+        g_return_val_if_fail(self != NULL, FALSE);
+        g_return_val_if_fail(path != NULL, FALSE);
+
+        if (!mk_manifest_file_init(&file, path)) {
+                return FALSE;
+        }
+
+        g_mutex_lock(&self->lock);
+        if (g_key_file_has_group(self->keyfile, file.path) &&
+            g_key_file_get_uint64(self->keyfile, file.path, "Size", NULL) == file.size) {
+                current = g_key_file_get_int64(self->keyfile, file.path, "MTime", NULL) ==
+                          file.mtime;
+                recorded = g_key_file_get_string(self->keyfile, file.path, "SHA256", NULL);
+                name = g_key_file_get_string(self->keyfile, file.path, "Name", NULL);
+                matches = g_key_file_get_string_list(self->keyfile,
+                                                     file.path,
+                                                     "Aliases",
+                                                     NULL,
+                                                     NULL);
+        }
+        g_mutex_unlock(&self->lock);
+
+        if (!recorded || !name || !matches) {
+                mk_manifest_file_clear(&file);
+                return FALSE;
+        }
+
+        /* Hash outside the lock, it's the slow part */
+        if (!current) {
+                checksum = mk_manifest_file_checksum(&file);
+                if (!checksum || !g_str_equal(checksum, recorded)) {
+                        mk_manifest_file_clear(&file);
+                        return FALSE;
+                }
+        }
+
+        for (guint i = 0; matches[i]; i++) {
+                g_ptr_array_add(aliases, mk_alias_new(matches[i], name, package_name));
+        }
+
+        g_mutex_lock(&self->lock);
+        if (!current) {
+                g_key_file_set_int64(self->keyfile, file.path, "MTime", file.mtime);
+                self->dirty = TRUE;
+        }
+        ++self->n_reused;
+        g_mutex_unlock(&self->lock);
+
+        mk_manifest_file_clear(&file);
+        return TRUE;
+}
+
+/**
+ * mk_manifest_store:
+ * @path: Kernel module that was just probed
+ * @name: Name of the module, as used for the driver of each alias
+ * @aliases: (element-type MkAlias): Array the aliases were appended to
+ * @begin: Index of the first alias of this module in @aliases
+ *
+ * Record the aliases of a freshly probed module.
+ */
+void mk_manifest_store(MkManifest *self, const gchar *path, const gchar *name, GPtrArray *aliases,
+                       guint begin)
+{
+        MkManifestFile file = { 0 };
+        g_autofree gchar *checksum = NULL;
+        g_autofree const gchar **matches = NULL;
+
+        g_return_if_fail(self != NULL);
+        g_return_if_fail(path != NULL);
+        g_return_if_fail(name != NULL);
+        g_return_if_fail(aliases != NULL && begin <= aliases->len);
+
+        if (!mk_manifest_file_init(&file, path)) {
+                return;
+        }
+        checksum = mk_manifest_file_checksum(&file);
+        if (!checksum) {
+                mk_manifest_file_clear(&file);
+                return;
+        }
+
+        matches = g_new0(const gchar *, aliases->len - begin + 1);
+        for (guint i = begin; i < aliases->len; i++) {
+                matches[i - begin] = ((MkAlias *)aliases->pdata[i])->match;
+        }
+
+        g_mutex_lock(&self->lock);
+        g_key_file_remove_group(self->keyfile, file.path, NULL);
+        g_key_file_set_uint64(self->keyfile, file.path, "Size", file.size);
+        g_key_file_set_int64(self->keyfile, file.path, "MTime", file.mtime);
+        g_key_file_set_string(self->keyfile, file.path, "SHA256", checksum);
+        g_key_file_set_string(self->keyfile, file.path, "Name", name);
+        g_key_file_set_string_list(self->keyfile,
+                                   file.path,
+                                   "Aliases",
+                                   matches,
+                                   aliases->len - begin);
+        ++self->n_probed;
+        self->dirty = TRUE;
+        g_mutex_unlock(&self->lock);
+
+        mk_manifest_file_clear(&file);
+}
+
+/**
+ * mk_manifest_save:
+ *
+ * Atomically write the manifest back if anything changed, dropping the
+ * records of modules that no longer exist.
+ *
+ * Returns: TRUE if the manifest is up to date on disk
+ */
+gboolean mk_manifest_save(MkManifest *self)
+{
+        g_autoptr(GError) error = NULL;
+        g_auto(GStrv) groups = NULL;
+        gboolean ret = TRUE;
+
+        g_return_val_if_fail(self != NULL, FALSE);
+
+        g_mutex_lock(&self->lock);
+
+        groups = g_key_file_get_groups(self->keyfile, NULL);
+        for (guint i = 0; groups[i]; i++) {
+                if (g_str_equal(groups[i], MK_MANIFEST_GROUP) || access(groups[i], F_OK) == 0) {
+                        continue;
+                }
+                g_key_file_remove_group(self->keyfile, groups[i], NULL);
+                self->dirty = TRUE;
+        }
+
+        if (self->dirty) {
+                g_key_file_set_integer(self->keyfile,
+                                       MK_MANIFEST_GROUP,
+                                       "Version",
+                                       MK_MANIFEST_VERSION);
+                ret = g_key_file_save_to_file(self->keyfile, self->filename, &error);
+                if (!ret) {
+                        fprintf(stderr,
+                                "Failed to write manifest %s: %s\n",
+                                self->filename,
+                                error->message);
+                } else {
+                        self->dirty = FALSE;
+                }
+        }
+
+        g_mutex_unlock(&self->lock);
+        return ret;
+}
+
+/**
+ * mk_manifest_get_stats:
+ * @n_reused: (out): Modules whose recorded aliases were used
+ * @n_probed: (out): Modules probed and recorded
+ */
+void mk_manifest_get_stats(MkManifest *self, guint *n_reused, guint *n_probed)
+{
+        g_return_if_fail(self != NULL);
+
+        g_mutex_lock(&self->lock);
+        *n_reused = self->n_reused;
+        *n_probed = self->n_probed;
+        g_mutex_unlock(&self->lock);
+}
+
+/*
+ * Editor modelines  -  https://www.wireshark.org/tools/modelines.html
+ *
+ * Local variables:
+ * c-basic-offset: 8
+ * tab-width: 8
+ * indent-tabs-mode: nil
+ * End:
+ *
+ * vi: set shiftwidth=8 tabstop=8 expandtab:
+ * :indentSize=8:tabSize=8:noTabs=true:
+ */
@@ -0,0 +1,48 @@
+/*
+ * This file is part of linux-driver-management.
+ *
+ * Copyright © 2016-2018 Ikey Doherty
+ *
+ * linux-driver-management is free software; you can redistribute it and/or
+ * modify it under the terms of the GNU Lesser General Public License as
+ * published by the Free Software Foundation; either version 2.1
+ * of the License, or (at your option) any later version.
+ */
+
+#pragma once
+
+#include <glib.h>
+
+#include "../lib/util.h"
+
+/*
+ * Record of the aliases each kernel module had when it was last probed,
+ * keyed on its path and checked against its size, mtime and content hash.
+ * All functions may be called from any thread.
+ */
+typedef struct MkManifest MkManifest;
+
+MkManifest *mk_manifest_load(const gchar *filename);
+void mk_manifest_free(MkManifest *self);
+gboolean mk_manifest_save(MkManifest *self);
+
+gboolean mk_manifest_lookup(MkManifest *self, const gchar *path, const gchar *package_name,
+                            GPtrArray *aliases);
+void mk_manifest_store(MkManifest *self, const gchar *path, const gchar *name, GPtrArray *aliases,
+                       guint begin);
+void mk_manifest_get_stats(MkManifest *self, guint *n_reused, guint *n_probed);
+
+DEF_AUTOFREE(MkManifest, mk_manifest_free)
+
+/*
+ * Editor modelines  -  https://www.wireshark.org/tools/modelines.html
+ *
+ * Local variables:
+ * c-basic-offset: 8
+ * tab-width: 8
+ * indent-tabs-mode: nil
+ * End:
+ *
+ * vi: set shiftwidth=8 tabstop=8 expandtab:
+ * :indentSize=8:tabSize=8:noTabs=true:
+ */
@@ -11,8 +11,13 @@
 
 #define _GNU_SOURCE
 
+#include "../lib/modalias-db.h"
+#include "../lib/modalias-file.h"
+#include "../lib/modalias-summary.h"
 #include "../lib/util.h"
 #include "config.h"
+#include "manifest.h"
+#include "optimize.h"
 
 #include <errno.h>
 #include <glib.h>
@@ -33,6 +38,12 @@ DEF_AUTOFREE(kmod_list, kmod_module_info_free_list)
 static void print_usage(const char *progname)
 {
         fprintf(stderr, "%s usage: package-name [.ko files]\n", progname);
+        fprintf(stderr, "       %s --optimize [-o output] file.modaliases\n", progname);
+        fprintf(stderr,
+                "       %s --tree [-o output-directory] directory|package-list\n",
+                progname);
+        fprintf(stderr, "       %s --emit-c [-o output.c] file.modaliases...\n", progname);
+        fprintf(stderr, "       %s --database [-o output] directory\n", progname);
         fprintf(stderr, "Run '%s --help' for further information\n", progname);
 }
 
@@ -53,17 +64,73 @@ the Free Software Foundation; either version 2.1 of the License, or\n\
  */
 
 static gboolean opt_version = FALSE;
+static gboolean opt_database = FALSE;
+static gboolean opt_optimize = FALSE;
+static gboolean opt_tree = FALSE;
+static gint opt_jobs = 0;
 static gchar *opt_filename = NULL;
+static gchar *opt_manifest = NULL;
+static gboolean opt_emit_c = FALSE;
+static gchar *opt_symbol = NULL;
 static gchar **opt_strings = NULL;
 
 static GOptionEntry cli_entries[] = {
         { "version", 'v', 0, G_OPTION_ARG_NONE, &opt_version, "Print version and exit", NULL },
+        { "database",
+          'd',
+          0,
+          G_OPTION_ARG_NONE,
+          &opt_database,
+          "Compile a directory of .modaliases files into a binary database",
+          NULL },
+        { "optimize",
+          'O',
+          0,
+          G_OPTION_ARG_NONE,
+          &opt_optimize,
+          "Write the fewest aliases matching the same modaliases, sorted by pattern",
+          NULL },
+        { "tree",
+          't',
+          0,
+          G_OPTION_ARG_NONE,
+          &opt_tree,
+          "Write the .modaliases files of every package in a directory or package list",
+          NULL },
+        { "jobs",
+          'j',
+          0,
+          G_OPTION_ARG_INT,
+          &opt_jobs,
+          "Number of modules to probe at once in tree mode, defaulting to one per CPU",
+          "N" },
+        { "manifest",
+          'm',
+          0,
+          G_OPTION_ARG_FILENAME,
+          &opt_manifest,
+          "Reuse the aliases recorded for unchanged modules, and record the rest",
+          "FILE" },
+        { "emit-c",
+          'c',
+          0,
+          G_OPTION_ARG_NONE,
+          &opt_emit_c,
+          "Compile .modaliases files into C source for a built-in rule table",
+          NULL },
+        { "symbol",
+          's',
+          0,
+          G_OPTION_ARG_STRING,
+          &opt_symbol,
+          "Prefix for the symbols of the generated C source",
+          "NAME" },
         { "output",
           'o',
           0,
           G_OPTION_ARG_FILENAME,
           &opt_filename,
-          "Redirect to the given file",
+          "Redirect to the given file, or directory in tree mode",
           NULL },
         { G_OPTION_REMAINING,
           0,
@@ -76,9 +143,9 @@ static GOptionEntry cli_entries[] = {
 };
 
 /**
- * Examine just one kmod module and emit the info to the output file.
+ * Examine just one kmod module and collect its aliases.
  */
-static gboolean examine_module(const gchar *package_name, FILE *fileh, kmod_module *module)
+static gboolean examine_module(const gchar *package_name, GPtrArray *aliases, kmod_module *module)
 {
         const char *kname = NULL;
         autofree(kmod_list) *list = NULL;
@@ -100,21 +167,127 @@ static gboolean examine_module(const gchar *package_name, FILE *fileh, kmod_modu
                         continue;
                 }
                 const char *value = kmod_module_info_get_value(iter);
-                if (fprintf(fileh, "alias %s %s %s\n", value, kname, package_name) < 0) {
-                        return FALSE;
-                }
+                g_ptr_array_add(aliases, mk_alias_new(value, kname, package_name));
         };
 
         return TRUE;
 }
 
+/* Aliases of modules from previous runs, if requested */
+static MkManifest *manifest = NULL;
+
 /**
- * Construct a modaliases file for the given package name and module paths.
+ * Open the kernel module at @path and collect its aliases, unless the
+ * manifest already has them for the module as it is now.
  */
-static int mkmodaliases(const char *package_name, gchar **paths, guint n_paths)
+static gboolean probe_module(kmod_ctx *ctx, const gchar *package_name, const gchar *path,
+                             GPtrArray *aliases)
+{
+        autofree(kmod_module) *module = NULL;
+        guint begin = aliases->len;
+
+        if (manifest && mk_manifest_lookup(manifest, path, package_name, aliases)) {
+                return TRUE;
+        }
+
+        if (kmod_module_new_from_path(ctx, path, &module) != 0) {
+                fprintf(stderr, "Couldn't open module: %s %s\n", path, strerror(errno));
+                return FALSE;
+        }
+
+        if (!examine_module(package_name, aliases, module)) {
+                return FALSE;
+        }
+
+        if (manifest) {
+                mk_manifest_store(manifest, path, kmod_module_get_name(module), aliases, begin);
+        }
+        return TRUE;
+}
+
+/**
+ * Write back the manifest once everything has been probed.
+ */
+static void save_manifest(void)
+{
+        guint n_reused = 0;
+        guint n_probed = 0;
+
+        if (!manifest) {
+                return;
+        }
+
+        mk_manifest_get_stats(manifest, &n_reused, &n_probed);
+        fprintf(stderr, "Reused the aliases of %u modules, probed %u\n", n_reused, n_probed);
+        mk_manifest_save(manifest);
+}
+
+/**
+ * Replace the aliases with their optimised form when requested.
+ */
+static gboolean optimize_aliases(GPtrArray **aliases)
+{
+        GPtrArray *optimized = NULL;
+        MkOptimizeStats stats = { 0 };
+
+        if (!opt_optimize) {
+                return TRUE;
+        }
+
+        optimized = mk_optimize(*aliases, &stats);
+        if (!optimized) {
+                return FALSE;
+        }
+
+        fprintf(stderr,
+                "Optimised %u aliases into %u (%u duplicate, %u subsumed, %u merged)\n",
+                stats.n_input,
+                stats.n_output,
+                stats.n_duplicates,
+                stats.n_subsumed,
+                stats.n_merged);
+
+        g_ptr_array_unref(*aliases);
+        *aliases = optimized;
+        return TRUE;
+}
+
+/**
+ * Format the aliases as the contents of a modaliases file.
+ *
+ * The first line is a summary of the buses and vendors the aliases cover, so
+ * that libldm can skip loading the file for hardware it can't possibly match.
+ */
+static gchar *format_aliases(GPtrArray *aliases)
+{
+        autofree(LdmModaliasSummary) *summary = NULL;
+        g_autoptr(GString) lines = NULL;
+        g_autofree gchar *header = NULL;
+
+        summary = ldm_modalias_summary_new();
+        lines = g_string_new(NULL);
+
+        for (guint i = 0; i < aliases->len; i++) {
+                MkAlias *alias = aliases->pdata[i];
+
+                g_string_append_printf(lines,
+                                       "alias %s %s %s\n",
+                                       alias->match,
+                                       alias->driver,
+                                       alias->package);
+                ldm_modalias_summary_add(summary, alias->match);
+        }
+        header = ldm_modalias_summary_to_string(summary);
+
+        return g_strdup_printf("%s\n%s", header, lines->str);
+}
+
+/**
+ * Write the output file, or to stdout.
+ */
+static int write_output(const gchar *contents)
 {
         FILE *output_file = NULL;
-        autofree(kmod_ctx) *ctx = NULL;
         int ret = EXIT_FAILURE;
 
         /* Default to stdout if no path is set */
@@ -130,29 +303,11 @@ static int mkmodaliases(const char *package_name, gchar **paths, guint n_paths)
                 return EXIT_FAILURE;
         }
 
-        /* Open kmod context with no host kernel knowledge */
-        ctx = kmod_new(NULL, NULL);
-        if (!ctx) {
-                fprintf(stderr, "Cannot init kmod: %s\n", strerror(errno));
+        if (fputs(contents, output_file) < 0) {
+                fprintf(stderr, "Failed to write output: %s\n", strerror(errno));
                 goto cleanup;
         }
 
-        /* Walk all modules and pass our fileh */
-        for (guint i = 0; i < n_paths; i++) {
-                const gchar *kpath = paths[i];
-                autofree(kmod_module) *module = NULL;
-
-                int ret = kmod_module_new_from_path(ctx, kpath, &module);
-                if (ret != 0) {
-                        fprintf(stderr, "Couldn't open module: %s %s\n", kpath, strerror(errno));
-                        goto cleanup;
-                }
-
-                if (!examine_module(package_name, output_file, module)) {
-                        goto cleanup;
-                }
-        }
-
         /* All good so far */
         ret = EXIT_SUCCESS;
 
@@ -172,6 +327,628 @@ cleanup:
         return ret;
 }
 
+/**
+ * Write the aliases out as a modaliases file.
+ */
+static int write_aliases(GPtrArray *aliases)
+{
+        g_autofree gchar *contents = format_aliases(aliases);
+
+        return write_output(contents);
+}
+
+/**
+ * Collect an alias line of an existing modaliases file, with the same
+ * semantics as libldm has when loading it.
+ */
+static gboolean read_alias_line(const gchar *line, gsize len, gpointer v)
+{
+        GPtrArray *aliases = v;
+        LdmModaliasSpan columns[4] = { 0 };
+        MkAlias *alias = NULL;
+
+        if (!ldm_modalias_file_split_line(line, len, columns)) {
+                return TRUE;
+        }
+        if (!ldm_modalias_span_equal(&columns[0], "alias")) {
+                fprintf(stderr,
+                        "Skipping unknown directive '%.*s'\n",
+                        (int)columns[0].len,
+                        columns[0].str);
+                return TRUE;
+        }
+
+        alias = g_new0(MkAlias, 1);
+        alias->match = g_strndup(columns[1].str, columns[1].len);
+        alias->driver = g_strndup(columns[2].str, columns[2].len);
+        alias->package = g_strndup(columns[3].str, columns[3].len);
+        g_ptr_array_add(aliases, alias);
+        return TRUE;
+}
+
+/**
+ * Rewrite an existing modaliases file, which may be compressed, in its
+ * optimised form.
+ */
+static int mkmodaliases_optimize(const char *path)
+{
+        g_autoptr(GPtrArray) aliases = NULL;
+
+        if (!ldm_modalias_file_is_supported(path)) {
+                fprintf(stderr, "Not a modaliases file: %s\n", path);
+                return EXIT_FAILURE;
+        }
+
+        aliases = g_ptr_array_new_with_free_func((GDestroyNotify)mk_alias_free);
+        if (!ldm_modalias_file_foreach_line(path, read_alias_line, aliases)) {
+                return EXIT_FAILURE;
+        }
+
+        if (!optimize_aliases(&aliases)) {
+                return EXIT_FAILURE;
+        }
+        return write_aliases(aliases);
+}
+
+/**
+ * Ensure the prefix can start a C identifier.
+ */
+static gboolean is_c_identifier(const gchar *name)
+{
+        if (!g_ascii_isalpha(*name) && *name != '_') {
+                return FALSE;
+        }
+        for (const gchar *c = name; *c; c++) {
+                if (!g_ascii_isalnum(*c) && *c != '_') {
+                        return FALSE;
+                }
+        }
+        return TRUE;
+}
+
+/**
+ * Compile the modaliases files, in priority order, into C source defining
+ * the rules as a static table in the database format, and a function to
+ * register it with an LdmManager. The table is emitted as 64-bit words so it
+ * is suitably aligned to be used in place.
+ */
+static int mkmodaliases_emit_c(gchar **paths, guint n_paths)
+{
+        g_autoptr(GByteArray) table = NULL;
+        g_autoptr(GString) out = NULL;
+        const gchar *symbol = opt_symbol ? opt_symbol : "ldm_modalias_table";
+
+        if (!is_c_identifier(symbol)) {
+                fprintf(stderr, "Not a valid C identifier: %s\n", symbol);
+                return EXIT_FAILURE;
+        }
+
+        for (guint i = 0; i < n_paths; i++) {
+                if (!ldm_modalias_file_is_supported(paths[i])) {
+                        fprintf(stderr, "Not a modaliases file: %s\n", paths[i]);
+                        return EXIT_FAILURE;
+                }
+        }
+
+        table = ldm_modalias_db_compile_files(paths, n_paths);
+        if (!table) {
+                return EXIT_FAILURE;
+        }
+
+        /* Pad out to whole words */
+        while (table->len % sizeof(guint64) != 0) {
+                guint8 zero = 0;
+                g_byte_array_append(table, &zero, 1);
+        }
+
+        out = g_string_new("/*\n * Generated by mkmodaliases --emit-c from:\n *\n");
+        for (guint i = 0; i < n_paths; i++) {
+                g_autofree gchar *name = g_path_get_basename(paths[i]);
+
+                g_string_append_printf(out, " *   %s\n", name);
+        }
+        g_string_append_printf(out,
+                               " *\n"
+                               " * Modalias database version %d, in the byte order of the host "
+                               "that\n * generated it. Do not edit.\n */\n\n"
+                               "#include <ldm.h>\n\n"
+                               "static const guint64 %s_data[] = {\n",
+                               LDM_MODALIAS_DB_VERSION,
+                               symbol);
+
+        for (guint i = 0; i < table->len / sizeof(guint64); i++) {
+                guint64 word = 0;
+
+                memcpy(&word, table->data + i * sizeof(guint64), sizeof(word));
+                g_string_append_printf(out,
+                                       "%s0x%016" G_GINT64_MODIFIER "x,%s",
+                                       i % 4 == 0 ? "        " : " ",
+                                       word,
+                                       i % 4 == 3 ? "\n" : "");
+        }
+        if (table->len % (4 * sizeof(guint64)) != 0) {
+                g_string_append_c(out, '\n');
+        }
+
+        g_string_append_printf(out,
+                               "};\n\n"
+                               "gboolean %s_register(LdmManager *manager);\n\n"
+                               "/**\n"
+                               " * %s_register:\n"
+                               " *\n"
+                               " * Add a modalias plugin for each of the files above to the "
+                               "manager.\n"
+                               " *\n"
+                               " * Returns: TRUE if the plugins were added\n"
+                               " */\n"
+                               "gboolean %s_register(LdmManager *manager)\n"
+                               "{\n"
+                               "        gconstpointer table = %s_data;\n"
+                               "        gsize size = sizeof(%s_data);\n"
+                               "\n"
+                               "        return ldm_manager_add_modalias_plugins_for_table(manager, "
+                               "table, size);\n"
+                               "}\n",
+                               symbol,
+                               symbol,
+                               symbol,
+                               symbol,
+                               symbol);
+
+        return write_output(out->str);
+}
+
+/**
+ * Compile the .modaliases files in the directory into a database, which by
+ * default lives alongside them. Files unchanged since an existing database
+ * was written are carried over rather than parsed again.
+ */
+static int mkmodaliases_database(const char *directory)
+{
+        g_autofree gchar *output = NULL;
+
+        if (!g_file_test(directory, G_FILE_TEST_IS_DIR)) {
+                fprintf(stderr, "Not a directory: %s\n", directory);
+                return EXIT_FAILURE;
+        }
+
+        if (opt_filename) {
+                output = g_strdup(opt_filename);
+        } else {
+                output = g_build_filename(directory, LDM_MODALIAS_DB_NAME, NULL);
+        }
+
+        if (!ldm_modalias_db_update(directory, output, NULL, NULL)) {
+                return EXIT_FAILURE;
+        }
+        return EXIT_SUCCESS;
+}
+
+/**
+ * Construct a modaliases file for the given package name and module paths.
+ */
+static int mkmodaliases(const char *package_name, gchar **paths, guint n_paths)
+{
+        autofree(kmod_ctx) *ctx = NULL;
+        g_autoptr(GPtrArray) aliases = NULL;
+
+        /* Open kmod context with no host kernel knowledge */
+        ctx = kmod_new(NULL, NULL);
+        if (!ctx) {
+                fprintf(stderr, "Cannot init kmod: %s\n", strerror(errno));
+                return EXIT_FAILURE;
+        }
+
+        aliases = g_ptr_array_new_with_free_func((GDestroyNotify)mk_alias_free);
+
+        /* Walk all modules and collect their aliases */
+        for (guint i = 0; i < n_paths; i++) {
+                if (!probe_module(ctx, package_name, paths[i], aliases)) {
+                        return EXIT_FAILURE;
+                }
+        }
+
+        if (!optimize_aliases(&aliases)) {
+                return EXIT_FAILURE;
+        }
+        return write_aliases(aliases);
+}
+
+/*
+ * A kernel module to probe in tree mode
+ */
+typedef struct MkModuleJob {
+        const gchar *package_name;
+        gchar *path;
+        GPtrArray *aliases; /* MkAlias, NULL until probed successfully */
+} MkModuleJob;
+
+/*
+ * A package to write in tree mode, once all of its modules are probed
+ */
+typedef struct MkPackageJob {
+        gchar *name;
+        GPtrArray *modules; /* MkModuleJob, in the order given */
+        const gchar *output_dir;
+        gboolean written;
+} MkPackageJob;
+
+static void mk_module_job_free(MkModuleJob *job)
+{
+        g_free(job->path);
+        if (job->aliases) {
+                g_ptr_array_unref(job->aliases);
+        }
+        g_free(job);
+}
+
+static void mk_package_job_free(MkPackageJob *job)
+{
+        g_free(job->name);
+        g_ptr_array_unref(job->modules);
+        g_free(job);
+}
+
+static void worker_ctx_free(gpointer ctx)
+{
+        kmod_unref(ctx);
+}
+
+/* libkmod contexts aren't thread safe, so every worker gets its own */
+static GPrivate worker_ctx = G_PRIVATE_INIT(worker_ctx_free);
+
+static void run_module_job(gpointer data, __ldm_unused__ gpointer user_data)
+{
+        MkModuleJob *job = data;
+        kmod_ctx *ctx = g_private_get(&worker_ctx);
+        g_autoptr(GPtrArray) aliases = NULL;
+
+        if (!ctx) {
+                /* Open kmod context with no host kernel knowledge */
+                ctx = kmod_new(NULL, NULL);
+                if (!ctx) {
+                        fprintf(stderr, "Cannot init kmod: %s\n", strerror(errno));
+                        return;
+                }
+                g_private_set(&worker_ctx, ctx);
+        }
+
+        aliases = g_ptr_array_new_with_free_func((GDestroyNotify)mk_alias_free);
+        if (!probe_module(ctx, job->package_name, job->path, aliases)) {
+                return;
+        }
+        job->aliases = g_steal_pointer(&aliases);
+}
+
+/**
+ * Write out a package from the aliases of its modules, in the same order as
+ * the serial mode would. The file is replaced atomically, so a package is
+ * never seen half written.
+ */
+static void run_package_job(gpointer data, __ldm_unused__ gpointer user_data)
+{
+        MkPackageJob *job = data;
+        g_autoptr(GPtrArray) aliases = NULL;
+        g_autoptr(GError) error = NULL;
+        g_autofree gchar *contents = NULL;
+        g_autofree gchar *filename = NULL;
+        g_autofree gchar *path = NULL;
+
+        aliases = g_ptr_array_new_with_free_func((GDestroyNotify)mk_alias_free);
+        for (guint i = 0; i < job->modules->len; i++) {
+                MkModuleJob *module = job->modules->pdata[i];
+
+                if (!module->aliases) {
+                        fprintf(stderr,
+                                "Not writing %s: failed to probe %s\n",
+                                job->name,
+                                module->path);
+                        return;
+                }
+                for (guint j = 0; j < module->aliases->len; j++) {
+                        MkAlias *alias = module->aliases->pdata[j];
+
+                        g_ptr_array_add(aliases,
+                                        mk_alias_new(alias->match, alias->driver, alias->package));
+                }
+        }
+
+        if (!optimize_aliases(&aliases)) {
+                fprintf(stderr, "Not writing %s: failed to optimise its aliases\n", job->name);
+                return;
+        }
+
+        contents = format_aliases(aliases);
+        filename = g_strconcat(job->name, LDM_MODALIAS_FILE_SUFFIX, NULL);
+        path = g_build_filename(job->output_dir, filename, NULL);
+        if (!g_file_set_contents(path, contents, -1, &error)) {
+                fprintf(stderr, "Failed to write %s: %s\n", path, error->message);
+                return;
+        }
+
+        job->written = TRUE;
+}
+
+/**
+ * Run every job, on a pool of worker threads if more than one is allowed.
+ */
+static void run_jobs(GFunc func, GPtrArray *jobs)
+{
+        g_autoptr(GError) error = NULL;
+        GThreadPool *pool = NULL;
+        guint n_threads = opt_jobs > 0 ? (guint)opt_jobs : g_get_num_processors();
+
+        n_threads = MIN(n_threads, jobs->len);
+        if (n_threads >= 2) {
+                pool = g_thread_pool_new(func, NULL, (gint)n_threads, TRUE, &error);
+                if (!pool) {
+                        fprintf(stderr, "Failed to create worker pool: %s\n", error->message);
+                }
+        }
+
+        for (guint i = 0; i < jobs->len; i++) {
+                if (!pool || !g_thread_pool_push(pool, jobs->pdata[i], NULL)) {
+                        func(jobs->pdata[i], NULL);
+                }
+        }
+
+        /* Wait for every job to complete */
+        if (pool) {
+                g_thread_pool_free(pool, FALSE, TRUE);
+        }
+}
+
+/**
+ * Find the named package, adding it if this is the first we've seen of it.
+ */
+static MkPackageJob *tree_get_package(GPtrArray *packages, const gchar *name)
+{
+        MkPackageJob *job = NULL;
+
+        for (guint i = 0; i < packages->len; i++) {
+                job = packages->pdata[i];
+                if (g_str_equal(job->name, name)) {
+                        return job;
+                }
+        }
+
+        job = g_new0(MkPackageJob, 1);
+        job->name = g_strdup(name);
+        job->modules = g_ptr_array_new();
+        g_ptr_array_add(packages, job);
+
+        return job;
+}
+
+/**
+ * Queue a module of the package for probing.
+ */
+static gboolean tree_add_module(GPtrArray *modules, MkPackageJob *package, const gchar *path)
+{
+        MkModuleJob *job = NULL;
+
+        if (!g_str_has_suffix(path, ".ko")) {
+                fprintf(stderr, "File does not appear to be a kernel module: %s\n", path);
+                return FALSE;
+        }
+        if (access(path, F_OK) != 0) {
+                fprintf(stderr, "Kernel module does not exist: %s\n", path);
+                return FALSE;
+        }
+
+        job = g_new0(MkModuleJob, 1);
+        job->package_name = package->name;
+        job->path = g_strdup(path);
+        g_ptr_array_add(modules, job);
+        g_ptr_array_add(package->modules, job);
+
+        return TRUE;
+}
+
+static gint compare_paths(gconstpointer a, gconstpointer b)
+{
+        return strcmp(*(const gchar **)a, *(const gchar **)b);
+}
+
+/**
+ * Recursively collect the kernel modules beneath the directory.
+ */
+static void tree_collect_modules(const gchar *directory, GPtrArray *paths)
+{
+        GDir *dir = NULL;
+        const gchar *name = NULL;
+
+        dir = g_dir_open(directory, 0, NULL);
+        if (!dir) {
+                return;
+        }
+
+        while ((name = g_dir_read_name(dir)) != NULL) {
+                gchar *path = g_build_filename(directory, name, NULL);
+
+                if (g_file_test(path, G_FILE_TEST_IS_DIR)) {
+                        tree_collect_modules(path, paths);
+                        g_free(path);
+                } else if (g_str_has_suffix(name, ".ko")) {
+                        g_ptr_array_add(paths, path);
+                } else {
+                        g_free(path);
+                }
+        }
+        g_dir_close(dir);
+}
+
+/**
+ * Every directory within @directory is a package, named for the directory,
+ * holding its kernel modules at any depth. Modules are taken in the order
+ * of their paths.
+ */
+static gboolean tree_load_directory(const gchar *directory, GPtrArray *packages,
+                                    GPtrArray *modules)
+{
+        g_autoptr(GPtrArray) names = NULL;
+        GDir *dir = NULL;
+        const gchar *name = NULL;
+
+        dir = g_dir_open(directory, 0, NULL);
+        if (!dir) {
+                fprintf(stderr, "Failed to open directory: %s\n", directory);
+                return FALSE;
+        }
+
+        names = g_ptr_array_new_with_free_func(g_free);
+        while ((name = g_dir_read_name(dir)) != NULL) {
+                g_autofree gchar *path = g_build_filename(directory, name, NULL);
+
+                if (g_file_test(path, G_FILE_TEST_IS_DIR)) {
+                        g_ptr_array_add(names, g_strdup(name));
+                }
+        }
+        g_dir_close(dir);
+        g_ptr_array_sort(names, compare_paths);
+
+        for (guint i = 0; i < names->len; i++) {
+                g_autofree gchar *path = g_build_filename(directory, names->pdata[i], NULL);
+                g_autoptr(GPtrArray) paths = g_ptr_array_new_with_free_func(g_free);
+                MkPackageJob *package = NULL;
+
+                tree_collect_modules(path, paths);
+                if (paths->len == 0) {
+                        continue;
+                }
+                g_ptr_array_sort(paths, compare_paths);
+
+                package = tree_get_package(packages, names->pdata[i]);
+                for (guint j = 0; j < paths->len; j++) {
+                        if (!tree_add_module(modules, package, paths->pdata[j])) {
+                                return FALSE;
+                        }
+                }
+        }
+
+        return TRUE;
+}
+
+/**
+ * A package list has a line per package, naming the package and then its
+ * kernel modules, separated by whitespace. Relative module paths are taken
+ * from the directory of the list, and a package may span several lines.
+ */
+static gboolean tree_load_list(const gchar *filename, GPtrArray *packages, GPtrArray *modules)
+{
+        g_autoptr(GError) error = NULL;
+        g_autofree gchar *contents = NULL;
+        g_autofree gchar *base = NULL;
+        g_auto(GStrv) lines = NULL;
+
+        if (!g_file_get_contents(filename, &contents, NULL, &error)) {
+                fprintf(stderr, "Failed to read %s: %s\n", filename, error->message);
+                return FALSE;
+        }
+
+        base = g_path_get_dirname(filename);
+        lines = g_strsplit(contents, "\n", -1);
+        for (guint i = 0; lines[i]; i++) {
+                g_auto(GStrv) fields = NULL;
+                MkPackageJob *package = NULL;
+                guint n_fields = 0;
+
+                g_strstrip(lines[i]);
+                if (*lines[i] == '\0' || *lines[i] == '#') {
+                        continue;
+                }
+
+                fields = g_strsplit_set(lines[i], " \t", -1);
+                for (guint j = 0; fields[j]; j++) {
+                        if (*fields[j] != '\0') {
+                                fields[n_fields++] = fields[j];
+                        } else {
+                                g_free(fields[j]);
+                        }
+                }
+                fields[n_fields] = NULL;
+
+                if (n_fields < 2) {
+                        fprintf(stderr,
+                                "%s:%u: Expected a package and its modules\n",
+                                filename,
+                                i + 1);
+                        return FALSE;
+                }
+                if (strchr(fields[0], '/')) {
+                        fprintf(stderr,
+                                "%s:%u: Invalid package name: %s\n",
+                                filename,
+                                i + 1,
+                                fields[0]);
+                        return FALSE;
+                }
+
+                package = tree_get_package(packages, fields[0]);
+                for (guint j = 1; j < n_fields; j++) {
+                        g_autofree gchar *path = NULL;
+
+                        if (g_path_is_absolute(fields[j])) {
+                                path = g_strdup(fields[j]);
+                        } else {
+                                path = g_build_filename(base, fields[j], NULL);
+                        }
+                        if (!tree_add_module(modules, package, path)) {
+                                return FALSE;
+                        }
+                }
+        }
+
+        return TRUE;
+}
+
+/**
+ * Construct the modaliases files of every package in a directory or package
+ * list. Modules are probed on a pool of workers, each with its own kmod
+ * context, and every package is written to the output directory exactly as
+ * the serial mode would write it.
+ */
+static int mkmodaliases_tree(const char *source)
+{
+        g_autoptr(GPtrArray) packages = NULL;
+        g_autoptr(GPtrArray) modules = NULL;
+        const gchar *output_dir = opt_filename ? opt_filename : ".";
+        gboolean loaded = FALSE;
+        int ret = EXIT_SUCCESS;
+
+        packages = g_ptr_array_new_with_free_func((GDestroyNotify)mk_package_job_free);
+        modules = g_ptr_array_new_with_free_func((GDestroyNotify)mk_module_job_free);
+
+        if (g_file_test(source, G_FILE_TEST_IS_DIR)) {
+                loaded = tree_load_directory(source, packages, modules);
+        } else {
+                loaded = tree_load_list(source, packages, modules);
+        }
+        if (!loaded) {
+                return EXIT_FAILURE;
+        }
+
+        if (g_mkdir_with_parents(output_dir, 00755) != 0) {
+                fprintf(stderr, "Failed to create %s: %s\n", output_dir, strerror(errno));
+                return EXIT_FAILURE;
+        }
+
+        run_jobs(run_module_job, modules);
+
+        for (guint i = 0; i < packages->len; i++) {
+                ((MkPackageJob *)packages->pdata[i])->output_dir = output_dir;
+        }
+        run_jobs(run_package_job, packages);
+
+        for (guint i = 0; i < packages->len; i++) {
+                if (!((MkPackageJob *)packages->pdata[i])->written) {
+                        ret = EXIT_FAILURE;
+                }
+        }
+
+        return ret;
+}
+
 int main(int argc, char **argv)
 {
         g_autoptr(GError) error = NULL;
@@ -196,6 +973,44 @@ int main(int argc, char **argv)
         }
 
         n_strings = opt_strings ? g_strv_length(opt_strings) : 0;
+
+        if (opt_database) {
+                if (n_strings != 1) {
+                        print_usage(argv[0]);
+                        goto cleanup;
+                }
+                ret = mkmodaliases_database(opt_strings[0]);
+                goto cleanup;
+        }
+
+        if (opt_emit_c) {
+                if (n_strings < 1) {
+                        print_usage(argv[0]);
+                        goto cleanup;
+                }
+                ret = mkmodaliases_emit_c(opt_strings, n_strings);
+                goto cleanup;
+        }
+
+        if (opt_manifest) {
+                manifest = mk_manifest_load(opt_manifest);
+        }
+
+        if (opt_tree) {
+                if (n_strings != 1) {
+                        print_usage(argv[0]);
+                        goto cleanup;
+                }
+                ret = mkmodaliases_tree(opt_strings[0]);
+                save_manifest();
+                goto cleanup;
+        }
+
+        if (opt_optimize && n_strings == 1) {
+                ret = mkmodaliases_optimize(opt_strings[0]);
+                goto cleanup;
+        }
+
         if (n_strings < 2) {
                 print_usage(argv[0]);
                 goto cleanup;
@@ -219,11 +1034,15 @@ int main(int argc, char **argv)
 
         /* All good, proceed. */
         ret = mkmodaliases(package_name, opt_strings + 1, n_strings - 1);
+        save_manifest();
 
 cleanup:
         if (opt_filename) {
                 g_free(opt_filename);
         }
+        g_free(opt_manifest);
+        g_free(opt_symbol);
+        mk_manifest_free(manifest);
         if (opt_strings && *opt_strings) {
                 g_strfreev(opt_strings);
         }
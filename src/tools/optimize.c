@@ -0,0 +1,1114 @@
+/*
+ * This file is part of linux-driver-management.
+ *
+ * Copyright © 2016-2018 Ikey Doherty
+ *
+ * linux-driver-management is free software; you can redistribute it and/or
+ * modify it under the terms of the GNU Lesser General Public License as
+ * published by the Free Software Foundation; either version 2.1
+ * of the License, or (at your option) any later version.
+ */
+
+#define _GNU_SOURCE
+
+#include <stdio.h>
+#include <stdlib.h>
+#include <string.h>
+
+#include "../lib/modalias-fields.h"
+#include "optimize.h"
+
+/*
+ * Patterns are handled as a sequence of tokens, each either a `*` or a set of
+ * the bytes that may appear at that position. A literal is a set of one, `?`
+ * is every byte, and a bracket expression is whatever it lists. Comparing two
+ * patterns then boils down to set inclusion, position by position.
+ */
+typedef struct MkToken {
+        gboolean star;
+        guint32 set[8];
+} MkToken;
+
+/*
+ * An alias during optimisation
+ */
+typedef struct MkRule {
+        gchar *match;       /* Current pattern */
+        const gchar *driver; /* Owned by the input alias */
+        GArray *tokens;     /* MkToken, NULL if we don't understand the pattern */
+        gboolean merged;    /* Pattern must be written out again from the tokens */
+        gboolean dead;      /* Dropped from the output */
+        gboolean touched;   /* Merged into during the current round */
+} MkRule;
+
+/*
+ * Finds rules that may cover a pattern. A rule can only cover patterns that
+ * start with its literal prefix, so rules are keyed on the driver and that.
+ */
+typedef struct MkIndex {
+        GHashTable *exact;    /* Driver and pattern */
+        GHashTable *prefixes; /* Driver and literal prefix to GPtrArray of MkRule */
+} MkIndex;
+
+MkAlias *mk_alias_new(const gchar *match, const gchar *driver, const gchar *package)
+{
+        MkAlias *ret = g_new0(MkAlias, 1);
+
+        ret->match = g_strdup(match);
+        ret->driver = g_strdup(driver);
+        ret->package = g_strdup(package);
+
+        return ret;
+}
+
+void mk_alias_free(MkAlias *alias)
+{
+        if (!alias) {
+                return;
+        }
+        g_free(alias->match);
+        g_free(alias->driver);
+        g_free(alias->package);
+        g_free(alias);
+}
+
+static inline void mk_set_add(guint32 *set, guint c)
+{
+        set[c / 32] |= 1U << (c % 32);
+}
+
+static inline gboolean mk_set_has(const guint32 *set, guint c)
+{
+        return (set[c / 32] & (1U << (c % 32))) != 0;
+}
+
+static guint mk_set_count(const guint32 *set)
+{
+        guint ret = 0;
+
+        for (guint i = 0; i < 8; i++) {
+                ret += (guint)__builtin_popcount(set[i]);
+        }
+        return ret;
+}
+
+static gboolean mk_set_is_subset(const guint32 *a, const guint32 *b)
+{
+        for (guint i = 0; i < 8; i++) {
+                if ((a[i] & ~b[i]) != 0) {
+                        return FALSE;
+                }
+        }
+        return TRUE;
+}
+
+/**
+ * mk_set_is_any:
+ *
+ * Returns: TRUE if the set is every byte fnmatch could see, i.e. `?`
+ */
+static gboolean mk_set_is_any(const guint32 *set)
+{
+        return mk_set_count(set) == 255 && !mk_set_has(set, 0);
+}
+
+static gboolean mk_set_is_alnum(const guint32 *set)
+{
+        for (guint c = 0; c < 256; c++) {
+                if (mk_set_has(set, c) && !g_ascii_isalnum((gchar)c)) {
+                        return FALSE;
+                }
+        }
+        return TRUE;
+}
+
+static guint mk_set_first(const guint32 *set)
+{
+        for (guint c = 0; c < 256; c++) {
+                if (mk_set_has(set, c)) {
+                        return c;
+                }
+        }
+        return 0;
+}
+
+/**
+ * mk_tokens_parse_set:
+ * @pattern: (inout): Position of the opening `[`, advanced past the `]`
+ *
+ * Returns: TRUE if this is a bracket expression we fully understand
+ */
+static gboolean mk_tokens_parse_set(const gchar **pattern, guint32 *set)
+{
+        guint32 members[8] = { 0 };
+        const gchar *c = *pattern + 1;
+        gboolean negate = FALSE;
+
+        if (*c == '!' || *c == '^') {
+                negate = TRUE;
+                ++c;
+        }
+        if (*c == ']') {
+                return FALSE;
+        }
+
+        while (*c != '\0' && *c != ']') {
+                guchar first = (guchar)*c;
+                guchar last = first;
+
+                /* Character classes, collating symbols and escapes */
+                if (*c == '[' || *c == '\\') {
+                        return FALSE;
+                }
+                if (c[1] == '-' && c[2] != '\0' && c[2] != ']') {
+                        if (c[2] == '[' || c[2] == '\\') {
+                                return FALSE;
+                        }
+                        last = (guchar)c[2];
+                        c += 3;
+                } else {
+                        ++c;
+                }
+
+                if (last < first) {
+                        return FALSE;
+                }
+                for (guint i = first; i <= last; i++) {
+                        mk_set_add(members, i);
+                }
+        }
+
+        /* fnmatch treats an unterminated `[` literally, as should nobody */
+        if (*c != ']') {
+                return FALSE;
+        }
+        *pattern = c + 1;
+
+        for (guint i = 1; i < 256; i++) {
+                if (mk_set_has(members, i) != negate) {
+                        mk_set_add(set, i);
+                }
+        }
+
+        return TRUE;
+}
+
+/**
+ * mk_tokens_parse:
+ *
+ * Returns: (transfer full) (nullable): The tokens of the pattern, or NULL if
+ * it uses anything we can't reason about
+ */
+static GArray *mk_tokens_parse(const gchar *pattern)
+{
+        GArray *ret = g_array_new(FALSE, TRUE, sizeof(MkToken));
+        const gchar *c = pattern;
+
+        while (*c != '\0') {
+                MkToken token = { 0 };
+
+                switch (*c) {
+                case '*':
+                        ++c;
+                        /* Consecutive stars are the same as one */
+                        if (ret->len > 0 && g_array_index(ret, MkToken, ret->len - 1).star) {
+                                continue;
+                        }
+                        token.star = TRUE;
+                        break;
+                case '?':
+                        ++c;
+                        for (guint i = 1; i < 256; i++) {
+                                mk_set_add(token.set, i);
+                        }
+                        break;
+                case '[':
+                        if (!mk_tokens_parse_set(&c, token.set)) {
+                                g_array_unref(ret);
+                                return NULL;
+                        }
+                        break;
+                case '\\':
+                        g_array_unref(ret);
+                        return NULL;
+                default:
+                        mk_set_add(token.set, (guchar)*c);
+                        ++c;
+                        break;
+                }
+
+                g_array_append_val(ret, token);
+        }
+
+        return ret;
+}
+
+/**
+ * mk_token_is_literal:
+ *
+ * Returns: TRUE if the token is a single byte that can be written as is
+ */
+static gboolean mk_token_is_literal(const MkToken *token)
+{
+        if (token->star || mk_set_count(token->set) != 1) {
+                return FALSE;
+        }
+        return !strchr("*?[\\", (gchar)mk_set_first(token->set));
+}
+
+/**
+ * mk_token_is_plain:
+ *
+ * Returns: TRUE if we're able to write the token out again
+ */
+static gboolean mk_token_is_plain(const MkToken *token)
+{
+        return token->star || mk_set_is_any(token->set) || mk_token_is_literal(token) ||
+               mk_set_is_alnum(token->set);
+}
+
+/**
+ * mk_tokens_key:
+ * @skip: Position to leave out, or G_MAXUINT
+ *
+ * Returns: (transfer full): A string uniquely identifying the tokens
+ */
+static gchar *mk_tokens_key(GArray *tokens, guint skip)
+{
+        GString *ret = g_string_new(NULL);
+
+        for (guint i = 0; i < tokens->len; i++) {
+                const MkToken *token = &g_array_index(tokens, MkToken, i);
+
+                if (i == skip) {
+                        g_string_append_c(ret, '\x01');
+                } else if (token->star) {
+                        g_string_append_c(ret, '*');
+                } else if (mk_token_is_literal(token)) {
+                        g_string_append_c(ret, (gchar)mk_set_first(token->set));
+                } else {
+                        g_string_append_c(ret, '[');
+                        for (guint j = 0; j < 8; j++) {
+                                g_string_append_printf(ret, "%08x", token->set[j]);
+                        }
+                        g_string_append_c(ret, ']');
+                }
+        }
+
+        return g_string_free(ret, FALSE);
+}
+
+/**
+ * mk_tokens_to_pattern:
+ *
+ * Write plain tokens out as a pattern. Runs of digits become ranges, letters
+ * are listed so the result doesn't depend on the collation order.
+ */
+static gchar *mk_tokens_to_pattern(GArray *tokens)
+{
+        GString *ret = g_string_new(NULL);
+
+        for (guint i = 0; i < tokens->len; i++) {
+                const MkToken *token = &g_array_index(tokens, MkToken, i);
+
+                if (token->star) {
+                        g_string_append_c(ret, '*');
+                        continue;
+                }
+                if (mk_set_is_any(token->set)) {
+                        g_string_append_c(ret, '?');
+                        continue;
+                }
+                if (mk_token_is_literal(token)) {
+                        g_string_append_c(ret, (gchar)mk_set_first(token->set));
+                        continue;
+                }
+
+                g_string_append_c(ret, '[');
+                for (guint c = 0; c < 256; c++) {
+                        guint last = c;
+
+                        if (!mk_set_has(token->set, c)) {
+                                continue;
+                        }
+                        while (g_ascii_isdigit((gchar)c) && last < '9' &&
+                               mk_set_has(token->set, last + 1)) {
+                                ++last;
+                        }
+                        if (last - c >= 2) {
+                                g_string_append_printf(ret, "%c-%c", c, last);
+                                c = last;
+                        } else {
+                                g_string_append_c(ret, (gchar)c);
+                        }
+                }
+                g_string_append_c(ret, ']');
+        }
+
+        return g_string_free(ret, FALSE);
+}
+
+/**
+ * mk_tokens_literal_prefix:
+ *
+ * Returns: (transfer full): The literal bytes the pattern starts with
+ */
+static gchar *mk_tokens_literal_prefix(GArray *tokens)
+{
+        GString *ret = g_string_new(NULL);
+
+        for (guint i = 0; i < tokens->len; i++) {
+                const MkToken *token = &g_array_index(tokens, MkToken, i);
+
+                if (token->star || mk_set_count(token->set) != 1) {
+                        break;
+                }
+                g_string_append_c(ret, (gchar)mk_set_first(token->set));
+        }
+
+        return g_string_free(ret, FALSE);
+}
+
+/**
+ * mk_tokens_expansions:
+ *
+ * Returns: How many literal patterns libldm expands the tokens into, see
+ * #ldm_modalias_pattern_expand
+ */
+static guint64 mk_tokens_expansions(GArray *tokens)
+{
+        guint64 ret = 1;
+
+        for (guint i = 0; i < tokens->len; i++) {
+                const MkToken *token = &g_array_index(tokens, MkToken, i);
+
+                if (token->star || mk_set_is_any(token->set)) {
+                        continue;
+                }
+                ret *= mk_set_count(token->set);
+        }
+
+        return ret;
+}
+
+/**
+ * mk_tokens_covered:
+ *
+ * Decide whether every string matched by @a is also matched by @b, by
+ * matching @b against the tokens of @a: a `*` in @b may swallow any run of
+ * tokens, and every other token of @b must include the token of @a it lines
+ * up with. This never claims coverage that isn't there, though it may miss
+ * some contrived cases that are.
+ *
+ * Returns: TRUE if @a is covered by @b
+ */
+static gboolean mk_tokens_covered(GArray *a, GArray *b)
+{
+        guint n = a->len;
+        guint m = b->len;
+        g_autofree gboolean *table = NULL;
+
+        /* table[i * (m + 1) + j] is whether a[i..] is covered by b[j..] */
+        table = g_new0(gboolean, (n + 1) * (m + 1));
+        table[n * (m + 1) + m] = TRUE;
+
+        for (guint i = n + 1; i > 0; i--) {
+                for (guint j = m; j > 0; j--) {
+                        const MkToken *tb = &g_array_index(b, MkToken, j - 1);
+                        guint ai = i - 1;
+                        guint bj = j - 1;
+                        gboolean covered = FALSE;
+
+                        if (tb->star) {
+                                covered = table[ai * (m + 1) + bj + 1] ||
+                                          (ai < n && table[(ai + 1) * (m + 1) + bj]);
+                        } else if (ai < n) {
+                                const MkToken *ta = &g_array_index(a, MkToken, ai);
+
+                                covered = !ta->star && mk_set_is_subset(ta->set, tb->set) &&
+                                          table[(ai + 1) * (m + 1) + bj + 1];
+                        }
+
+                        table[ai * (m + 1) + bj] = covered;
+                }
+        }
+
+        return table[0];
+}
+
+static gboolean mk_set_intersects(const guint32 *a, const guint32 *b)
+{
+        for (guint i = 0; i < 8; i++) {
+                if ((a[i] & b[i]) != 0) {
+                        return TRUE;
+                }
+        }
+        return FALSE;
+}
+
+/**
+ * mk_tokens_overlap:
+ *
+ * Returns: TRUE if some string is matched by both @a and @b
+ */
+static gboolean mk_tokens_overlap(GArray *a, GArray *b)
+{
+        guint n = a->len;
+        guint m = b->len;
+        g_autofree gboolean *table = NULL;
+
+        /* table[i * (m + 1) + j] is whether a[i..] and b[j..] share a match */
+        table = g_new0(gboolean, (n + 1) * (m + 1));
+
+        for (guint i = n + 1; i > 0; i--) {
+                for (guint j = m + 1; j > 0; j--) {
+                        const MkToken *ta = i <= n ? &g_array_index(a, MkToken, i - 1) : NULL;
+                        const MkToken *tb = j <= m ? &g_array_index(b, MkToken, j - 1) : NULL;
+                        guint ai = i - 1;
+                        guint bj = j - 1;
+                        gboolean overlap = FALSE;
+
+                        if (!ta && !tb) {
+                                overlap = TRUE;
+                        }
+                        /* A star may stop here, or take on a byte of the other side */
+                        if (!overlap && ta && ta->star) {
+                                overlap = table[(ai + 1) * (m + 1) + bj] ||
+                                          (tb && !tb->star && table[ai * (m + 1) + bj + 1]);
+                        }
+                        if (!overlap && tb && tb->star) {
+                                overlap = table[ai * (m + 1) + bj + 1] ||
+                                          (ta && !ta->star && table[(ai + 1) * (m + 1) + bj]);
+                        }
+                        if (!overlap && ta && tb && !ta->star && !tb->star) {
+                                overlap = mk_set_intersects(ta->set, tb->set) &&
+                                          table[(ai + 1) * (m + 1) + bj + 1];
+                        }
+
+                        table[ai * (m + 1) + bj] = overlap;
+                }
+        }
+
+        return table[0];
+}
+
+static void mk_rule_free(MkRule *rule)
+{
+        g_free(rule->match);
+        if (rule->tokens) {
+                g_array_unref(rule->tokens);
+        }
+        g_free(rule);
+}
+
+static MkRule *mk_rule_new(const gchar *match, const gchar *driver)
+{
+        MkRule *ret = g_new0(MkRule, 1);
+
+        ret->match = g_strdup(match);
+        ret->driver = driver;
+        ret->tokens = mk_tokens_parse(match);
+
+        return ret;
+}
+
+static void mk_index_init(MkIndex *index, GPtrArray *rules)
+{
+        index->exact = g_hash_table_new_full(g_str_hash, g_str_equal, g_free, NULL);
+        index->prefixes = g_hash_table_new_full(g_str_hash,
+                                                g_str_equal,
+                                                g_free,
+                                                (GDestroyNotify)g_ptr_array_unref);
+
+        for (guint i = 0; i < rules->len; i++) {
+                MkRule *rule = rules->pdata[i];
+                g_autofree gchar *prefix = NULL;
+                gchar *key = NULL;
+                GPtrArray *bucket = NULL;
+
+                if (rule->dead) {
+                        continue;
+                }
+                g_hash_table_add(index->exact,
+                                 g_strdup_printf("%s\n%s", rule->driver, rule->match));
+                if (!rule->tokens) {
+                        continue;
+                }
+
+                prefix = mk_tokens_literal_prefix(rule->tokens);
+                key = g_strdup_printf("%s\n%s", rule->driver, prefix);
+                bucket = g_hash_table_lookup(index->prefixes, key);
+                if (!bucket) {
+                        bucket = g_ptr_array_new();
+                        g_hash_table_insert(index->prefixes, key, bucket);
+                } else {
+                        g_free(key);
+                }
+                g_ptr_array_add(bucket, rule);
+        }
+}
+
+static void mk_index_clear(MkIndex *index)
+{
+        g_clear_pointer(&index->exact, g_hash_table_unref);
+        g_clear_pointer(&index->prefixes, g_hash_table_unref);
+}
+
+/**
+ * mk_index_covers:
+ * @skip: (nullable): Rule to leave out
+ *
+ * Returns: TRUE if a single live rule of the driver covers all of @tokens
+ */
+static gboolean mk_index_covers(MkIndex *index, const gchar *driver, GArray *tokens, MkRule *skip)
+{
+        g_autofree gchar *prefix = mk_tokens_literal_prefix(tokens);
+        gsize prefix_len = strlen(prefix);
+
+        for (gsize len = 0; len <= prefix_len; len++) {
+                g_autofree gchar *key = NULL;
+                GPtrArray *bucket = NULL;
+
+                key = g_strdup_printf("%s\n%.*s", driver, (int)len, prefix);
+                bucket = g_hash_table_lookup(index->prefixes, key);
+                if (!bucket) {
+                        continue;
+                }
+
+                for (guint i = 0; i < bucket->len; i++) {
+                        MkRule *rule = bucket->pdata[i];
+
+                        if (rule == skip || rule->dead) {
+                                continue;
+                        }
+                        if (mk_tokens_covered(tokens, rule->tokens)) {
+                                return TRUE;
+                        }
+                }
+        }
+
+        return FALSE;
+}
+
+/**
+ * mk_optimize_dedupe:
+ *
+ * Drop patterns spelled identically, or differently for the same tokens, as
+ * another of the same driver.
+ */
+static guint mk_optimize_dedupe(GPtrArray *rules)
+{
+        g_autoptr(GHashTable) seen = NULL;
+        guint ret = 0;
+
+        seen = g_hash_table_new_full(g_str_hash, g_str_equal, g_free, NULL);
+
+        for (guint i = 0; i < rules->len; i++) {
+                MkRule *rule = rules->pdata[i];
+                g_autofree gchar *tokens = NULL;
+                gchar *key = NULL;
+
+                tokens = rule->tokens ? mk_tokens_key(rule->tokens, G_MAXUINT) : NULL;
+                key = g_strdup_printf("%s\n%s", rule->driver, tokens ? tokens : rule->match);
+                if (g_hash_table_contains(seen, key)) {
+                        g_free(key);
+                        rule->dead = TRUE;
+                        ++ret;
+                        continue;
+                }
+                g_hash_table_add(seen, key);
+        }
+
+        return ret;
+}
+
+/**
+ * mk_optimize_subsume:
+ *
+ * Drop every pattern covered by a broader one of the same driver. Of two
+ * patterns covering each other, the first is dropped while the second stays.
+ */
+static guint mk_optimize_subsume(GPtrArray *rules)
+{
+        MkIndex index = { 0 };
+        guint ret = 0;
+
+        mk_index_init(&index, rules);
+
+        for (guint i = 0; i < rules->len; i++) {
+                MkRule *rule = rules->pdata[i];
+
+                if (rule->dead || !rule->tokens) {
+                        continue;
+                }
+                if (mk_index_covers(&index, rule->driver, rule->tokens, rule)) {
+                        rule->dead = TRUE;
+                        ++ret;
+                }
+        }
+
+        mk_index_clear(&index);
+        return ret;
+}
+
+static gboolean mk_rule_is_plain(MkRule *rule)
+{
+        for (guint i = 0; i < rule->tokens->len; i++) {
+                if (!mk_token_is_plain(&g_array_index(rule->tokens, MkToken, i))) {
+                        return FALSE;
+                }
+        }
+        return TRUE;
+}
+
+static gint mk_compare_strings(gconstpointer a, gconstpointer b)
+{
+        return strcmp(*(const gchar **)a, *(const gchar **)b);
+}
+
+/**
+ * mk_optimize_merge_round:
+ *
+ * Patterns of the same driver differing in a single alphanumeric position,
+ * like consecutive device IDs, are the same as one pattern with a bracket
+ * expression there. Merge every such group we find, leaving rules that were
+ * merged into alone until the next round, and keep each result within what
+ * libldm can still expand and compile.
+ *
+ * Returns: The number of patterns merged away
+ */
+static guint mk_optimize_merge_round(GPtrArray *rules)
+{
+        g_autoptr(GHashTable) groups = NULL;
+        g_autoptr(GPtrArray) keys = NULL;
+        GHashTableIter iter = { 0 };
+        gpointer k = NULL;
+        gpointer v = NULL;
+        guint ret = 0;
+
+        groups = g_hash_table_new_full(g_str_hash,
+                                       g_str_equal,
+                                       g_free,
+                                       (GDestroyNotify)g_ptr_array_unref);
+
+        for (guint i = 0; i < rules->len; i++) {
+                MkRule *rule = rules->pdata[i];
+
+                if (rule->dead || !rule->tokens || !mk_rule_is_plain(rule)) {
+                        continue;
+                }
+
+                for (guint j = 0; j < rule->tokens->len; j++) {
+                        const MkToken *token = &g_array_index(rule->tokens, MkToken, j);
+                        g_autofree gchar *tokens = NULL;
+                        gchar *key = NULL;
+                        GPtrArray *group = NULL;
+
+                        if (token->star || !mk_set_is_alnum(token->set)) {
+                                continue;
+                        }
+
+                        tokens = mk_tokens_key(rule->tokens, j);
+                        key = g_strdup_printf("%s\n%u\n%s", rule->driver, j, tokens);
+                        group = g_hash_table_lookup(groups, key);
+                        if (!group) {
+                                group = g_ptr_array_new();
+                                g_hash_table_insert(groups, key, group);
+                        } else {
+                                g_free(key);
+                        }
+                        g_ptr_array_add(group, rule);
+                }
+        }
+
+        /* Visit the groups in a stable order so the output is reproducible */
+        keys = g_ptr_array_new();
+        g_hash_table_iter_init(&iter, groups);
+        while (g_hash_table_iter_next(&iter, &k, &v)) {
+                if (((GPtrArray *)v)->len > 1) {
+                        g_ptr_array_add(keys, k);
+                }
+        }
+        g_ptr_array_sort(keys, mk_compare_strings);
+
+        for (guint i = 0; i < keys->len; i++) {
+                GPtrArray *group = g_hash_table_lookup(groups, keys->pdata[i]);
+                const gchar *position = strchr(keys->pdata[i], '\n') + 1;
+                guint j = (guint)strtoul(position, NULL, 10);
+                MkRule *survivor = NULL;
+
+                for (guint r = 0; r < group->len; r++) {
+                        MkRule *rule = group->pdata[r];
+                        MkToken *into = NULL;
+                        MkToken before = { 0 };
+
+                        if (rule->dead || rule->touched) {
+                                continue;
+                        }
+                        if (!survivor) {
+                                survivor = rule;
+                                continue;
+                        }
+
+                        into = &g_array_index(survivor->tokens, MkToken, j);
+                        before = *into;
+                        for (guint w = 0; w < 8; w++) {
+                                into->set[w] |= g_array_index(rule->tokens, MkToken, j).set[w];
+                        }
+
+                        /* Keep the result compilable by libldm */
+                        if (mk_tokens_expansions(survivor->tokens) > LDM_MODALIAS_EXPAND_MAX) {
+                                *into = before;
+                                break;
+                        }
+
+                        rule->dead = TRUE;
+                        survivor->merged = TRUE;
+                        ++ret;
+                }
+
+                if (survivor && survivor->merged) {
+                        survivor->touched = TRUE;
+                }
+        }
+
+        for (guint i = 0; i < rules->len; i++) {
+                ((MkRule *)rules->pdata[i])->touched = FALSE;
+        }
+
+        return ret;
+}
+
+static gint mk_compare_aliases(gconstpointer a, gconstpointer b)
+{
+        const MkAlias *aliasA = *(const MkAlias **)a;
+        const MkAlias *aliasB = *(const MkAlias **)b;
+        gint ret = strcmp(aliasA->match, aliasB->match);
+
+        return ret != 0 ? ret : strcmp(aliasA->driver, aliasB->driver);
+}
+
+/**
+ * mk_tokens_foreach_expansion:
+ *
+ * Call @func with each literal expansion of the bracket expressions in the
+ * tokens, leaving `*` and `?` as they are, until it returns FALSE.
+ *
+ * Returns: FALSE if @func did
+ */
+static gboolean mk_tokens_foreach_expansion(GArray *tokens,
+                                            gboolean (*func)(GArray *expansion, gpointer v),
+                                            gpointer v)
+{
+        g_autoptr(GArray) expansion = NULL;
+        guint64 n_expansions = mk_tokens_expansions(tokens);
+
+        expansion = g_array_sized_new(FALSE, TRUE, sizeof(MkToken), tokens->len);
+        g_array_append_vals(expansion, tokens->data, tokens->len);
+
+        for (guint64 n = 0; n < n_expansions; n++) {
+                guint64 remainder = n;
+
+                for (guint i = tokens->len; i > 0; i--) {
+                        const MkToken *token = &g_array_index(tokens, MkToken, i - 1);
+                        MkToken *out = &g_array_index(expansion, MkToken, i - 1);
+                        guint n_members = 0;
+                        guint choice = 0;
+
+                        if (token->star || mk_set_is_any(token->set)) {
+                                continue;
+                        }
+
+                        n_members = mk_set_count(token->set);
+                        choice = (guint)(remainder % n_members);
+                        remainder /= n_members;
+
+                        memset(out->set, 0, sizeof(out->set));
+                        for (guint c = 0; c < 256; c++) {
+                                if (mk_set_has(token->set, c) && choice-- == 0) {
+                                        mk_set_add(out->set, c);
+                                        break;
+                                }
+                        }
+                }
+
+                if (!func(expansion, v)) {
+                        return FALSE;
+                }
+        }
+
+        return TRUE;
+}
+
+typedef struct MkVerifyState {
+        MkIndex *index;
+        const gchar *driver;
+} MkVerifyState;
+
+static gboolean mk_verify_expansion(GArray *expansion, gpointer v)
+{
+        MkVerifyState *state = v;
+
+        return mk_index_covers(state->index, state->driver, expansion, NULL);
+}
+
+/**
+ * mk_verify_covered:
+ *
+ * Check that every rule in @rules only matches what @by matches as well.
+ * Rules spelled the same in both trivially do, and anything else must have
+ * each of its expansions covered by a single rule in @by.
+ */
+static gboolean mk_verify_covered(GPtrArray *rules, GPtrArray *by, const gchar *what)
+{
+        MkIndex index = { 0 };
+        gboolean ret = TRUE;
+
+        mk_index_init(&index, by);
+
+        for (guint i = 0; i < rules->len; i++) {
+                MkRule *rule = rules->pdata[i];
+                g_autofree gchar *key = g_strdup_printf("%s\n%s", rule->driver, rule->match);
+                MkVerifyState state = {
+                        .index = &index,
+                        .driver = rule->driver,
+                };
+
+                if (g_hash_table_contains(index.exact, key)) {
+                        continue;
+                }
+                if (rule->tokens && mk_index_covers(&index, rule->driver, rule->tokens, NULL)) {
+                        continue;
+                }
+                if (rule->tokens &&
+                    mk_tokens_expansions(rule->tokens) <= LDM_MODALIAS_EXPAND_MAX &&
+                    mk_tokens_foreach_expansion(rule->tokens, mk_verify_expansion, &state)) {
+                        continue;
+                }
+
+                fprintf(stderr,
+                        "Verification failed: %s for %s is not %s\n",
+                        rule->match,
+                        rule->driver,
+                        what);
+                ret = FALSE;
+                break;
+        }
+
+        mk_index_clear(&index);
+        return ret;
+}
+
+/**
+ * mk_optimize_check_drivers:
+ *
+ * libldm reports the earliest rule matching a device, so reordering rules is
+ * only safe while no modalias is matched by rules of two different drivers.
+ *
+ * Returns: TRUE if that holds for @rules
+ */
+static gboolean mk_optimize_check_drivers(GPtrArray *rules)
+{
+        g_autoptr(GHashTable) prefixes = NULL;
+        const gchar *driver = NULL;
+        gboolean single = TRUE;
+
+        for (guint i = 0; i < rules->len; i++) {
+                MkRule *rule = rules->pdata[i];
+
+                if (driver && !g_str_equal(driver, rule->driver)) {
+                        single = FALSE;
+                }
+                driver = rule->driver;
+        }
+        if (single) {
+                return TRUE;
+        }
+
+        prefixes = g_hash_table_new_full(g_str_hash,
+                                         g_str_equal,
+                                         g_free,
+                                         (GDestroyNotify)g_ptr_array_unref);
+
+        for (guint i = 0; i < rules->len; i++) {
+                MkRule *rule = rules->pdata[i];
+                g_autofree gchar *prefix = NULL;
+                gsize prefix_len = 0;
+                GPtrArray *bucket = NULL;
+
+                if (!rule->tokens) {
+                        fprintf(stderr,
+                                "Cannot optimise aliases of several drivers with pattern %s\n",
+                                rule->match);
+                        return FALSE;
+                }
+
+                /* Two patterns can only overlap if one literal prefix starts the other */
+                prefix = mk_tokens_literal_prefix(rule->tokens);
+                prefix_len = strlen(prefix);
+                for (gsize len = 0; len <= prefix_len; len++) {
+                        g_autofree gchar *key = g_strndup(prefix, len);
+
+                        bucket = g_hash_table_lookup(prefixes, key);
+                        for (guint j = 0; bucket && j < bucket->len; j++) {
+                                MkRule *other = bucket->pdata[j];
+
+                                if (g_str_equal(other->driver, rule->driver) ||
+                                    !mk_tokens_overlap(rule->tokens, other->tokens)) {
+                                        continue;
+                                }
+                                fprintf(stderr,
+                                        "Cannot optimise aliases of different drivers matching "
+                                        "the same modalias: %s for %s, %s for %s\n",
+                                        other->match,
+                                        other->driver,
+                                        rule->match,
+                                        rule->driver);
+                                return FALSE;
+                        }
+                }
+
+                bucket = g_hash_table_lookup(prefixes, prefix);
+                if (!bucket) {
+                        bucket = g_ptr_array_new();
+                        g_hash_table_insert(prefixes, g_steal_pointer(&prefix), bucket);
+                }
+                g_ptr_array_add(bucket, rule);
+        }
+
+        return TRUE;
+}
+
+/**
+ * mk_optimize:
+ * @aliases: (element-type MkAlias): Aliases in file order, all for one package
+ * @stats: (out) (optional): What was done to them
+ *
+ * Shrink the aliases to the fewest we can find matching exactly the same
+ * modaliases for each driver, as libldm would load them:
+ *
+ *  - A repeated pattern replaces the earlier one, then duplicates are dropped
+ *  - Patterns covered by a broader one of the same driver are dropped
+ *  - Patterns differing in one alphanumeric position, i.e. runs of device
+ *    IDs, are merged into a bracket expression libldm can still compile
+ *  - The result is sorted by pattern, keeping rules with a common literal
+ *    prefix together
+ *
+ * libldm reports the earliest rule matching a device, so reordering is only
+ * safe because every alias names the same package, and no modalias may be
+ * matched by the aliases of two different drivers. The result is then
+ * verified in both directions against the input, with each rule of either
+ * having to be covered by one of the other.
+ *
+ * Returns: (transfer full) (nullable) (element-type MkAlias): The optimised
+ * aliases, or NULL on error
+ */
+GPtrArray *mk_optimize(GPtrArray *aliases, MkOptimizeStats *stats)
+{
+        g_autoptr(GHashTable) positions = NULL;
+        g_autoptr(GPtrArray) effective = NULL;
+        g_autoptr(GPtrArray) rules = NULL;
+        g_autoptr(GPtrArray) originals = NULL;
+        g_autoptr(GPtrArray) survivors = NULL;
+        GPtrArray *ret = NULL;
+        MkOptimizeStats done = { 0 };
+        const gchar *package = NULL;
+        guint merged = 0;
+
+        g_return_val_if_fail(aliases != NULL, NULL);
+
+        /* Later lines replace earlier ones with the same pattern, in place */
+        positions = g_hash_table_new(g_str_hash, g_str_equal);
+        effective = g_ptr_array_new();
+        for (guint i = 0; i < aliases->len; i++) {
+                MkAlias *alias = aliases->pdata[i];
+                gpointer position = NULL;
+
+                if (package && !g_str_equal(package, alias->package)) {
+                        fprintf(stderr,
+                                "Cannot optimise aliases for more than one package: %s, %s\n",
+                                package,
+                                alias->package);
+                        return NULL;
+                }
+                package = alias->package;
+
+                if (g_hash_table_lookup_extended(positions, alias->match, NULL, &position)) {
+                        effective->pdata[GPOINTER_TO_UINT(position)] = alias;
+                        ++done.n_duplicates;
+                        continue;
+                }
+                g_hash_table_insert(positions,
+                                    alias->match,
+                                    GUINT_TO_POINTER(effective->len));
+                g_ptr_array_add(effective, alias);
+        }
+        done.n_input = aliases->len;
+
+        rules = g_ptr_array_new_with_free_func((GDestroyNotify)mk_rule_free);
+        originals = g_ptr_array_new_with_free_func((GDestroyNotify)mk_rule_free);
+        for (guint i = 0; i < effective->len; i++) {
+                MkAlias *alias = effective->pdata[i];
+
+                g_ptr_array_add(rules, mk_rule_new(alias->match, alias->driver));
+                g_ptr_array_add(originals, mk_rule_new(alias->match, alias->driver));
+        }
+
+        if (!mk_optimize_check_drivers(originals)) {
+                return NULL;
+        }
+
+        done.n_duplicates += mk_optimize_dedupe(rules);
+        done.n_subsumed = mk_optimize_subsume(rules);
+        while ((merged = mk_optimize_merge_round(rules)) > 0) {
+                done.n_merged += merged;
+        }
+        /* Merged runs may now cover what no single rule did before */
+        done.n_subsumed += mk_optimize_subsume(rules);
+
+        survivors = g_ptr_array_new();
+        for (guint i = 0; i < rules->len; i++) {
+                MkRule *rule = rules->pdata[i];
+
+                if (rule->dead) {
+                        continue;
+                }
+                if (rule->merged) {
+                        g_free(rule->match);
+                        rule->match = mk_tokens_to_pattern(rule->tokens);
+                }
+                g_ptr_array_add(survivors, rule);
+        }
+
+        if (!mk_verify_covered(originals, survivors, "matched by the optimised aliases") ||
+            !mk_verify_covered(survivors, originals, "in the original aliases")) {
+                return NULL;
+        }
+
+        ret = g_ptr_array_new_with_free_func((GDestroyNotify)mk_alias_free);
+        for (guint i = 0; i < survivors->len; i++) {
+                MkRule *rule = survivors->pdata[i];
+
+                g_ptr_array_add(ret, mk_alias_new(rule->match, rule->driver, package));
+        }
+        g_ptr_array_sort(ret, mk_compare_aliases);
+        done.n_output = ret->len;
+
+        if (stats) {
+                *stats = done;
+        }
+        return ret;
+}
+
+/*
+ * Editor modelines  -  https://www.wireshark.org/tools/modelines.html
+ *
+ * Local variables:
+ * c-basic-offset: 8
+ * tab-width: 8
+ * indent-tabs-mode: nil
+ * End:
+ *
+ * vi: set shiftwidth=8 tabstop=8 expandtab:
+ * :indentSize=8:tabSize=8:noTabs=true:
+ */
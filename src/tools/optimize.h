@@ -0,0 +1,56 @@
+/*
+ * This file is part of linux-driver-management.
+ *
+ * Copyright © 2016-2018 Ikey Doherty
+ *
+ * linux-driver-management is free software; you can redistribute it and/or
+ * modify it under the terms of the GNU Lesser General Public License as
+ * published by the Free Software Foundation; either version 2.1
+ * of the License, or (at your option) any later version.
+ */
+
+#pragma once
+
+#include <glib.h>
+
+#include "../lib/util.h"
+
+/*
+ * A single `alias` line of a `.modaliases` file
+ */
+typedef struct MkAlias {
+        gchar *match;
+        gchar *driver;
+        gchar *package;
+} MkAlias;
+
+/*
+ * What the optimisation pass did to the aliases
+ */
+typedef struct MkOptimizeStats {
+        guint n_input;      /* Alias lines read */
+        guint n_duplicates; /* Repeated patterns, including replaced ones */
+        guint n_subsumed;   /* Patterns covered by a broader one */
+        guint n_merged;     /* Patterns folded into a bracket expression */
+        guint n_output;     /* Alias lines written */
+} MkOptimizeStats;
+
+MkAlias *mk_alias_new(const gchar *match, const gchar *driver, const gchar *package);
+void mk_alias_free(MkAlias *alias);
+
+GPtrArray *mk_optimize(GPtrArray *aliases, MkOptimizeStats *stats);
+
+DEF_AUTOFREE(MkAlias, mk_alias_free)
+
+/*
+ * Editor modelines  -  https://www.wireshark.org/tools/modelines.html
+ *
+ * Local variables:
+ * c-basic-offset: 8
+ * tab-width: 8
+ * indent-tabs-mode: nil
+ * End:
+ *
+ * vi: set shiftwidth=8 tabstop=8 expandtab:
+ * :indentSize=8:tabSize=8:noTabs=true:
+ */
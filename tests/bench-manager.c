@@ -0,0 +1,211 @@
+/*
+ * This file is part of linux-driver-management.
+ *
+ * Copyright © 2016-2018 Ikey Doherty
+ *
+ * linux-driver-management is free software; you can redistribute it and/or
+ * modify it under the terms of the GNU Lesser General Public License as
+ * published by the Free Software Foundation; either version 2.1
+ * of the License, or (at your option) any later version.
+ */
+
+#define _GNU_SOURCE
+
+#include <malloc.h>
+#include <stdio.h>
+#include <stdlib.h>
+#include <string.h>
+#include <umockdev.h>
+
+#include "ldm-private.h"
+#include "ldm.h"
+#include "util.h"
+
+/*
+ * Report the memory held by LdmManager once every umockdev capture in the
+ * test data has been loaded, for keeping the per-device footprint down in
+ * long running daemons, and how enumeration time grows with the number of
+ * devices. Must be run under umockdev-wrapper.
+ */
+
+DEF_AUTOFREE(UMockdevTestbed, g_object_unref)
+
+/* Synthetic devices in the smaller enumeration run, the larger has four times as many */
+#define BENCH_DEVICES 1024
+
+/**
+ * Returns: Resident set size of this process in kB, or 0 if unknown
+ */
+static guint64 bench_rss(void)
+{
+        g_autofree gchar *contents = NULL;
+        const gchar *line = NULL;
+
+        if (!g_file_get_contents("/proc/self/status", &contents, NULL, NULL)) {
+                return 0;
+        }
+
+        line = strstr(contents, "VmRSS:");
+        if (!line) {
+                return 0;
+        }
+
+        return g_ascii_strtoull(line + strlen("VmRSS:"), NULL, 10);
+}
+
+/**
+ * Returns: Number of devices in the tree below @device, including it
+ */
+static guint bench_count_devices(LdmDevice *device)
+{
+        LdmDeviceIter iter = { 0 };
+        LdmDevice *child = NULL;
+        guint ret = 1;
+
+        ldm_device_iter_init(&iter, device);
+        while (ldm_device_iter_next(&iter, &child)) {
+                ret += bench_count_devices(child);
+        }
+
+        return ret;
+}
+
+/**
+ * Returns: (transfer full) (nullable): Manager of the devices in @path
+ */
+static LdmManager *bench_load_capture(const gchar *path)
+{
+        autofree(UMockdevTestbed) *bed = NULL;
+
+        bed = umockdev_testbed_new();
+        if (!umockdev_testbed_add_from_file(bed, path, NULL)) {
+                fprintf(stderr, "Cannot load %s\n", path);
+                return NULL;
+        }
+
+        return ldm_manager_new(LDM_MANAGER_FLAGS_NO_MONITOR);
+}
+
+/**
+ * Returns: Microseconds taken to enumerate @n_devices synthetic USB devices
+ */
+static gint64 bench_enumeration(guint n_devices)
+{
+        autofree(UMockdevTestbed) *bed = NULL;
+        g_autoptr(LdmManager) manager = NULL;
+        gint64 start = 0;
+
+        bed = umockdev_testbed_new();
+        for (guint i = 0; i < n_devices; i++) {
+                g_autofree gchar *name = NULL;
+                g_autofree gchar *path = NULL;
+
+                name = g_strdup_printf("usb%05u", i);
+                path = umockdev_testbed_add_device(bed,
+                                                   "usb",
+                                                   name,
+                                                   NULL,
+                                                   "idVendor",
+                                                   "1d6b",
+                                                   "idProduct",
+                                                   "0002",
+                                                   "bDeviceClass",
+                                                   "09",
+                                                   NULL,
+                                                   "DEVTYPE",
+                                                   "usb_device",
+                                                   NULL);
+        }
+
+        start = g_get_monotonic_time();
+        manager = ldm_manager_new(LDM_MANAGER_FLAGS_NO_MONITOR);
+        return g_get_monotonic_time() - start;
+}
+
+int main(int argc, char **argv)
+{
+        g_autoptr(GPtrArray) managers = NULL;
+        g_autoptr(GDir) dir = NULL;
+        const gchar *data_root = TEST_DATA_ROOT;
+        const gchar *name = NULL;
+        size_t heap = 0;
+        guint64 rss = 0;
+        guint n_devices = 0;
+        gint64 small = 0;
+        gint64 large = 0;
+
+        if (argc > 1) {
+                data_root = argv[1];
+        }
+
+        dir = g_dir_open(data_root, 0, NULL);
+        if (!dir) {
+                fprintf(stderr, "Cannot open %s\n", data_root);
+                return EXIT_FAILURE;
+        }
+
+        managers = g_ptr_array_new_with_free_func(g_object_unref);
+
+        /* Warm up the type system first */
+        g_object_unref(ldm_manager_new(LDM_MANAGER_FLAGS_NO_MONITOR));
+
+        heap = mallinfo2().uordblks;
+        rss = bench_rss();
+
+        while ((name = g_dir_read_name(dir)) != NULL) {
+                g_autofree gchar *path = NULL;
+                LdmManager *manager = NULL;
+                g_autoptr(GPtrArray) devices = NULL;
+
+                if (!g_str_has_suffix(name, ".umockdev")) {
+                        continue;
+                }
+                path = g_build_filename(data_root, name, NULL);
+
+                manager = bench_load_capture(path);
+                if (!manager) {
+                        return EXIT_FAILURE;
+                }
+                g_ptr_array_add(managers, manager);
+
+                devices = ldm_manager_get_devices(manager, LDM_DEVICE_TYPE_ANY);
+                for (guint i = 0; i < devices->len; i++) {
+                        n_devices += bench_count_devices(devices->pdata[i]);
+                }
+        }
+
+        heap = mallinfo2().uordblks - heap;
+        rss = bench_rss() - rss;
+
+        printf("%u captures, %u devices\n", managers->len, n_devices);
+        printf("heap: %10zu bytes, %6zu per device\n", heap, n_devices ? heap / n_devices : 0);
+        printf("rss:  %10" G_GUINT64_FORMAT " kB\n", rss);
+
+        /* Drop the captures so their testbeds can't show up in the timings */
+        g_clear_pointer(&managers, g_ptr_array_unref);
+
+        small = MAX(bench_enumeration(BENCH_DEVICES), 1);
+        large = bench_enumeration(BENCH_DEVICES * 4);
+
+        /* Linear lookups should take about four times as long, quadratic sixteen */
+        printf("enumerate %5u devices: %8" G_GINT64_FORMAT " us\n", BENCH_DEVICES, small);
+        printf("enumerate %5u devices: %8" G_GINT64_FORMAT " us (%.1fx)\n",
+               BENCH_DEVICES * 4,
+               large,
+               (double)large / (double)small);
+
+        return EXIT_SUCCESS;
+}
+
+/*
+ * Editor modelines  -  https://www.wireshark.org/tools/modelines.html
+ *
+ * Local variables:
+ * c-basic-offset: 8
+ * tab-width: 8
+ * indent-tabs-mode: nil
+ * End:
+ *
+ * vi: set shiftwidth=8 tabstop=8 expandtab:
+ * :indentSize=8:tabSize=8:noTabs=true:
+ */
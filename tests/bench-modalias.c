@@ -0,0 +1,424 @@
+/*
+ * This file is part of linux-driver-management.
+ *
+ * Copyright © 2016-2018 Ikey Doherty
+ *
+ * linux-driver-management is free software; you can redistribute it and/or
+ * modify it under the terms of the GNU Lesser General Public License as
+ * published by the Free Software Foundation; either version 2.1
+ * of the License, or (at your option) any later version.
+ */
+
+#define _GNU_SOURCE
+
+#include <fcntl.h>
+#include <malloc.h>
+#include <stdio.h>
+#include <stdlib.h>
+#include <string.h>
+#include <sys/stat.h>
+#include <unistd.h>
+
+#include "ldm-private.h"
+#include "ldm.h"
+#include "util.h"
+
+/*
+ * Compare the compiled matcher used by LdmModaliasPlugin against the naive
+ * approach of running fnmatch over every rule, using the modaliases files
+ * and umockdev captures from the test data as the corpus.
+ */
+
+#define BENCH_ROUNDS 50
+#define BENCH_LOAD_ROUNDS 200
+#define BENCH_COLD_ROUNDS 50
+
+typedef struct BenchRules {
+        LdmPlugin *plugin;
+        GPtrArray *modaliases; /* In file order, duplicates replaced */
+} BenchRules;
+
+static void bench_rules_free(gpointer v)
+{
+        BenchRules *rules = v;
+
+        g_object_unref(rules->plugin);
+        g_ptr_array_unref(rules->modaliases);
+        g_free(rules);
+}
+
+/**
+ * Parse the modaliases file again for the fnmatch baseline, mirroring the
+ * plugin semantics (later duplicates replace the earlier rule in place).
+ */
+static GPtrArray *bench_load_modaliases(const gchar *path)
+{
+        g_autofree gchar *contents = NULL;
+        g_auto(GStrv) lines = NULL;
+        g_autoptr(GHashTable) seen = NULL;
+        GPtrArray *ret = NULL;
+
+        if (!g_file_get_contents(path, &contents, NULL, NULL)) {
+                return NULL;
+        }
+
+        ret = g_ptr_array_new_with_free_func(g_object_unref);
+        seen = g_hash_table_new(g_str_hash, g_str_equal);
+        lines = g_strsplit(contents, "\n", -1);
+
+        for (gchar **line = lines; *line; line++) {
+                g_auto(GStrv) splits = NULL;
+                LdmModalias *modalias = NULL;
+                gpointer v = NULL;
+
+                splits = g_strsplit(g_strstrip(*line), " ", 4);
+                if (g_strv_length(splits) != 4 || !g_str_equal(splits[0], "alias")) {
+                        continue;
+                }
+
+                modalias = g_object_ref_sink(ldm_modalias_new(splits[1], splits[2], splits[3]));
+                if (g_hash_table_lookup_extended(seen, splits[1], NULL, &v)) {
+                        guint index = GPOINTER_TO_UINT(v);
+                        g_object_unref(ret->pdata[index]);
+                        ret->pdata[index] = modalias;
+                        continue;
+                }
+
+                g_hash_table_insert(seen,
+                                    (gpointer)ldm_modalias_get_match(modalias),
+                                    GUINT_TO_POINTER(ret->len));
+                g_ptr_array_add(ret, modalias);
+        }
+
+        return ret;
+}
+
+/**
+ * Grab all of the `A: modalias=` attributes from the umockdev captures and
+ * turn them into fake devices.
+ */
+static void bench_load_devices(const gchar *path, GPtrArray *devices)
+{
+        g_autofree gchar *contents = NULL;
+        g_auto(GStrv) lines = NULL;
+
+        if (!g_file_get_contents(path, &contents, NULL, NULL)) {
+                return;
+        }
+
+        lines = g_strsplit(contents, "\n", -1);
+        for (gchar **line = lines; *line; line++) {
+                LdmDevice *device = NULL;
+
+                if (!g_str_has_prefix(*line, "A: modalias=")) {
+                        continue;
+                }
+
+                device = g_object_ref_sink(g_object_new(LDM_TYPE_DEVICE, NULL));
+                device->os.modalias = g_strdup(*line + strlen("A: modalias="));
+                device->os.sysfs_path = g_strdup_printf("/fake/bench/%u", devices->len);
+                g_ptr_array_add(devices, device);
+        }
+}
+
+static GPtrArray *bench_load_data(const gchar *data_root, const gchar *suffix, gboolean rules)
+{
+        g_autoptr(GDir) dir = NULL;
+        GPtrArray *ret = NULL;
+        const gchar *name = NULL;
+
+        dir = g_dir_open(data_root, 0, NULL);
+        if (!dir) {
+                fprintf(stderr, "Cannot open %s\n", data_root);
+                return NULL;
+        }
+
+        ret = g_ptr_array_new_with_free_func(rules ? bench_rules_free : g_object_unref);
+
+        while ((name = g_dir_read_name(dir)) != NULL) {
+                g_autofree gchar *path = NULL;
+
+                if (!g_str_has_suffix(name, suffix)) {
+                        continue;
+                }
+
+                path = g_build_filename(data_root, name, NULL);
+                if (rules) {
+                        BenchRules *r = g_new0(BenchRules, 1);
+                        r->plugin = ldm_modalias_plugin_new_from_filename(path);
+                        r->modaliases = bench_load_modaliases(path);
+                        g_ptr_array_add(ret, r);
+                } else {
+                        bench_load_devices(path, ret);
+                }
+        }
+
+        return ret;
+}
+
+/**
+ * Report the time taken to load each modaliases file, and the heap retained
+ * by the resulting plugin.
+ */
+static void bench_load_files(const gchar *data_root)
+{
+        g_autoptr(GDir) dir = NULL;
+        const gchar *name = NULL;
+
+        dir = g_dir_open(data_root, 0, NULL);
+        if (!dir) {
+                return;
+        }
+
+        while ((name = g_dir_read_name(dir)) != NULL) {
+                g_autofree gchar *path = NULL;
+                LdmPlugin *plugin = NULL;
+                size_t heap = 0;
+                gint64 start = 0;
+                gint64 elapsed = 0;
+
+                if (!g_str_has_suffix(name, ".modaliases")) {
+                        continue;
+                }
+                path = g_build_filename(data_root, name, NULL);
+
+                /* Warm up the type system and the page cache first */
+                g_object_unref(g_object_ref_sink(ldm_modalias_plugin_new_from_filename(path)));
+
+                heap = mallinfo2().uordblks;
+                plugin = g_object_ref_sink(ldm_modalias_plugin_new_from_filename(path));
+                heap = mallinfo2().uordblks - heap;
+                g_object_unref(plugin);
+
+                start = g_get_monotonic_time();
+                for (guint round = 0; round < BENCH_LOAD_ROUNDS; round++) {
+                        plugin = ldm_modalias_plugin_new_from_filename(path);
+                        g_object_unref(g_object_ref_sink(plugin));
+                }
+                elapsed = g_get_monotonic_time() - start;
+
+                printf("load %s: %8zu bytes retained, %6" G_GINT64_FORMAT " us per load\n",
+                       name,
+                       heap,
+                       elapsed / BENCH_LOAD_ROUNDS);
+        }
+}
+
+static const gchar *bench_fnmatch(BenchRules *rules, LdmDevice *device)
+{
+        for (guint i = 0; i < rules->modaliases->len; i++) {
+                LdmModalias *modalias = rules->modaliases->pdata[i];
+
+                if (ldm_modalias_matches_device(modalias, device)) {
+                        return ldm_modalias_get_package(modalias);
+                }
+        }
+        return NULL;
+}
+
+static const gchar *bench_plugin(BenchRules *rules, LdmDevice *device, LdmProvider **provider)
+{
+        *provider = ldm_plugin_get_provider(rules->plugin, device);
+        if (!*provider) {
+                return NULL;
+        }
+        return ldm_provider_get_package(*provider);
+}
+
+/**
+ * Evict the file from the page cache, so the next load has to read it from
+ * the disk again.
+ *
+ * Returns: The size of the file on disk, or -1 if it's missing
+ */
+static goffset bench_drop_cache(const gchar *path)
+{
+        struct stat st = { 0 };
+        gint fd = -1;
+
+        fd = open(path, O_RDONLY | O_CLOEXEC);
+        if (fd < 0) {
+                return -1;
+        }
+        if (fstat(fd, &st) == 0) {
+                posix_fadvise(fd, 0, 0, POSIX_FADV_DONTNEED);
+        }
+        close(fd);
+
+        return (goffset)st.st_size;
+}
+
+/**
+ * Compare cold cache load times of each modaliases file in the test data
+ * against its compressed forms, when the library can read them.
+ */
+static void bench_load_cold(const gchar *data_root)
+{
+        static const gchar *suffixes[] = { "", ".gz", ".zst" };
+        g_autoptr(GDir) dir = NULL;
+        const gchar *name = NULL;
+
+        dir = g_dir_open(data_root, 0, NULL);
+        if (!dir) {
+                return;
+        }
+
+        while ((name = g_dir_read_name(dir)) != NULL) {
+                if (!g_str_has_suffix(name, ".modaliases")) {
+                        continue;
+                }
+
+                for (guint i = 0; i < G_N_ELEMENTS(suffixes); i++) {
+                        g_autofree gchar *path = NULL;
+                        LdmPlugin *plugin = NULL;
+                        goffset size = 0;
+                        gint64 elapsed = 0;
+
+                        if (*suffixes[i] == '\0') {
+                                path = g_build_filename(data_root, name, NULL);
+                        } else {
+                                g_autofree gchar *file = g_strconcat(name, suffixes[i], NULL);
+                                path = g_build_filename(data_root, "compressed", file, NULL);
+                        }
+
+                        /* Not in the test data, or not supported by this build */
+                        plugin = ldm_modalias_plugin_new_from_filename(path);
+                        if (!plugin) {
+                                continue;
+                        }
+                        g_object_unref(g_object_ref_sink(plugin));
+
+                        for (guint round = 0; round < BENCH_COLD_ROUNDS; round++) {
+                                gint64 start = 0;
+
+                                size = bench_drop_cache(path);
+                                start = g_get_monotonic_time();
+                                plugin = ldm_modalias_plugin_new_from_filename(path);
+                                elapsed += g_get_monotonic_time() - start;
+                                g_object_unref(g_object_ref_sink(plugin));
+                        }
+
+                        printf("cold %s%s: %8" G_GOFFSET_FORMAT " bytes on disk, %6" G_GINT64_FORMAT
+                               " us per load\n",
+                               name,
+                               suffixes[i],
+                               size,
+                               elapsed / BENCH_COLD_ROUNDS);
+                }
+        }
+}
+
+/**
+ * Report how many rules the manager's unified index was spared by interning
+ * patterns shared between the modaliases files.
+ */
+static void bench_shared_patterns(const gchar *data_root)
+{
+        g_autoptr(LdmManager) manager = NULL;
+        guint n_rules = 0;
+        guint n_patterns = 0;
+
+        manager = ldm_manager_new(LDM_MANAGER_FLAGS_NO_MONITOR);
+        if (!ldm_manager_add_modalias_plugins_for_directory(manager, data_root)) {
+                return;
+        }
+
+        ldm_manager_get_pattern_stats(manager, &n_rules, &n_patterns);
+        printf("shared patterns: %u rules, %u indexed, %u duplicates eliminated\n",
+               n_rules,
+               n_patterns,
+               n_rules - n_patterns);
+}
+
+int main(int argc, char **argv)
+{
+        g_autoptr(GPtrArray) rules = NULL;
+        g_autoptr(GPtrArray) devices = NULL;
+        const gchar *data_root = TEST_DATA_ROOT;
+        gint64 start = 0;
+        gint64 naive = 0;
+        gint64 compiled = 0;
+        guint hits = 0;
+        guint n_rules = 0;
+
+        if (argc > 1) {
+                data_root = argv[1];
+        }
+
+        rules = bench_load_data(data_root, ".modaliases", TRUE);
+        devices = bench_load_data(data_root, ".umockdev", FALSE);
+        if (!rules || !devices) {
+                return EXIT_FAILURE;
+        }
+
+        /* Make sure both paths agree before timing anything */
+        for (guint i = 0; i < rules->len; i++) {
+                BenchRules *r = rules->pdata[i];
+
+                n_rules += r->modaliases->len;
+                for (guint j = 0; j < devices->len; j++) {
+                        g_autoptr(LdmProvider) provider = NULL;
+                        const gchar *want = bench_fnmatch(r, devices->pdata[j]);
+                        const gchar *got = bench_plugin(r, devices->pdata[j], &provider);
+
+                        if (g_strcmp0(want, got) != 0) {
+                                fprintf(stderr,
+                                        "Mismatch for %s in %s: fnmatch=%s compiled=%s\n",
+                                        ldm_device_get_modalias(devices->pdata[j]),
+                                        ldm_plugin_get_name(r->plugin),
+                                        want,
+                                        got);
+                                return EXIT_FAILURE;
+                        }
+                        hits += want ? 1 : 0;
+                }
+        }
+
+        start = g_get_monotonic_time();
+        for (guint round = 0; round < BENCH_ROUNDS; round++) {
+                for (guint i = 0; i < rules->len; i++) {
+                        for (guint j = 0; j < devices->len; j++) {
+                                bench_fnmatch(rules->pdata[i], devices->pdata[j]);
+                        }
+                }
+        }
+        naive = g_get_monotonic_time() - start;
+
+        start = g_get_monotonic_time();
+        for (guint round = 0; round < BENCH_ROUNDS; round++) {
+                for (guint i = 0; i < rules->len; i++) {
+                        for (guint j = 0; j < devices->len; j++) {
+                                g_autoptr(LdmProvider) provider = NULL;
+                                bench_plugin(rules->pdata[i], devices->pdata[j], &provider);
+                        }
+                }
+        }
+        compiled = g_get_monotonic_time() - start;
+
+        printf("%u rules, %u devices, %u matches, %d rounds\n",
+               n_rules,
+               devices->len,
+               hits,
+               BENCH_ROUNDS);
+        printf("fnmatch:  %10" G_GINT64_FORMAT " us\n", naive);
+        printf("compiled: %10" G_GINT64_FORMAT " us\n", compiled);
+
+        bench_load_files(data_root);
+        bench_load_cold(data_root);
+        bench_shared_patterns(data_root);
+
+        return EXIT_SUCCESS;
+}
+
+/*
+ * Editor modelines  -  https://www.wireshark.org/tools/modelines.html
+ *
+ * Local variables:
+ * c-basic-offset: 8
+ * tab-width: 8
+ * indent-tabs-mode: nil
+ * End:
+ *
+ * vi: set shiftwidth=8 tabstop=8 expandtab:
+ * :indentSize=8:tabSize=8:noTabs=true:
+ */
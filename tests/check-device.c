@@ -0,0 +1,484 @@
+/*
+ * This file is part of linux-driver-management.
+ *
+ * Copyright © 2016-2018 Ikey Doherty
+ *
+ * linux-driver-management is free software; you can redistribute it and/or
+ * modify it under the terms of the GNU Lesser General Public License as
+ * published by the Free Software Foundation; either version 2.1
+ * of the License, or (at your option) any later version.
+ */
+
+#define _GNU_SOURCE
+
+#include <check.h>
+#include <stdio.h>
+#include <stdlib.h>
+#include <umockdev.h>
+
+#include "ldm.h"
+#include "util.h"
+
+DEF_AUTOFREE(UMockdevTestbed, g_object_unref)
+
+/* Plug and unplug operations in the hotplug sequence */
+#define HOTPLUG_STEPS 48
+
+/* Interface classes drawn for the synthetic interfaces: audio, HID, printer, storage, vendor */
+static const gchar *hotplug_classes[] = {
+        "01", "03", "07", "08", "255",
+};
+
+/**
+ * Add the USB device everything else is plugged into.
+ *
+ * Returns: (transfer full): sysfs path of the new device
+ */
+static gchar *hotplug_add_root(UMockdevTestbed *bed)
+{
+        gchar *path = NULL;
+
+        path = umockdev_testbed_add_device(bed,
+                                           "usb",
+                                           "1-1",
+                                           NULL,
+                                           "idVendor",
+                                           "1d6b",
+                                           "idProduct",
+                                           "0002",
+                                           "bDeviceClass",
+                                           "09",
+                                           NULL,
+                                           "DEVTYPE",
+                                           "usb_device",
+                                           NULL);
+        fail_if(!path, "Failed to add the USB device");
+
+        return path;
+}
+
+/**
+ * Returns: (transfer none): The manager's device for the root USB device
+ */
+static LdmDevice *hotplug_get_root(LdmManager *manager)
+{
+        g_autoptr(GPtrArray) devices = NULL;
+
+        devices = ldm_manager_get_devices(manager, LDM_DEVICE_TYPE_USB);
+        fail_if(devices->len != 1, "Expected 1 USB device, got %u", devices->len);
+
+        return devices->pdata[0];
+}
+
+/**
+ * Hotplug a new interface of class @klass into the root device.
+ *
+ * Returns: (transfer full): sysfs path of the new interface
+ */
+static gchar *hotplug_plug_interface(UMockdevTestbed *bed, const gchar *root_path, guint id,
+                                     const gchar *klass)
+{
+        g_autofree gchar *name = NULL;
+        gchar *path = NULL;
+
+        name = g_strdup_printf("1-1:1.%u", id);
+        path = umockdev_testbed_add_device(bed,
+                                           "usb",
+                                           name,
+                                           root_path,
+                                           "bInterfaceClass",
+                                           klass,
+                                           NULL,
+                                           "DEVTYPE",
+                                           "usb_interface",
+                                           NULL);
+        fail_if(!path, "Failed to add %s", name);
+        umockdev_testbed_uevent(bed, path, "add");
+
+        return path;
+}
+
+/**
+ * Hotplug a new HID device into the interface at @interface_path.
+ *
+ * Returns: (transfer full): sysfs path of the new HID device
+ */
+static gchar *hotplug_plug_hid(UMockdevTestbed *bed, const gchar *interface_path, guint id)
+{
+        g_autofree gchar *name = NULL;
+        gchar *path = NULL;
+
+        name = g_strdup_printf("0003:1D6B:0002.%04X", id);
+        path = umockdev_testbed_add_device(bed, "hid", name, interface_path, NULL, NULL);
+        fail_if(!path, "Failed to add %s", name);
+        umockdev_testbed_uevent(bed, path, "add");
+
+        return path;
+}
+
+/**
+ * Hotplug removal of the device at @path, along with anything beneath it.
+ */
+static void hotplug_unplug(UMockdevTestbed *bed, const gchar *path)
+{
+        umockdev_testbed_uevent(bed, path, "remove");
+        umockdev_testbed_remove_device(bed, path);
+}
+
+/**
+ * Returns: Number of devices in the tree below @device, including it
+ */
+static guint hotplug_count(LdmDevice *device)
+{
+        LdmDeviceIter iter = { 0 };
+        LdmDevice *child = NULL;
+        guint ret = 1;
+
+        ldm_device_iter_init(&iter, device);
+        while (ldm_device_iter_next(&iter, &child)) {
+                ret += hotplug_count(child);
+        }
+
+        return ret;
+}
+
+/**
+ * Let the manager process uevents until the tree below @root holds
+ * @n_devices devices.
+ */
+static void hotplug_wait(LdmDevice *root, guint n_devices)
+{
+        gint64 deadline = 0;
+
+        deadline = g_get_monotonic_time() + 2 * G_USEC_PER_SEC;
+        while (hotplug_count(root) != n_devices && g_get_monotonic_time() < deadline) {
+                if (!g_main_context_iteration(NULL, FALSE)) {
+                        g_usleep(G_USEC_PER_SEC / 100);
+                }
+        }
+
+        fail_if(hotplug_count(root) != n_devices,
+                "Expected %u devices in the tree, got %u",
+                n_devices,
+                hotplug_count(root));
+}
+
+/**
+ * Flatten the tree below @device, including it.
+ */
+static void hotplug_collect(LdmDevice *device, GPtrArray *nodes)
+{
+        LdmDeviceIter iter = { 0 };
+        LdmDevice *child = NULL;
+
+        g_ptr_array_add(nodes, device);
+
+        ldm_device_iter_init(&iter, device);
+        while (ldm_device_iter_next(&iter, &child)) {
+                hotplug_collect(child, nodes);
+        }
+}
+
+/**
+ * The uncached definition of #ldm_device_has_type
+ */
+static gboolean hotplug_has_type(LdmDevice *device, guint mask)
+{
+        LdmDeviceIter iter = { 0 };
+        LdmDevice *child = NULL;
+
+        if ((ldm_device_get_device_type(device) & mask) == mask) {
+                return TRUE;
+        }
+
+        ldm_device_iter_init(&iter, device);
+        while (ldm_device_iter_next(&iter, &child)) {
+                if (hotplug_has_type(child, mask)) {
+                        return TRUE;
+                }
+        }
+
+        return FALSE;
+}
+
+/**
+ * The uncached definition of #ldm_device_has_attribute
+ */
+static gboolean hotplug_has_attribute(LdmDevice *device, guint mask)
+{
+        LdmDeviceIter iter = { 0 };
+        LdmDevice *child = NULL;
+
+        if ((ldm_device_get_attributes(device) & mask) == mask) {
+                return TRUE;
+        }
+
+        ldm_device_iter_init(&iter, device);
+        while (ldm_device_iter_next(&iter, &child)) {
+                if (hotplug_has_attribute(child, mask)) {
+                        return TRUE;
+                }
+        }
+
+        return FALSE;
+}
+
+/**
+ * Ensure every node of the tree answers type and attribute queries as if
+ * nothing were cached.
+ */
+static void assert_hotplug_masks(LdmDevice *root, guint step)
+{
+        g_autoptr(GPtrArray) nodes = NULL;
+
+        nodes = g_ptr_array_new();
+        hotplug_collect(root, nodes);
+
+        for (guint i = 0; i < nodes->len; i++) {
+                LdmDevice *device = nodes->pdata[i];
+
+                for (guint a = 1; a < LDM_DEVICE_TYPE_MAX; a <<= 1) {
+                        for (guint b = a; b < LDM_DEVICE_TYPE_MAX; b <<= 1) {
+                                fail_if(ldm_device_has_type(device, a | b) !=
+                                            hotplug_has_type(device, a | b),
+                                        "Step %u: %s disagrees on type %u",
+                                        step,
+                                        ldm_device_get_path(device),
+                                        a | b);
+                        }
+                }
+
+                for (guint mask = 0; mask < LDM_DEVICE_ATTRIBUTE_MAX; mask++) {
+                        fail_if(ldm_device_has_attribute(device, mask) !=
+                                    hotplug_has_attribute(device, mask),
+                                "Step %u: %s disagrees on attribute %u",
+                                step,
+                                ldm_device_get_path(device),
+                                mask);
+                }
+        }
+}
+
+/**
+ * Ensure the cached subtree masks stay correct while interfaces and HID
+ * devices are hotplugged into, and unplugged from, random points of the tree.
+ */
+START_TEST(test_device_hotplug_masks)
+{
+        g_autoptr(LdmManager) manager = NULL;
+        autofree(UMockdevTestbed) *bed = NULL;
+        g_autoptr(GRand) rand = NULL;
+        g_autoptr(GPtrArray) interfaces = NULL;
+        g_autoptr(GArray) n_hids = NULL;
+        g_autofree gchar *root_path = NULL;
+        LdmDevice *root = NULL;
+        guint n_devices = 1;
+
+        rand = g_rand_new_with_seed(1);
+        interfaces = g_ptr_array_new_with_free_func(g_free);
+        n_hids = g_array_new(FALSE, TRUE, sizeof(guint));
+
+        bed = umockdev_testbed_new();
+        root_path = hotplug_add_root(bed);
+        manager = ldm_manager_new(0);
+        root = hotplug_get_root(manager);
+
+        for (guint step = 1; step <= HOTPLUG_STEPS; step++) {
+                gint32 op = g_rand_int_range(rand, 0, 3);
+                guint pick = 0;
+
+                if (interfaces->len > 0) {
+                        pick = (guint)g_rand_int_range(rand, 0, (gint32)interfaces->len);
+                }
+
+                if (interfaces->len > 0 && op == 0) {
+                        /* Unplug an interface, taking its HID devices with it */
+                        hotplug_unplug(bed, interfaces->pdata[pick]);
+                        n_devices -= 1 + g_array_index(n_hids, guint, pick);
+                        g_ptr_array_remove_index(interfaces, pick);
+                        g_array_remove_index(n_hids, pick);
+                } else if (interfaces->len > 0 && op == 1) {
+                        g_autofree gchar *path = NULL;
+
+                        path = hotplug_plug_hid(bed, interfaces->pdata[pick], step);
+                        ++g_array_index(n_hids, guint, pick);
+                        ++n_devices;
+                } else {
+                        const gchar *klass = NULL;
+                        guint zero = 0;
+
+                        klass = hotplug_classes[g_rand_int_range(rand,
+                                                                 0,
+                                                                 G_N_ELEMENTS(hotplug_classes))];
+                        g_ptr_array_add(interfaces,
+                                        hotplug_plug_interface(bed, root_path, step, klass));
+                        g_array_append_val(n_hids, zero);
+                        ++n_devices;
+                }
+
+                hotplug_wait(root, n_devices);
+                assert_hotplug_masks(root, step);
+        }
+}
+END_TEST
+
+/**
+ * Ensure the children of @device are exactly @paths, in that order, whether
+ * visited through the iterator or the list.
+ */
+static void assert_children(LdmDevice *device, GPtrArray *paths)
+{
+        g_autoptr(GList) kids = NULL;
+        LdmDeviceIter iter = { 0 };
+        LdmDevice *child = NULL;
+        GList *node = NULL;
+        guint n_kids = 0;
+
+        kids = ldm_device_get_children(device);
+        node = kids;
+
+        ldm_device_iter_init(&iter, device);
+        while (ldm_device_iter_next(&iter, &child)) {
+                fail_if(n_kids >= paths->len ||
+                            !g_str_equal(ldm_device_get_path(child), paths->pdata[n_kids]),
+                        "Child %u is out of order",
+                        n_kids);
+                fail_if(!node || node->data != child, "Children list disagrees with the iterator");
+                node = node->next;
+                ++n_kids;
+        }
+        fail_if(n_kids != paths->len, "Expected %u children, got %u", paths->len, n_kids);
+        fail_if(node != NULL, "Children list holds more than the iterator");
+}
+
+/**
+ * Returns: (transfer none): The child of @device at @index
+ */
+static LdmDevice *nth_child(LdmDevice *device, guint index)
+{
+        LdmDeviceIter iter = { 0 };
+        LdmDevice *child = NULL;
+
+        ldm_device_iter_init(&iter, device);
+        for (guint i = 0; i <= index; i++) {
+                fail_if(!ldm_device_iter_next(&iter, &child), "No child at %u", index);
+        }
+
+        return child;
+}
+
+/**
+ * Ensure children keep their order and stay reachable by path through
+ * hotplug, both before and after a device holds enough of them to index.
+ */
+START_TEST(test_device_children)
+{
+        g_autoptr(LdmManager) manager = NULL;
+        autofree(UMockdevTestbed) *bed = NULL;
+        g_autoptr(GPtrArray) paths = NULL;
+        g_autofree gchar *root_path = NULL;
+        g_autofree gchar *first_hid = NULL;
+        g_autofree gchar *last_hid = NULL;
+        LdmDevice *root = NULL;
+        LdmDevice *hid = NULL;
+
+        paths = g_ptr_array_new_with_free_func(g_free);
+
+        bed = umockdev_testbed_new();
+        root_path = hotplug_add_root(bed);
+        manager = ldm_manager_new(0);
+        root = hotplug_get_root(manager);
+        fail_if(ldm_device_get_children(root) != NULL, "Leaf device has children");
+
+        for (guint i = 1; i <= 32; i++) {
+                g_ptr_array_add(paths, hotplug_plug_interface(bed, root_path, i, "03"));
+                hotplug_wait(root, i + 1);
+                assert_children(root, paths);
+        }
+
+        /* Repeated add events must find the existing child rather than duplicate it */
+        umockdev_testbed_uevent(bed, paths->pdata[0], "add");
+        umockdev_testbed_uevent(bed, paths->pdata[31], "add");
+
+        /* HID devices are parented by looking their interface up by path */
+        first_hid = hotplug_plug_hid(bed, paths->pdata[0], 1);
+        last_hid = hotplug_plug_hid(bed, paths->pdata[31], 32);
+        hotplug_wait(root, 35);
+        assert_children(root, paths);
+
+        hid = nth_child(nth_child(root, 0), 0);
+        fail_if(!g_str_equal(ldm_device_get_path(hid), first_hid), "First HID device misplaced");
+        hid = nth_child(nth_child(root, 31), 0);
+        fail_if(!g_str_equal(ldm_device_get_path(hid), last_hid), "Last HID device misplaced");
+
+        /* Unplug the odd interfaces, the first along with its HID device */
+        for (guint i = paths->len; i > 0; i--) {
+                if (i % 2 == 0) {
+                        continue;
+                }
+                hotplug_unplug(bed, paths->pdata[i - 1]);
+                g_ptr_array_remove_index(paths, i - 1);
+        }
+        hotplug_wait(root, 18);
+        assert_children(root, paths);
+
+        /* Replacing the first interface appends it */
+        g_ptr_array_add(paths, hotplug_plug_interface(bed, root_path, 1, "07"));
+        hotplug_wait(root, 19);
+        assert_children(root, paths);
+        fail_if(!ldm_device_has_type(root, LDM_DEVICE_TYPE_PRINTER), "Replacement was lost");
+        fail_if(ldm_device_has_type(root, LDM_DEVICE_TYPE_HID | LDM_DEVICE_TYPE_PRINTER),
+                "Replacement took on the type of the unplugged interface");
+}
+END_TEST
+
+/**
+ * Standard helper for running a test suite
+ */
+static int ldm_test_run(Suite *suite)
+{
+        SRunner *runner = NULL;
+        int n_failed = 0;
+
+        runner = srunner_create(suite);
+        srunner_run_all(runner, CK_VERBOSE);
+        n_failed = srunner_ntests_failed(runner);
+        srunner_free(runner);
+
+        return n_failed == 0 ? EXIT_SUCCESS : EXIT_FAILURE;
+}
+
+static Suite *test_create(void)
+{
+        Suite *s = NULL;
+        TCase *tc = NULL;
+
+        s = suite_create(__FILE__);
+        tc = tcase_create(__FILE__);
+        suite_add_tcase(s, tc);
+
+        /* Every step waits on the manager to process its uevents */
+        tcase_set_timeout(tc, 30);
+        tcase_add_test(tc, test_device_hotplug_masks);
+        tcase_add_test(tc, test_device_children);
+
+        return s;
+}
+
+int main(__ldm_unused__ int argc, __ldm_unused__ char **argv)
+{
+        return ldm_test_run(test_create());
+}
+
+/*
+ * Editor modelines  -  https://www.wireshark.org/tools/modelines.html
+ *
+ * Local variables:
+ * c-basic-offset: 8
+ * tab-width: 8
+ * indent-tabs-mode: nil
+ * End:
+ *
+ * vi: set shiftwidth=8 tabstop=8 expandtab:
+ * :indentSize=8:tabSize=8:noTabs=true:
+ */
@@ -180,6 +180,262 @@ START_TEST(test_manager_wifi_pci)
 }
 END_TEST
 
+/**
+ * Ensure filtering through the manager's type table agrees with testing
+ * every device in @all against @mask.
+ */
+static void assert_type_filter(LdmManager *manager, GPtrArray *all, guint mask)
+{
+        g_autoptr(GPtrArray) devices = NULL;
+        guint n_devices = 0;
+
+        devices = ldm_manager_get_devices(manager, mask);
+        for (guint i = 0; i < all->len; i++) {
+                if (!ldm_device_has_type(all->pdata[i], mask)) {
+                        continue;
+                }
+                fail_if(n_devices >= devices->len || devices->pdata[n_devices] != all->pdata[i],
+                        "Mask %u is missing device %u",
+                        mask,
+                        i);
+                ++n_devices;
+        }
+        fail_if(n_devices != devices->len,
+                "Mask %u has %u devices, expected %u",
+                mask,
+                devices->len,
+                n_devices);
+}
+
+/**
+ * Check every single type, and types which may be spread over a subtree.
+ */
+START_TEST(test_manager_type_table)
+{
+        static const gchar *files[] = {
+                NV_MOCKDEV_FILE,
+                OPTIMUS_MOCKDEV_FILE,
+                BLUETOOTH_UMOCKDEV_FILE,
+                WIFI_UMOCKDEV_FILE,
+        };
+        static const guint masks[] = {
+                LDM_DEVICE_TYPE_GPU | LDM_DEVICE_TYPE_PCI,
+                LDM_DEVICE_TYPE_USB | LDM_DEVICE_TYPE_BLUETOOTH,
+                LDM_DEVICE_TYPE_PCI | LDM_DEVICE_TYPE_WIRELESS,
+                LDM_DEVICE_TYPE_GPU | LDM_DEVICE_TYPE_USB,
+        };
+
+        for (guint i = 0; i < G_N_ELEMENTS(files); i++) {
+                g_autoptr(LdmManager) manager = NULL;
+                autofree(UMockdevTestbed) *bed = NULL;
+                g_autoptr(GPtrArray) all = NULL;
+
+                bed = umockdev_testbed_new();
+                fail_if(!umockdev_testbed_add_from_file(bed, files[i], NULL),
+                        "Failed to load %s",
+                        files[i]);
+                manager = ldm_manager_new(LDM_MANAGER_FLAGS_NO_MONITOR);
+                all = ldm_manager_get_devices(manager, LDM_DEVICE_TYPE_ANY);
+
+                for (guint bit = 1; bit < LDM_DEVICE_TYPE_MAX; bit <<= 1) {
+                        assert_type_filter(manager, all, bit);
+                }
+                for (guint j = 0; j < G_N_ELEMENTS(masks); j++) {
+                        assert_type_filter(manager, all, masks[j]);
+                }
+        }
+}
+END_TEST
+
+static void count_device(__ldm_unused__ LdmDevice *device, gpointer v)
+{
+        ++*(guint *)v;
+}
+
+/**
+ * Ensure the iterators visit what the array returning functions return.
+ */
+START_TEST(test_manager_iter)
+{
+        static const guint masks[] = {
+                LDM_DEVICE_TYPE_ANY,
+                LDM_DEVICE_TYPE_USB,
+                LDM_DEVICE_TYPE_BLUETOOTH,
+                LDM_DEVICE_TYPE_USB | LDM_DEVICE_TYPE_BLUETOOTH,
+                LDM_DEVICE_TYPE_GPU,
+        };
+        g_autoptr(LdmManager) manager = NULL;
+        autofree(UMockdevTestbed) *bed = NULL;
+
+        bed = umockdev_testbed_new();
+        fail_if(!umockdev_testbed_add_from_file(bed, BLUETOOTH_UMOCKDEV_FILE, NULL),
+                "Failed to create Bluetooth device");
+        manager = ldm_manager_new(LDM_MANAGER_FLAGS_NO_MONITOR);
+
+        for (guint i = 0; i < G_N_ELEMENTS(masks); i++) {
+                g_autoptr(GPtrArray) devices = NULL;
+                LdmDeviceIter iter = { 0 };
+                LdmDevice *device = NULL;
+                guint n_devices = 0;
+                guint n_called = 0;
+
+                devices = ldm_manager_get_devices(manager, masks[i]);
+                ldm_manager_iter_init(&iter, manager, masks[i]);
+                while (ldm_device_iter_next(&iter, &device)) {
+                        fail_if(n_devices >= devices->len || devices->pdata[n_devices] != device,
+                                "Mask %u: iterator disagrees at device %u",
+                                masks[i],
+                                n_devices);
+                        ++n_devices;
+                }
+                fail_if(n_devices != devices->len, "Mask %u: iterator stopped early", masks[i]);
+
+                ldm_manager_foreach_device(manager, masks[i], count_device, &n_called);
+                fail_if(n_called != devices->len, "Mask %u: foreach missed devices", masks[i]);
+        }
+
+        /* And the children of each device */
+        for (guint i = 0; i < G_N_ELEMENTS(masks); i++) {
+                g_autoptr(GPtrArray) devices = ldm_manager_get_devices(manager, masks[i]);
+
+                for (guint j = 0; j < devices->len; j++) {
+                        g_autoptr(GList) kids = ldm_device_get_children(devices->pdata[j]);
+                        LdmDeviceIter iter = { 0 };
+                        LdmDevice *child = NULL;
+                        guint n_kids = 0;
+                        guint n_called = 0;
+
+                        ldm_device_iter_init(&iter, devices->pdata[j]);
+                        while (ldm_device_iter_next(&iter, &child)) {
+                                fail_if(!g_list_find(kids, child), "Iterated an unknown child");
+                                ++n_kids;
+                        }
+                        fail_if(n_kids != g_list_length(kids), "Child iterator missed children");
+
+                        ldm_device_foreach_child(devices->pdata[j], count_device, &n_called);
+                        fail_if(n_called != n_kids, "foreach missed children");
+                }
+        }
+}
+END_TEST
+
+/* Synthetic devices in the smaller scaling run, the larger has four times as many */
+#define SCALING_DEVICES 1024
+
+/**
+ * Add @n_devices synthetic USB devices after those already in @paths,
+ * recording their sysfs paths there.
+ */
+static void add_usb_devices(UMockdevTestbed *bed, GPtrArray *paths, guint n_devices)
+{
+        guint first = paths->len;
+
+        for (guint i = first; i < first + n_devices; i++) {
+                g_autofree gchar *name = NULL;
+                gchar *path = NULL;
+
+                /* Zero padded, so udev enumerates them in the order we add them */
+                name = g_strdup_printf("usb%05u", i);
+                path = umockdev_testbed_add_device(bed,
+                                                   "usb",
+                                                   name,
+                                                   NULL,
+                                                   "idVendor",
+                                                   "1d6b",
+                                                   "idProduct",
+                                                   "0002",
+                                                   "bDeviceClass",
+                                                   "09",
+                                                   NULL,
+                                                   "DEVTYPE",
+                                                   "usb_device",
+                                                   NULL);
+                fail_if(!path, "Failed to add %s", name);
+                g_ptr_array_add(paths, path);
+        }
+}
+
+/**
+ * Ensure the manager holds exactly the devices of @paths, in that order.
+ */
+static void assert_devices(LdmManager *manager, GPtrArray *paths)
+{
+        g_autoptr(GPtrArray) devices = NULL;
+
+        devices = ldm_manager_get_devices(manager, LDM_DEVICE_TYPE_USB);
+        fail_if(devices->len != paths->len,
+                "Expected %u devices, got %u",
+                paths->len,
+                devices->len);
+        for (guint i = 0; i < devices->len; i++) {
+                fail_if(!g_str_equal(ldm_device_get_path(devices->pdata[i]), paths->pdata[i]),
+                        "Device %u is out of order",
+                        i);
+        }
+}
+
+/**
+ * Ensure a fresh manager enumerates exactly @paths, in that order.
+ */
+static void assert_enumeration(GPtrArray *paths)
+{
+        g_autoptr(LdmManager) manager = NULL;
+
+        manager = ldm_manager_new(LDM_MANAGER_FLAGS_NO_MONITOR);
+        assert_devices(manager, paths);
+}
+
+/**
+ * Ensure thousands of devices enumerate in udev order, and that hotplug
+ * removal keeps the remaining devices in order. How enumeration time scales
+ * is measured by bench-manager rather than asserted here.
+ */
+START_TEST(test_manager_scaling)
+{
+        g_autoptr(LdmManager) manager = NULL;
+        g_autoptr(GPtrArray) paths = NULL;
+        g_autoptr(GPtrArray) remaining = NULL;
+        autofree(UMockdevTestbed) *bed = NULL;
+        gint64 deadline = 0;
+
+        bed = umockdev_testbed_new();
+        paths = g_ptr_array_new_with_free_func(g_free);
+
+        add_usb_devices(bed, paths, SCALING_DEVICES);
+        assert_enumeration(paths);
+
+        add_usb_devices(bed, paths, SCALING_DEVICES * 3);
+        assert_enumeration(paths);
+
+        /* Unplug every other device */
+        manager = ldm_manager_new(0);
+        remaining = g_ptr_array_new();
+        for (guint i = 0; i < paths->len; i++) {
+                if (i % 2 == 0) {
+                        g_ptr_array_add(remaining, paths->pdata[i]);
+                        continue;
+                }
+                umockdev_testbed_uevent(bed, paths->pdata[i], "remove");
+                umockdev_testbed_remove_device(bed, paths->pdata[i]);
+        }
+
+        deadline = g_get_monotonic_time() + 10 * G_USEC_PER_SEC;
+        while (g_get_monotonic_time() < deadline) {
+                g_autoptr(GPtrArray) devices = NULL;
+
+                devices = ldm_manager_get_devices(manager, LDM_DEVICE_TYPE_USB);
+                if (devices->len == remaining->len) {
+                        break;
+                }
+                if (!g_main_context_iteration(NULL, FALSE)) {
+                        g_usleep(G_USEC_PER_SEC / 100);
+                }
+        }
+
+        assert_devices(manager, remaining);
+}
+END_TEST
+
 /**
  * Standard helper for running a test suite
  */
@@ -209,6 +465,14 @@ static Suite *test_create(void)
         tcase_add_test(tc, test_manager_optimus);
         tcase_add_test(tc, test_manager_bluetooth_usb);
         tcase_add_test(tc, test_manager_wifi_pci);
+        tcase_add_test(tc, test_manager_type_table);
+        tcase_add_test(tc, test_manager_iter);
+
+        /* Thousands of devices need longer than the default timeout */
+        tc = tcase_create("scaling");
+        tcase_set_timeout(tc, 120);
+        tcase_add_test(tc, test_manager_scaling);
+        suite_add_tcase(s, tc);
 
         return s;
 }
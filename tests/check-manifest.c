@@ -0,0 +1,329 @@
+/*
+ * This file is part of linux-driver-management.
+ *
+ * Copyright © 2016-2018 Ikey Doherty
+ *
+ * linux-driver-management is free software; you can redistribute it and/or
+ * modify it under the terms of the GNU Lesser General Public License as
+ * published by the Free Software Foundation; either version 2.1
+ * of the License, or (at your option) any later version.
+ */
+
+#define _GNU_SOURCE
+
+#include <check.h>
+#include <fcntl.h>
+#include <glib/gstdio.h>
+#include <stdio.h>
+#include <stdlib.h>
+#include <string.h>
+#include <sys/stat.h>
+
+#include "../src/tools/manifest.h"
+#include "../src/tools/optimize.h"
+#include "util.h"
+
+/*
+ * The manifest only stats, hashes and records paths, so any regular file
+ * will do in place of a kernel module.
+ */
+
+#define MODULE_CONTENTS "not really a kernel module"
+#define MODULE_CHANGED "NOT REALLY A KERNEL MODULE" /* Same size */
+#define MODULE_ALIAS "pci:v000010DEd*sv*sd*bc03sc*i*"
+
+static void write_module(const gchar *path, const gchar *contents)
+{
+        fail_if(!g_file_set_contents(path, contents, -1, NULL), "Failed to write %s", path);
+}
+
+static struct timespec get_mtime(const gchar *path)
+{
+        struct stat st = { 0 };
+
+        fail_if(stat(path, &st) != 0, "Failed to stat %s", path);
+        return st.st_mtim;
+}
+
+static void set_mtime(const gchar *path, struct timespec mtime)
+{
+        struct timespec times[2] = { { .tv_nsec = UTIME_OMIT }, mtime };
+
+        fail_if(utimensat(AT_FDCWD, path, times, 0) != 0, "Failed to set mtime of %s", path);
+}
+
+/**
+ * Give @path an mtime @delta seconds away from its current one, as a
+ * rebuild of an identical module would.
+ */
+static void shift_mtime(const gchar *path, time_t delta)
+{
+        struct timespec mtime = get_mtime(path);
+
+        mtime.tv_sec += delta;
+        set_mtime(path, mtime);
+}
+
+/**
+ * Probe @path the way mkmodaliases does: use the manifest if it can, and
+ * record a single alias otherwise.
+ *
+ * Returns: TRUE if the recorded aliases were reused
+ */
+static gboolean probe_module(MkManifest *manifest, const gchar *path)
+{
+        g_autoptr(GPtrArray) aliases = NULL;
+        MkAlias *alias = NULL;
+
+        aliases = g_ptr_array_new_with_free_func((GDestroyNotify)mk_alias_free);
+        if (mk_manifest_lookup(manifest, path, "test-package", aliases)) {
+                fail_if(aliases->len != 1, "Expected 1 reused alias, got %u", aliases->len);
+                alias = aliases->pdata[0];
+                fail_if(!g_str_equal(alias->match, MODULE_ALIAS), "Wrong alias %s", alias->match);
+                fail_if(!g_str_equal(alias->driver, "test"), "Wrong driver %s", alias->driver);
+                fail_if(!g_str_equal(alias->package, "test-package"),
+                        "Wrong package %s",
+                        alias->package);
+                return TRUE;
+        }
+
+        fail_if(aliases->len != 0, "Failed lookup must not append aliases");
+        g_ptr_array_add(aliases, mk_alias_new(MODULE_ALIAS, "test", "test-package"));
+        mk_manifest_store(manifest, path, "test", aliases, 0);
+        return FALSE;
+}
+
+static void assert_stats(MkManifest *manifest, guint reused, guint probed)
+{
+        guint n_reused = 0;
+        guint n_probed = 0;
+
+        mk_manifest_get_stats(manifest, &n_reused, &n_probed);
+        fail_if(n_reused != reused, "Expected %u reused, got %u", reused, n_reused);
+        fail_if(n_probed != probed, "Expected %u probed, got %u", probed, n_probed);
+}
+
+static void remove_tmp(const gchar *tmp)
+{
+        g_autoptr(GDir) dir = g_dir_open(tmp, 0, NULL);
+        const gchar *name = NULL;
+
+        while (dir && (name = g_dir_read_name(dir)) != NULL) {
+                g_autofree gchar *path = g_build_filename(tmp, name, NULL);
+
+                g_unlink(path);
+        }
+        g_rmdir(tmp);
+}
+
+/**
+ * Recorded aliases are reused while the module is unchanged, even across a
+ * touch, but never once its contents change.
+ */
+START_TEST(test_manifest_reuse)
+{
+        g_autoptr(GError) error = NULL;
+        g_autofree gchar *tmp = NULL;
+        g_autofree gchar *module = NULL;
+        g_autofree gchar *filename = NULL;
+        autofree(MkManifest) *manifest = NULL;
+        struct timespec touched = { 0 };
+
+        tmp = g_dir_make_tmp("ldm-manifest-XXXXXX", &error);
+        fail_if(!tmp, "Failed to create temporary directory: %s", error ? error->message : "");
+        module = g_build_filename(tmp, "test.ko", NULL);
+        filename = g_build_filename(tmp, "manifest", NULL);
+        write_module(module, MODULE_CONTENTS);
+
+        manifest = mk_manifest_load(filename);
+        fail_if(probe_module(manifest, module), "Unknown module must be probed");
+        assert_stats(manifest, 0, 1);
+
+        /* Same size and mtime are trusted outright */
+        fail_if(!probe_module(manifest, module), "Unchanged module should be reused");
+        assert_stats(manifest, 1, 1);
+
+        /* A touch leaves the contents, and so the checksum, as they were */
+        shift_mtime(module, -100);
+        touched = get_mtime(module);
+        fail_if(!probe_module(manifest, module), "Touched module should be reused");
+        assert_stats(manifest, 2, 1);
+
+        /*
+         * The new mtime was recorded, so the next lookup doesn't hash at all:
+         * it trusts even different contents of the same size and mtime.
+         */
+        write_module(module, MODULE_CHANGED);
+        set_mtime(module, touched);
+        fail_if(!probe_module(manifest, module), "Recorded mtime should be trusted");
+        assert_stats(manifest, 3, 1);
+
+        /* Otherwise changed contents of the same size fail the checksum */
+        shift_mtime(module, -100);
+        fail_if(probe_module(manifest, module), "Changed module must be probed again");
+        assert_stats(manifest, 3, 2);
+
+        /* As does a different size, whatever the mtime */
+        write_module(module, MODULE_CONTENTS " but longer");
+        fail_if(probe_module(manifest, module), "Resized module must be probed again");
+        assert_stats(manifest, 3, 3);
+
+        /* What was saved is what gets reused */
+        fail_if(!mk_manifest_save(manifest), "Failed to save %s", filename);
+        g_clear_pointer(&manifest, mk_manifest_free);
+        manifest = mk_manifest_load(filename);
+        fail_if(!probe_module(manifest, module), "Saved record should be reused");
+        assert_stats(manifest, 1, 0);
+
+        g_clear_pointer(&manifest, mk_manifest_free);
+        remove_tmp(tmp);
+}
+END_TEST
+
+/**
+ * Records of modules that went away are dropped on save.
+ */
+START_TEST(test_manifest_prune)
+{
+        g_autoptr(GError) error = NULL;
+        g_autofree gchar *tmp = NULL;
+        g_autofree gchar *kept = NULL;
+        g_autofree gchar *removed = NULL;
+        g_autofree gchar *kept_path = NULL;
+        g_autofree gchar *removed_path = NULL;
+        g_autofree gchar *filename = NULL;
+        autofree(MkManifest) *manifest = NULL;
+        g_autoptr(GKeyFile) keyfile = NULL;
+
+        tmp = g_dir_make_tmp("ldm-manifest-XXXXXX", &error);
+        fail_if(!tmp, "Failed to create temporary directory: %s", error ? error->message : "");
+        kept = g_build_filename(tmp, "kept.ko", NULL);
+        removed = g_build_filename(tmp, "removed.ko", NULL);
+        filename = g_build_filename(tmp, "manifest", NULL);
+        write_module(kept, MODULE_CONTENTS);
+        write_module(removed, MODULE_CONTENTS);
+
+        /* Groups are named for the canonical path */
+        kept_path = realpath(kept, NULL);
+        removed_path = realpath(removed, NULL);
+        fail_if(!kept_path || !removed_path, "Failed to resolve module paths");
+
+        manifest = mk_manifest_load(filename);
+        probe_module(manifest, kept);
+        probe_module(manifest, removed);
+        fail_if(!mk_manifest_save(manifest), "Failed to save %s", filename);
+
+        keyfile = g_key_file_new();
+        fail_if(!g_key_file_load_from_file(keyfile, filename, G_KEY_FILE_NONE, NULL),
+                "Failed to read %s",
+                filename);
+        fail_if(!g_key_file_has_group(keyfile, removed_path), "Module should be recorded");
+
+        g_unlink(removed);
+        fail_if(!mk_manifest_save(manifest), "Failed to save %s", filename);
+
+        fail_if(!g_key_file_load_from_file(keyfile, filename, G_KEY_FILE_NONE, NULL),
+                "Failed to read %s",
+                filename);
+        fail_if(g_key_file_has_group(keyfile, removed_path), "Removed module should be pruned");
+        fail_if(!g_key_file_has_group(keyfile, kept_path), "Existing module should be kept");
+
+        g_clear_pointer(&manifest, mk_manifest_free);
+        remove_tmp(tmp);
+}
+END_TEST
+
+/**
+ * A manifest written by another version is ignored rather than trusted.
+ */
+START_TEST(test_manifest_version)
+{
+        g_autoptr(GError) error = NULL;
+        g_autofree gchar *tmp = NULL;
+        g_autofree gchar *module = NULL;
+        g_autofree gchar *filename = NULL;
+        autofree(MkManifest) *manifest = NULL;
+        g_autoptr(GKeyFile) keyfile = NULL;
+
+        tmp = g_dir_make_tmp("ldm-manifest-XXXXXX", &error);
+        fail_if(!tmp, "Failed to create temporary directory: %s", error ? error->message : "");
+        module = g_build_filename(tmp, "test.ko", NULL);
+        filename = g_build_filename(tmp, "manifest", NULL);
+        write_module(module, MODULE_CONTENTS);
+
+        manifest = mk_manifest_load(filename);
+        probe_module(manifest, module);
+        fail_if(!mk_manifest_save(manifest), "Failed to save %s", filename);
+        g_clear_pointer(&manifest, mk_manifest_free);
+
+        keyfile = g_key_file_new();
+        fail_if(!g_key_file_load_from_file(keyfile, filename, G_KEY_FILE_NONE, NULL),
+                "Failed to read %s",
+                filename);
+        g_key_file_set_integer(keyfile, "Manifest", "Version", 1000);
+        fail_if(!g_key_file_save_to_file(keyfile, filename, NULL), "Failed to write %s", filename);
+
+        manifest = mk_manifest_load(filename);
+        fail_if(probe_module(manifest, module), "Record of another version must not be used");
+        assert_stats(manifest, 0, 1);
+
+        /* Saving replaces it with one of ours */
+        fail_if(!mk_manifest_save(manifest), "Failed to save %s", filename);
+        g_clear_pointer(&manifest, mk_manifest_free);
+        manifest = mk_manifest_load(filename);
+        fail_if(!probe_module(manifest, module), "Rewritten manifest should be used");
+
+        g_clear_pointer(&manifest, mk_manifest_free);
+        remove_tmp(tmp);
+}
+END_TEST
+
+/**
+ * Standard helper for running a test suite
+ */
+static int ldm_test_run(Suite *suite)
+{
+        SRunner *runner = NULL;
+        int n_failed = 0;
+
+        runner = srunner_create(suite);
+        srunner_run_all(runner, CK_VERBOSE);
+        n_failed = srunner_ntests_failed(runner);
+        srunner_free(runner);
+
+        return n_failed == 0 ? EXIT_SUCCESS : EXIT_FAILURE;
+}
+
+static Suite *test_create(void)
+{
+        Suite *s = NULL;
+        TCase *tc = NULL;
+
+        s = suite_create(__FILE__);
+        tc = tcase_create(__FILE__);
+        suite_add_tcase(s, tc);
+
+        tcase_add_test(tc, test_manifest_reuse);
+        tcase_add_test(tc, test_manifest_prune);
+        tcase_add_test(tc, test_manifest_version);
+
+        return s;
+}
+
+int main(__ldm_unused__ int argc, __ldm_unused__ char **argv)
+{
+        return ldm_test_run(test_create());
+}
+
+/*
+ * Editor modelines  -  https://www.wireshark.org/tools/modelines.html
+ *
+ * Local variables:
+ * c-basic-offset: 8
+ * tab-width: 8
+ * indent-tabs-mode: nil
+ * End:
+ *
+ * vi: set shiftwidth=8 tabstop=8 expandtab:
+ * :indentSize=8:tabSize=8:noTabs=true:
+ */
@@ -0,0 +1,676 @@
+/*
+ * This file is part of linux-driver-management.
+ *
+ * Copyright © 2016-2018 Ikey Doherty
+ *
+ * linux-driver-management is free software; you can redistribute it and/or
+ * modify it under the terms of the GNU Lesser General Public License as
+ * published by the Free Software Foundation; either version 2.1
+ * of the License, or (at your option) any later version.
+ */
+
+#define _GNU_SOURCE
+
+#include <check.h>
+#include <fcntl.h>
+#include <glib/gstdio.h>
+#include <stdio.h>
+#include <stdlib.h>
+#include <string.h>
+#include <sys/stat.h>
+#include <umockdev.h>
+
+#include "ldm-private.h"
+#include "ldm.h"
+#include "util.h"
+
+DEF_AUTOFREE(UMockdevTestbed, g_object_unref)
+
+#define RAZER_MOCKDEV_FILE TEST_DATA_ROOT "/razer-ornata-chroma.umockdev"
+
+/* Every fixture with at least one device we may have a provider for */
+static const gchar *mockdev_files[] = {
+        "nvidia1060.umockdev",
+        "optimus765m.umockdev",
+        "optimus1050m.umockdev",
+        "desktop-nvidia-intel.umockdev",
+        "desktop-nvidia980-intel.umockdev",
+        "razer-ornata-chroma.umockdev",
+        "razerMamba.umockdev",
+        "wifi.umockdev",
+};
+
+static UMockdevTestbed *create_bed_from(const char *mockdevname)
+{
+        UMockdevTestbed *bed = NULL;
+
+        bed = umockdev_testbed_new();
+        fail_if(!umockdev_testbed_add_from_file(bed, mockdevname, NULL),
+                "Failed to create device: %s",
+                mockdevname);
+
+        return bed;
+}
+
+/**
+ * Copy all of the test modalias files into a new temporary directory and
+ * compile the database for it with mkmodaliases.
+ */
+static gchar *create_db_dir(void)
+{
+        g_autoptr(GError) error = NULL;
+        GDir *dir = NULL;
+        const gchar *name = NULL;
+        gchar *tmp = NULL;
+        gchar *argv[] = { MKMODALIASES_BINARY, "--database", NULL, NULL };
+        gint status = 0;
+
+        tmp = g_dir_make_tmp("ldm-modalias-db-XXXXXX", &error);
+        fail_if(!tmp, "Failed to create temporary directory: %s", error ? error->message : "");
+
+        dir = g_dir_open(TEST_DATA_ROOT, 0, NULL);
+        fail_if(!dir, "Failed to open %s", TEST_DATA_ROOT);
+
+        while ((name = g_dir_read_name(dir)) != NULL) {
+                g_autofree gchar *source = NULL;
+                g_autofree gchar *target = NULL;
+                g_autofree gchar *contents = NULL;
+                gsize len = 0;
+
+                if (!g_str_has_suffix(name, ".modaliases")) {
+                        continue;
+                }
+
+                source = g_build_filename(TEST_DATA_ROOT, name, NULL);
+                target = g_build_filename(tmp, name, NULL);
+                fail_if(!g_file_get_contents(source, &contents, &len, NULL),
+                        "Failed to read %s",
+                        source);
+                fail_if(!g_file_set_contents(target, contents, (gssize)len, NULL),
+                        "Failed to write %s",
+                        target);
+        }
+        g_dir_close(dir);
+
+        argv[2] = tmp;
+        fail_if(!g_spawn_sync(NULL,
+                              argv,
+                              NULL,
+                              G_SPAWN_DEFAULT,
+                              NULL,
+                              NULL,
+                              NULL,
+                              NULL,
+                              &status,
+                              &error),
+                "Failed to run mkmodaliases: %s",
+                error ? error->message : "");
+        fail_if(status != 0, "mkmodaliases failed with status %d", status);
+
+        return tmp;
+}
+
+static void remove_db_dir(const gchar *tmp)
+{
+        GDir *dir = NULL;
+        const gchar *name = NULL;
+
+        dir = g_dir_open(tmp, 0, NULL);
+        if (dir) {
+                while ((name = g_dir_read_name(dir)) != NULL) {
+                        g_autofree gchar *path = g_build_filename(tmp, name, NULL);
+                        g_unlink(path);
+                }
+                g_dir_close(dir);
+        }
+        g_rmdir(tmp);
+}
+
+/**
+ * Compare the providers of every device between two managers constructed
+ * on the same testbed.
+ *
+ * Returns: The number of providers found
+ */
+static guint compare_providers(const gchar *mockdev, LdmManager *text, LdmManager *db)
+{
+        g_autoptr(GPtrArray) text_devices = NULL;
+        g_autoptr(GPtrArray) db_devices = NULL;
+        guint n_providers = 0;
+
+        text_devices = ldm_manager_get_devices(text, LDM_DEVICE_TYPE_ANY);
+        db_devices = ldm_manager_get_devices(db, LDM_DEVICE_TYPE_ANY);
+        fail_if(text_devices->len != db_devices->len,
+                "%s: device count differs (%u vs %u)",
+                mockdev,
+                text_devices->len,
+                db_devices->len);
+
+        for (guint i = 0; i < text_devices->len; i++) {
+                LdmDevice *device = text_devices->pdata[i];
+                g_autoptr(GPtrArray) text_providers = NULL;
+                g_autoptr(GPtrArray) db_providers = NULL;
+
+                text_providers = ldm_manager_get_providers(text, device);
+                db_providers = ldm_manager_get_providers(db, db_devices->pdata[i]);
+
+                fail_if(text_providers->len != db_providers->len,
+                        "%s: %s has %u providers from text, %u from database",
+                        mockdev,
+                        ldm_device_get_path(device),
+                        text_providers->len,
+                        db_providers->len);
+
+                for (guint j = 0; j < text_providers->len; j++) {
+                        LdmProvider *a = text_providers->pdata[j];
+                        LdmProvider *b = db_providers->pdata[j];
+                        LdmPlugin *plugin_a = ldm_provider_get_plugin(a);
+                        LdmPlugin *plugin_b = ldm_provider_get_plugin(b);
+
+                        fail_if(!g_str_equal(ldm_plugin_get_name(plugin_a),
+                                             ldm_plugin_get_name(plugin_b)),
+                                "%s: plugin mismatch '%s' vs '%s'",
+                                mockdev,
+                                ldm_plugin_get_name(plugin_a),
+                                ldm_plugin_get_name(plugin_b));
+                        fail_if(ldm_plugin_get_priority(plugin_a) !=
+                                    ldm_plugin_get_priority(plugin_b),
+                                "%s: priority mismatch for '%s'",
+                                mockdev,
+                                ldm_plugin_get_name(plugin_a));
+                        fail_if(!g_str_equal(ldm_provider_get_package(a),
+                                             ldm_provider_get_package(b)),
+                                "%s: package mismatch '%s' vs '%s'",
+                                mockdev,
+                                ldm_provider_get_package(a),
+                                ldm_provider_get_package(b));
+                }
+
+                n_providers += text_providers->len;
+        }
+
+        return n_providers;
+}
+
+/**
+ * Ensure that a manager loading the compiled database finds exactly the same
+ * providers, in the same order, as one parsing the text files.
+ */
+START_TEST(test_modalias_db_consistency)
+{
+        g_autofree gchar *tmp = NULL;
+        guint n_providers = 0;
+
+        tmp = create_db_dir();
+
+        for (guint i = 0; i < G_N_ELEMENTS(mockdev_files); i++) {
+                g_autofree gchar *path = NULL;
+                autofree(UMockdevTestbed) *bed = NULL;
+                g_autoptr(LdmManager) text = NULL;
+                g_autoptr(LdmManager) db = NULL;
+
+                path = g_build_filename(TEST_DATA_ROOT, mockdev_files[i], NULL);
+                bed = create_bed_from(path);
+
+                text = ldm_manager_new(0);
+                fail_if(!ldm_manager_add_modalias_plugins_for_directory(text, TEST_DATA_ROOT),
+                        "Failed to add text modalias directory");
+
+                db = ldm_manager_new(0);
+                fail_if(!ldm_manager_add_modalias_plugins_for_directory(db, tmp),
+                        "Failed to add database modalias directory");
+
+                n_providers += compare_providers(mockdev_files[i], text, db);
+        }
+
+        fail_if(n_providers == 0, "Expected to find providers in the fixtures");
+
+        remove_db_dir(tmp);
+}
+END_TEST
+
+/**
+ * Ensure that once the directory changes, the database is ignored and we
+ * see the new contents of the text files.
+ */
+START_TEST(test_modalias_db_stale)
+{
+        g_autofree gchar *tmp = NULL;
+        g_autofree gchar *extra = NULL;
+        autofree(UMockdevTestbed) *bed = NULL;
+        g_autoptr(LdmManager) manager = NULL;
+        g_autoptr(GPtrArray) devices = NULL;
+        g_autoptr(GPtrArray) providers = NULL;
+        gboolean found = FALSE;
+
+        tmp = create_db_dir();
+
+        /* Adding a file must invalidate the database */
+        extra = g_build_filename(tmp, "zz-razer-extra.modaliases", NULL);
+        fail_if(!g_file_set_contents(extra,
+                                     "alias hid:b0003g*v00001532p0000021E razerkbd razer-extra\n",
+                                     -1,
+                                     NULL),
+                "Failed to write %s",
+                extra);
+
+        bed = create_bed_from(RAZER_MOCKDEV_FILE);
+        manager = ldm_manager_new(0);
+        fail_if(!ldm_manager_add_modalias_plugins_for_directory(manager, tmp),
+                "Failed to add modalias directory");
+
+        devices = ldm_manager_get_devices(manager, LDM_DEVICE_TYPE_USB | LDM_DEVICE_TYPE_HID);
+        fail_if(devices->len != 1, "Failed to find HID device!");
+
+        providers = ldm_manager_get_providers(manager, devices->pdata[0]);
+        for (guint i = 0; i < providers->len; i++) {
+                if (g_str_equal(ldm_provider_get_package(providers->pdata[i]), "razer-extra")) {
+                        found = TRUE;
+                }
+        }
+        fail_if(!found, "Stale database was used instead of the modalias files");
+
+        remove_db_dir(tmp);
+}
+END_TEST
+
+/**
+ * Ensure that a single stale file is parsed from text while the database
+ * is still used for the others, with the same results as the text files.
+ */
+START_TEST(test_modalias_db_partial)
+{
+        g_autofree gchar *tmp = NULL;
+        g_autofree gchar *touched = NULL;
+        g_autofree gchar *contents = NULL;
+        g_autofree gchar *changed = NULL;
+        guint n_providers = 0;
+
+        tmp = create_db_dir();
+
+        /* A comment leaves the rules intact but the database stale for it */
+        touched = g_build_filename(tmp, "nvidia-glx-driver.modaliases", NULL);
+        fail_if(!g_file_get_contents(touched, &contents, NULL, NULL), "Failed to read %s", touched);
+        changed = g_strconcat(contents, "# touched\n", NULL);
+        fail_if(!g_file_set_contents(touched, changed, -1, NULL), "Failed to write %s", touched);
+
+        for (guint i = 0; i < G_N_ELEMENTS(mockdev_files); i++) {
+                g_autofree gchar *path = NULL;
+                autofree(UMockdevTestbed) *bed = NULL;
+                g_autoptr(LdmManager) text = NULL;
+                g_autoptr(LdmManager) db = NULL;
+
+                path = g_build_filename(TEST_DATA_ROOT, mockdev_files[i], NULL);
+                bed = create_bed_from(path);
+
+                text = ldm_manager_new(0);
+                fail_if(!ldm_manager_add_modalias_plugins_for_directory(text, TEST_DATA_ROOT),
+                        "Failed to add text modalias directory");
+
+                db = ldm_manager_new(0);
+                fail_if(!ldm_manager_add_modalias_plugins_for_directory(db, tmp),
+                        "Failed to add database modalias directory");
+
+                n_providers += compare_providers(mockdev_files[i], text, db);
+        }
+
+        fail_if(n_providers == 0, "Expected to find providers in the fixtures");
+
+        remove_db_dir(tmp);
+}
+END_TEST
+
+/**
+ * Returns: TRUE if the Razer keyboard is provided for by @package
+ */
+static gboolean razer_has_package(const gchar *directory, const gchar *package)
+{
+        autofree(UMockdevTestbed) *bed = NULL;
+        g_autoptr(LdmManager) manager = NULL;
+        g_autoptr(GPtrArray) devices = NULL;
+        g_autoptr(GPtrArray) providers = NULL;
+
+        bed = create_bed_from(RAZER_MOCKDEV_FILE);
+        manager = ldm_manager_new(0);
+        fail_if(!ldm_manager_add_modalias_plugins_for_directory(manager, directory),
+                "Failed to add modalias directory");
+
+        devices = ldm_manager_get_devices(manager, LDM_DEVICE_TYPE_USB | LDM_DEVICE_TYPE_HID);
+        fail_if(devices->len != 1, "Failed to find HID device!");
+
+        providers = ldm_manager_get_providers(manager, devices->pdata[0]);
+        for (guint i = 0; i < providers->len; i++) {
+                if (g_str_equal(ldm_provider_get_package(providers->pdata[i]), package)) {
+                        return TRUE;
+                }
+        }
+
+        return FALSE;
+}
+
+/**
+ * Write @contents to @path, keeping its mtime so only the size and inode can
+ * tell the change apart. With @in_place the inode is kept too.
+ */
+static void rewrite_keeping_mtime(const gchar *path, const gchar *contents, gboolean in_place)
+{
+        struct stat st = { 0 };
+        struct timespec times[2] = { { 0 } };
+
+        fail_if(stat(path, &st) != 0, "Failed to stat %s", path);
+
+        if (in_place) {
+                FILE *fp = fopen(path, "r+");
+
+                fail_if(!fp, "Failed to open %s", path);
+                fail_if(fputs(contents, fp) < 0, "Failed to write %s", path);
+                fclose(fp);
+        } else {
+                fail_if(!g_file_set_contents(path, contents, -1, NULL), "Failed to write %s", path);
+        }
+
+        times[0] = st.st_atim;
+        times[1] = st.st_mtim;
+        fail_if(utimensat(AT_FDCWD, path, times, 0) != 0, "Failed to restore mtime of %s", path);
+}
+
+/**
+ * Ensure the cache is updated incrementally as a package adds, replaces and
+ * removes its file, and that an unchanged record is trusted over the text.
+ */
+START_TEST(test_modalias_db_update_cache)
+{
+        g_autofree gchar *tmp = NULL;
+        g_autofree gchar *extra = NULL;
+
+        tmp = create_db_dir();
+        extra = g_build_filename(tmp, "zz-razer-extra.modaliases", NULL);
+
+        /* New package installs its file */
+        fail_if(!g_file_set_contents(extra,
+                                     "alias hid:b0003g*v00001532p0000021E razerkbd razer-extra\n",
+                                     -1,
+                                     NULL),
+                "Failed to write %s",
+                extra);
+        fail_if(!ldm_manager_update_modalias_cache(tmp), "Failed to update the cache");
+        fail_if(!razer_has_package(tmp, "razer-extra"), "Added file missing from the cache");
+
+        /* Same size, mtime and inode: the cache can't tell, so it's used */
+        rewrite_keeping_mtime(extra,
+                              "alias hid:b0003g*v00001532p0000021E razerkbd razer-xxtra\n",
+                              TRUE);
+        fail_if(!razer_has_package(tmp, "razer-extra"), "Current cache entry wasn't used");
+        fail_if(razer_has_package(tmp, "razer-xxtra"), "Current cache entry wasn't used");
+
+        /* Replaced by a new inode, as package managers do on upgrade */
+        rewrite_keeping_mtime(extra,
+                              "alias hid:b0003g*v00001532p0000021E razerkbd razer-yytra\n",
+                              FALSE);
+        fail_if(!razer_has_package(tmp, "razer-yytra"), "Replaced file wasn't parsed");
+        fail_if(razer_has_package(tmp, "razer-extra"), "Stale cache entry was used");
+
+        fail_if(!ldm_manager_update_modalias_cache(tmp), "Failed to update the cache");
+        fail_if(!razer_has_package(tmp, "razer-yytra"), "Replaced file missing from the cache");
+
+        /* Package removal drops the file from the cache */
+        fail_if(g_unlink(extra) != 0, "Failed to remove %s", extra);
+        fail_if(!ldm_manager_update_modalias_cache(tmp), "Failed to update the cache");
+        fail_if(razer_has_package(tmp, "razer-yytra"), "Removed file still in the cache");
+        fail_if(!razer_has_package(tmp, "razer-drivers"), "Lost the remaining files");
+
+        remove_db_dir(tmp);
+}
+END_TEST
+
+/**
+ * Returns: (transfer full): The aliases of a plain `.modaliases` file
+ */
+static GPtrArray *read_aliases(const gchar *path)
+{
+        g_autofree gchar *contents = NULL;
+        g_auto(GStrv) lines = NULL;
+        GPtrArray *ret = NULL;
+
+        fail_if(!g_file_get_contents(path, &contents, NULL, NULL), "Failed to read %s", path);
+
+        ret = g_ptr_array_new_with_free_func(g_object_unref);
+        lines = g_strsplit(contents, "\n", -1);
+        for (guint i = 0; lines[i]; i++) {
+                g_auto(GStrv) splits = g_strsplit(g_strstrip(lines[i]), " ", 4);
+
+                if (g_strv_length(splits) != 4 || !g_str_equal(splits[0], "alias")) {
+                        continue;
+                }
+                g_ptr_array_add(ret, ldm_modalias_new(splits[1], splits[2], splits[3]));
+        }
+
+        return ret;
+}
+
+/**
+ * Returns: (transfer full): A modalias the pattern matches, taking the first
+ * member of any bracket expression
+ */
+static gchar *synthesize_modalias(const gchar *pattern)
+{
+        GString *ret = g_string_new(NULL);
+
+        for (const gchar *c = pattern; *c; c++) {
+                switch (*c) {
+                case '*':
+                        break;
+                case '?':
+                        g_string_append_c(ret, '0');
+                        break;
+                case '[':
+                        g_string_append_c(ret, c[1]);
+                        c = strchr(c, ']');
+                        break;
+                default:
+                        g_string_append_c(ret, *c);
+                        break;
+                }
+        }
+
+        return g_string_free(ret, FALSE);
+}
+
+/**
+ * Ensure a modalias synthesized from every alias in @aliases is matched by
+ * an alias of the same driver in @by.
+ */
+static void assert_aliases_matched(GPtrArray *aliases, GPtrArray *by, const gchar *what)
+{
+        for (guint i = 0; i < aliases->len; i++) {
+                LdmModalias *modalias = aliases->pdata[i];
+                g_autofree gchar *subject = NULL;
+                gboolean found = FALSE;
+
+                subject = synthesize_modalias(ldm_modalias_get_match(modalias));
+                for (guint j = 0; j < by->len && !found; j++) {
+                        found = ldm_modalias_matches(by->pdata[j], subject) &&
+                                g_str_equal(ldm_modalias_get_driver(by->pdata[j]),
+                                            ldm_modalias_get_driver(modalias));
+                }
+                fail_if(!found,
+                        "%s for %s isn't matched by the %s aliases",
+                        subject,
+                        ldm_modalias_get_driver(modalias),
+                        what);
+        }
+}
+
+/**
+ * Ensure mkmodaliases --optimize shrinks every test file while matching the
+ * same modaliases, and that libldm finds the same providers with them.
+ */
+START_TEST(test_modalias_optimize)
+{
+        g_autoptr(GError) error = NULL;
+        g_autofree gchar *tmp = NULL;
+        GDir *dir = NULL;
+        const gchar *name = NULL;
+        guint n_providers = 0;
+
+        tmp = g_dir_make_tmp("ldm-modalias-optimize-XXXXXX", &error);
+        fail_if(!tmp, "Failed to create temporary directory: %s", error ? error->message : "");
+
+        dir = g_dir_open(TEST_DATA_ROOT, 0, NULL);
+        fail_if(!dir, "Failed to open %s", TEST_DATA_ROOT);
+
+        while ((name = g_dir_read_name(dir)) != NULL) {
+                g_autofree gchar *source = NULL;
+                g_autofree gchar *target = NULL;
+                g_autoptr(GPtrArray) original = NULL;
+                g_autoptr(GPtrArray) optimized = NULL;
+                gchar *argv[] = { MKMODALIASES_BINARY, "--optimize", "-o", NULL, NULL, NULL };
+                gint status = 0;
+
+                if (!g_str_has_suffix(name, ".modaliases")) {
+                        continue;
+                }
+
+                source = g_build_filename(TEST_DATA_ROOT, name, NULL);
+                target = g_build_filename(tmp, name, NULL);
+                argv[3] = target;
+                argv[4] = source;
+                fail_if(!g_spawn_sync(NULL,
+                                      argv,
+                                      NULL,
+                                      G_SPAWN_DEFAULT,
+                                      NULL,
+                                      NULL,
+                                      NULL,
+                                      NULL,
+                                      &status,
+                                      &error),
+                        "Failed to run mkmodaliases: %s",
+                        error ? error->message : "");
+                fail_if(status != 0, "mkmodaliases --optimize failed for %s", name);
+
+                original = read_aliases(source);
+                optimized = read_aliases(target);
+                fail_if(optimized->len >= original->len,
+                        "%s wasn't optimised (%u aliases from %u)",
+                        name,
+                        optimized->len,
+                        original->len);
+
+                assert_aliases_matched(original, optimized, "optimised");
+                assert_aliases_matched(optimized, original, "original");
+        }
+        g_dir_close(dir);
+
+        for (guint i = 0; i < G_N_ELEMENTS(mockdev_files); i++) {
+                g_autofree gchar *path = NULL;
+                autofree(UMockdevTestbed) *bed = NULL;
+                g_autoptr(LdmManager) text = NULL;
+                g_autoptr(LdmManager) optimized = NULL;
+
+                path = g_build_filename(TEST_DATA_ROOT, mockdev_files[i], NULL);
+                bed = create_bed_from(path);
+
+                text = ldm_manager_new(0);
+                fail_if(!ldm_manager_add_modalias_plugins_for_directory(text, TEST_DATA_ROOT),
+                        "Failed to add text modalias directory");
+
+                optimized = ldm_manager_new(0);
+                fail_if(!ldm_manager_add_modalias_plugins_for_directory(optimized, tmp),
+                        "Failed to add optimised modalias directory");
+
+                n_providers += compare_providers(mockdev_files[i], text, optimized);
+        }
+
+        fail_if(n_providers == 0, "Expected to find providers in the fixtures");
+
+        remove_db_dir(tmp);
+}
+END_TEST
+
+/* Generated from the test data by mkmodaliases --emit-c */
+gboolean test_modalias_table_register(LdmManager *manager);
+
+/**
+ * Ensure the rule table compiled into the test finds exactly the same
+ * providers, from plugins of the same name and priority, as the text files.
+ */
+START_TEST(test_modalias_table)
+{
+        guint n_providers = 0;
+
+        for (guint i = 0; i < G_N_ELEMENTS(mockdev_files); i++) {
+                g_autofree gchar *path = NULL;
+                autofree(UMockdevTestbed) *bed = NULL;
+                g_autoptr(LdmManager) text = NULL;
+                g_autoptr(LdmManager) table = NULL;
+
+                path = g_build_filename(TEST_DATA_ROOT, mockdev_files[i], NULL);
+                bed = create_bed_from(path);
+
+                text = ldm_manager_new(0);
+                fail_if(!ldm_manager_add_modalias_plugins_for_directory(text, TEST_DATA_ROOT),
+                        "Failed to add text modalias directory");
+
+                table = ldm_manager_new(0);
+                fail_if(!test_modalias_table_register(table), "Failed to add the rule table");
+
+                n_providers += compare_providers(mockdev_files[i], text, table);
+        }
+
+        fail_if(n_providers == 0, "Expected to find providers in the fixtures");
+}
+END_TEST
+
+/**
+ * Standard helper for running a test suite
+ */
+static int ldm_test_run(Suite *suite)
+{
+        SRunner *runner = NULL;
+        int n_failed = 0;
+
+        runner = srunner_create(suite);
+        srunner_run_all(runner, CK_VERBOSE);
+        n_failed = srunner_ntests_failed(runner);
+        srunner_free(runner);
+
+        return n_failed == 0 ? EXIT_SUCCESS : EXIT_FAILURE;
+}
+
+static Suite *test_create(void)
+{
+        Suite *s = NULL;
+        TCase *tc = NULL;
+
+        s = suite_create(__FILE__);
+        tc = tcase_create(__FILE__);
+        suite_add_tcase(s, tc);
+
+        tcase_add_test(tc, test_modalias_db_consistency);
+        tcase_add_test(tc, test_modalias_db_stale);
+        tcase_add_test(tc, test_modalias_db_partial);
+        tcase_add_test(tc, test_modalias_db_update_cache);
+        tcase_add_test(tc, test_modalias_optimize);
+        tcase_add_test(tc, test_modalias_table);
+
+        return s;
+}
+
+int main(__ldm_unused__ int argc, __ldm_unused__ char **argv)
+{
+        return ldm_test_run(test_create());
+}
+
+/*
+ * Editor modelines  -  https://www.wireshark.org/tools/modelines.html
+ *
+ * Local variables:
+ * c-basic-offset: 8
+ * tab-width: 8
+ * indent-tabs-mode: nil
+ * End:
+ *
+ * vi: set shiftwidth=8 tabstop=8 expandtab:
+ * :indentSize=8:tabSize=8:noTabs=true:
+ */
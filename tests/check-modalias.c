@@ -12,9 +12,14 @@
 #define _GNU_SOURCE
 
 #include <check.h>
+#include <glib/gstdio.h>
 #include <stdio.h>
 #include <stdlib.h>
+#include <string.h>
+#include <unistd.h>
+#include <umockdev.h>
 
+#include "config.h"
 #include "ldm-private.h"
 #include "ldm.h"
 #include "util.h"
@@ -28,6 +33,12 @@
 #define GLX_NO_MATCH "pci:v000010DEd00001B84sv*sd*bc03sc*i*"
 
 #define NV_MODALIAS_FILE TEST_DATA_ROOT "/nvidia-glx-driver.modaliases"
+#define COMPRESSED_DIR TEST_DATA_ROOT "/compressed"
+
+#define OPTIMUS_MOCKDEV_FILE TEST_DATA_ROOT "/optimus765m.umockdev"
+#define RAZER_MOCKDEV_FILE TEST_DATA_ROOT "/razer-ornata-chroma.umockdev"
+
+DEF_AUTOFREE(UMockdevTestbed, g_object_unref)
 
 /**
  * Abuse the private API to construct a fake LdmDevice with the given name, vendor, and modalias
@@ -104,6 +115,501 @@ START_TEST(test_modalias_file)
 }
 END_TEST
 
+/**
+ * Ensure the file loader splits columns exactly as before, copes with files
+ * it cannot write, and only builds rule objects on request.
+ */
+START_TEST(test_modalias_file_parse)
+{
+        g_autoptr(GError) error = NULL;
+        g_autofree gchar *path = NULL;
+        g_autoptr(LdmPlugin) plugin = NULL;
+        g_autoptr(LdmDevice) nvidia = NULL;
+        g_autoptr(LdmProvider) provider = NULL;
+        LdmModalias *modalias = NULL;
+        gint fd = -1;
+        const gchar *contents = "# Comment line\n"
+                                "\n"
+                                "  alias " GLX_MATCH " nvidia first-package \r\n"
+                                "alias " GLX_MATCH " nvidia replaced package\n"
+                                "alias usb:v1532p* razerkbd\n"
+                                "alias pci:v00008086d* i915 intel-package";
+
+        fd = g_file_open_tmp("ldm-modalias-XXXXXX.modaliases", &path, &error);
+        fail_if(fd < 0, "Failed to create temporary file: %s", error ? error->message : "");
+        close(fd);
+        fail_if(!g_file_set_contents(path, contents, -1, NULL), "Failed to write %s", path);
+
+        /* Installed files are rarely writable by whoever loads them */
+        fail_if(g_chmod(path, 0444) != 0, "Failed to make %s read-only", path);
+
+        plugin = ldm_modalias_plugin_new_from_filename(path);
+        g_unlink(path);
+        fail_if(!plugin, "Failed to construct plugin from %s", path);
+
+        /* The last column takes the remainder of the line */
+        modalias = ldm_modalias_plugin_get_modalias(LDM_MODALIAS_PLUGIN(plugin), GLX_MATCH);
+        fail_if(!modalias, "Missing rule for " GLX_MATCH);
+        fail_if(!g_str_equal(ldm_modalias_get_driver(modalias), "nvidia"), "Wrong driver");
+        fail_if(!g_str_equal(ldm_modalias_get_package(modalias), "replaced package"),
+                "Wrong package: '%s'",
+                ldm_modalias_get_package(modalias));
+        fail_if(ldm_modalias_plugin_get_modalias(LDM_MODALIAS_PLUGIN(plugin), GLX_MATCH) !=
+                    modalias,
+                "Rule object should only be constructed once");
+
+        fail_if(ldm_modalias_plugin_get_modalias(LDM_MODALIAS_PLUGIN(plugin), "usb:v1532p*"),
+                "Line with 3 columns should be skipped");
+        fail_if(!ldm_modalias_plugin_get_modalias(LDM_MODALIAS_PLUGIN(plugin), "pci:v00008086d*"),
+                "Last line without a newline should be loaded");
+
+        nvidia = create_fake_device("GTX 1060", "NVIDIA", NVIDIA_MODALIAS);
+        provider = ldm_plugin_get_provider(plugin, nvidia);
+        fail_if(!provider || !g_str_equal(ldm_provider_get_package(provider), "replaced package"),
+                "Replaced rule not honoured");
+}
+END_TEST
+
+/**
+ * Compressed files must load exactly the rules of the plain file they were
+ * made from. The gzip fixture is larger than a decoder chunk, so lines
+ * straddling chunk boundaries are covered too.
+ */
+START_TEST(test_modalias_file_compressed)
+{
+        const gchar *compressed[] = {
+#ifdef HAVE_ZLIB
+                "nvidia-340-glx-driver.modaliases.gz",
+#endif
+#ifdef HAVE_ZSTD
+                "nvidia-glx-driver.modaliases.zst",
+                "razer-drivers.modaliases.zst",
+#endif
+                NULL,
+        };
+
+        for (guint i = 0; compressed[i]; i++) {
+                g_autofree gchar *path = NULL;
+                g_autofree gchar *plain_path = NULL;
+                g_autofree gchar *contents = NULL;
+                g_auto(GStrv) lines = NULL;
+                g_autoptr(LdmPlugin) plain = NULL;
+                g_autoptr(LdmPlugin) plugin = NULL;
+                guint n_rules = 0;
+
+                path = g_build_filename(COMPRESSED_DIR, compressed[i], NULL);
+                plain_path = g_build_filename(TEST_DATA_ROOT, compressed[i], NULL);
+                *strrchr(plain_path, '.') = '\0';
+
+                plain = ldm_modalias_plugin_new_from_filename(plain_path);
+                fail_if(!plain, "Failed to load %s", plain_path);
+                plugin = ldm_modalias_plugin_new_from_filename(path);
+                fail_if(!plugin, "Failed to load %s", path);
+                fail_if(!g_str_equal(ldm_plugin_get_name(plugin), ldm_plugin_get_name(plain)),
+                        "Wrong plugin name for %s: %s",
+                        path,
+                        ldm_plugin_get_name(plugin));
+
+                fail_if(!g_file_get_contents(plain_path, &contents, NULL, NULL),
+                        "Failed to read %s",
+                        plain_path);
+                lines = g_strsplit(contents, "\n", -1);
+                for (guint j = 0; lines[j]; j++) {
+                        g_auto(GStrv) splits = g_strsplit(g_strstrip(lines[j]), " ", 4);
+                        LdmModalias *want = NULL;
+                        LdmModalias *got = NULL;
+
+                        if (g_strv_length(splits) != 4 || !g_str_equal(splits[0], "alias")) {
+                                continue;
+                        }
+
+                        want = ldm_modalias_plugin_get_modalias(LDM_MODALIAS_PLUGIN(plain),
+                                                                splits[1]);
+                        got = ldm_modalias_plugin_get_modalias(LDM_MODALIAS_PLUGIN(plugin),
+                                                               splits[1]);
+                        fail_if(!got, "%s is missing %s", path, splits[1]);
+                        fail_if(!g_str_equal(ldm_modalias_get_driver(got),
+                                             ldm_modalias_get_driver(want)) ||
+                                    !g_str_equal(ldm_modalias_get_package(got),
+                                                 ldm_modalias_get_package(want)),
+                                "%s has the wrong rule for %s",
+                                path,
+                                splits[1]);
+                        ++n_rules;
+                }
+                fail_if(n_rules == 0, "No rules checked for %s", path);
+        }
+}
+END_TEST
+
+/**
+ * A directory of compressed files must give the same plugins, in the same
+ * order, as their plain forms would, whether loaded eagerly or lazily.
+ */
+START_TEST(test_modalias_compressed_directory)
+{
+#if defined(HAVE_ZLIB) && defined(HAVE_ZSTD)
+        autofree(UMockdevTestbed) *bed = NULL;
+        const LdmManagerFlags flags[] = { 0, LDM_MANAGER_FLAGS_LAZY_PLUGINS };
+
+        bed = umockdev_testbed_new();
+        fail_if(!umockdev_testbed_add_from_file(bed, OPTIMUS_MOCKDEV_FILE, NULL),
+                "Failed to create device: %s",
+                OPTIMUS_MOCKDEV_FILE);
+
+        for (guint i = 0; i < G_N_ELEMENTS(flags); i++) {
+                g_autoptr(LdmManager) manager = NULL;
+                g_autoptr(LdmGPUConfig) gpu = NULL;
+                g_autoptr(GPtrArray) providers = NULL;
+                const gchar *plugin_id = NULL;
+
+                manager = ldm_manager_new(flags[i]);
+                fail_if(!ldm_manager_add_modalias_plugins_for_directory(manager, COMPRESSED_DIR),
+                        "Failed to add compressed modalias directory");
+
+                gpu = ldm_gpu_config_new(manager);
+                fail_if(!gpu, "Failed to create GPUConfig");
+
+                providers = ldm_gpu_config_get_providers(gpu);
+                fail_if(providers->len != 2, "Expected 2 providers, got %u", providers->len);
+
+                plugin_id = ldm_plugin_get_name(ldm_provider_get_plugin(providers->pdata[0]));
+                fail_if(!g_str_equal(plugin_id, "nvidia-glx-driver"),
+                        "First candidate should be nvidia-glx-driver, got %s",
+                        plugin_id);
+
+                plugin_id = ldm_plugin_get_name(ldm_provider_get_plugin(providers->pdata[1]));
+                fail_if(!g_str_equal(plugin_id, "nvidia-340-glx-driver"),
+                        "Second candidate should be nvidia-340-glx-driver, got %s",
+                        plugin_id);
+        }
+#endif
+}
+END_TEST
+
+/**
+ * A plain file and a compressed form of it in the same directory must give a
+ * single plugin, loaded from the plain file.
+ */
+START_TEST(test_modalias_duplicate_forms)
+{
+#ifdef HAVE_ZSTD
+        g_autoptr(GError) error = NULL;
+        g_autofree gchar *tmp = NULL;
+        g_autofree gchar *plain = NULL;
+        g_autofree gchar *compressed = NULL;
+        g_autofree gchar *extra = NULL;
+        g_autofree gchar *contents = NULL;
+        g_autoptr(LdmManager) manager = NULL;
+        autofree(UMockdevTestbed) *bed = NULL;
+        g_autoptr(GPtrArray) devices = NULL;
+        g_autoptr(GPtrArray) providers = NULL;
+        gsize len = 0;
+
+        tmp = g_dir_make_tmp("ldm-forms-XXXXXX", &error);
+        fail_if(!tmp, "Failed to create temporary directory: %s", error ? error->message : "");
+
+        plain = g_build_filename(tmp, "razer-drivers.modaliases", NULL);
+        fail_if(!g_file_set_contents(plain,
+                                     "alias hid:b0003g*v00001532p0000021E razerkbd plain-package\n",
+                                     -1,
+                                     NULL),
+                "Failed to write %s",
+                plain);
+
+        compressed = g_build_filename(tmp, "razer-drivers.modaliases.zst", NULL);
+        fail_if(!g_file_get_contents(COMPRESSED_DIR "/razer-drivers.modaliases.zst",
+                                     &contents,
+                                     &len,
+                                     NULL),
+                "Failed to read compressed razer modaliases");
+        fail_if(!g_file_set_contents(compressed, contents, (gssize)len, NULL),
+                "Failed to write %s",
+                compressed);
+
+        extra = g_build_filename(tmp, "zz-extra.modaliases", NULL);
+        fail_if(!g_file_set_contents(extra,
+                                     "alias hid:b0003g*v00001532p0000021E razerkbd extra-package\n",
+                                     -1,
+                                     NULL),
+                "Failed to write %s",
+                extra);
+
+        bed = umockdev_testbed_new();
+        fail_if(!umockdev_testbed_add_from_file(bed, RAZER_MOCKDEV_FILE, NULL),
+                "Failed to create device: %s",
+                RAZER_MOCKDEV_FILE);
+
+        manager = ldm_manager_new(LDM_MANAGER_FLAGS_NO_MONITOR);
+        fail_if(!ldm_manager_add_modalias_plugins_for_directory(manager, tmp),
+                "Failed to add modalias directory");
+
+        devices = ldm_manager_get_devices(manager, LDM_DEVICE_TYPE_USB | LDM_DEVICE_TYPE_HID);
+        fail_if(devices->len != 1, "Failed to find HID device!");
+
+        /* The compressed form neither replaces the plain file nor takes a slot */
+        providers = ldm_manager_get_providers(manager, devices->pdata[0]);
+        fail_if(providers->len != 2, "Expected 2 providers, got %u", providers->len);
+        fail_if(!g_str_equal(ldm_provider_get_package(providers->pdata[0]), "extra-package"),
+                "Later file should come first, got %s",
+                ldm_provider_get_package(providers->pdata[0]));
+        fail_if(!g_str_equal(ldm_provider_get_package(providers->pdata[1]), "plain-package"),
+                "Plain file should be preferred, got %s",
+                ldm_provider_get_package(providers->pdata[1]));
+
+        g_unlink(plain);
+        g_unlink(compressed);
+        g_unlink(extra);
+        g_rmdir(tmp);
+#endif
+}
+END_TEST
+
+/**
+ * Regular matches are compiled into integer compares against the decoded
+ * modalias. Make sure they agree with fnmatch, including for modaliases we
+ * cannot decode.
+ */
+START_TEST(test_modalias_typed)
+{
+        g_autoptr(LdmDevice) nvidia = NULL;
+        g_autoptr(LdmDevice) mangled = NULL;
+        g_autoptr(LdmDevice) razer = NULL;
+        g_autoptr(LdmDevice) razer_hid = NULL;
+        g_autoptr(LdmModalias) stale = NULL;
+        struct {
+                const gchar *match;
+                LdmDevice **device;
+                gboolean expected;
+        } cases[] = {
+                { GLX_MATCH, &nvidia, TRUE },
+                { GLX_NO_MATCH, &nvidia, FALSE },
+                { "pci:v*d*sv*sd*bc03sc*i*", &nvidia, TRUE },
+                { "pci:v000010DEd*", &nvidia, TRUE },
+                { "pci:v000010DEd00001C60sv00001558sd000065A4bc03sc00i00", &nvidia, TRUE },
+                { "pci:v000010DEd00001C60sv00001558sd000065A4bc03sc00i01", &nvidia, FALSE },
+                { "pci:v000010ded*", &nvidia, FALSE },
+                { GLX_MATCH, &mangled, TRUE },
+                { "pci:v000010DEd00001C60sv00001558sd000065A4bc03sc00i00", &mangled, FALSE },
+                { "usb:v1532p021Ed*dc*dsc*dp*ic03isc01ip01in*", &razer, TRUE },
+                { "usb:v1532p021Ed*dc*dsc*dp*ic03isc01ip02in*", &razer, FALSE },
+                { "usb:v1532p*", &razer, TRUE },
+                { "hid:b0003g*v00001532p0000021E", &razer_hid, TRUE },
+                { "hid:b0003g*v00001532p00000215", &razer_hid, FALSE },
+                { "hid:b0005g*v00001532p0000021E", &razer_hid, FALSE },
+        };
+
+        nvidia = create_fake_device("GTX 1060", "NVIDIA", NVIDIA_MODALIAS);
+        mangled = create_fake_device("GTX 1060", "NVIDIA", NVIDIA_MODALIAS "junk");
+        razer = create_fake_device("Ornata",
+                                   "Razer",
+                                   "usb:v1532p021Ed0200dc00dsc00dp00ic03isc01ip01in00");
+        razer_hid = create_fake_device("Ornata", "Razer", "hid:b0003g0001v00001532p0000021E");
+
+        for (guint i = 0; i < G_N_ELEMENTS(cases); i++) {
+                g_autoptr(LdmModalias) modalias = NULL;
+                const gchar *id = ldm_device_get_modalias(*cases[i].device);
+
+                modalias = ldm_modalias_new(cases[i].match, "fake", "fake");
+
+                fail_if(ldm_modalias_matches(modalias, id) != cases[i].expected,
+                        "fnmatch disagrees for %s against %s",
+                        cases[i].match,
+                        id);
+                fail_if(ldm_modalias_matches_device(modalias, *cases[i].device) !=
+                            cases[i].expected,
+                        "Device match disagrees for %s against %s",
+                        cases[i].match,
+                        id);
+        }
+
+        /* Changing the match must drop the previously compiled rule */
+        stale = ldm_modalias_new(GLX_MATCH, "fake", "fake");
+        fail_if(!ldm_modalias_matches_device(stale, nvidia), "Compiled rule doesn't match");
+        g_object_set(stale, "match", GLX_NO_MATCH, NULL);
+        fail_if(ldm_modalias_matches_device(stale, nvidia), "Matched with the stale rule");
+        g_object_set(stale, "match", GLX_MATCH, NULL);
+        g_object_set(stale, "match", NULL, NULL);
+        fail_if(ldm_modalias_matches_device(stale, nvidia), "NULL match still matches");
+}
+END_TEST
+
+/**
+ * Add the sysfs path of each descendant of @device whose modalias starts
+ * with @prefix to @paths.
+ */
+static void collect_descendants(LdmDevice *device, const gchar *prefix, GPtrArray *paths)
+{
+        g_autoptr(GList) kids = ldm_device_get_children(device);
+
+        for (GList *node = kids; node; node = node->next) {
+                const gchar *modalias = ldm_device_get_modalias(node->data);
+
+                if (modalias && g_str_has_prefix(modalias, prefix)) {
+                        g_ptr_array_add(paths, g_strdup(ldm_device_get_path(node->data)));
+                }
+                collect_descendants(node->data, prefix, paths);
+        }
+}
+
+/**
+ * Returns: Number of descendants of @device whose modalias starts with @prefix
+ */
+static guint count_descendants(LdmDevice *device, const gchar *prefix)
+{
+        g_autoptr(GPtrArray) paths = g_ptr_array_new_with_free_func(g_free);
+
+        collect_descendants(device, prefix, paths);
+        return paths->len;
+}
+
+/**
+ * Ensure the flattened subtree modaliases of a real USB device include its
+ * interfaces and their HID children, and lose them again on unplug.
+ */
+START_TEST(test_modalias_subtree)
+{
+        g_autoptr(LdmManager) manager = NULL;
+        autofree(UMockdevTestbed) *bed = NULL;
+        g_autoptr(GPtrArray) devices = NULL;
+        g_autoptr(LdmModalias) hid_match = NULL;
+        g_autoptr(LdmModalias) iface_match = NULL;
+        g_autoptr(LdmModalias) no_match = NULL;
+        LdmDevice *usb = NULL;
+        g_autoptr(GPtrArray) hid_paths = NULL;
+        gint64 deadline = 0;
+
+        hid_match = ldm_modalias_new("hid:b0003g*v00001532p0000021E", "fake", "fake");
+        iface_match =
+            ldm_modalias_new("usb:v1532p021Ed*dc*dsc*dp*ic03isc01ip01in*", "fake", "fake");
+        no_match = ldm_modalias_new("hid:b0003g*v00001532p00000215", "fake", "fake");
+
+        bed = umockdev_testbed_new();
+        fail_if(!umockdev_testbed_add_from_file(bed, RAZER_MOCKDEV_FILE, NULL),
+                "Failed to create device: %s",
+                RAZER_MOCKDEV_FILE);
+
+        manager = ldm_manager_new(0);
+        devices = ldm_manager_get_devices(manager, LDM_DEVICE_TYPE_USB | LDM_DEVICE_TYPE_HID);
+        fail_if(devices->len != 1, "Failed to find HID device!");
+        usb = devices->pdata[0];
+
+        fail_if(!ldm_modalias_matches_device(hid_match, usb), "Grandchild should match");
+        fail_if(!ldm_modalias_matches_device(iface_match, usb), "Child should match");
+        fail_if(ldm_modalias_matches_device(no_match, usb), "Unrelated HID rule matched");
+
+        /* Unplug the HID devices, leaving their interfaces behind */
+        hid_paths = g_ptr_array_new_with_free_func(g_free);
+        collect_descendants(usb, "hid:", hid_paths);
+        fail_if(hid_paths->len == 0, "Failed to find the HID grandchildren");
+        for (guint i = 0; i < hid_paths->len; i++) {
+                umockdev_testbed_uevent(bed, hid_paths->pdata[i], "remove");
+                umockdev_testbed_remove_device(bed, hid_paths->pdata[i]);
+        }
+
+        deadline = g_get_monotonic_time() + 5 * G_USEC_PER_SEC;
+        while (count_descendants(usb, "hid:") > 0 && g_get_monotonic_time() < deadline) {
+                if (!g_main_context_iteration(NULL, FALSE)) {
+                        g_usleep(G_USEC_PER_SEC / 100);
+                }
+        }
+
+        fail_if(count_descendants(usb, "hid:") != 0, "HID devices were not removed");
+        fail_if(ldm_modalias_matches_device(hid_match, usb), "Removed grandchild still matches");
+        fail_if(!ldm_modalias_matches_device(iface_match, usb), "Child should still match");
+}
+END_TEST
+
+/**
+ * Ensure plugin lookups still find rules regardless of which index bucket
+ * they land in: device, vendor, bus, or the wildcard fallback.
+ */
+START_TEST(test_modalias_plugin_index)
+{
+        g_autoptr(LdmPlugin) plugin = NULL;
+        g_autoptr(LdmDevice) nvidia = NULL;
+        g_autoptr(LdmDevice) intel = NULL;
+        g_autoptr(LdmDevice) razer = NULL;
+        g_autoptr(LdmProvider) provider = NULL;
+        struct {
+                const gchar *match;
+                const gchar *package;
+        } rules[] = {
+                { GLX_NO_MATCH, "wrong-device" },
+                { "usb:v1532p*", "usb-vendor" },
+                { "*bc03sc??i*", "any-display" },
+                { GLX_MATCH, "device" },
+                { "pci:v000010DE*", "vendor" },
+                { "pci:*", "bus" },
+        };
+
+        plugin = ldm_modalias_plugin_new("index");
+        for (guint i = 0; i < G_N_ELEMENTS(rules); i++) {
+                ldm_modalias_plugin_add_modalias(LDM_MODALIAS_PLUGIN(plugin),
+                                                 ldm_modalias_new(rules[i].match,
+                                                                  "fake",
+                                                                  rules[i].package));
+        }
+
+        nvidia = create_fake_device("GTX 1060", "NVIDIA", NVIDIA_MODALIAS);
+        intel = create_fake_device("HD 530", "Intel",
+                                   "pci:v00008086d00001912sv00001558sd000065A4bc03sc00i00");
+        razer = create_fake_device("Ornata", "Razer",
+                                   "usb:v1532p021Ed0200dc00dsc00dp00ic03isc01ip01in00");
+
+        /* Earliest added matching rule wins, which is the wildcard one */
+        provider = ldm_plugin_get_provider(plugin, nvidia);
+        fail_if(!provider, "Failed to match NVIDIA device");
+        fail_if(!g_str_equal(ldm_provider_get_package(provider), "any-display"),
+                "Wrong rule for NVIDIA device: %s",
+                ldm_provider_get_package(provider));
+        g_clear_object(&provider);
+
+        provider = ldm_plugin_get_provider(plugin, intel);
+        fail_if(!provider, "Failed to match Intel device");
+        fail_if(!g_str_equal(ldm_provider_get_package(provider), "any-display"),
+                "Wrong rule for Intel device");
+        g_clear_object(&provider);
+
+        provider = ldm_plugin_get_provider(plugin, razer);
+        fail_if(!provider, "Failed to match Razer device");
+        fail_if(!g_str_equal(ldm_provider_get_package(provider), "usb-vendor"),
+                "Wrong rule for Razer device");
+        g_clear_object(&provider);
+
+        /* Replacing a rule keeps its original position */
+        ldm_modalias_plugin_add_modalias(LDM_MODALIAS_PLUGIN(plugin),
+                                         ldm_modalias_new("*bc03sc??i*", "fake", "replaced"));
+        provider = ldm_plugin_get_provider(plugin, nvidia);
+        fail_if(!provider || !g_str_equal(ldm_provider_get_package(provider), "replaced"),
+                "Replaced rule not honoured");
+        g_clear_object(&provider);
+
+        /* Without the wildcard rules, each device is decided by its own buckets */
+        g_clear_object(&plugin);
+        plugin = ldm_modalias_plugin_new("index");
+        for (guint i = 3; i < G_N_ELEMENTS(rules); i++) {
+                ldm_modalias_plugin_add_modalias(LDM_MODALIAS_PLUGIN(plugin),
+                                                 ldm_modalias_new(rules[i].match,
+                                                                  "fake",
+                                                                  rules[i].package));
+        }
+
+        provider = ldm_plugin_get_provider(plugin, nvidia);
+        fail_if(!provider || !g_str_equal(ldm_provider_get_package(provider), "device"),
+                "Device bucket not honoured");
+        g_clear_object(&provider);
+
+        provider = ldm_plugin_get_provider(plugin, intel);
+        fail_if(!provider || !g_str_equal(ldm_provider_get_package(provider), "bus"),
+                "Bus bucket not honoured");
+        g_clear_object(&provider);
+
+        provider = ldm_plugin_get_provider(plugin, razer);
+        fail_if(provider != NULL, "Razer device should not match PCI rules");
+}
+END_TEST
+
 /**
  * Standard helper for running a test suite
  */
@@ -132,6 +638,13 @@ static Suite *test_create(void)
         tcase_add_test(tc, test_modalias_simple);
         tcase_add_test(tc, test_modalias_device);
         tcase_add_test(tc, test_modalias_file);
+        tcase_add_test(tc, test_modalias_file_parse);
+        tcase_add_test(tc, test_modalias_file_compressed);
+        tcase_add_test(tc, test_modalias_compressed_directory);
+        tcase_add_test(tc, test_modalias_duplicate_forms);
+        tcase_add_test(tc, test_modalias_typed);
+        tcase_add_test(tc, test_modalias_subtree);
+        tcase_add_test(tc, test_modalias_plugin_index);
 
         return s;
 }
@@ -12,10 +12,13 @@
 #define _GNU_SOURCE
 
 #include <check.h>
+#include <glib/gstdio.h>
 #include <stdio.h>
 #include <stdlib.h>
+#include <string.h>
 #include <umockdev.h>
 
+#include "config.h"
 #include "ldm-private.h"
 #include "ldm.h"
 #include "util.h"
@@ -27,11 +30,161 @@ DEF_AUTOFREE(UMockdevTestbed, g_object_unref)
 
 #define NV_MAIN_MODALIAS TEST_DATA_ROOT "/nvidia-glx-driver.modaliases"
 #define NV_340_MODALIAS TEST_DATA_ROOT "/nvidia-340-glx-driver.modaliases"
-#define MODALIAS_DIR TEST_DATA_ROOT "/"
+#define TEST_MODALIAS_DIR TEST_DATA_ROOT "/"
 
 #define RAZER_MOCKDEV_FILE TEST_DATA_ROOT "/razer-ornata-chroma.umockdev"
 #define RAZER_MODALIAS TEST_DATA_ROOT "razer-drivers.modaliases"
 
+/* Every fixture in the test data */
+static const gchar *all_mockdevs[] = {
+        "blueYeti.umockdev",
+        "bluetoothUSB.umockdev",
+        "brotherPrinter.umockdev",
+        "corsairk70r.umockdev",
+        "desktop-nvidia-intel.umockdev",
+        "desktop-nvidia980-intel.umockdev",
+        "hpPrinter.umockdev",
+        "ipodtouchgen5.umockdev",
+        "logitechg403.umockdev",
+        "logitechg502.umockdev",
+        "logitechm305.umockdev",
+        "nvidia1060.umockdev",
+        "optimus1050m.umockdev",
+        "optimus765m.umockdev",
+        "razer-ornata-chroma.umockdev",
+        "razerMamba.umockdev",
+        "samsungPrinter.umockdev",
+        "smartcard.umockdev",
+        "wifi.umockdev",
+        "xboxone.umockdev",
+        "yubikey4.umockdev",
+        "yubikey_neo.umockdev",
+        "yubikeyu2f.umockdev",
+};
+
+/*
+ * Plugin providing for every device whose vendor contains the plugin name,
+ * or every device at all if named "*". It only reads immutable state, so
+ * declares itself thread-safe.
+ */
+typedef struct TestVendorPlugin {
+        LdmPlugin parent;
+} TestVendorPlugin;
+
+typedef struct TestVendorPluginClass {
+        LdmPluginClass parent_class;
+} TestVendorPluginClass;
+
+G_DEFINE_TYPE(TestVendorPlugin, test_vendor_plugin, LDM_TYPE_PLUGIN)
+
+static LdmProvider *test_vendor_plugin_get_provider(LdmPlugin *plugin, LdmDevice *device)
+{
+        const gchar *name = ldm_plugin_get_name(plugin);
+        const gchar *vendor = ldm_device_get_vendor(device);
+        g_autofree gchar *package = NULL;
+
+        if (!g_str_equal(name, "*") && (!vendor || !strstr(vendor, name))) {
+                return NULL;
+        }
+
+        package = g_strdup_printf("%s-package", name);
+        return ldm_provider_new(plugin, device, package);
+}
+
+static void test_vendor_plugin_class_init(TestVendorPluginClass *klazz)
+{
+        LdmPluginClass *plug_class = LDM_PLUGIN_CLASS(klazz);
+
+        plug_class->get_provider = test_vendor_plugin_get_provider;
+        plug_class->thread_safe = TRUE;
+}
+
+static void test_vendor_plugin_init(__ldm_unused__ TestVendorPlugin *self)
+{
+}
+
+/*
+ * The same plugin, without the claim of thread safety
+ */
+typedef struct TestSerialPlugin {
+        TestVendorPlugin parent;
+} TestSerialPlugin;
+
+typedef struct TestSerialPluginClass {
+        TestVendorPluginClass parent_class;
+} TestSerialPluginClass;
+
+G_DEFINE_TYPE(TestSerialPlugin, test_serial_plugin, test_vendor_plugin_get_type())
+
+static void test_serial_plugin_class_init(TestSerialPluginClass *klazz)
+{
+        LDM_PLUGIN_CLASS(klazz)->thread_safe = FALSE;
+}
+
+static void test_serial_plugin_init(__ldm_unused__ TestSerialPlugin *self)
+{
+}
+
+/**
+ * Add the modalias test data and a mix of thread-safe and serial plugins,
+ * some sharing a priority, to the manager.
+ */
+static void add_test_plugins(LdmManager *manager)
+{
+        static const struct {
+                const gchar *name;
+                gint priority;
+                gboolean thread_safe;
+        } plugins[] = {
+                { "NVIDIA", 50, TRUE },   { "Intel", 50, TRUE }, { "Razer", 40, FALSE },
+                { "Logitech", 40, TRUE }, { "Yubico", 30, TRUE }, { "*", 10, TRUE },
+                { "Corporation", 10, FALSE },
+        };
+
+        fail_if(!ldm_manager_add_modalias_plugins_for_directory(manager, TEST_MODALIAS_DIR),
+                "Failed to add main modalias directory");
+
+        for (guint i = 0; i < G_N_ELEMENTS(plugins); i++) {
+                GType type = plugins[i].thread_safe ? test_vendor_plugin_get_type()
+                                                    : test_serial_plugin_get_type();
+                LdmPlugin *plugin = g_object_new(type,
+                                                 "name",
+                                                 plugins[i].name,
+                                                 "priority",
+                                                 plugins[i].priority,
+                                                 NULL);
+                ldm_manager_add_plugin(manager, plugin);
+        }
+}
+
+/**
+ * Ensure both provider lists hold the same plugins and packages in the
+ * same order.
+ */
+static void compare_provider_lists(const gchar *mockdev, GPtrArray *serial, GPtrArray *parallel)
+{
+        fail_if(serial->len != parallel->len,
+                "%s: expected %u providers, got %u",
+                mockdev,
+                serial->len,
+                parallel->len);
+
+        for (guint i = 0; i < serial->len; i++) {
+                LdmPlugin *a = ldm_provider_get_plugin(serial->pdata[i]);
+                LdmPlugin *b = ldm_provider_get_plugin(parallel->pdata[i]);
+
+                fail_if(!g_str_equal(ldm_plugin_get_name(a), ldm_plugin_get_name(b)),
+                        "%s: plugin mismatch '%s' vs '%s'",
+                        mockdev,
+                        ldm_plugin_get_name(a),
+                        ldm_plugin_get_name(b));
+                fail_if(!g_str_equal(ldm_provider_get_package(serial->pdata[i]),
+                                     ldm_provider_get_package(parallel->pdata[i])),
+                        "%s: package mismatch",
+                        mockdev);
+        }
+}
+
 static UMockdevTestbed *create_bed_from(const char *mockdevname)
 {
         UMockdevTestbed *bed = NULL;
@@ -131,7 +284,7 @@ START_TEST(test_plugins_nvidia_multiple_glob)
         manager = ldm_manager_new(0);
 
         /* Modalias plugins preserve the priority from the insert order. */
-        fail_if(!ldm_manager_add_modalias_plugins_for_directory(manager, MODALIAS_DIR),
+        fail_if(!ldm_manager_add_modalias_plugins_for_directory(manager, TEST_MODALIAS_DIR),
                 "Failed to add main modalias directory");
 
         gpu = ldm_gpu_config_new(manager);
@@ -171,7 +324,7 @@ START_TEST(test_plugins_razer)
         manager = ldm_manager_new(0);
 
         /* Modalias plugins preserve the priority from the insert order. */
-        fail_if(!ldm_manager_add_modalias_plugins_for_directory(manager, MODALIAS_DIR),
+        fail_if(!ldm_manager_add_modalias_plugins_for_directory(manager, TEST_MODALIAS_DIR),
                 "Failed to add main modalias directory");
 
         devices = ldm_manager_get_devices(manager, LDM_DEVICE_TYPE_USB | LDM_DEVICE_TYPE_HID);
@@ -189,6 +342,767 @@ START_TEST(test_plugins_razer)
 }
 END_TEST
 
+/**
+ * Ensure the manager's unified index sees rules added to plugins after they
+ * were registered, and follows priority changes.
+ */
+START_TEST(test_plugins_unified_index)
+{
+        g_autoptr(LdmManager) manager = NULL;
+        autofree(UMockdevTestbed) *bed = NULL;
+        g_autoptr(GPtrArray) devices = NULL;
+        g_autoptr(GPtrArray) providers = NULL;
+        g_autoptr(GPtrArray) reordered = NULL;
+        LdmPlugin *first = NULL;
+        LdmPlugin *second = NULL;
+        LdmDevice *device = NULL;
+
+        bed = create_bed_from(RAZER_MOCKDEV_FILE);
+        manager = ldm_manager_new(0);
+
+        first = ldm_modalias_plugin_new("first");
+        second = ldm_modalias_plugin_new("second");
+        ldm_plugin_set_priority(first, 10);
+        ldm_plugin_set_priority(second, 5);
+        ldm_manager_add_plugin(manager, first);
+        ldm_manager_add_plugin(manager, second);
+
+        devices = ldm_manager_get_devices(manager, LDM_DEVICE_TYPE_USB | LDM_DEVICE_TYPE_HID);
+        fail_if(devices->len != 1, "Failed to find HID device!");
+        device = devices->pdata[0];
+
+        providers = ldm_manager_get_providers(manager, device);
+        fail_if(providers->len != 0, "Expected no providers, got %u", providers->len);
+        g_clear_pointer(&providers, g_ptr_array_unref);
+
+        /* Rules added after registration must be picked up */
+        ldm_modalias_plugin_add_modalias(LDM_MODALIAS_PLUGIN(first),
+                                         ldm_modalias_new("hid:b0003g*v00001532p0000021E",
+                                                          "razerkbd",
+                                                          "first-package"));
+        ldm_modalias_plugin_add_modalias(LDM_MODALIAS_PLUGIN(second),
+                                         ldm_modalias_new("usb:v1532p021E*",
+                                                          "razerkbd",
+                                                          "second-package"));
+
+        providers = ldm_manager_get_providers(manager, device);
+        fail_if(providers->len != 2, "Expected 2 providers, got %u", providers->len);
+        fail_if(ldm_provider_get_plugin(providers->pdata[0]) != first,
+                "Highest priority plugin should be first");
+        fail_if(!g_str_equal(ldm_provider_get_package(providers->pdata[0]), "first-package"),
+                "Wrong package for first plugin");
+        fail_if(!g_str_equal(ldm_provider_get_package(providers->pdata[1]), "second-package"),
+                "Wrong package for second plugin");
+
+        /* Changing the priority reorders the results */
+        ldm_plugin_set_priority(second, 20);
+        reordered = ldm_manager_get_providers(manager, device);
+        fail_if(reordered->len != 2, "Expected 2 providers, got %u", reordered->len);
+        fail_if(ldm_provider_get_plugin(reordered->pdata[0]) != second,
+                "Reprioritised plugin should be first");
+}
+END_TEST
+
+/**
+ * Ensure batch resolution agrees with resolving each device on its own.
+ */
+START_TEST(test_plugins_batch)
+{
+        const gchar *mockdevs[] = { OPTIMUS_MOCKDEV_FILE, RAZER_MOCKDEV_FILE };
+
+        for (guint m = 0; m < G_N_ELEMENTS(mockdevs); m++) {
+                g_autoptr(LdmManager) manager = NULL;
+                autofree(UMockdevTestbed) *bed = NULL;
+                g_autoptr(GPtrArray) devices = NULL;
+                g_autoptr(GHashTable) providers_map = NULL;
+                guint n_providers = 0;
+
+                bed = create_bed_from(mockdevs[m]);
+                manager = ldm_manager_new(0);
+                fail_if(!ldm_manager_add_modalias_plugins_for_directory(manager, TEST_MODALIAS_DIR),
+                        "Failed to add main modalias directory");
+
+                devices = ldm_manager_get_devices(manager, LDM_DEVICE_TYPE_ANY);
+                providers_map = ldm_manager_get_providers_for_devices(manager, devices);
+                fail_if(g_hash_table_size(providers_map) != devices->len,
+                        "Expected %u devices in map, got %u",
+                        devices->len,
+                        g_hash_table_size(providers_map));
+
+                for (guint i = 0; i < devices->len; i++) {
+                        g_autoptr(GPtrArray) providers = NULL;
+                        GPtrArray *batched = NULL;
+
+                        providers = ldm_manager_get_providers(manager, devices->pdata[i]);
+                        batched = g_hash_table_lookup(providers_map, devices->pdata[i]);
+                        fail_if(!batched, "Device missing from map");
+                        fail_if(batched->len != providers->len,
+                                "Expected %u providers, got %u",
+                                providers->len,
+                                batched->len);
+
+                        for (guint j = 0; j < providers->len; j++) {
+                                fail_if(ldm_provider_get_plugin(providers->pdata[j]) !=
+                                            ldm_provider_get_plugin(batched->pdata[j]),
+                                        "Provider order differs");
+                                fail_if(!g_str_equal(ldm_provider_get_package(providers->pdata[j]),
+                                                     ldm_provider_get_package(batched->pdata[j])),
+                                        "Provider package differs");
+                        }
+                        n_providers += providers->len;
+                }
+
+                fail_if(n_providers == 0, "Expected providers for %s", mockdevs[m]);
+        }
+}
+END_TEST
+
+/**
+ * Ensure repeat lookups are served from the cache, and that adding a plugin
+ * invalidates it.
+ */
+START_TEST(test_plugins_cache)
+{
+        g_autoptr(LdmManager) manager = NULL;
+        autofree(UMockdevTestbed) *bed = NULL;
+        g_autoptr(GPtrArray) devices = NULL;
+        g_autoptr(GPtrArray) providers = NULL;
+        LdmPlugin *extra = NULL;
+        LdmDevice *device = NULL;
+        guint64 hits = 0;
+        guint64 misses = 0;
+        guint64 first_misses = 0;
+
+        bed = create_bed_from(RAZER_MOCKDEV_FILE);
+        manager = ldm_manager_new(0);
+        fail_if(!ldm_manager_add_modalias_plugins_for_directory(manager, TEST_MODALIAS_DIR),
+                "Failed to add main modalias directory");
+
+        devices = ldm_manager_get_devices(manager, LDM_DEVICE_TYPE_USB | LDM_DEVICE_TYPE_HID);
+        fail_if(devices->len != 1, "Failed to find HID device!");
+        device = devices->pdata[0];
+
+        providers = ldm_manager_get_providers(manager, device);
+        fail_if(providers->len != 1, "Expected 1 provider, got %u", providers->len);
+        g_clear_pointer(&providers, g_ptr_array_unref);
+
+        ldm_manager_get_cache_stats(manager, &hits, &first_misses);
+        fail_if(first_misses == 0, "Expected the first lookup to miss");
+
+        /* Unchanged plugins and hardware must not probe again */
+        providers = ldm_manager_get_providers(manager, device);
+        fail_if(providers->len != 1, "Expected 1 provider, got %u", providers->len);
+        g_clear_pointer(&providers, g_ptr_array_unref);
+
+        ldm_manager_get_cache_stats(manager, &hits, &misses);
+        fail_if(misses != first_misses, "Repeat lookup should not miss");
+        fail_if(hits < first_misses, "Repeat lookup should hit for every modalias");
+
+        /* New plugin must invalidate the cache, and be seen */
+        extra = ldm_modalias_plugin_new("extra");
+        ldm_manager_add_plugin(manager, extra);
+        ldm_modalias_plugin_add_modalias(LDM_MODALIAS_PLUGIN(extra),
+                                         ldm_modalias_new("usb:v1532p021E*",
+                                                          "razerkbd",
+                                                          "extra-package"));
+
+        providers = ldm_manager_get_providers(manager, device);
+        fail_if(providers->len != 2, "Expected 2 providers, got %u", providers->len);
+
+        ldm_manager_get_cache_stats(manager, NULL, &misses);
+        fail_if(misses != first_misses * 2, "Expected the cache to be invalidated");
+}
+END_TEST
+
+/**
+ * Identical patterns from different plugins are indexed once, and must still
+ * match for every plugin owning them.
+ */
+START_TEST(test_plugins_shared_patterns)
+{
+        g_autoptr(LdmManager) manager = NULL;
+        autofree(UMockdevTestbed) *bed = NULL;
+        g_autoptr(LdmGPUConfig) gpu = NULL;
+        g_autoptr(GPtrArray) providers = NULL;
+        g_autoptr(LdmPlugin) shared = NULL;
+        guint n_rules = 0;
+        guint n_patterns = 0;
+
+        bed = create_bed_from(OPTIMUS_MOCKDEV_FILE);
+        manager = ldm_manager_new(0);
+        fail_if(!ldm_manager_add_modalias_plugins_for_directory(manager, TEST_MODALIAS_DIR),
+                "Failed to add main modalias directory");
+
+        /* The two NVIDIA generations share 240 of their device patterns */
+        ldm_manager_get_pattern_stats(manager, &n_rules, &n_patterns);
+        fail_if(n_rules != 1284, "Expected 1284 rules, got %u", n_rules);
+        fail_if(n_patterns != 1044, "Expected 1044 patterns, got %u", n_patterns);
+
+        /* Both own the pattern for this GPU */
+        gpu = ldm_gpu_config_new(manager);
+        providers = ldm_gpu_config_get_providers(gpu);
+        fail_if(providers->len != 2, "Expected 2 providers, got %u", providers->len);
+        g_clear_pointer(&providers, g_ptr_array_unref);
+        g_clear_object(&gpu);
+
+        /* A later plugin joins the existing pattern rather than adding one */
+        shared = ldm_modalias_plugin_new("shared");
+        ldm_manager_add_plugin(manager, shared);
+        ldm_modalias_plugin_add_modalias(LDM_MODALIAS_PLUGIN(shared),
+                                         ldm_modalias_new("pci:v000010DEd000011E2sv*sd*bc03sc*i*",
+                                                          "nvidia",
+                                                          "shared-package"));
+        ldm_modalias_plugin_add_modalias(LDM_MODALIAS_PLUGIN(shared),
+                                         ldm_modalias_new("pci:v000010DEd0000FFFFsv*sd*bc03sc*i*",
+                                                          "nvidia",
+                                                          "unused-package"));
+
+        ldm_manager_get_pattern_stats(manager, &n_rules, &n_patterns);
+        fail_if(n_rules != 1286, "Expected 1286 rules, got %u", n_rules);
+        fail_if(n_patterns != 1045, "Expected 1045 patterns, got %u", n_patterns);
+
+        gpu = ldm_gpu_config_new(manager);
+        providers = ldm_gpu_config_get_providers(gpu);
+        fail_if(providers->len != 3, "Expected 3 providers, got %u", providers->len);
+}
+END_TEST
+
+/**
+ * Ensure a lazily loading manager finds exactly the same providers, in the
+ * same order, as one parsing every file up front.
+ */
+START_TEST(test_plugins_lazy)
+{
+        const gchar *mockdevs[] = { NV_MOCKDEV_FILE, OPTIMUS_MOCKDEV_FILE, RAZER_MOCKDEV_FILE };
+
+        for (guint m = 0; m < G_N_ELEMENTS(mockdevs); m++) {
+                g_autoptr(LdmManager) eager = NULL;
+                g_autoptr(LdmManager) lazy = NULL;
+                autofree(UMockdevTestbed) *bed = NULL;
+                g_autoptr(GPtrArray) eager_devices = NULL;
+                g_autoptr(GPtrArray) lazy_devices = NULL;
+                guint n_providers = 0;
+
+                bed = create_bed_from(mockdevs[m]);
+                eager = ldm_manager_new(0);
+                lazy = ldm_manager_new(LDM_MANAGER_FLAGS_LAZY_PLUGINS);
+                fail_if(!ldm_manager_add_modalias_plugins_for_directory(eager, TEST_MODALIAS_DIR),
+                        "Failed to add main modalias directory");
+                fail_if(!ldm_manager_add_modalias_plugins_for_directory(lazy, TEST_MODALIAS_DIR),
+                        "Failed to add main modalias directory");
+
+                eager_devices = ldm_manager_get_devices(eager, LDM_DEVICE_TYPE_ANY);
+                lazy_devices = ldm_manager_get_devices(lazy, LDM_DEVICE_TYPE_ANY);
+                fail_if(eager_devices->len != lazy_devices->len, "Device count differs");
+
+                for (guint i = 0; i < eager_devices->len; i++) {
+                        g_autoptr(GPtrArray) providers = NULL;
+                        g_autoptr(GPtrArray) lazy_providers = NULL;
+
+                        providers = ldm_manager_get_providers(eager, eager_devices->pdata[i]);
+                        lazy_providers = ldm_manager_get_providers(lazy, lazy_devices->pdata[i]);
+                        fail_if(lazy_providers->len != providers->len,
+                                "Expected %u providers, got %u",
+                                providers->len,
+                                lazy_providers->len);
+
+                        for (guint j = 0; j < providers->len; j++) {
+                                LdmPlugin *a = ldm_provider_get_plugin(providers->pdata[j]);
+                                LdmPlugin *b = ldm_provider_get_plugin(lazy_providers->pdata[j]);
+
+                                fail_if(!g_str_equal(ldm_plugin_get_name(a),
+                                                     ldm_plugin_get_name(b)),
+                                        "Provider order differs");
+                                fail_if(ldm_plugin_get_priority(a) != ldm_plugin_get_priority(b),
+                                        "Provider priority differs");
+                        }
+                        n_providers += providers->len;
+                }
+
+                fail_if(n_providers == 0, "Expected providers for %s", mockdevs[m]);
+        }
+}
+END_TEST
+
+/**
+ * Ensure a lazily loading manager trusts the summary line and never loads a
+ * file that can't match the hardware. The second file lies about its
+ * contents, so it only provides for the Razer device if it gets loaded.
+ */
+START_TEST(test_plugins_lazy_summary)
+{
+        g_autoptr(GError) error = NULL;
+        g_autofree gchar *tmp = NULL;
+        g_autofree gchar *razer = NULL;
+        g_autofree gchar *other = NULL;
+        g_autoptr(LdmManager) eager = NULL;
+        g_autoptr(LdmManager) lazy = NULL;
+        autofree(UMockdevTestbed) *bed = NULL;
+        g_autoptr(GPtrArray) devices = NULL;
+        g_autoptr(GPtrArray) providers = NULL;
+        g_autoptr(GPtrArray) lazy_providers = NULL;
+
+        tmp = g_dir_make_tmp("ldm-lazy-XXXXXX", &error);
+        fail_if(!tmp, "Failed to create temporary directory: %s", error ? error->message : "");
+
+        razer = g_build_filename(tmp, "a-razer.modaliases", NULL);
+        fail_if(!g_file_set_contents(razer,
+                                     "# ldm-summary: hid:1532\n"
+                                     "alias hid:b0003g*v00001532p0000021E razerkbd razer-lazy\n",
+                                     -1,
+                                     NULL),
+                "Failed to write %s",
+                razer);
+
+        other = g_build_filename(tmp, "b-other.modaliases", NULL);
+        fail_if(!g_file_set_contents(other,
+                                     "# ldm-summary: pci:10DE\n"
+                                     "alias hid:b0003g*v00001532p0000021E razerkbd other-lazy\n",
+                                     -1,
+                                     NULL),
+                "Failed to write %s",
+                other);
+
+        bed = create_bed_from(RAZER_MOCKDEV_FILE);
+
+        eager = ldm_manager_new(0);
+        fail_if(!ldm_manager_add_modalias_plugins_for_directory(eager, tmp),
+                "Failed to add modalias directory");
+        devices = ldm_manager_get_devices(eager, LDM_DEVICE_TYPE_USB | LDM_DEVICE_TYPE_HID);
+        fail_if(devices->len != 1, "Failed to find HID device!");
+        providers = ldm_manager_get_providers(eager, devices->pdata[0]);
+        fail_if(providers->len != 2, "Expected 2 providers, got %u", providers->len);
+        g_clear_pointer(&devices, g_ptr_array_unref);
+
+        lazy = ldm_manager_new(LDM_MANAGER_FLAGS_LAZY_PLUGINS);
+        fail_if(!ldm_manager_add_modalias_plugins_for_directory(lazy, tmp),
+                "Failed to add modalias directory");
+        devices = ldm_manager_get_devices(lazy, LDM_DEVICE_TYPE_USB | LDM_DEVICE_TYPE_HID);
+        fail_if(devices->len != 1, "Failed to find HID device!");
+        lazy_providers = ldm_manager_get_providers(lazy, devices->pdata[0]);
+        fail_if(lazy_providers->len != 1, "Expected 1 provider, got %u", lazy_providers->len);
+        fail_if(!g_str_equal(ldm_provider_get_package(lazy_providers->pdata[0]), "razer-lazy"),
+                "Expected 'razer-lazy', got '%s'",
+                ldm_provider_get_package(lazy_providers->pdata[0]));
+
+        g_unlink(razer);
+        g_unlink(other);
+        g_rmdir(tmp);
+}
+END_TEST
+
+/**
+ * Stress parallel resolution, ensuring it gives exactly the same results as
+ * a serial run for every fixture.
+ */
+START_TEST(test_plugins_parallel)
+{
+        for (guint m = 0; m < G_N_ELEMENTS(all_mockdevs); m++) {
+                g_autofree gchar *path = NULL;
+                g_autoptr(LdmManager) serial = NULL;
+                g_autoptr(LdmManager) parallel = NULL;
+                autofree(UMockdevTestbed) *bed = NULL;
+                g_autoptr(GPtrArray) serial_devices = NULL;
+                g_autoptr(GPtrArray) parallel_devices = NULL;
+                g_autoptr(GHashTable) serial_map = NULL;
+
+                path = g_build_filename(TEST_DATA_ROOT, all_mockdevs[m], NULL);
+                bed = create_bed_from(path);
+
+                serial = ldm_manager_new(0);
+                parallel = ldm_manager_new(LDM_MANAGER_FLAGS_PARALLEL_PLUGINS);
+                add_test_plugins(serial);
+                add_test_plugins(parallel);
+
+                serial_devices = ldm_manager_get_devices(serial, LDM_DEVICE_TYPE_ANY);
+                parallel_devices = ldm_manager_get_devices(parallel, LDM_DEVICE_TYPE_ANY);
+                fail_if(serial_devices->len != parallel_devices->len,
+                        "%s: device count differs",
+                        all_mockdevs[m]);
+
+                serial_map = ldm_manager_get_providers_for_devices(serial, serial_devices);
+
+                for (guint round = 0; round < 20; round++) {
+                        g_autoptr(GHashTable) parallel_map = NULL;
+
+                        parallel_map =
+                            ldm_manager_get_providers_for_devices(parallel, parallel_devices);
+
+                        for (guint i = 0; i < serial_devices->len; i++) {
+                                g_autoptr(GPtrArray) providers = NULL;
+
+                                compare_provider_lists(
+                                    all_mockdevs[m],
+                                    g_hash_table_lookup(serial_map, serial_devices->pdata[i]),
+                                    g_hash_table_lookup(parallel_map, parallel_devices->pdata[i]));
+
+                                providers =
+                                    ldm_manager_get_providers(parallel, parallel_devices->pdata[i]);
+                                compare_provider_lists(
+                                    all_mockdevs[m],
+                                    g_hash_table_lookup(serial_map, serial_devices->pdata[i]),
+                                    providers);
+                        }
+                }
+        }
+}
+END_TEST
+
+/**
+ * Ensure plugins may opt in to worker threads through their class, or
+ * through the property when bindings can't reach the class.
+ */
+START_TEST(test_plugins_thread_safe)
+{
+        g_autoptr(LdmPlugin) by_class = NULL;
+        g_autoptr(LdmPlugin) by_property = NULL;
+        g_autoptr(LdmPlugin) serial = NULL;
+        gboolean thread_safe = FALSE;
+
+        by_class = g_object_ref_sink(g_object_new(test_vendor_plugin_get_type(), NULL));
+        by_property = g_object_ref_sink(
+            g_object_new(test_serial_plugin_get_type(), "thread-safe", TRUE, NULL));
+        serial = g_object_ref_sink(g_object_new(test_serial_plugin_get_type(), NULL));
+
+        fail_if(!ldm_plugin_get_thread_safe(by_class), "Class opt-in was ignored");
+        fail_if(!ldm_plugin_get_thread_safe(by_property), "Property opt-in was ignored");
+        fail_if(ldm_plugin_get_thread_safe(serial), "Serial plugin claims thread safety");
+
+        g_object_get(by_class, "thread-safe", &thread_safe, NULL);
+        fail_if(!thread_safe, "Property disagrees with the class");
+}
+END_TEST
+
+/**
+ * Ensure concurrent loading of a directory assigns exactly the priorities of
+ * adding each file in glob order.
+ */
+START_TEST(test_plugins_directory_priority)
+{
+        g_autoptr(GError) error = NULL;
+        g_autofree gchar *tmp = NULL;
+        g_autoptr(GPtrArray) paths = NULL;
+        g_autoptr(LdmManager) serial = NULL;
+        g_autoptr(LdmManager) directory = NULL;
+        autofree(UMockdevTestbed) *bed = NULL;
+        g_autoptr(GPtrArray) serial_devices = NULL;
+        g_autoptr(GPtrArray) devices = NULL;
+        g_autoptr(GPtrArray) serial_providers = NULL;
+        g_autoptr(GPtrArray) providers = NULL;
+        const guint n_files = 24;
+
+        tmp = g_dir_make_tmp("ldm-priority-XXXXXX", &error);
+        fail_if(!tmp, "Failed to create temporary directory: %s", error ? error->message : "");
+
+        paths = g_ptr_array_new_with_free_func(g_free);
+        for (guint i = 0; i < n_files; i++) {
+                g_autofree gchar *name = g_strdup_printf("%02u-driver.modaliases", i);
+                g_autofree gchar *contents = NULL;
+                gchar *path = g_build_filename(tmp, name, NULL);
+
+                contents = g_strdup_printf("alias hid:b0003g*v00001532p0000021E razerkbd pkg-%02u\n"
+                                           "alias pci:v000010DEd%08X* nvidia pkg-%02u\n",
+                                           i,
+                                           i,
+                                           i);
+                fail_if(!g_file_set_contents(path, contents, -1, NULL), "Failed to write %s", path);
+                g_ptr_array_add(paths, path);
+        }
+
+        bed = create_bed_from(RAZER_MOCKDEV_FILE);
+
+        serial = ldm_manager_new(0);
+        for (guint i = 0; i < paths->len; i++) {
+                fail_if(!ldm_manager_add_modalias_plugin_for_path(serial, paths->pdata[i]),
+                        "Failed to add %s",
+                        (const gchar *)paths->pdata[i]);
+        }
+
+        directory = ldm_manager_new(0);
+        fail_if(!ldm_manager_add_modalias_plugins_for_directory(directory, tmp),
+                "Failed to add modalias directory");
+
+        serial_devices = ldm_manager_get_devices(serial, LDM_DEVICE_TYPE_USB | LDM_DEVICE_TYPE_HID);
+        devices = ldm_manager_get_devices(directory, LDM_DEVICE_TYPE_USB | LDM_DEVICE_TYPE_HID);
+        fail_if(serial_devices->len != 1 || devices->len != 1, "Failed to find HID device!");
+
+        serial_providers = ldm_manager_get_providers(serial, serial_devices->pdata[0]);
+        providers = ldm_manager_get_providers(directory, devices->pdata[0]);
+        fail_if(providers->len != n_files,
+                "Expected %u providers, got %u",
+                n_files,
+                providers->len);
+        fail_if(serial_providers->len != n_files, "Expected %u serial providers", n_files);
+
+        /* Last file in glob order wins, and every priority is as before */
+        for (guint i = 0; i < n_files; i++) {
+                LdmPlugin *a = ldm_provider_get_plugin(serial_providers->pdata[i]);
+                LdmPlugin *b = ldm_provider_get_plugin(providers->pdata[i]);
+                g_autofree gchar *name = g_strdup_printf("%02u-driver", n_files - 1 - i);
+
+                fail_if(!g_str_equal(ldm_plugin_get_name(b), name),
+                        "Expected '%s' at %u, got '%s'",
+                        name,
+                        i,
+                        ldm_plugin_get_name(b));
+                fail_if(!g_str_equal(ldm_plugin_get_name(a), ldm_plugin_get_name(b)),
+                        "Plugin order differs from serial loading");
+                fail_if(ldm_plugin_get_priority(a) != ldm_plugin_get_priority(b),
+                        "Priority of '%s' differs from serial loading",
+                        name);
+        }
+
+        for (guint i = 0; i < paths->len; i++) {
+                g_unlink(paths->pdata[i]);
+        }
+        g_rmdir(tmp);
+}
+END_TEST
+
+/*
+ * Records every LdmManager::plugins-changed emission
+ */
+typedef struct WatchState {
+        guint n_signals;
+        guint n_devices; /* Devices passed to the last emission */
+} WatchState;
+
+static void plugins_changed_cb(__ldm_unused__ LdmManager *manager, GPtrArray *devices, gpointer v)
+{
+        WatchState *state = v;
+
+        ++state->n_signals;
+        state->n_devices = devices->len;
+}
+
+static void wait_for_plugins_changed(WatchState *state, guint n_signals)
+{
+        gint64 deadline = g_get_monotonic_time() + 5 * G_USEC_PER_SEC;
+
+        while (state->n_signals < n_signals && g_get_monotonic_time() < deadline) {
+                if (!g_main_context_iteration(NULL, FALSE)) {
+                        g_usleep(G_USEC_PER_SEC / 100);
+                }
+        }
+        fail_if(state->n_signals != n_signals,
+                "Expected %u plugins-changed signals, got %u",
+                n_signals,
+                state->n_signals);
+}
+
+/**
+ * Returns: (transfer none) (nullable): The plugin providing @package
+ */
+static LdmPlugin *find_package_plugin(LdmManager *manager, LdmDevice *device,
+                                      const gchar *package)
+{
+        g_autoptr(GPtrArray) providers = NULL;
+
+        providers = ldm_manager_get_providers(manager, device);
+        for (guint i = 0; i < providers->len; i++) {
+                if (g_str_equal(ldm_provider_get_package(providers->pdata[i]), package)) {
+                        return ldm_provider_get_plugin(providers->pdata[i]);
+                }
+        }
+
+        return NULL;
+}
+
+/**
+ * Ensure a watched directory swaps the plugin for a single changed file in
+ * place, keeping its priority, and tells us which devices were affected.
+ */
+START_TEST(test_plugins_watch)
+{
+        g_autoptr(GError) error = NULL;
+        g_autofree gchar *tmp = NULL;
+        g_autofree gchar *nvidia = NULL;
+        g_autofree gchar *razer = NULL;
+        g_autofree gchar *extra = NULL;
+        g_autofree gchar *contents = NULL;
+        g_autofree gchar *updated = NULL;
+        g_auto(GStrv) parts = NULL;
+        autofree(UMockdevTestbed) *bed = NULL;
+        g_autoptr(LdmManager) manager = NULL;
+        g_autoptr(GPtrArray) devices = NULL;
+        WatchState state = { 0 };
+        LdmDevice *device = NULL;
+        LdmPlugin *plugin = NULL;
+        gint priority = 0;
+
+        tmp = g_dir_make_tmp("ldm-watch-XXXXXX", &error);
+        fail_if(!tmp, "Failed to create temporary directory: %s", error ? error->message : "");
+
+        /* Sorts before razer-drivers, so the razer plugin isn't simply the last one */
+        nvidia = g_build_filename(tmp, "nvidia-glx-driver.modaliases", NULL);
+        fail_if(!g_file_get_contents(NV_MAIN_MODALIAS, &contents, NULL, NULL), "Failed to read");
+        fail_if(!g_file_set_contents(nvidia, contents, -1, NULL), "Failed to write %s", nvidia);
+        g_clear_pointer(&contents, g_free);
+
+        razer = g_build_filename(tmp, "razer-drivers.modaliases", NULL);
+        fail_if(!g_file_get_contents(TEST_DATA_ROOT "/razer-drivers.modaliases",
+                                     &contents,
+                                     NULL,
+                                     NULL),
+                "Failed to read razer modaliases");
+        fail_if(!g_file_set_contents(razer, contents, -1, NULL), "Failed to write %s", razer);
+
+        bed = create_bed_from(RAZER_MOCKDEV_FILE);
+        manager = ldm_manager_new(LDM_MANAGER_FLAGS_NO_MONITOR | LDM_MANAGER_FLAGS_WATCH_PLUGINS);
+        g_signal_connect(manager, "plugins-changed", G_CALLBACK(plugins_changed_cb), &state);
+        fail_if(!ldm_manager_add_modalias_plugins_for_directory(manager, tmp),
+                "Failed to add modalias directory");
+
+        devices = ldm_manager_get_devices(manager, LDM_DEVICE_TYPE_USB | LDM_DEVICE_TYPE_HID);
+        fail_if(devices->len != 1, "Failed to find HID device!");
+        device = devices->pdata[0];
+
+        plugin = find_package_plugin(manager, device, "razer-drivers");
+        fail_if(!plugin, "Failed to find razer-drivers provider");
+        priority = ldm_plugin_get_priority(plugin);
+
+        /* Package upgrade replaces the file */
+        parts = g_strsplit(contents, " razer-drivers\n", -1);
+        updated = g_strjoinv(" razer-drivers-git\n", parts);
+        fail_if(!g_file_set_contents(razer, updated, -1, NULL), "Failed to write %s", razer);
+        wait_for_plugins_changed(&state, 1);
+        fail_if(state.n_devices != 1, "Expected the keyboard to be affected");
+
+        fail_if(find_package_plugin(manager, device, "razer-drivers") != NULL,
+                "Replaced plugin is still in use");
+        plugin = find_package_plugin(manager, device, "razer-drivers-git");
+        fail_if(!plugin, "Replaced plugin wasn't loaded");
+        fail_if(ldm_plugin_get_priority(plugin) != priority, "Replaced plugin lost its priority");
+
+        /* New package adds a file, which takes precedence */
+        extra = g_build_filename(tmp, "zz-razer-extra.modaliases", NULL);
+        fail_if(!g_file_set_contents(extra,
+                                     "alias hid:b0003g*v00001532p0000021E razerkbd razer-extra\n",
+                                     -1,
+                                     NULL),
+                "Failed to write %s",
+                extra);
+        wait_for_plugins_changed(&state, 2);
+        plugin = find_package_plugin(manager, device, "razer-extra");
+        fail_if(!plugin, "Added plugin wasn't loaded");
+        fail_if(ldm_plugin_get_priority(plugin) <= priority, "Added plugin has a low priority");
+
+        /* Unrelated file affects no devices */
+        fail_if(!g_file_set_contents(nvidia, "", -1, NULL), "Failed to write %s", nvidia);
+        wait_for_plugins_changed(&state, 3);
+        fail_if(state.n_devices != 0, "Expected no affected devices");
+
+        /* Package removal */
+        fail_if(g_unlink(razer) != 0, "Failed to remove %s", razer);
+        wait_for_plugins_changed(&state, 4);
+        fail_if(state.n_devices != 1, "Expected the keyboard to be affected");
+        fail_if(find_package_plugin(manager, device, "razer-drivers-git") != NULL,
+                "Removed plugin is still in use");
+        fail_if(!find_package_plugin(manager, device, "razer-extra"), "Lost the other plugins");
+
+        g_unlink(nvidia);
+        g_unlink(extra);
+        g_rmdir(tmp);
+}
+END_TEST
+
+/**
+ * Ensure removing one form of a watched file falls back to another, and
+ * that working out the affected devices doesn't load lazy plugins.
+ */
+START_TEST(test_plugins_watch_forms)
+{
+#ifdef HAVE_ZSTD
+        g_autoptr(GError) error = NULL;
+        g_autofree gchar *tmp = NULL;
+        g_autofree gchar *plain = NULL;
+        g_autofree gchar *compressed = NULL;
+        g_autofree gchar *lying = NULL;
+        g_autofree gchar *contents = NULL;
+        g_autofree gchar *updated = NULL;
+        g_auto(GStrv) parts = NULL;
+        autofree(UMockdevTestbed) *bed = NULL;
+        g_autoptr(LdmManager) manager = NULL;
+        g_autoptr(GPtrArray) devices = NULL;
+        WatchState state = { 0 };
+        LdmDevice *device = NULL;
+        LdmPlugin *plugin = NULL;
+        gint priority = 0;
+        gsize len = 0;
+
+        tmp = g_dir_make_tmp("ldm-forms-XXXXXX", &error);
+        fail_if(!tmp, "Failed to create temporary directory: %s", error ? error->message : "");
+
+        plain = g_build_filename(tmp, "razer-drivers.modaliases", NULL);
+        fail_if(!g_file_get_contents(TEST_DATA_ROOT "/razer-drivers.modaliases",
+                                     &contents,
+                                     NULL,
+                                     NULL),
+                "Failed to read razer modaliases");
+        parts = g_strsplit(contents, " razer-drivers\n", -1);
+        updated = g_strjoinv(" razer-plain\n", parts);
+        fail_if(!g_file_set_contents(plain, updated, -1, NULL), "Failed to write %s", plain);
+        g_clear_pointer(&contents, g_free);
+
+        compressed = g_build_filename(tmp, "razer-drivers.modaliases.zst", NULL);
+        fail_if(!g_file_get_contents(TEST_DATA_ROOT "/compressed/razer-drivers.modaliases.zst",
+                                     &contents,
+                                     &len,
+                                     NULL),
+                "Failed to read compressed razer modaliases");
+        fail_if(!g_file_set_contents(compressed, contents, (gssize)len, NULL),
+                "Failed to write %s",
+                compressed);
+
+        bed = create_bed_from(RAZER_MOCKDEV_FILE);
+        manager = ldm_manager_new(LDM_MANAGER_FLAGS_NO_MONITOR | LDM_MANAGER_FLAGS_WATCH_PLUGINS |
+                                  LDM_MANAGER_FLAGS_LAZY_PLUGINS);
+        g_signal_connect(manager, "plugins-changed", G_CALLBACK(plugins_changed_cb), &state);
+        fail_if(!ldm_manager_add_modalias_plugins_for_directory(manager, tmp),
+                "Failed to add modalias directory");
+
+        devices = ldm_manager_get_devices(manager, LDM_DEVICE_TYPE_USB | LDM_DEVICE_TYPE_HID);
+        fail_if(devices->len != 1, "Failed to find HID device!");
+        device = devices->pdata[0];
+
+        plugin = find_package_plugin(manager, device, "razer-plain");
+        fail_if(!plugin, "Plain file should be preferred");
+        priority = ldm_plugin_get_priority(plugin);
+
+        /* Only loading the file would reveal the keyboard, its summary says otherwise */
+        lying = g_build_filename(tmp, "zz-lying.modaliases", NULL);
+        fail_if(!g_file_set_contents(lying,
+                                     "# ldm-summary: pci:10DE\n"
+                                     "alias hid:b0003g*v00001532p0000021E razerkbd lying\n",
+                                     -1,
+                                     NULL),
+                "Failed to write %s",
+                lying);
+        wait_for_plugins_changed(&state, 1);
+        fail_if(state.n_devices != 0, "Lazy plugin was loaded to find the affected devices");
+
+        /* Removing the plain file falls back to the compressed one */
+        fail_if(g_unlink(plain) != 0, "Failed to remove %s", plain);
+        wait_for_plugins_changed(&state, 2);
+        fail_if(state.n_devices != 1, "Expected the keyboard to be affected");
+        fail_if(find_package_plugin(manager, device, "razer-plain") != NULL,
+                "Removed plugin is still in use");
+        plugin = find_package_plugin(manager, device, "razer-drivers");
+        fail_if(!plugin, "Compressed form wasn't loaded");
+        fail_if(ldm_plugin_get_priority(plugin) != priority, "Fallback lost its priority");
+
+        /* Removing the last form removes the plugin */
+        fail_if(g_unlink(compressed) != 0, "Failed to remove %s", compressed);
+        wait_for_plugins_changed(&state, 3);
+        fail_if(find_package_plugin(manager, device, "razer-drivers") != NULL,
+                "Removed plugin is still in use");
+
+        g_unlink(lying);
+        g_rmdir(tmp);
+#endif
+}
+END_TEST
+
 /**
  * Standard helper for running a test suite
  */
@@ -218,6 +1132,17 @@ static Suite *test_create(void)
         tcase_add_test(tc, test_plugins_nvidia_multiple);
         tcase_add_test(tc, test_plugins_nvidia_multiple_glob);
         tcase_add_test(tc, test_plugins_razer);
+        tcase_add_test(tc, test_plugins_unified_index);
+        tcase_add_test(tc, test_plugins_batch);
+        tcase_add_test(tc, test_plugins_cache);
+        tcase_add_test(tc, test_plugins_shared_patterns);
+        tcase_add_test(tc, test_plugins_lazy);
+        tcase_add_test(tc, test_plugins_lazy_summary);
+        tcase_add_test(tc, test_plugins_parallel);
+        tcase_add_test(tc, test_plugins_thread_safe);
+        tcase_add_test(tc, test_plugins_directory_priority);
+        tcase_add_test(tc, test_plugins_watch);
+        tcase_add_test(tc, test_plugins_watch_forms);
 
         return s;
 }
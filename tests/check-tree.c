@@ -0,0 +1,386 @@
+/*
+ * This file is part of linux-driver-management.
+ *
+ * Copyright © 2016-2018 Ikey Doherty
+ *
+ * linux-driver-management is free software; you can redistribute it and/or
+ * modify it under the terms of the GNU Lesser General Public License as
+ * published by the Free Software Foundation; either version 2.1
+ * of the License, or (at your option) any later version.
+ */
+
+#define _GNU_SOURCE
+
+#include <check.h>
+#include <glib/gstdio.h>
+#include <stdio.h>
+#include <stdlib.h>
+#include <string.h>
+
+#include "../src/tools/manifest.h"
+#include "../src/tools/optimize.h"
+#include "util.h"
+
+/*
+ * There are no kernel modules in the test data, but mkmodaliases takes the
+ * aliases of any module recorded in its manifest without opening it. So
+ * plain files recorded in a manifest written here stand in for modules, and
+ * any file left out of it fails to probe, as a broken module would.
+ */
+
+typedef struct TreeModule {
+        const gchar *path; /* Relative to the modules directory */
+        const gchar *aliases[3];
+} TreeModule;
+
+static const TreeModule tree_modules[] = {
+        { "nvidia/nvidia.ko",
+          { "pci:v000010DEd00001C60sv*sd*bc03sc*i*", "pci:v000010DEd00001B84sv*sd*bc03sc*i*" } },
+        { "nvidia/nvidia-uvm.ko", { "pci:v000010DEd*sv*sd*bc03sc02i00" } },
+        { "razer/razerkbd.ko",
+          { "hid:b0003g*v00001532p0000021E", "usb:v1532p021Ed*dc*dsc*dp*ic*isc*ip*in*" } },
+        { "razer/extra/razermouse.ko", { "hid:b0003g*v00001532p00000046" } },
+};
+
+/*
+ * Temporary directory holding the modules, their manifest and any output
+ */
+typedef struct TreeFixture {
+        gchar *root;
+        gchar *manifest;
+} TreeFixture;
+
+static gchar *tree_path(TreeFixture *fixture, const gchar *path)
+{
+        return g_build_filename(fixture->root, path, NULL);
+}
+
+static void tree_write(TreeFixture *fixture, const gchar *path, const gchar *contents)
+{
+        g_autofree gchar *full = tree_path(fixture, path);
+        g_autofree gchar *dir = g_path_get_dirname(full);
+
+        fail_if(g_mkdir_with_parents(dir, 00755) != 0, "Failed to create %s", dir);
+        fail_if(!g_file_set_contents(full, contents, -1, NULL), "Failed to write %s", full);
+}
+
+static TreeFixture *tree_fixture_new(void)
+{
+        g_autoptr(GError) error = NULL;
+        autofree(MkManifest) *manifest = NULL;
+        TreeFixture *fixture = g_new0(TreeFixture, 1);
+
+        fixture->root = g_dir_make_tmp("ldm-tree-XXXXXX", &error);
+        fail_if(!fixture->root,
+                "Failed to create temporary directory: %s",
+                error ? error->message : "");
+        fixture->manifest = tree_path(fixture, "manifest");
+
+        manifest = mk_manifest_load(fixture->manifest);
+        for (guint i = 0; i < G_N_ELEMENTS(tree_modules); i++) {
+                const TreeModule *module = &tree_modules[i];
+                g_autofree gchar *path = g_build_filename("modules", module->path, NULL);
+                g_autofree gchar *full = tree_path(fixture, path);
+                g_autofree gchar *name = g_path_get_basename(module->path);
+                g_autoptr(GPtrArray) aliases = NULL;
+
+                /* Distinct contents, as the manifest hashes them */
+                tree_write(fixture, path, path);
+
+                *strrchr(name, '.') = '\0';
+                aliases = g_ptr_array_new_with_free_func((GDestroyNotify)mk_alias_free);
+                for (guint j = 0; j < G_N_ELEMENTS(module->aliases) && module->aliases[j]; j++) {
+                        g_ptr_array_add(aliases, mk_alias_new(module->aliases[j], name, NULL));
+                }
+                mk_manifest_store(manifest, full, name, aliases, 0);
+        }
+        fail_if(!mk_manifest_save(manifest), "Failed to write %s", fixture->manifest);
+
+        return fixture;
+}
+
+static void tree_remove(const gchar *path)
+{
+        if (g_file_test(path, G_FILE_TEST_IS_DIR)) {
+                g_autoptr(GDir) dir = g_dir_open(path, 0, NULL);
+                const gchar *name = NULL;
+
+                while (dir && (name = g_dir_read_name(dir)) != NULL) {
+                        g_autofree gchar *child = g_build_filename(path, name, NULL);
+
+                        tree_remove(child);
+                }
+                g_rmdir(path);
+        } else {
+                g_unlink(path);
+        }
+}
+
+static void tree_fixture_free(TreeFixture *fixture)
+{
+        tree_remove(fixture->root);
+        g_free(fixture->manifest);
+        g_free(fixture->root);
+        g_free(fixture);
+}
+
+DEF_AUTOFREE(TreeFixture, tree_fixture_free)
+
+/**
+ * Run mkmodaliases with the fixture manifest from @cwd, or the fixture root.
+ *
+ * Returns: TRUE if it succeeded
+ */
+static gboolean tree_run(TreeFixture *fixture, const gchar *cwd, const gchar *const *args)
+{
+        g_autoptr(GError) error = NULL;
+        g_autoptr(GPtrArray) argv = g_ptr_array_new();
+        gint status = 0;
+
+        g_ptr_array_add(argv, MKMODALIASES_BINARY);
+        g_ptr_array_add(argv, "--manifest");
+        g_ptr_array_add(argv, fixture->manifest);
+        for (guint i = 0; args[i]; i++) {
+                g_ptr_array_add(argv, (gpointer)args[i]);
+        }
+        g_ptr_array_add(argv, NULL);
+
+        fail_if(!g_spawn_sync(cwd ? cwd : fixture->root,
+                              (gchar **)argv->pdata,
+                              NULL,
+                              G_SPAWN_DEFAULT,
+                              NULL,
+                              NULL,
+                              NULL,
+                              NULL,
+                              &status,
+                              &error),
+                "Failed to run mkmodaliases: %s",
+                error ? error->message : "");
+
+        return status == 0;
+}
+
+static gchar *tree_read(TreeFixture *fixture, const gchar *path)
+{
+        g_autofree gchar *full = tree_path(fixture, path);
+        gchar *contents = NULL;
+
+        if (!g_file_get_contents(full, &contents, NULL, NULL)) {
+                return NULL;
+        }
+        return contents;
+}
+
+/**
+ * Every package of a list must be written exactly as the serial mode writes
+ * it, with relative paths taken from the directory of the list.
+ */
+START_TEST(test_tree_list)
+{
+        autofree(TreeFixture) *fixture = tree_fixture_new();
+        g_autofree gchar *list = NULL;
+        g_autofree gchar *elsewhere = NULL;
+        g_autofree gchar *uvm = NULL;
+        g_autofree gchar *out = NULL;
+        g_autoptr(GDir) dir = NULL;
+        const gchar *name = NULL;
+        guint n_files = 0;
+        const gchar *serial_nvidia[] = {
+                "-o",
+                "serial-nvidia.modaliases",
+                "nvidia-glx-driver",
+                "modules/nvidia/nvidia.ko",
+                "modules/nvidia/nvidia-uvm.ko",
+                NULL,
+        };
+        const gchar *serial_razer[] = {
+                "-o",
+                "serial-razer.modaliases",
+                "razer-drivers",
+                "modules/razer/razerkbd.ko",
+                "modules/razer/extra/razermouse.ko",
+                NULL,
+        };
+
+        /* Absolute paths are used as they are */
+        uvm = tree_path(fixture, "modules/nvidia/nvidia-uvm.ko");
+        list = g_strdup_printf("# Package, then its modules\n"
+                               "\n"
+                               "nvidia-glx-driver modules/nvidia/nvidia.ko\n"
+                               "razer-drivers\tmodules/razer/razerkbd.ko  "
+                               "modules/razer/extra/razermouse.ko\n"
+                               "  nvidia-glx-driver %s  \n",
+                               uvm);
+        tree_write(fixture, "packages.list", list);
+        tree_write(fixture, "elsewhere/.keep", "");
+
+        /* Run from another directory so relative paths can't resolve by luck */
+        elsewhere = tree_path(fixture, "elsewhere");
+        for (guint jobs = 1; jobs <= 4; jobs += 3) {
+                g_autofree gchar *packages = tree_path(fixture, "packages.list");
+                g_autofree gchar *jobs_arg = g_strdup_printf("%u", jobs);
+                g_autofree gchar *output = g_strdup_printf("%s/tree-%u", fixture->root, jobs);
+                const gchar *args[] = { "--tree", "-j", jobs_arg, "-o", output, packages, NULL };
+
+                fail_if(!tree_run(fixture, elsewhere, args), "mkmodaliases --tree failed");
+        }
+
+        fail_if(!tree_run(fixture, NULL, serial_nvidia), "mkmodaliases failed for nvidia");
+        fail_if(!tree_run(fixture, NULL, serial_razer), "mkmodaliases failed for razer");
+
+        for (guint jobs = 1; jobs <= 4; jobs += 3) {
+                const gchar *packages[][2] = {
+                        { "nvidia-glx-driver", "serial-nvidia.modaliases" },
+                        { "razer-drivers", "serial-razer.modaliases" },
+                };
+
+                for (guint i = 0; i < G_N_ELEMENTS(packages); i++) {
+                        g_autofree gchar *path = NULL;
+                        g_autofree gchar *tree = NULL;
+                        g_autofree gchar *serial = NULL;
+
+                        path = g_strdup_printf("tree-%u/%s.modaliases", jobs, packages[i][0]);
+                        tree = tree_read(fixture, path);
+                        serial = tree_read(fixture, packages[i][1]);
+                        fail_if(!tree || !serial, "Missing output for %s", packages[i][0]);
+                        fail_if(!strstr(serial, packages[i][0]), "Serial output lacks package");
+                        fail_if(!g_str_equal(tree, serial),
+                                "Tree output for %s with %u jobs differs from serial:\n%s\n%s",
+                                packages[i][0],
+                                jobs,
+                                tree,
+                                serial);
+                }
+        }
+
+        /* Nothing else, such as temporary files, is left behind */
+        out = tree_path(fixture, "tree-4");
+        dir = g_dir_open(out, 0, NULL);
+        fail_if(!dir, "Failed to open %s", out);
+        while ((name = g_dir_read_name(dir)) != NULL) {
+                fail_if(!g_str_has_suffix(name, ".modaliases"), "Unexpected file %s", name);
+                ++n_files;
+        }
+        fail_if(n_files != 2, "Expected 2 packages, found %u", n_files);
+}
+END_TEST
+
+/**
+ * A bad package list is rejected as a whole, before anything is written.
+ */
+START_TEST(test_tree_list_errors)
+{
+        autofree(TreeFixture) *fixture = tree_fixture_new();
+        const gchar *lists[] = {
+                /* Missing module */
+                "nvidia-glx-driver modules/nvidia/nvidia.ko modules/nvidia/missing.ko\n",
+                /* Package names become file names */
+                "nvidia/glx modules/nvidia/nvidia.ko\n",
+                /* Not a kernel module */
+                "nvidia-glx-driver manifest\n",
+                /* No modules */
+                "nvidia-glx-driver modules/nvidia/nvidia.ko\nrazer-drivers\n",
+                /* Relative to the list, not to where we run */
+                "nvidia-glx-driver nvidia/nvidia.ko\n",
+        };
+
+        for (guint i = 0; i < G_N_ELEMENTS(lists); i++) {
+                g_autofree gchar *packages = tree_path(fixture, "packages.list");
+                g_autofree gchar *out = tree_path(fixture, "out");
+                g_autofree gchar *modules = tree_path(fixture, "modules");
+                const gchar *args[] = { "--tree", "-o", out, packages, NULL };
+
+                tree_write(fixture, "packages.list", lists[i]);
+                fail_if(tree_run(fixture, modules, args), "List %u should be rejected", i);
+                fail_if(g_file_test(out, G_FILE_TEST_EXISTS), "List %u wrote output", i);
+        }
+}
+END_TEST
+
+/**
+ * A package with a module that fails to probe is left alone, while the other
+ * packages are still replaced, and no package is ever half written.
+ */
+START_TEST(test_tree_failed_module)
+{
+        autofree(TreeFixture) *fixture = tree_fixture_new();
+        g_autofree gchar *packages = tree_path(fixture, "packages.list");
+        g_autofree gchar *out = tree_path(fixture, "out");
+        g_autofree gchar *nvidia = NULL;
+        g_autofree gchar *razer = NULL;
+        const gchar *args[] = { "--tree", "-o", out, packages, NULL };
+
+        /* Not in the manifest, and not really a module either */
+        tree_write(fixture, "modules/razer/broken.ko", "broken");
+        tree_write(fixture,
+                   "packages.list",
+                   "nvidia-glx-driver modules/nvidia/nvidia.ko\n"
+                   "razer-drivers modules/razer/razerkbd.ko modules/razer/broken.ko\n");
+        tree_write(fixture, "out/nvidia-glx-driver.modaliases", "stale nvidia\n");
+        tree_write(fixture, "out/razer-drivers.modaliases", "previous razer\n");
+
+        fail_if(tree_run(fixture, NULL, args), "A failed module should fail the run");
+
+        nvidia = tree_read(fixture, "out/nvidia-glx-driver.modaliases");
+        fail_if(!nvidia || !strstr(nvidia, "alias pci:v000010DEd00001C60sv*sd*bc03sc*i* nvidia "),
+                "Good package should be replaced, got:\n%s",
+                nvidia);
+        fail_if(strstr(nvidia, "stale"), "Good package should be replaced entirely");
+
+        razer = tree_read(fixture, "out/razer-drivers.modaliases");
+        fail_if(!razer || !g_str_equal(razer, "previous razer\n"),
+                "Package with a failed module must not be written, got:\n%s",
+                razer);
+}
+END_TEST
+
+/**
+ * Standard helper for running a test suite
+ */
+static int ldm_test_run(Suite *suite)
+{
+        SRunner *runner = NULL;
+        int n_failed = 0;
+
+        runner = srunner_create(suite);
+        srunner_run_all(runner, CK_VERBOSE);
+        n_failed = srunner_ntests_failed(runner);
+        srunner_free(runner);
+
+        return n_failed == 0 ? EXIT_SUCCESS : EXIT_FAILURE;
+}
+
+static Suite *test_create(void)
+{
+        Suite *s = NULL;
+        TCase *tc = NULL;
+
+        s = suite_create(__FILE__);
+        tc = tcase_create(__FILE__);
+        suite_add_tcase(s, tc);
+
+        tcase_add_test(tc, test_tree_list);
+        tcase_add_test(tc, test_tree_list_errors);
+        tcase_add_test(tc, test_tree_failed_module);
+
+        return s;
+}
+
+int main(__ldm_unused__ int argc, __ldm_unused__ char **argv)
+{
+        return ldm_test_run(test_create());
+}
+
+/*
+ * Editor modelines  -  https://www.wireshark.org/tools/modelines.html
+ *
+ * Local variables:
+ * c-basic-offset: 8
+ * tab-width: 8
+ * indent-tabs-mode: nil
+ * End:
+ *
+ * vi: set shiftwidth=8 tabstop=8 expandtab:
+ * :indentSize=8:tabSize=8:noTabs=true:
+ */